@@ -26,9 +26,6 @@ extern const char* CHARACTERISTIC_UUID_RX;
 /** UUID of the characteristic used to notify the phone with responses. */
 extern const char* CHARACTERISTIC_UUID_TX;
 
-/** Shared TLS client instance used for secure HTTP communication. */
-extern WiFiClientSecure secureClient;
-
 /** Provisioning command handler defined in BLEFunc.cpp. */
 void handleRequest(const std::string& data);
 
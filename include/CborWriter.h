@@ -0,0 +1,84 @@
+/**
+ * @file CborWriter.h
+ * @brief Streaming CBOR (RFC 8949) writer with the same interface as
+ *        JsonWriter.
+ *
+ * Telemetry can be published as CBOR instead of JSON on metered links.  The
+ * message keeps the JSON-RPC structure -- the same keys, nesting and value
+ * types -- so a server decodes it into the object it would have parsed from
+ * JSON.  Objects and arrays use indefinite-length encoding, so the writer
+ * never has to go back and patch a member count, and mark()/rewind() split
+ * messages exactly like JsonWriter does.
+ *
+ * Floating point values are rounded to the parameter's precision first; a
+ * value that is then whole is sent as an integer, otherwise as a 32-bit float
+ * when that keeps every published decimal, else as a 64-bit float.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "SampleValue.h"
+
+/**
+ * @brief Appends CBOR data items to a caller-provided buffer.
+ *
+ * The buffer is binary; use length(), not strlen().  One byte of the capacity
+ * is kept free, like JsonWriter's terminator, so both writers accept the same
+ * buffer sizes.
+ */
+class CborWriter {
+public:
+    /** Position to return to with rewind(). */
+    struct Mark {
+        size_t length;
+    };
+
+    CborWriter(char* buffer, size_t capacity);
+
+    void reset();
+    void reset(char* buffer, size_t capacity);
+
+    CborWriter& beginObject();
+    CborWriter& endObject();
+    CborWriter& beginArray();
+    CborWriter& endArray();
+    CborWriter& key(const char* name);
+
+    CborWriter& value(const char* text);  ///< Text string, null for nullptr
+    CborWriter& value(int number) { return value(static_cast<long long>(number)); }
+    CborWriter& value(unsigned int number) { return value(static_cast<long long>(number)); }
+    CborWriter& value(long number) { return value(static_cast<long long>(number)); }
+    CborWriter& value(unsigned long number) { return value(static_cast<long long>(number)); }
+    CborWriter& value(long long number);
+    CborWriter& value(bool flag);  ///< 0/1, as in JSON telemetry
+    /** Number rounded to @p precision decimals, null if not finite. */
+    CborWriter& value(double number, uint8_t precision);
+    CborWriter& value(const SampleValue& sample, uint8_t precision);
+    CborWriter& valueNull();
+
+    /** `{"jsonrpc":"2.0","method":"<method>","params":{` */
+    CborWriter& beginRpc(const char* method);
+    /** Closes the params and message objects opened by beginRpc(). */
+    CborWriter& endRpc();
+
+    Mark mark() const { return {length_}; }
+    /** Drop everything written after @p position and clear overflow. */
+    void rewind(const Mark& position);
+
+    bool overflow() const { return overflow_; }
+    size_t length() const { return length_; }
+    size_t capacity() const { return capacity_; }
+    size_t remaining() const { return capacity_ - 1 - length_; }
+    const char* c_str() const { return buffer_; }  ///< Binary data, not terminated
+
+private:
+    void append(const uint8_t* data, size_t size);
+    void appendByte(uint8_t byte) { append(&byte, 1); }
+    void appendHead(uint8_t major, uint64_t argument);
+
+    char* buffer_;
+    size_t capacity_;
+    size_t length_;
+    bool overflow_;
+};
@@ -3,93 +3,182 @@
  * @brief Thread‑safe containers and helper classes for queuing sensor data
  *        and MQTT messages.
  *
- * Sensor readings collected throughout the application are wrapped in
- * DataItem objects and stored in a global map keyed by parameter name. The
- * queue is later processed and forwarded to the MQTT broker. A separate
- * queue is used for MQTT messages that are waiting to be published.
+ * Sensor readings collected throughout the application are stored in the
+ * slots of paramRegistry (see ParamRegistry.h), addressed by interned IDs.
+ * processQueue() periodically turns changed slots into JSON-RPC messages for
+ * the MQTT broker, as JSON or, where bytes are expensive, as CBOR (see
+ * TelemetryFormat). Messages waiting to be published live in the preallocated
+ * slots of the mqttLanes priority lanes (see MqttRing.h); while the broker is
+ * unreachable they are stored in the flash outbox instead (see Outbox.h).
  */
 
 #pragma once
 
-#include <memory>
-#include <map>
-#include <queue>
-#include <mutex>
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include "WebSocketsClient.h"
 #include "MQTTPubSubClient.h"
 #include "MutexLock.h"
+#include "DeadBand.h"
+#include "CborWriter.h"
+#include "DeviceIdentity.h"
+#include "JsonWriter.h"
+#include "MqttInflight.h"
+#include "MqttRing.h"
+#include "ParamRegistry.h"
 
 // External MQTT client instance (defined in mqttFunc.h)
 extern MQTTPubSub::PubSubClient<MQTT_BUFFER_SIZE> mqtt;
-extern String getChipID();
 
 /**
  * @brief Abstract base class representing a data item destined for MQTT.
  *
- * Derivatives must provide the parameter name, value and method type. The
- * process() method is invoked when the queue is flushed.
+ * Derivatives must provide the parameter name, typed value and method type.
+ * Items are handed to queueDataItem(), which stores the value in the
+ * parameter's registry slot; code that samples often should register once and
+ * call queueParam(ParamId, ...) instead.
  */
 class DataItem {
 public:
     virtual ~DataItem() {}
 
-    virtual String getParamName() const = 0;   ///< Return parameter name
-    virtual String getParamValue() const = 0;  ///< Return parameter value
-    virtual String getMethodType() const = 0;  ///< Return method type
+    virtual String getParamName() const = 0;      ///< Return parameter name
+    virtual SampleValue getValue() const = 0;     ///< Return typed value
+    virtual String getMethodType() const = 0;     ///< Return method type
+    virtual uint8_t getPrecision() const { return 2; }  ///< Decimals for floats
+    virtual uint8_t getAggregate() const { return PARAM_AGG_NONE; }  ///< PARAM_AGG_* flags
+
+    /// Value formatted as it is published, for logging.
+    String getParamValue() const {
+        char text[32];
+        return getValue().format(text, sizeof(text), getPrecision()) ? String(text) : String();
+    }
 
     /// Publish or queue the value. Implemented by derived classes.
     virtual void process() const = 0;
 };
 
-// Global map holding DataItem instances indexed by parameter name
-extern std::map<String, std::unique_ptr<DataItem>> dataQueue;
-extern SemaphoreHandle_t dataQueueMutex;  ///< Protects access to dataQueue
+extern SemaphoreHandle_t dataQueueMutex;  ///< Protects access to paramRegistry
 extern SemaphoreHandle_t mqttMutex;       ///< Protects access to MQTT client
 
 /**
- * @brief Simple implementation of DataItem that stores values as strings.
+ * @brief Simple implementation of DataItem holding one typed value.
  */
 class GenericDataItem : public DataItem {
 public:
     String paramName;   ///< MQTT topic or parameter name
-    String paramValue;  ///< Value converted to string
+    SampleValue value;  ///< Sample in its native type
     String methodType;  ///< RPC method associated with the value
+    uint8_t precision;  ///< Decimals used for floating point values
+    uint8_t aggregate;  ///< PARAM_AGG_* statistics published with the value
+
+    GenericDataItem(String name, const SampleValue& value, String method, uint8_t precision = 2,
+                    uint8_t aggregate = PARAM_AGG_NONE)
+        : paramName(name), value(value), methodType(method), precision(precision),
+          aggregate(aggregate) {}
 
+    /// Legacy form: the string is parsed into a number, flag or text once.
     GenericDataItem(String name, String value, String method)
-        : paramName(name), paramValue(value), methodType(method) {}
+        : paramName(name), value(SampleValue::parse(value.c_str())), methodType(method),
+          precision(2), aggregate(PARAM_AGG_NONE) {}
 
     String getParamName() const override { return paramName; }
-    String getParamValue() const override { return paramValue; }
+    SampleValue getValue() const override { return value; }
     String getMethodType() const override { return methodType; }
+    uint8_t getPrecision() const override { return precision; }
+    uint8_t getAggregate() const override { return aggregate; }
 
     void process() const override {
+        const String text = getParamValue();
         if (mqtt.isConnected()) {
-            mqtt.publish(paramName.c_str(), paramValue.c_str());
-            Serial.printf("Data sent [%s]: %s\n", paramName.c_str(), paramValue.c_str());
+            mqtt.publish(paramName.c_str(), text.c_str());
+            Serial.printf("Data sent [%s]: %s\n", paramName.c_str(), text.c_str());
         } else {
             Serial.printf("MQTT not connected. Queuing data for [%s]: %s\n",
-                          paramName.c_str(), paramValue.c_str());
+                          paramName.c_str(), text.c_str());
         }
     }
 };
 
 /**
- * @brief Structure representing a pending MQTT publication.
+ * @brief Largest QoS 0 payload that fits one MQTT_BUFFER_SIZE packet on a
+ *        topic of @p topicLength bytes (fixed header, topic length, topic).
  */
-struct MQTTMessage {
-    String topic;    ///< MQTT topic
-    String payload;  ///< Message payload
-    bool retain;     ///< Retain flag
-    int qos;         ///< Quality of service level
+inline size_t mqttPayloadCapacity(size_t topicLength) {
+    const size_t overhead = 5 + 2 + topicLength;
+    return MQTT_BUFFER_SIZE > overhead ? MQTT_BUFFER_SIZE - overhead : 0;
+}
+
+/** Encoding of the telemetry built by processQueue(). */
+enum class TelemetryFormat : uint8_t {
+    Json,  ///< JSON-RPC text on stream/<id>/rpcout
+    Cbor,  ///< The same JSON-RPC structure as CBOR on stream/<id>/rpcout-cbor
 };
 
-extern std::queue<MQTTMessage> mqttQueue;  ///< FIFO for outgoing messages
-extern std::mutex mqttQueueMutex;          ///< Protects access to mqttQueue
+/** Telemetry settings, stored in the "telemetry" NVS namespace. */
+struct TelemetryConfig {
+    TelemetryFormat format = TelemetryFormat::Json;
+    /**
+     * Send only the parameters of a method that crossed their dead band,
+     * marked with a top-level "delta":1, plus a full keyframe of the
+     * method every keyframeSec.
+     */
+    bool delta = false;
+    uint16_t keyframeSec = 300;  ///< 0: only the first message of a method is a keyframe
+};
+
+extern TelemetryConfig telemetryConfig;  ///< Loaded by loadTelemetryConfig()
+
+#ifndef MQTT_DRAIN_TIME_BUDGET_MS
+#define MQTT_DRAIN_TIME_BUDGET_MS 20    ///< Publishing time per processMQTTQueue() call
+#endif
+
+#ifndef MQTT_DRAIN_BYTE_BUDGET
+#define MQTT_DRAIN_BYTE_BUDGET 16384    ///< Payload bytes per processMQTTQueue() call
+#endif
+
+#ifndef MQTT_TELEMETRY_QOS
+#define MQTT_TELEMETRY_QOS 1            ///< Telemetry QoS; 1 goes through the in-flight window (MqttInflight.h)
+#endif
+
+/** processMQTTQueue() counters since boot. */
+struct MqttDrainStats {
+    uint32_t calls;            ///< Calls with the client connected
+    uint32_t published;        ///< Messages published (lanes and outbox)
+    uint32_t bytes;            ///< Payload bytes published
+    uint32_t timeBudgetStops;  ///< Calls that stopped on the time budget
+    uint32_t byteBudgetStops;  ///< Calls that stopped on the byte budget
+    uint32_t ratePerSec;       ///< Messages per second over the last window of >= 1 s
+    uint32_t peakRatePerSec;   ///< Highest ratePerSec seen
+};
 
 // Queue management functions
+void queueDataItem(const DataItem& item);
 void processQueue();
-void enqueueMQTTMessage(const String& topic, const String& payload,
-                        bool retain = false, int qos = 0);
-void processMQTTQueue();
+/** Copy a message into a lane of mqttLanes. @return false if it was rejected. */
+bool enqueueMQTTMessage(const char* topic, const char* payload, size_t length,
+                        bool retain = false, uint8_t qos = 0,
+                        MqttLane lane = MqttLane::Bulk);
+bool enqueueMQTTMessage(const String& topic, const String& payload,
+                        bool retain = false, int qos = 0, MqttLane lane = MqttLane::Bulk);
+/**
+ * @brief Drop handler of mqttInflight (see MqttInflight::setDropHandler()):
+ *        a lane message the window gave up is appended to the outbox, to be
+ *        replayed.  Outbox and RTC records are left to their publishers.
+ */
+void storeDroppedMessage(uint16_t packetId, const char* topic, size_t topicLength,
+                         const uint8_t* payload, size_t length, void* context);
+/**
+ * @brief Publish queued messages until the lanes and the outbox are empty or
+ *        a budget is used up.  At least one message is published per call.
+ */
+void processMQTTQueue(uint32_t timeBudgetMs = MQTT_DRAIN_TIME_BUDGET_MS,
+                      size_t byteBudget = MQTT_DRAIN_BYTE_BUDGET);
+MqttDrainStats mqttDrainStats();
+/**
+ * @brief Publish the deep-sleep RTC queue (SleepQueue.h), calling @p poll
+ *        (the client's update()) while waiting for PUBACKs.  A record leaves
+ *        the queue only once the broker acknowledged it.
+ * @return true if the queue was emptied before @p deadline.
+ */
+bool publishSleepQueue(unsigned long deadline, void (*poll)());
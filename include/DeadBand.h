@@ -0,0 +1,117 @@
+/**
+ * @file DeadBand.h
+ * @brief Rule table deciding when a parameter changed enough to be published.
+ *
+ * Every parameter is matched once against an ordered list of rules (exact name
+ * or name prefix) and keeps the index of the rule that applies to it, so the
+ * per-tick check is a couple of float operations.  Rules pushed from the cloud
+ * are stored in front of the built-in defaults and can be persisted to NVS as
+ * an opaque blob (see serialize()/deserialize()).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef DEADBAND_MAX_CUSTOM_RULES
+#define DEADBAND_MAX_CUSTOM_RULES 16  ///< Runtime rules on top of the defaults
+#endif
+
+#define DEADBAND_PATTERN_SIZE 24      ///< Max pattern length including '\0'
+#define DEADBAND_UNRESOLVED 0xFF      ///< DeadBandState::rule before first use
+
+#define DEADBAND_FLAG_ALARM 0x01      ///< Changes are published on the alarm lane
+
+extern SemaphoreHandle_t deadBandMutex;  ///< Guards deadBandTable edits
+
+/** How a rule selects the parameters it applies to. */
+enum class DeadBandMatch : uint8_t {
+    Prefix,  ///< Parameter name starts with the pattern ("" matches all)
+    Name     ///< Parameter name equals the pattern
+};
+
+/** How the difference between new and last published value is judged. */
+enum class DeadBandKind : uint8_t {
+    Absolute,  ///< |new - last| >= threshold
+    Relative,  ///< |new - last| / |last| * 100 >= threshold (percent)
+    Exact      ///< any change at all (binary inputs, counters)
+};
+
+/** One entry of the rule table. */
+struct DeadBandRule {
+    char pattern[DEADBAND_PATTERN_SIZE];
+    DeadBandMatch match;
+    DeadBandKind kind;
+    uint8_t flags;     ///< DEADBAND_FLAG_* bits
+    float threshold;   ///< Units of the parameter, percent for Relative
+    float hysteresis;  ///< Extra margin required when the change reverses direction
+};
+
+/**
+ * @brief Per-parameter state owned by the caller.
+ *
+ * Holds the resolved rule and the direction of the last published change.  A
+ * change in the opposite direction has to exceed threshold + hysteresis, which
+ * stops values bouncing between two levels from being reported every tick.
+ */
+struct DeadBandState {
+    uint8_t rule = DEADBAND_UNRESOLVED;  ///< Index into the combined table
+    uint8_t generation = 0;              ///< Table generation of @ref rule
+    int8_t lastDirection = 0;            ///< -1, 0 or +1
+};
+
+/**
+ * @brief Ordered dead-band rules: runtime overrides first, then defaults.
+ */
+class DeadBandTable {
+public:
+    DeadBandTable();
+
+    /**
+     * @brief Check whether @p newValue should be reported.
+     * @param state     State of the parameter, resolved lazily.
+     * @param name      Parameter name, only used when the rule is resolved.
+     * @param lastValue Value published previously.
+     * @param newValue  Candidate value.
+     */
+    bool exceeded(DeadBandState& state, const char* name, double lastValue, double newValue);
+
+    /** Rule that applies to a parameter, resolved lazily like exceeded(). */
+    const DeadBandRule& ruleFor(DeadBandState& state, const char* name);
+
+    /** Record that @p newValue was published after @p lastValue. */
+    static void markSent(DeadBandState& state, double lastValue, double newValue);
+
+    /** Add a runtime rule or replace the one with the same pattern/match. */
+    bool setRule(const DeadBandRule& rule);
+    /** Remove a runtime rule. Built-in defaults cannot be removed. */
+    bool removeRule(const char* pattern, DeadBandMatch match);
+    /** Drop all runtime rules. */
+    void resetRules();
+
+    size_t ruleCount() const;                     ///< Runtime plus default rules
+    const DeadBandRule& ruleAt(size_t index) const;
+    size_t customRuleCount() const { return customCount_; }
+
+    /** Store the runtime rules into @p out. @return bytes written, 0 on error. */
+    size_t serialize(uint8_t* out, size_t size) const;
+    /** Replace the runtime rules with a blob produced by serialize(). */
+    bool deserialize(const uint8_t* data, size_t size);
+    /** Upper bound for serialize() output. */
+    static constexpr size_t maxSerializedSize() {
+        return 4 + DEADBAND_MAX_CUSTOM_RULES * sizeof(DeadBandRule);
+    }
+
+    static bool parseKind(const char* text, DeadBandKind& kind);
+    static bool parseMatch(const char* text, DeadBandMatch& match);
+
+private:
+    uint8_t resolve(const char* name) const;
+    void invalidate();
+
+    DeadBandRule custom_[DEADBAND_MAX_CUSTOM_RULES];
+    uint8_t customCount_;
+    uint8_t generation_;
+};
+
+extern DeadBandTable deadBandTable;  ///< Rules used by processQueue()
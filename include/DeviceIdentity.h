@@ -0,0 +1,70 @@
+/**
+ * @file DeviceIdentity.h
+ * @brief Chip ID and every MQTT topic of the device, computed once.
+ *
+ * The chip ID is derived from the factory MAC address the first time it is
+ * needed and every publish/subscribe topic is formatted into a fixed buffer
+ * at the same moment.  Callers get stable `const char*` pointers, so building
+ * a message never concatenates topic strings.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef DEVICE_TOPIC_SIZE
+#define DEVICE_TOPIC_SIZE 48  ///< Longest topic incl. '\0' ("stream/<12 hex>/rpcout-cbor" is 31)
+#endif
+
+/** Topics of the device; <id> is the 12-digit chip ID. */
+enum class Topic : uint8_t {
+    RpcOut,           ///< stream/<id>/rpcout   -- telemetry and RPC responses
+    RpcOutCbor,       ///< stream/<id>/rpcout-cbor -- telemetry encoded as CBOR
+    Version,          ///< stream/<id>/version  -- firmware version on connect
+    TimeEcho,         ///< time/<id>            -- echo of command/<id>/time
+    CommandTime,      ///< command/<id>/time
+    CommandUpgrade,   ///< command/<id>/upgrade
+    CommandDeadBand,  ///< command/<id>/deadband
+    CommandOutbox,    ///< command/<id>/outbox
+    CommandTelemetry, ///< command/<id>/telemetry
+    CommandPower,     ///< command/<id>/power
+    CommandSleep,     ///< command/<id>/sleep
+    CommandMqtt,      ///< command/<id>/mqtt
+    CommandReboot,    ///< command/<id>/reboot
+    CommandReset,     ///< command/<id>/reset
+    Count
+};
+
+/**
+ * @brief Read the factory MAC address.  Provided by the platform:
+ *        utilities.cpp on the ESP32, the benchmark on the host.
+ */
+void readDeviceMac(uint8_t mac[6]);
+
+/**
+ * @brief Device chip ID, MQTT client ID and topic table.
+ *
+ * begin() is called once from setup; the accessors call it on first use as
+ * well, so early callers still see the real ID.
+ */
+class DeviceIdentity {
+public:
+    DeviceIdentity();
+
+    /** Read the MAC address and build all strings. Idempotent. */
+    void begin();
+
+    const char* chipId();    ///< 12 upper-case hex digits
+    const char* clientId();  ///< "ESP32#<id>"
+    const char* topic(Topic topic);
+    size_t topicLength(Topic topic);
+
+private:
+    bool ready_;
+    char chipId_[13];
+    char clientId_[20];
+    char topics_[static_cast<size_t>(Topic::Count)][DEVICE_TOPIC_SIZE];
+    uint8_t topicLengths_[static_cast<size_t>(Topic::Count)];
+};
+
+extern DeviceIdentity deviceIdentity;
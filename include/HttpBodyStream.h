@@ -0,0 +1,69 @@
+/**
+ * @file HttpBodyStream.h
+ * @brief Response body of an HTTP/1.1 request read straight from the
+ *        connection, so a parser can consume it without a copy in RAM.
+ *
+ * HTTPClient::getStream() hands out the raw connection: with
+ * "Transfer-Encoding: chunked" the chunk sizes are mixed into the data, and
+ * nothing stops a reader at the end of the body.  HttpBodyStream removes the
+ * chunk framing and returns -1 at the end of the body, whether it is
+ * delimited by Content-Length, by the last chunk or by the server closing
+ * the connection.
+ *
+ * A kept connection (see HttpsPool.h) carries the next response right after
+ * this body, so whatever the parser left must be read before the connection
+ * is used again: finish() does that and tells whether the connection can be
+ * kept.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef HTTP_BODY_DRAIN_MAX
+#define HTTP_BODY_DRAIN_MAX 4096    ///< Most bytes finish() skips; a longer rest closes the connection
+#endif
+
+#define HTTP_CHUNK_LINE_MAX 64      ///< Longest chunk-size or trailer line
+
+class HttpBodyStream : public Stream {
+public:
+    /**
+     * @param source  Connection positioned at the start of the body.
+     * @param length  Content-Length, -1 if the response has none.
+     * @param chunked The response is sent with "Transfer-Encoding: chunked"
+     *                (takes precedence over @p length, as in RFC 9112).
+     */
+    HttpBodyStream(Stream& source, int32_t length, bool chunked);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override { return 0; }
+
+    /**
+     * @brief Skip what is left of the body, at most HTTP_BODY_DRAIN_MAX bytes.
+     * @return true if the end of the body was reached, so the connection
+     *         can carry the next request.
+     */
+    bool finish();
+
+    /** The body was cut short or its chunk framing is broken. */
+    bool failed() const { return failed_; }
+
+    /** Body bytes read so far, framing excluded. */
+    size_t bodyBytes() const { return bodyBytes_; }
+
+private:
+    int sourceRead();
+    bool readLine(char* line, size_t size);
+    bool startChunk();
+
+    Stream& source_;
+    int32_t remaining_;  ///< Left in the current chunk or the body; -1: until the connection closes
+    bool chunked_;
+    bool done_;
+    bool failed_;
+    int peeked_;         ///< Byte returned by peek(), -1: none
+    size_t bodyBytes_;
+};
@@ -0,0 +1,173 @@
+/**
+ * @file HttpQueue.h
+ * @brief Request queue of the HTTP worker task: deduplication of identical
+ *        requests and per-endpoint rate limits that delay instead of drop.
+ *
+ * Callers submit a request with a completion callback and return at once;
+ * the HTTP worker task takes the requests one by one with next(), performs
+ * them over the pooled HTTPS connections and hands the result back with
+ * complete().  The network task then runs the callbacks through
+ * takeFinished(), so callbacks may change the tokens and URLs the network
+ * task works with, exactly as the synchronous calls did.
+ *
+ * A request identical to one that is queued or in flight (same method, URL
+ * and body) is not queued again; its callback is attached to the existing
+ * one.  Requests to the same endpoint (URL without the query) start at
+ * least HTTP_MIN_INTERVAL_MS apart; a request that comes too early waits in
+ * the queue.  Requests still queued after HTTP_QUEUE_TIMEOUT_MS (no Wi-Fi)
+ * finish with code 0.
+ *
+ * A request may come with a parser that the worker runs on a 200 response,
+ * reading the body straight from the connection (see HttpBodyStream.h) into
+ * the fixed-size fields of its target; the body is then not kept.  A target
+ * belongs to one request at a time: from its start until its callbacks ran
+ * and dispatched() was called.
+ *
+ * The queue is not locked; the worker glue holds httpQueueMutex.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef HTTP_QUEUE_SIZE
+#define HTTP_QUEUE_SIZE 6               ///< Requests queued, running or waiting for their callbacks
+#endif
+
+#ifndef HTTP_WAITERS
+#define HTTP_WAITERS 2                  ///< Callbacks per request (deduplicated submits)
+#endif
+
+#ifndef HTTP_ENDPOINTS
+#define HTTP_ENDPOINTS 4                ///< Endpoints with a rate limit tracked
+#endif
+
+#ifndef HTTP_MIN_INTERVAL_MS
+#define HTTP_MIN_INTERVAL_MS 3000       ///< Between request starts to one endpoint
+#endif
+
+#ifndef HTTP_QUEUE_TIMEOUT_MS
+#define HTTP_QUEUE_TIMEOUT_MS 60000     ///< Longest wait in the queue
+#endif
+
+enum class HttpMethod : uint8_t { Get, Post };
+
+/** Outcome handed to the callbacks. */
+struct HttpResult {
+    uint32_t id;
+    int code;     ///< HTTP status; < 0: HTTPClient error; 0: not sent (timed out in the queue)
+    bool parsed;  ///< The parser filled the target
+    String body;  ///< Unless a parser read it
+};
+
+/** Completion callback, run on the network task. */
+typedef void (*HttpCallback)(const HttpResult& result, void* context);
+
+/** Reads a 200 response body into @p target on the worker; false if it is unusable. */
+typedef bool (*HttpParser)(Stream& body, void* target);
+
+/** A request as the worker performs it. */
+struct HttpJob {
+    uint32_t id;
+    HttpMethod method;
+    String url;
+    String body;
+    HttpParser parser;  ///< nullptr: the body is returned in HttpResult
+    void* target;
+};
+
+/** Counters since boot. */
+struct HttpQueueStats {
+    uint32_t submitted;
+    uint32_t deduplicated;  ///< Submits attached to an identical request
+    uint32_t rejected;      ///< Queue full
+    uint32_t delayed;       ///< Requests that waited for their endpoint's rate limit
+    uint32_t completed;     ///< Sent and answered (any status)
+    uint32_t failed;        ///< Sent, no answer (HTTPClient error)
+    uint32_t expired;       ///< Never sent
+    uint32_t maxWaitMs;     ///< Longest time from submit to start
+};
+
+class HttpQueue {
+public:
+    HttpQueue();
+
+    /**
+     * @brief Queue a request, or attach @p callback to an identical one.
+     * @param parser Reads the body into @p target, nullptr to keep it as text.
+     * @return Request ID, 0 if the queue is full (the callback is not called).
+     */
+    uint32_t submit(HttpMethod method, const String& url, const String& body, HttpParser parser,
+                    void* target, HttpCallback callback, void* context, uint32_t nowMs);
+
+    /**
+     * @brief Oldest queued request whose endpoint may start at @p nowMs and
+     *        whose target is free; marks it running.
+     * @return false if none may start yet.
+     */
+    bool next(uint32_t nowMs, HttpJob& job);
+
+    /** The worker finished request @p id. */
+    void complete(uint32_t id, int code, const String& body, bool parsed);
+
+    /** Finish requests queued for longer than HTTP_QUEUE_TIMEOUT_MS. */
+    size_t expire(uint32_t nowMs);
+
+    /**
+     * @brief Take one finished request and copy out its result and its
+     *        @p waiters callbacks, to be run after the lock is released.
+     * @return false if no request has finished.
+     */
+    bool takeFinished(HttpResult& result, HttpCallback callbacks[HTTP_WAITERS],
+                      void* contexts[HTTP_WAITERS], uint8_t& waiters);
+
+    /** The callbacks of request @p id ran; its slot and target are free again. */
+    void dispatched(uint32_t id);
+
+    /**
+     * @brief Time until next() may return a request; UINT32_MAX if none is
+     *        queued or all wait for their target.
+     */
+    uint32_t msUntilNext(uint32_t nowMs) const;
+
+    /** Requests queued or running. */
+    size_t pending() const;
+    const HttpQueueStats& stats() const { return stats_; }
+
+private:
+    enum class State : uint8_t { Free, Queued, Running, Finished, Dispatching };
+
+    struct Entry {
+        State state;
+        bool delayed;
+        uint32_t id;
+        HttpMethod method;
+        uint32_t endpoint;  ///< Hash of the URL without the query
+        uint32_t queuedMs;
+        String url;
+        String body;
+        HttpParser parser;
+        void* target;
+        uint8_t waiters;
+        HttpCallback callbacks[HTTP_WAITERS];
+        void* contexts[HTTP_WAITERS];
+        HttpResult result;
+    };
+
+    struct Endpoint {
+        uint32_t hash;  ///< 0: unused
+        uint32_t lastStartMs;
+    };
+
+    static uint32_t endpointHash(const String& url);
+    uint32_t msUntilAllowed(uint32_t endpoint, uint32_t nowMs) const;
+    bool targetBusy(const void* target) const;
+    void started(uint32_t endpoint, uint32_t nowMs);
+
+    Entry entries_[HTTP_QUEUE_SIZE];
+    Endpoint endpoints_[HTTP_ENDPOINTS];
+    uint32_t nextId_;
+    HttpQueueStats stats_;
+};
+
+extern HttpQueue httpQueue;
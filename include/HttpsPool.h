@@ -0,0 +1,99 @@
+/**
+ * @file HttpsPool.h
+ * @brief Bookkeeping of the persistent HTTPS connections to the OAuth and
+ *        config endpoints.
+ *
+ * Each slot owns one TlsClient (httpsClients[]) and the host it is connected
+ * to.  A request to a host leases its slot, or the least recently used one,
+ * and HTTPClient keeps the connection open after the response when the
+ * server allows it (HTTP/1.1 keep-alive).  The device-flow polls every 3 s
+ * therefore run over a single TLS connection instead of a handshake each.
+ *
+ * A connection idle for HTTPS_IDLE_MS is closed: before the server's own
+ * keep-alive timeout (nginx: 75 s, many load balancers: 60 s) so a request is
+ * rarely sent into a connection the server is closing, and to give back the
+ * ~40 KB of TLS buffers a connection holds.  Reconnecting after that resumes
+ * the TLS session (see TlsSession.h).
+ *
+ * The pool only decides; the caller holds httpsMutex and does the I/O.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef HTTPS_POOL_SLOTS
+#define HTTPS_POOL_SLOTS 2            ///< Hosts with a connection of their own
+#endif
+
+#ifndef HTTPS_IDLE_MS
+#define HTTPS_IDLE_MS 20000           ///< Idle connections are closed after this
+#endif
+
+#define HTTPS_HOST_SIZE 64            ///< Host name incl. '\0'
+
+/** Slot handed out by HttpsPool::acquire(). */
+struct HttpsLease {
+    int8_t slot;  ///< Index into httpsClients[]; -1: URL not usable
+    bool close;   ///< Stop the slot's connection first: other host or idle too long
+};
+
+/** Counters since boot. */
+struct HttpsPoolStats {
+    uint32_t requests;
+    uint32_t reused;     ///< Requests sent over a connection that was already open
+    uint32_t opened;     ///< Requests that had to connect
+    uint32_t idleClosed; ///< Connections closed by the idle timeout
+    uint32_t evicted;    ///< Connections closed to make room for another host
+    uint32_t retried;    ///< Requests repeated after a kept connection failed
+};
+
+class HttpsPool {
+public:
+    HttpsPool();
+
+    /**
+     * @brief Split an http(s) URL into host and port.
+     * @return false if it is not an absolute http(s) URL or the host does not fit.
+     */
+    static bool parseUrl(const char* url, char* host, size_t hostSize, uint16_t& port);
+
+    /** Slot for a request to @p host:@p port at @p nowMs. */
+    HttpsLease acquire(const char* host, uint16_t port, uint32_t nowMs);
+
+    /**
+     * @brief Request on @p slot done.
+     * @param reused   The connection was already open when the request started.
+     * @param keptOpen The connection is still open (server allowed keep-alive).
+     */
+    void release(int8_t slot, uint32_t nowMs, bool reused, bool keptOpen);
+
+    /** A request failed on a kept connection and is sent again on a new one. */
+    void countRetry() { stats_.retried++; }
+
+    /**
+     * @brief Next open slot idle for HTTPS_IDLE_MS, marked closed.
+     * @return Slot to stop, -1 if there is none.
+     */
+    int8_t nextIdle(uint32_t nowMs);
+
+    /** Forget every connection, e.g. after the Wi-Fi link was reset. */
+    void closeAll();
+
+    /** Slots whose connection is open. */
+    size_t open() const;
+    const HttpsPoolStats& stats() const { return stats_; }
+
+private:
+    struct Slot {
+        char host[HTTPS_HOST_SIZE];
+        uint16_t port;
+        bool open;
+        uint32_t lastUsedMs;
+    };
+
+    Slot slots_[HTTPS_POOL_SLOTS];
+    HttpsPoolStats stats_;
+};
+
+extern HttpsPool httpsPool;
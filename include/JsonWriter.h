@@ -0,0 +1,107 @@
+/**
+ * @file JsonWriter.h
+ * @brief Streaming JSON-RPC writer into a fixed, caller-provided buffer.
+ *
+ * Messages are written front to back with no heap allocation.  When the next
+ * token does not fit, the writer stops and reports overflow() instead of
+ * truncating silently; mark()/rewind() let the caller drop the token that did
+ * not fit and close the message, e.g. to split a method across several MQTT
+ * payloads of at most MQTT_BUFFER_SIZE bytes.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "SampleValue.h"
+
+#define JSON_WRITER_MAX_DEPTH 16  ///< Max nesting of objects/arrays
+
+/**
+ * @brief Appends JSON tokens to a char buffer, keeping it '\0' terminated.
+ *
+ * Commas between members are inserted automatically.  Calls can be chained:
+ * @code
+ *   char buf[128];
+ *   JsonWriter json(buf, sizeof(buf));
+ *   json.beginRpc("sensor-data").key("wifi").beginObject()
+ *       .key("value").value(-61).endObject().endRpc();
+ * @endcode
+ */
+class JsonWriter {
+public:
+    /** Position to return to with rewind(). */
+    struct Mark {
+        size_t length;
+        uint32_t commaBits;
+        uint8_t depth;
+        bool afterKey;
+    };
+
+    JsonWriter(char* buffer, size_t capacity);
+
+    /** Start over with an empty buffer. */
+    void reset();
+    /** Start over in another buffer. */
+    void reset(char* buffer, size_t capacity);
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    /** Member name; the next value call writes its value. */
+    JsonWriter& key(const char* name);
+
+    JsonWriter& value(const char* text);  ///< Escaped string, null for nullptr
+    // Fundamental types rather than intN_t, whose mapping differs by toolchain.
+    JsonWriter& value(int number) { return value(static_cast<long long>(number)); }
+    JsonWriter& value(unsigned int number) { return value(static_cast<long long>(number)); }
+    JsonWriter& value(long number) { return value(static_cast<long long>(number)); }
+    JsonWriter& value(unsigned long number);
+    JsonWriter& value(long long number);
+    JsonWriter& value(bool flag);
+    /** Fixed-point number with @p precision decimals, null if not finite. */
+    JsonWriter& value(double number, uint8_t precision);
+    /** Sample in its native type, see SampleValue::format(). */
+    JsonWriter& value(const SampleValue& sample, uint8_t precision);
+    JsonWriter& valueNull();
+    /** Pre-serialized JSON, copied verbatim. */
+    JsonWriter& raw(const char* json);
+
+    /** `{"jsonrpc":"2.0","method":"<method>","params":{` */
+    JsonWriter& beginRpc(const char* method);
+    /** Closes the params and message objects opened by beginRpc(). */
+    JsonWriter& endRpc();
+    /** Complete `{"jsonrpc":"2.0","id":<id>,"result":"<result>"}` message. */
+    JsonWriter& rpcResult(int64_t id, const char* result);
+    /** Complete JSON-RPC error message with a string code. */
+    JsonWriter& rpcError(int64_t id, const char* code, const char* message);
+
+    Mark mark() const { return {length_, commaBits_, depth_, afterKey_}; }
+    /** Drop everything written after @p position and clear overflow. */
+    void rewind(const Mark& position);
+
+    /** True once a token did not fit; the buffer holds the part before it. */
+    bool overflow() const { return overflow_; }
+    size_t length() const { return length_; }
+    size_t capacity() const { return capacity_; }
+    /** Bytes still free, excluding the terminator. */
+    size_t remaining() const { return capacity_ - 1 - length_; }
+    const char* c_str() const { return buffer_; }
+
+private:
+    void separate();
+    void append(const char* data, size_t size);
+    void appendChar(char c);
+    void appendEscaped(const char* text);
+    void appendInteger(int64_t number);
+    void push(char open);
+    void pop(char close);
+
+    char* buffer_;
+    size_t capacity_;
+    size_t length_;
+    uint32_t commaBits_;  ///< Bit n: container at depth n already has a member
+    uint8_t depth_;
+    bool afterKey_;
+    bool overflow_;
+};
@@ -0,0 +1,173 @@
+/**
+ * @file MqttInflight.h
+ * @brief QoS 1 in-flight window: outgoing PUBLISH packets kept until the
+ *        broker acknowledges them, sent again with DUP when it does not.
+ *
+ * MQTTPubSubClient publishes QoS 1 stop-and-wait: publish() blocks the
+ * network task until the PUBACK, one message per round trip.  A message
+ * whose PUBACK did not come in time was published again as a new message,
+ * under a new packet ID and without DUP, so the broker could not tell it
+ * was a copy.
+ *
+ * The window encodes QoS 1 PUBLISH packets itself and sends them on the
+ * WebSocket transport, up to window() at a time.  Each keeps a copy of its
+ * packet and its packet ID until the matching PUBACK arrives (the transport
+ * hands every received byte to receive()).  A message not acknowledged
+ * within MQTT_INFLIGHT_TIMEOUT_MS, and every unacknowledged message after a
+ * reconnect, is sent again unchanged except for the DUP flag, so the broker
+ * can drop the copy it already has.  The window survives reconnects, and
+ * resends after a reconnect do not count towards MQTT_INFLIGHT_MAX_SENDS: a
+ * flapping link does not make the window give up messages.
+ *
+ * publish() returns the packet ID; callers that must not lose a message
+ * (outbox replay, the deep-sleep burst) keep it stored until delivery()
+ * reports it acknowledged, and publish it again if it was dropped.  Other
+ * messages are handed to the drop handler before their copy is freed.
+ *
+ * Packet IDs start at MQTT_PACKET_ID_FIRST; the IDs below are left to the
+ * library, which numbers its SUBSCRIBEs from 1.
+ *
+ * Not locked: used by the network task only, like processMQTTQueue().
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef MQTT_INFLIGHT_WINDOW
+#define MQTT_INFLIGHT_WINDOW 4          ///< Largest window; each slot holds a packet copy
+#endif
+
+#ifndef MQTT_INFLIGHT_TIMEOUT_MS
+#define MQTT_INFLIGHT_TIMEOUT_MS 10000  ///< PUBACK wait before a message is sent again
+#endif
+
+#ifndef MQTT_INFLIGHT_MAX_SENDS
+#define MQTT_INFLIGHT_MAX_SENDS 5       ///< Timed-out sends of one message before it is given up
+#endif
+
+#ifndef MQTT_INFLIGHT_DROPPED_IDS
+#define MQTT_INFLIGHT_DROPPED_IDS 8     ///< Dropped packet IDs remembered for delivery()
+#endif
+
+#define MQTT_PACKET_ID_FIRST 0x8000
+#define MQTT_INFLIGHT_PACKET_SIZE (MQTT_BUFFER_SIZE + 2)  ///< Library packet plus the packet ID
+
+/** Writes one complete MQTT packet to the transport. */
+typedef bool (*MqttSendFn)(const uint8_t* packet, size_t length, void* context);
+
+/** Receives a message the window gives up, before its copy is freed. */
+typedef void (*MqttDropFn)(uint16_t id, const char* topic, size_t topicLength,
+                           const uint8_t* payload, size_t length, void* context);
+
+/** What became of a message, see MqttInflight::delivery(). */
+enum class MqttDelivery : uint8_t {
+    InFlight,      ///< Waiting for its PUBACK
+    Acknowledged,
+    Dropped        ///< Given up after MQTT_INFLIGHT_MAX_SENDS
+};
+
+/** Counters since boot. */
+struct MqttInflightStats {
+    uint32_t sent;           ///< Messages sent the first time
+    uint32_t acknowledged;
+    uint32_t retransmitted;  ///< Sends with DUP, timed out or after a reconnect
+    uint32_t dropped;        ///< Given up after MQTT_INFLIGHT_MAX_SENDS
+    uint32_t unknownAcks;    ///< PUBACKs for no message in flight (late or repeated)
+    uint32_t highWater;      ///< Most messages in flight at once
+    uint32_t ackMsMax;       ///< Longest first send to PUBACK
+    uint64_t ackMsTotal;
+};
+
+class MqttInflight {
+public:
+    MqttInflight();
+
+    /** Transport for the packets; set before the first publish(). */
+    void setTransport(MqttSendFn send, void* context);
+    /** Called for every message given up after MQTT_INFLIGHT_MAX_SENDS. */
+    void setDropHandler(MqttDropFn drop, void* context);
+
+    /** Messages in flight at once, 1..MQTT_INFLIGHT_WINDOW (1: stop-and-wait). */
+    void setWindow(size_t window);
+    size_t window() const { return window_; }
+
+    /**
+     * @brief Send a QoS 1 message and keep it until its PUBACK.
+     * @return Packet ID of the message, 0 if the window is full, the packet
+     *         does not fit or the send failed; the message is then not kept.
+     */
+    uint16_t publish(const char* topic, const uint8_t* payload, size_t length, bool retain,
+                     uint32_t nowMs);
+
+    /**
+     * @brief Fate of the message published under @p id.  Dropped IDs are
+     *        remembered for the last MQTT_INFLIGHT_DROPPED_IDS drops; ask
+     *        while the message is recent.
+     */
+    MqttDelivery delivery(uint16_t id) const;
+    bool acked(uint16_t id) const { return delivery(id) == MqttDelivery::Acknowledged; }
+
+    /** Bytes received from the broker, in order; PUBACKs release their messages. */
+    void receive(const uint8_t* data, size_t length, uint32_t nowMs);
+
+    /**
+     * @brief New connection: the received byte stream starts over and every
+     *        unacknowledged message is sent again by the next retransmit().
+     */
+    void reconnected();
+
+    /**
+     * @brief Send again, with DUP, the messages due after a reconnect or
+     *        unacknowledged for MQTT_INFLIGHT_TIMEOUT_MS, oldest first.  A
+     *        message that timed out MQTT_INFLIGHT_MAX_SENDS times is dropped
+     *        instead; resends after a reconnect are not counted.
+     * @return Messages sent.
+     */
+    size_t retransmit(uint32_t nowMs);
+
+    bool full() const { return size() >= window_; }
+    size_t size() const;
+    const MqttInflightStats& stats() const { return stats_; }
+
+private:
+    struct Entry {
+        uint16_t id;       ///< 0: free
+        uint16_t length;
+        uint8_t sends;     ///< The first send and the timed-out ones
+        bool due;          ///< Reconnected: send again at the next retransmit()
+        uint32_t order;    ///< Publish order, for retransmitting oldest first
+        uint32_t firstSentMs;
+        uint32_t sentMs;
+        uint8_t packet[MQTT_INFLIGHT_PACKET_SIZE];
+    };
+
+    /** Where receive() is in the current packet. */
+    enum class Phase : uint8_t { Header, Length, Body };
+
+    uint16_t nextPacketId();
+    void acknowledge(uint16_t id, uint32_t nowMs);
+    void dropEntry(Entry& entry);
+    bool recentlyDropped(uint16_t id) const;
+
+    Entry entries_[MQTT_INFLIGHT_WINDOW];
+    size_t window_;
+    MqttSendFn send_;
+    void* sendContext_;
+    MqttDropFn drop_;
+    void* dropContext_;
+    uint16_t lastId_;
+    uint16_t droppedIds_[MQTT_INFLIGHT_DROPPED_IDS];  ///< Ring of the last drops, 0: none
+    uint8_t droppedNext_;
+    uint32_t order_;
+    MqttInflightStats stats_;
+
+    Phase phase_;
+    uint8_t type_;
+    uint32_t remaining_;
+    uint8_t lengthShift_;
+    uint8_t body_[2];
+    uint8_t bodyLength_;
+};
+
+extern MqttInflight mqttInflight;
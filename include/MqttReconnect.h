@@ -0,0 +1,170 @@
+/**
+ * @file MqttReconnect.h
+ * @brief MQTT reconnect state machine with exponentially growing, fully
+ *        jittered retry delays.
+ *
+ * The network task calls step() on every pass and carries out the action it
+ * returns: open the WebSocket/TLS transport, send CONNECT, start a token
+ * refresh in a separate task, or close the transport.  The state machine
+ * itself never waits; backoff and token refresh cost the network task
+ * nothing.  Opening the transport and sending CONNECT are blocking calls of
+ * the WebSocket and MQTT libraries, however, so those two actions hold the
+ * network task for the TLS handshake and the CONNACK wait, bounded only by
+ * the libraries' own timeouts.  MQTT_TRANSPORT_TIMEOUT_MS and
+ * MQTT_CONNACK_TIMEOUT_MS are checked between passes, after those calls
+ * return.
+ *
+ * After the n-th failure in a row the next attempt is made after a uniformly
+ * random delay in [0, min(MQTT_BACKOFF_CAP_MS, MQTT_BACKOFF_BASE_MS * 2^(n-1))]
+ * ("full jitter").  Devices dropped by the same broker restart therefore
+ * spread their attempts over a window that doubles with every failure,
+ * instead of returning together on a fixed period.  The counter is reset
+ * only after the connection stayed up for MQTT_STABLE_MS, so a broker that
+ * accepts and immediately drops connections does not pull the fleet back in
+ * step.  The first attempt after boot is made at once: boot and Wi-Fi
+ * association times already spread it, and a deep-sleep burst wake should
+ * not keep the radio on longer than needed.
+ *
+ * The token is refreshed out of line after MQTT_TOKEN_REFRESH_AFTER failures
+ * in a row, or at once when the broker rejects the credentials (CONNACK
+ * return codes 4 and 5).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef MQTT_BACKOFF_BASE_MS
+#define MQTT_BACKOFF_BASE_MS 5000         ///< Window of the first retry
+#endif
+
+#ifndef MQTT_BACKOFF_CAP_MS
+#define MQTT_BACKOFF_CAP_MS 120000        ///< Largest retry window
+#endif
+
+#ifndef MQTT_TRANSPORT_TIMEOUT_MS
+#define MQTT_TRANSPORT_TIMEOUT_MS 20000   ///< WebSocket and TLS handshake
+#endif
+
+#ifndef MQTT_CONNACK_TIMEOUT_MS
+#define MQTT_CONNACK_TIMEOUT_MS 10000     ///< CONNECT sent, no CONNACK yet
+#endif
+
+#ifndef MQTT_TOKEN_REFRESH_TIMEOUT_MS
+#define MQTT_TOKEN_REFRESH_TIMEOUT_MS 30000
+#endif
+
+#ifndef MQTT_TOKEN_REFRESH_AFTER
+#define MQTT_TOKEN_REFRESH_AFTER 3        ///< Failures in a row before the token is refreshed
+#endif
+
+#ifndef MQTT_STABLE_MS
+#define MQTT_STABLE_MS 60000              ///< Connected time after which the backoff resets
+#endif
+
+#define MQTT_RETURN_CODES 6               ///< CONNACK return codes 0..5
+
+/** Connection states. */
+enum class ConnState : uint8_t {
+    Offline,       ///< No Wi-Fi link; nothing is attempted
+    Backoff,       ///< Waiting for the jittered retry time
+    Transport,     ///< WebSocket/TLS connection being opened
+    Connecting,    ///< CONNECT sent, waiting for the CONNACK
+    TokenRefresh,  ///< Refresh request with the HTTP worker, transport closed
+    Connected
+};
+
+/** What the caller has to do after step(). */
+enum class ConnAction : uint8_t {
+    None,
+    OpenTransport,      ///< Let the WebSocket client connect
+    SendConnect,        ///< Send CONNECT, then report connectResult()
+    StartTokenRefresh,  ///< Start the refresh task, then report tokenRefreshDone()
+    CloseTransport      ///< Drop the WebSocket connection and stop retrying it
+};
+
+/** Why an attempt failed. */
+enum class ConnFailure : uint8_t {
+    TransportTimeout,  ///< No WebSocket/TLS connection within MQTT_TRANSPORT_TIMEOUT_MS
+    Refused,           ///< CONNACK with a non-zero return code (see refused[])
+    ConnackTimeout,    ///< No CONNACK within MQTT_CONNACK_TIMEOUT_MS
+    Lost,              ///< Established connection dropped
+    TokenRefresh,      ///< Token refresh failed or timed out
+    Count
+};
+
+/** Counters since boot. */
+struct ConnStats {
+    uint32_t attempts;                    ///< Transport openings
+    uint32_t connects;                    ///< Successful CONNECTs
+    uint32_t failures[static_cast<size_t>(ConnFailure::Count)];
+    uint32_t refused[MQTT_RETURN_CODES];  ///< Refusals per return code; [0]: no code
+    uint32_t tokenRefreshes;
+    uint32_t lastConnectMs;   ///< Transport opening to CONNACK of the last connect
+    uint32_t maxConnectMs;
+    uint64_t totalConnectMs;  ///< For the mean over connects
+    uint32_t lastOutageMs;    ///< Connection lost (or boot) to connected again
+    uint32_t lastBackoffMs;   ///< Most recent retry delay
+};
+
+/**
+ * @brief Reconnect state machine.  Used by the network task only.
+ */
+class MqttReconnect {
+public:
+    MqttReconnect();
+
+    /** Seed the jitter; every device should use a different seed. */
+    void seed(uint32_t seed);
+
+    /**
+     * @brief Advance the state machine.
+     * @param linkUp      Wi-Fi is associated.
+     * @param transportUp The WebSocket/TLS connection is open.
+     * @param mqttUp      The MQTT session is established.
+     */
+    ConnAction step(uint32_t nowMs, bool linkUp, bool transportUp, bool mqttUp);
+
+    /**
+     * @brief Result of the CONNECT requested by ConnAction::SendConnect.
+     * @return CloseTransport after a refusal, else None.
+     */
+    ConnAction connectResult(uint32_t nowMs, bool accepted, int returnCode);
+
+    /** The refresh requested by ConnAction::StartTokenRefresh finished. */
+    void tokenRefreshDone(uint32_t nowMs, bool ok);
+
+    ConnState state() const { return state_; }
+    /** Transport must be serviced: a connection is being opened or is in use. */
+    bool transportActive() const {
+        return state_ == ConnState::Transport || state_ == ConnState::Connecting ||
+               state_ == ConnState::Connected;
+    }
+    uint8_t failuresInRow() const { return failuresInRow_; }
+    /** Milliseconds until the next attempt while in Backoff, else 0. */
+    uint32_t msUntilAttempt(uint32_t nowMs) const;
+
+    const ConnStats& stats() const { return stats_; }
+    static const char* stateName(ConnState state);
+    static const char* failureName(ConnFailure failure);
+
+    /** Upper bound of the retry window after @p failures failures in a row (0 counts as 1). */
+    static uint32_t backoffWindowMs(uint8_t failures);
+
+private:
+    ConnAction fail(uint32_t nowMs, ConnFailure failure, bool refreshToken);
+    ConnAction backoff(uint32_t nowMs);
+    uint32_t nextRandom();
+
+    ConnState state_;
+    uint8_t failuresInRow_;
+    bool refreshStarted_;
+    uint32_t deadlineMs_;      ///< Retry time in Backoff, timeout in the other states
+    uint32_t attemptStartMs_;  ///< Transport opened
+    uint32_t connectedMs_;     ///< Session established
+    uint32_t outageStartMs_;   ///< Session lost (or boot)
+    uint32_t rng_;
+    ConnStats stats_;
+};
+
+extern MqttReconnect mqttReconnect;
@@ -0,0 +1,188 @@
+/**
+ * @file MqttRing.h
+ * @brief Outgoing MQTT messages: bounded multi-producer / single-consumer
+ *        rings with preallocated slots, grouped into priority lanes.
+ *
+ * Every slot owns a payload buffer of MQTT_BUFFER_SIZE bytes and a topic
+ * String reserved up front, so enqueueing never allocates and the consumer
+ * publishes straight from the slot.  Producers (sensor flush, RPC responses,
+ * version publish) claim slots with a compare-and-swap on the enqueue
+ * position; only processMQTTQueue() consumes.  A message that fails to publish
+ * stays at the head of its lane and is retried in order.
+ *
+ * Control acknowledgements, alarms and bulk telemetry use separate lanes with
+ * their own capacity and drop policy, so a telemetry burst can never evict a
+ * command reply and the reply does not wait behind it.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef MQTT_LANE_CONTROL_SLOTS
+#define MQTT_LANE_CONTROL_SLOTS 4   ///< RPC responses, version announcement
+#endif
+
+#ifndef MQTT_LANE_ALARM_SLOTS
+#define MQTT_LANE_ALARM_SLOTS 4     ///< Methods with an alarm parameter change
+#endif
+
+#ifndef MQTT_LANE_BULK_SLOTS
+#define MQTT_LANE_BULK_SLOTS 16     ///< Periodic telemetry
+#endif
+
+#ifndef MQTT_LANE_STARVATION_LIMIT
+#define MQTT_LANE_STARVATION_LIMIT 8  ///< Higher-lane publishes before a waiting lower lane is served
+#endif
+
+#ifndef MQTT_RING_TOPIC_SIZE
+#define MQTT_RING_TOPIC_SIZE 64    ///< Topic capacity reserved per slot
+#endif
+
+#ifndef MQTT_RING_MAX_ATTEMPTS
+#define MQTT_RING_MAX_ATTEMPTS 5   ///< Publish attempts before a message is dropped
+#endif
+
+#define MQTT_IS_POW2(n) (((n) & ((n) - 1)) == 0)
+static_assert(MQTT_IS_POW2(MQTT_LANE_CONTROL_SLOTS) && MQTT_IS_POW2(MQTT_LANE_ALARM_SLOTS) &&
+                  MQTT_IS_POW2(MQTT_LANE_BULK_SLOTS),
+              "MQTT lane sizes must be powers of two");
+
+/** One queued message. Owned by a producer between reserve() and commit(). */
+struct MqttSlot {
+    String topic;
+    char payload[MQTT_BUFFER_SIZE];  ///< '\0' terminated for logging
+    uint16_t length;                 ///< Payload bytes, excluding '\0'
+    bool retain;
+    uint8_t qos;
+    uint8_t attempts;                ///< Failed publish attempts so far
+    std::atomic<uint32_t> sequence;  ///< Vyukov cell sequence number
+
+    /** Largest payload a slot can hold. */
+    static constexpr size_t payloadCapacity() { return MQTT_BUFFER_SIZE - 1; }
+};
+
+/** Called after a message was committed, e.g. to wake the consumer task. */
+typedef void (*MqttRingNotifyFn)(void* context);
+
+/** What reserve() does when the ring is full. */
+enum class MqttDropPolicy : uint8_t {
+    DropNewest,  ///< Reject the new message
+    DropOldest   ///< Evict the head if the consumer is idle, else reject
+};
+
+/** Counters since boot. */
+struct MqttRingStats {
+    uint32_t enqueued;   ///< Messages committed
+    uint32_t published;  ///< Messages published and removed
+    uint32_t retries;    ///< Failed publish attempts that kept the message
+    uint32_t overflows;  ///< Messages rejected because the ring was full
+    uint32_t evicted;    ///< Old messages removed to make room (DropOldest)
+    uint32_t dropped;    ///< Too large for a slot or out of publish attempts
+    uint32_t highWater;  ///< Most slots in use at once
+};
+
+/**
+ * @brief Lock-free bounded MPSC queue (Vyukov style) over caller storage.
+ *
+ * Producer side: reserve(), fill the slot, commit() -- or push() to copy a
+ * ready message.  Consumer side: lockConsumer(), peek() the head, publish from
+ * it, then pop() or leave it in place to retry, unlockConsumer().  The consumer
+ * flag is what lets a DropOldest producer evict the head safely.
+ */
+class MqttRing {
+public:
+    /** @param capacity Number of @p slots, power of two. */
+    MqttRing(MqttSlot* slots, uint32_t capacity, MqttDropPolicy policy);
+
+    /** Claim a free slot; nullptr (and an overflow) when none can be had. */
+    MqttSlot* reserve();
+    /** Make a reserved slot visible to the consumer. */
+    void commit(MqttSlot* slot);
+    /** Copy a complete message into the ring. */
+    bool push(const char* topic, const char* payload, size_t length, bool retain, uint8_t qos);
+
+    /** Become the consumer; false if another caller currently is. */
+    bool lockConsumer();
+    void unlockConsumer();
+
+    /** Oldest committed message or nullptr. Consumer only. */
+    MqttSlot* peek();
+    /** Release the head slot. @p published selects the counter. Consumer only. */
+    void pop(bool published);
+    /** Record a failed attempt on the head; pops it after MQTT_RING_MAX_ATTEMPTS. */
+    bool retryOrDrop(MqttSlot* slot);
+
+    size_t size() const;  ///< Committed or reserved slots
+    /** A committed message is at the head: peek() would return it. */
+    bool ready() const;
+    size_t capacity() const { return capacity_; }
+    /** Call @p notify after every commit(); nullptr removes it.  Set before producers start. */
+    void setNotify(MqttRingNotifyFn notify, void* context);
+    MqttDropPolicy policy() const { return policy_; }
+    MqttRingStats stats() const;
+
+private:
+    void release();  ///< Advance the head without touching the counters
+
+    MqttSlot* slots_;
+    uint32_t capacity_;
+    MqttDropPolicy policy_;
+    MqttRingNotifyFn notify_;
+    void* notifyContext_;
+    std::atomic<bool> consumer_;
+    std::atomic<uint32_t> enqueuePos_;
+    std::atomic<uint32_t> dequeuePos_;
+
+    std::atomic<uint32_t> enqueued_;
+    std::atomic<uint32_t> published_;
+    std::atomic<uint32_t> retries_;
+    std::atomic<uint32_t> overflows_;
+    std::atomic<uint32_t> evicted_;
+    std::atomic<uint32_t> dropped_;
+    std::atomic<uint32_t> highWater_;
+};
+
+/** Priority classes, highest first. */
+enum class MqttLane : uint8_t {
+    Control,  ///< Command acknowledgements and device announcements
+    Alarm,    ///< Telemetry containing an alarm parameter change
+    Bulk,     ///< Regular telemetry
+    Count
+};
+
+/**
+ * @brief The three lanes and the strict-priority drain order.
+ *
+ * next() always prefers the highest lane with a committed message at its
+ * head, except that after MQTT_LANE_STARVATION_LIMIT consecutive messages
+ * from higher lanes the lowest waiting lane gets one turn.  A slot still
+ * being filled by a producer does not make its lane eligible.
+ */
+class MqttLanes {
+public:
+    MqttLanes();
+
+    MqttRing& lane(MqttLane lane) { return *lanes_[static_cast<size_t>(lane)]; }
+
+    /**
+     * @brief Lock the consumer side of the lane to serve next.
+     * @return The lane's ring with its consumer locked, or nullptr if no
+     *         lane has a committed message.  Call done() afterwards.
+     */
+    MqttRing* next();
+    /** Unlock the consumer side of a ring returned by next(). */
+    void done(MqttRing* ring);
+
+    size_t size() const;  ///< Messages waiting in all lanes
+    /** MqttRing::setNotify() on every lane. */
+    void setNotify(MqttRingNotifyFn notify, void* context);
+    static const char* laneName(MqttLane lane);
+
+private:
+    MqttRing* lanes_[static_cast<size_t>(MqttLane::Count)];
+    uint8_t skipped_[static_cast<size_t>(MqttLane::Count)];  ///< Turns a waiting lane was passed over
+};
+
+extern MqttLanes mqttLanes;  ///< Outgoing messages, drained by processMQTTQueue()
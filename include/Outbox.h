@@ -0,0 +1,192 @@
+/**
+ * @file Outbox.h
+ * @brief Persistent store-and-forward queue for telemetry produced while the
+ *        MQTT connection is down.
+ *
+ * Messages are appended to numbered segment files in a LittleFS directory
+ * (the `spiffs` partition).  Each record carries a CRC-32 over its header,
+ * topic and payload, so a record torn by a power loss or a worn sector is
+ * detected and its segment skipped instead of replayed as garbage.
+ *
+ * Flash wear is bounded three ways: appends are collected in a RAM buffer and
+ * written in one go when it fills or after OUTBOX_FLUSH_INTERVAL_MS; the
+ * outbox never holds more than OUTBOX_MAX_SEGMENTS segments (the oldest is
+ * deleted); and the replay cursor is saved only every OUTBOX_CURSOR_SAVE_EVERY
+ * records and at segment boundaries.  After a reboot at most that many
+ * records are replayed twice.
+ *
+ * Records are replayed in the order they were appended, which is the order in
+ * which they were sampled; each carries its capture time.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "MqttRing.h"
+
+#ifndef OUTBOX_DIR
+#define OUTBOX_DIR "/outbox"
+#endif
+
+#ifndef OUTBOX_SEGMENT_SIZE
+#define OUTBOX_SEGMENT_SIZE 16384        ///< Bytes per segment file before rolling over
+#endif
+
+#ifndef OUTBOX_MAX_SEGMENTS
+#define OUTBOX_MAX_SEGMENTS 16           ///< 256 KB of the 384 KB spiffs partition
+#endif
+
+#ifndef OUTBOX_WRITE_BUFFER_SIZE
+#define OUTBOX_WRITE_BUFFER_SIZE 2048    ///< RAM collected before a flash write
+#endif
+
+#ifndef OUTBOX_FLUSH_INTERVAL_MS
+#define OUTBOX_FLUSH_INTERVAL_MS 60000   ///< Longest time an append stays in RAM
+#endif
+
+#ifndef OUTBOX_CURSOR_SAVE_EVERY
+#define OUTBOX_CURSOR_SAVE_EVERY 16      ///< Replayed records between cursor writes
+#endif
+
+#ifndef OUTBOX_READ_AHEAD
+#define OUTBOX_READ_AHEAD 8              ///< Records sent and not consumed yet, see markSent()
+#endif
+
+#define OUTBOX_RECORD_MAGIC 0x3158424fUL  ///< "OBX1"
+
+/** On-flash record header, followed by the topic and the payload. */
+struct OutboxRecordHeader {
+    uint32_t magic;          ///< OUTBOX_RECORD_MAGIC
+    uint32_t crc;            ///< CRC-32 of the header (crc = 0), topic and payload
+    uint64_t timestampMs;    ///< Capture time, Unix epoch ms; 0 if the clock was not set
+    uint32_t sequence;       ///< Running record number, for diagnostics
+    uint16_t payloadLength;
+    uint8_t topicLength;
+    uint8_t qos;
+};
+static_assert(sizeof(OutboxRecordHeader) == 24, "Outbox record header layout changed");
+
+/** A record read back by Outbox::peek(). */
+struct OutboxRecord {
+    char topic[MQTT_RING_TOPIC_SIZE];
+    char payload[MQTT_BUFFER_SIZE];  ///< '\0' terminated for logging
+    uint16_t length;
+    uint8_t qos;
+    uint64_t timestampMs;
+};
+
+/** Counters since boot. */
+struct OutboxStats {
+    uint32_t appended;         ///< Records accepted by append()
+    uint32_t replayed;         ///< Records consumed by advance()
+    uint32_t rejected;         ///< Records refused (outbox not ready or too large)
+    uint32_t corrupt;          ///< Records that failed validation; their segment was skipped
+    uint32_t droppedSegments;  ///< Oldest segments deleted to stay within OUTBOX_MAX_SEGMENTS
+    uint32_t flashWrites;      ///< Write-buffer flushes
+    uint32_t bytesWritten;     ///< Bytes written to segment files
+};
+
+/** Runtime settings, stored in the "outbox" NVS namespace. */
+struct OutboxConfig {
+    bool enabled = true;          ///< Store telemetry while MQTT is down
+    uint16_t drainPerSec = 20;    ///< Replayed messages per second after reconnect, 0 pauses
+};
+
+/**
+ * @brief Segment-based append-only message log on a file system.
+ *
+ * Producers call append(); the MQTT consumer calls peek(), publishes the
+ * record and calls markSent(), then advance() once the broker has it.  Up
+ * to OUTBOX_READ_AHEAD records may be sent ahead of the oldest unconsumed
+ * one, within its segment.  All methods are thread-safe.
+ */
+class Outbox {
+public:
+    Outbox();
+
+    /**
+     * @brief Open (or create) the outbox in @p dir of @p fs.
+     *
+     * Scans the existing segments, restores the replay cursor and checks the
+     * tail of the newest segment; appends after a torn tail go to a new
+     * segment.
+     */
+    bool begin(fs::FS& fs, const char* dir = OUTBOX_DIR);
+    bool ready() const { return fs_ != nullptr; }
+
+    /** Store one message. @return false if it was rejected. */
+    bool append(const char* topic, const char* payload, size_t length, uint64_t timestampMs,
+                uint8_t qos = 0);
+    /** Write the RAM buffer to flash. */
+    void flush();
+    /** Flush the RAM buffer if it is older than OUTBOX_FLUSH_INTERVAL_MS. */
+    void tick(uint32_t nowMs);
+
+    /**
+     * @brief Read the oldest stored message not sent yet into @p record.
+     *        Flushes pending appends first.  The segment stays open for the
+     *        next call.
+     * @return false if there is none, OUTBOX_READ_AHEAD records are sent
+     *         already, or the next record is in a later segment than the
+     *         sent ones.
+     */
+    bool peek(OutboxRecord& record);
+    /** The record returned by the last peek() was sent; peek() moves past it. */
+    void markSent();
+    /** Consume the oldest sent record. */
+    void advance();
+    /** Forget the sent records: peek() returns the oldest one again. */
+    void rewind();
+    size_t sentCount();  ///< Records sent and not consumed by advance()
+
+    bool empty();  ///< No record left to replay; no file access
+    /**
+     * @brief Stored bytes not replayed yet, including the RAM buffer.  Opens
+     *        every segment file: for statistics, hot paths use empty().
+     */
+    size_t backlogBytes();
+    size_t segmentCount();
+    OutboxStats stats() const;
+
+    /** Delete every stored message. */
+    void clear();
+
+private:
+    void segmentPath(uint32_t segment, char* path, size_t size) const;
+    void cursorPath(char* path, size_t size) const;
+    bool flushLocked();
+    void loadCursor();
+    void saveCursor();
+    size_t validLength(uint32_t segment);
+    bool openReadFile();
+    void forgetSent();
+    void dropReadSegment();
+    void enforceSegmentLimit();
+
+    fs::FS* fs_;
+    char dir_[32];
+    SemaphoreHandle_t mutex_;
+
+    uint32_t readSegment_;
+    uint32_t readOffset_;
+    uint32_t writeSegment_;
+    uint32_t writeSize_;       ///< Bytes of writeSegment_ on flash
+    uint32_t peekedSize_;      ///< Size of the record returned by the last peek(), 0 if none
+    uint32_t sentSizes_[OUTBOX_READ_AHEAD];  ///< Sizes of the sent records, oldest first
+    size_t sentCount_;
+    uint32_t sentBytes_;       ///< Their total: peek() reads at readOffset_ + sentBytes_
+    File readFile_;            ///< readSegment_, kept open between peek() calls
+    uint32_t readFileSegment_;
+    uint32_t sequence_;
+    uint32_t sinceCursorSave_;
+
+    uint8_t buffer_[OUTBOX_WRITE_BUFFER_SIZE];
+    size_t buffered_;
+    uint32_t bufferedSinceMs_;
+
+    OutboxStats stats_;
+};
+
+extern Outbox outbox;              ///< Telemetry outbox on LittleFS, see initializeStorage()
+extern OutboxConfig outboxConfig;  ///< Loaded by loadOutboxConfig()
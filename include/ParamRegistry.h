@@ -0,0 +1,175 @@
+/**
+ * @file ParamRegistry.h
+ * @brief Fixed-size table of telemetry parameters addressed by small IDs.
+ *
+ * Parameter and method names are interned once when a producer registers
+ * them.  Everything processQueue() needs per parameter (pending sample and
+ * its acquisition time, last published value, window aggregate, dead-band
+ * state, owning method) lives in one contiguous slot array, so storing a
+ * sample is an indexed write with no heap traffic and the table cannot grow
+ * past its compile-time capacity.  Sample histories come from a separate
+ * pool of PARAM_HISTORY_SLOTS rings, used only by parameters that ask for one.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "DeadBand.h"
+#include "MutexLock.h"
+#include "SampleHistory.h"
+#include "SampleValue.h"
+#include "WindowAggregate.h"
+
+#ifndef PARAM_REGISTRY_SIZE
+#define PARAM_REGISTRY_SIZE 128   ///< Maximum number of distinct parameters
+#endif
+
+#ifndef PARAM_METHOD_COUNT
+#define PARAM_METHOD_COUNT 32     ///< Maximum number of distinct RPC methods
+#endif
+
+#define PARAM_NAME_SIZE 24        ///< Max parameter/method name incl. '\0'
+#define PARAM_INVALID 0xFFFF      ///< Returned when a name cannot be registered
+
+typedef uint16_t ParamId;
+typedef uint8_t MethodId;
+
+static_assert(PARAM_REGISTRY_SIZE < PARAM_INVALID, "PARAM_REGISTRY_SIZE too large");
+static_assert(PARAM_METHOD_COUNT <= 256, "MethodId is 8 bits wide");
+
+/**
+ * @brief What processQueue() remembers of a parameter between publications.
+ *
+ * Owned by the task that runs processQueue() (and the deep-sleep retain /
+ * restore around it) and used there without dataQueueMutex; registerParam()
+ * only initialises it before the slot becomes visible.
+ */
+struct ParamFlushState {
+    bool sent;             ///< lastSent is valid
+    SampleValue lastSent;  ///< Value included in the last published message
+    DeadBandState band;    ///< Rule index resolved under deadBandMutex
+};
+
+/**
+ * @brief Per-parameter state.
+ *
+ * The configuration (method, precision, aggregate, history) and the producer
+ * side (pending sample, window) are guarded by dataQueueMutex: registerParam()
+ * may change the configuration from any task, so processQueue() copies it
+ * together with the sample.  name never changes once registered.  @ref flush
+ * is not locked, see ParamFlushState.
+ */
+struct ParamSlot {
+    char name[PARAM_NAME_SIZE];
+    MethodId method;
+    bool dirty;           ///< pending holds a sample not yet processed
+    uint8_t precision;    ///< Decimals used for Float/Double values
+    uint8_t aggregate;    ///< PARAM_AGG_* published with the value
+    uint8_t history;      ///< Index of the sample history or PARAM_NO_HISTORY
+    uint64_t pendingMs;      ///< Acquisition time of pending, epoch ms (0: clock not set)
+    SampleValue pending;     ///< Latest sample from the producer
+    WindowAggregate window;  ///< Numeric samples since the last publication
+    ParamFlushState flush;
+
+    /** Record a new sample: it becomes pending and joins the window. */
+    void store(const SampleValue& value, uint64_t timestampMs) {
+        pending = value;
+        pendingMs = timestampMs;
+        dirty = true;
+        if (aggregate != PARAM_AGG_NONE && value.isNumeric()) {
+            window.add(value.toDouble());
+        }
+    }
+};
+
+/** Hash index size: power of two, at least twice the slot count. */
+constexpr size_t paramIndexSize() {
+    size_t n = 1;
+    while (n < PARAM_REGISTRY_SIZE * 2) {
+        n <<= 1;
+    }
+    return n;
+}
+
+/**
+ * @brief Interning table for parameter and method names.
+ *
+ * Lookups by name go through an open-addressing hash index; after
+ * registration producers should keep the returned ParamId and call
+ * queueParam(ParamId, ...) directly.
+ */
+class ParamRegistry {
+public:
+    ParamRegistry();
+
+    /**
+     * @brief Intern @p name for @p method and return its ID.
+     *
+     * Registering an existing name returns the same ID (and moves it to
+     * @p method / @p precision / @p aggregate if those changed).  Returns
+     * PARAM_INVALID when a name is empty or too long, or when the parameter
+     * or method table is full.  PARAM_AGG_HISTORY is dropped from the slot's
+     * flags when the history pool is exhausted.  Caller must hold
+     * dataQueueMutex.
+     * @param precision Decimals published for floating point samples.
+     * @param aggregate PARAM_AGG_* statistics published with the value.
+     */
+    ParamId registerParam(const char* name, const char* method, uint8_t precision = 2,
+                          uint8_t aggregate = PARAM_AGG_NONE);
+
+    /**
+     * @brief Like registerParam(), but an existing name keeps its precision
+     *        and aggregation; a new one gets the defaults.  One index probe.
+     *        Caller must hold dataQueueMutex.
+     */
+    ParamId findOrRegister(const char* name, const char* method);
+
+    /** @return ID of @p name or PARAM_INVALID. Caller must hold dataQueueMutex. */
+    ParamId find(const char* name) const;
+
+    /**
+     * @brief Store a sample taken at @p timestampMs in slot @p id, and in its
+     *        history if it keeps one.  Caller must hold dataQueueMutex.
+     */
+    void store(ParamId id, const SampleValue& value, uint64_t timestampMs);
+
+    size_t size() const { return count_; }
+    size_t methodCount() const { return methodCount_; }
+    ParamSlot& slot(ParamId id) { return slots_[id]; }
+    const ParamSlot& slot(ParamId id) const { return slots_[id]; }
+    const char* methodName(MethodId id) const { return methods_[id]; }
+    SampleHistory& history(uint8_t index) { return histories_[index]; }
+
+private:
+    static uint32_t hash(const char* name);
+    int internMethod(const char* method);
+    ParamId intern(const char* name, const char* method, uint8_t precision, uint8_t aggregate,
+                   bool keepSettings);
+    void setAggregate(ParamSlot& slot, uint8_t aggregate);
+
+    ParamSlot slots_[PARAM_REGISTRY_SIZE];
+    SampleHistory histories_[PARAM_HISTORY_SLOTS];
+    uint8_t historyCount_;
+    char methods_[PARAM_METHOD_COUNT][PARAM_NAME_SIZE];
+    uint16_t index_[paramIndexSize()];  ///< Slot ID + 1, 0 marks an empty bucket
+    uint16_t count_;
+    uint16_t methodCount_;
+};
+
+extern ParamRegistry paramRegistry;  ///< Parameters flushed by processQueue()
+
+/**
+ * @brief Register a parameter under dataQueueMutex.
+ * @return ID to pass to queueParam(), PARAM_INVALID on failure.
+ */
+ParamId registerParam(const char* name, const char* method, uint8_t precision = 2,
+                      uint8_t aggregate = PARAM_AGG_NONE);
+
+/** Store the latest sample of a registered parameter, stamped with the current time. */
+void queueParam(ParamId id, const SampleValue& value);
+
+/** Store a sample acquired at @p timestampMs (Unix epoch ms, see epochMillis()). */
+void queueParam(ParamId id, const SampleValue& value, uint64_t timestampMs);
+
+/** Convenience wrapper that interns @p name on first use. */
+void queueParam(const char* name, const SampleValue& value, const char* method);
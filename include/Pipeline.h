@@ -0,0 +1,97 @@
+/**
+ * @file Pipeline.h
+ * @brief Two-stage acquisition / network pipeline: per-stage counters and the
+ *        backpressure rule between the stages.
+ *
+ * The acquisition task (pinned to APP_CPU) only runs sensorScheduler: drivers
+ * sample into paramRegistry and the telemetry flush turns the staged samples
+ * into messages in the bounded lanes of mqttLanes.  The network task (pinned
+ * to PRO_CPU) owns Wi-Fi, MQTT and HTTP and is the only consumer of the lanes.
+ * Neither stage waits for the other, so a TLS handshake or a broker outage
+ * stalls the network task only; sampling keeps its period.
+ *
+ * Backpressure: while the bulk lane has fewer free slots than the previous
+ * flush filled (at least PIPELINE_FLUSH_MIN_FREE_SLOTS) the flush is
+ * deferred.  The samples then stay in their registry slots, where a newer
+ * value replaces the older one and aggregation windows keep growing, instead
+ * of evicting queued messages.  After
+ * PIPELINE_MAX_DEFERRED_FLUSHES deferrals in a row the flush goes ahead anyway,
+ * so alarms and history rings are not held back indefinitely.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "MqttRing.h"
+
+#ifndef PIPELINE_FLUSH_MIN_FREE_SLOTS
+#define PIPELINE_FLUSH_MIN_FREE_SLOTS (MQTT_LANE_BULK_SLOTS / 4)  ///< Least room a flush waits for
+#endif
+
+#ifndef PIPELINE_MAX_DEFERRED_FLUSHES
+#define PIPELINE_MAX_DEFERRED_FLUSHES 3  ///< Deferrals in a row before a flush is forced
+#endif
+
+/** The two stages. */
+enum class PipelineStage : uint8_t {
+    Acquisition,  ///< Sensor polls and telemetry flush
+    Network,      ///< Connection handling and publishing
+    Count
+};
+
+/** Counters of one stage since boot. */
+struct PipelineStageStats {
+    uint32_t cycles;      ///< Completed iterations of the task loop
+    uint32_t idle;        ///< Iterations that woke up and found nothing to do
+    uint32_t maxCycleUs;  ///< Longest iteration
+    uint32_t busyUs;      ///< Time spent in iterations; wraps after 71 min, take differences
+    uint32_t busyMs;      ///< The same in ms, for totals since boot
+    uint16_t busyRestUs;  ///< Part of busyUs not counted in busyMs yet
+};
+
+/** Counters of the hand-over between the stages since boot. */
+struct PipelineStats {
+    PipelineStageStats stage[static_cast<size_t>(PipelineStage::Count)];
+    uint32_t flushes;          ///< Flushes handed to the lanes or the outbox
+    uint32_t deferredFlushes;  ///< Flushes postponed because the bulk lane was nearly full
+    uint32_t forcedFlushes;    ///< Flushes made despite a nearly full lane
+};
+
+/**
+ * @brief Hand-over between the acquisition and the network stage.
+ *
+ * Each stage records its own iterations; admitFlush() is only called from the
+ * acquisition stage.  Counters are written by one task each and read
+ * unlocked for the statistics, so each is 32 bits wide: a 64-bit counter
+ * can be read half-updated on the ESP32.
+ */
+class Pipeline {
+public:
+    Pipeline();
+
+    /**
+     * @brief Decide whether the telemetry flush may run now.
+     * @param bulk   Lane the flush fills.
+     * @param online Messages go to the lanes; offline they go to the outbox
+     *               and are always admitted.
+     */
+    bool admitFlush(const MqttRing& bulk, bool online);
+
+    /** Account one iteration of @p stage that took @p us microseconds. */
+    void recordCycle(PipelineStage stage, uint32_t us, bool idle);
+
+    /** The stage tasks are running; loopTasks() only feeds the watchdog. */
+    void setRunning(bool running) { running_ = running; }
+    bool running() const { return running_; }
+
+    const PipelineStats& stats() const { return stats_; }
+    static const char* stageName(PipelineStage stage);
+
+private:
+    PipelineStats stats_;
+    uint32_t enqueuedAtFlush_;  ///< Bulk lane enqueue count when the last flush was admitted
+    uint8_t deferred_;          ///< Deferrals in a row
+    volatile bool running_;
+};
+
+extern Pipeline pipeline;
@@ -0,0 +1,80 @@
+/**
+ * @file PowerMonitor.h
+ * @brief Power-managed runtime mode for battery units and the awake/asleep
+ *        accounting used to size their batteries.
+ *
+ * In light-sleep mode the CPU runs with dynamic frequency scaling and enters
+ * automatic light sleep whenever every task is blocked; the radio stays in
+ * modem sleep, waking for DTIM beacons (or every listenInterval beacons) so
+ * the MQTT-over-WebSocket session stays up.  The pipeline tasks already block
+ * between polls, and the network task polls its socket only every pollMs.
+ *
+ * The monitor splits each polling interval into the time the pipeline tasks
+ * were busy (awake) and the rest, during which the CPU could sleep.  Busy
+ * time is summed over both cores and does not include the Wi-Fi and TCP/IP
+ * tasks, so it is an estimate, not a current measurement.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "Pipeline.h"
+
+/** How the CPU spends the time between polls. */
+enum class PowerMode : uint8_t {
+    Performance,       ///< Fixed maximum clock, no sleep
+    FrequencyScaling,  ///< Light sleep requested but not available in this build
+    LightSleep         ///< Automatic light sleep with frequency scaling
+};
+
+/** Runtime settings, stored in the "power" NVS namespace. */
+struct PowerConfig {
+    bool lightSleep = false;     ///< Sleep between polls (battery units)
+    uint8_t listenInterval = 0;  ///< 0: wake the radio for every DTIM beacon; N: every N beacons
+    uint16_t pollMs = 1000;      ///< Socket poll of the network task while sleeping
+    bool report = false;         ///< Publish the awake/asleep split of every polling interval
+};
+
+extern PowerConfig powerConfig;  ///< Loaded by loadPowerConfig()
+
+/** Time split of one polling interval. */
+struct PowerInterval {
+    uint32_t durationMs;
+    uint32_t awakeMs;   ///< Busy time of the pipeline tasks
+    uint32_t asleepMs;  ///< The rest, in which the CPU could sleep
+    uint32_t wakeups;   ///< Task loop iterations
+};
+
+/**
+ * @brief Cuts the pipeline counters into per-interval awake/asleep figures.
+ */
+class PowerMonitor {
+public:
+    PowerMonitor();
+
+    /** End the current interval at @p nowUs and start the next one. */
+    PowerInterval close(uint32_t nowUs, const PipelineStats& stats);
+
+    void setMode(PowerMode mode) { mode_ = mode; }
+    PowerMode mode() const { return mode_; }
+
+    const PowerInterval& last() const { return last_; }
+    uint64_t totalAwakeMs() const { return totalAwakeMs_; }
+    uint64_t totalAsleepMs() const { return totalAsleepMs_; }
+    static const char* modeName(PowerMode mode);
+
+private:
+    static uint32_t busyUs(const PipelineStats& stats);
+    static uint32_t cycles(const PipelineStats& stats);
+
+    PowerMode mode_;
+    bool started_;
+    uint32_t startUs_;
+    uint32_t busyAtStart_;
+    uint32_t cyclesAtStart_;
+    PowerInterval last_;
+    uint64_t totalAwakeMs_;
+    uint64_t totalAsleepMs_;
+};
+
+extern PowerMonitor powerMonitor;
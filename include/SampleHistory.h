@@ -0,0 +1,93 @@
+/**
+ * @file SampleHistory.h
+ * @brief Acquisition timestamps and the (t, v) sample history a parameter
+ *        can publish with its latest value.
+ *
+ * Every sample stored in paramRegistry is stamped with the wall-clock time it
+ * was taken, so queueing, batching and store-and-forward no longer shift the
+ * data in time.  Parameters registered with PARAM_AGG_HISTORY additionally
+ * keep their last PARAM_HISTORY_DEPTH samples in a ring taken from a small
+ * shared pool; processQueue() publishes them as one compact array, so a
+ * single MQTT message carries many samples.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include "SampleValue.h"
+
+#ifndef PARAM_HISTORY_DEPTH
+#define PARAM_HISTORY_DEPTH 16   ///< Samples kept per parameter, power of two
+#endif
+
+#ifndef PARAM_HISTORY_SLOTS
+#define PARAM_HISTORY_SLOTS 16   ///< Parameters that can keep a history
+#endif
+
+#define PARAM_NO_HISTORY 0xFF    ///< ParamSlot::history of a parameter without one
+
+static_assert((PARAM_HISTORY_DEPTH & (PARAM_HISTORY_DEPTH - 1)) == 0,
+              "PARAM_HISTORY_DEPTH must be a power of two");
+static_assert(PARAM_HISTORY_SLOTS < PARAM_NO_HISTORY, "PARAM_HISTORY_SLOTS too large");
+
+/**
+ * @brief Wall-clock time in Unix epoch milliseconds, 0 until SNTP has set
+ *        the clock (see setDateTime()).
+ */
+inline uint64_t epochMillis() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec < 1600000000) {
+        return 0;
+    }
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+struct HistorySample {
+    uint64_t timestampMs;  ///< Acquisition time, 0 if the clock was not set
+    SampleValue value;     ///< As stored, so history and latest value agree
+};
+
+/**
+ * @brief Ring of the latest samples of one parameter.
+ *
+ * Samples are numbered by a running counter; the consumer remembers up to
+ * which number it has published, so producers can keep adding while a
+ * message is being built.  When the ring is full the oldest sample is
+ * overwritten.
+ */
+struct SampleHistory {
+    HistorySample samples[PARAM_HISTORY_DEPTH];
+    uint32_t written;   ///< Samples added so far
+    uint32_t consumed;  ///< Number of the first sample not published yet
+
+    void reset() { written = consumed = 0; }
+
+    void add(uint64_t timestampMs, const SampleValue& value) {
+        samples[written % PARAM_HISTORY_DEPTH] = {timestampMs, value};
+        written++;
+    }
+
+    /** Number of the oldest unpublished sample still held. */
+    uint32_t first() const { return written - pending(); }
+
+    /** Unpublished samples still held. */
+    uint32_t pending() const {
+        const uint32_t unpublished = written - consumed;
+        return unpublished < PARAM_HISTORY_DEPTH ? unpublished : PARAM_HISTORY_DEPTH;
+    }
+
+    bool full() const { return pending() >= PARAM_HISTORY_DEPTH; }
+
+    const HistorySample& at(uint32_t number) const {
+        return samples[number % PARAM_HISTORY_DEPTH];
+    }
+
+    /** Mark every sample before @p end as published. */
+    void consume(uint32_t end) {
+        if (static_cast<int32_t>(end - consumed) > 0) {
+            consumed = end;
+        }
+    }
+};
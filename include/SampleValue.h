@@ -0,0 +1,90 @@
+/**
+ * @file SampleValue.h
+ * @brief Typed sensor sample used by the telemetry queue.
+ *
+ * Values keep the type the producer measured them in (integer, counter,
+ * floating point, flag or short text) all the way to the serializer, so no
+ * String conversion or float round trip happens between sampling and
+ * publishing.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define SAMPLE_TEXT_SIZE 16  ///< Max text sample length including '\0'
+
+/** Native type of a SampleValue. */
+enum class SampleType : uint8_t {
+    None,    ///< No value stored yet
+    Int32,
+    Int64,   ///< Counters that do not fit a float (energy, pulses)
+    Float,
+    Double,
+    Bool,    ///< Published as 0/1
+    Text     ///< Short string, published quoted
+};
+
+/**
+ * @brief Tagged union holding one sample.
+ *
+ * Constructors are implicit for numeric types so producers can write
+ * `queueParam(id, rssi)`; text has to be wrapped with SampleValue::text().
+ */
+struct SampleValue {
+    SampleType type;
+    union {
+        int32_t i32;
+        int64_t i64;
+        float f32;
+        double f64;
+        bool b;
+        char str[SAMPLE_TEXT_SIZE];
+    };
+
+    SampleValue() : type(SampleType::None), i64(0) {}
+    SampleValue(int v) : type(SampleType::Int32), i32(v) {}
+    SampleValue(long v) { setInteger(v, sizeof(long) <= 4); }
+    SampleValue(long long v) : type(SampleType::Int64), i64(v) {}
+    SampleValue(unsigned int v) : type(SampleType::Int64), i64(v) {}
+    SampleValue(unsigned long v) : type(SampleType::Int64), i64(static_cast<int64_t>(v)) {}
+    SampleValue(unsigned long long v) : type(SampleType::Int64), i64(static_cast<int64_t>(v)) {}
+    SampleValue(float v) : type(SampleType::Float), f32(v) {}
+    SampleValue(double v) : type(SampleType::Double), f64(v) {}
+    SampleValue(bool v) : type(SampleType::Bool), i64(0) { b = v; }
+
+    /** Text sample, truncated to SAMPLE_TEXT_SIZE - 1 characters. */
+    static SampleValue text(const char* s);
+
+    /**
+     * @brief Parse a legacy string value: integers, decimals, "true"/"false",
+     *        anything else is kept as text.
+     */
+    static SampleValue parse(const char* s);
+
+    bool isNumeric() const { return type != SampleType::None && type != SampleType::Text; }
+
+    /** Numeric view used by the dead-band rules; 0 for text. */
+    double toDouble() const;
+
+    /** Same type and same value. */
+    bool equals(const SampleValue& other) const;
+
+    /**
+     * @brief Write the value as a JSON literal.
+     * @param precision Decimals for Float/Double; integers are exact.
+     * @return Characters written (excluding '\0'), 0 if @p size is too small.
+     */
+    size_t format(char* out, size_t size, uint8_t precision) const;
+
+private:
+    void setInteger(long long v, bool narrow) {
+        if (narrow) {
+            type = SampleType::Int32;
+            i32 = static_cast<int32_t>(v);
+        } else {
+            type = SampleType::Int64;
+            i64 = v;
+        }
+    }
+};
@@ -0,0 +1,162 @@
+/**
+ * @file SensorScheduler.h
+ * @brief Registry of sensor sources, each polled at its own period, phase and
+ *        deadline by a single timing-wheel scheduler.
+ *
+ * Every driver (Modbus master, ADC, 1-Wire bus, Wi-Fi RSSI, the telemetry
+ * flush, ...) registers a poll callback with its period.  Sources are kept in
+ * a hashed timing wheel of SENSOR_WHEEL_SLOTS buckets of SENSOR_WHEEL_TICK_MS:
+ * run() only looks at the buckets whose time has come, so its cost depends on
+ * the number of due sources, not on how many are registered.  Periods longer
+ * than one revolution of the wheel simply stay in their bucket until their
+ * due time is reached.
+ *
+ * Sources registered with SENSOR_PHASE_AUTO are placed in the least loaded
+ * bucket within their first period, so sources with equal periods are spread
+ * over the wheel instead of all firing on the same tick.  Due times advance by
+ * whole periods from the first one, so polling does not drift; periods missed
+ * because the loop was blocked are skipped and counted, not caught up.
+ *
+ * The scheduler is not thread-safe: register sources during setup and call
+ * run() from one task only (the acquisition task, or loop() without it).
+ * That task sleeps for msUntilNext(); setWakeup() tells it when the schedule
+ * changed underneath.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef SENSOR_SCHEDULER_MAX_SOURCES
+#define SENSOR_SCHEDULER_MAX_SOURCES 16   ///< Registered sources
+#endif
+
+#ifndef SENSOR_WHEEL_SLOTS
+#define SENSOR_WHEEL_SLOTS 64             ///< Buckets, power of two
+#endif
+
+#ifndef SENSOR_WHEEL_TICK_MS
+#define SENSOR_WHEEL_TICK_MS 50           ///< Time covered by one bucket
+#endif
+
+#define SENSOR_SOURCE_NAME_SIZE 16        ///< Max source name incl. '\0'
+#define SENSOR_SOURCE_INVALID 0xFF        ///< Returned when a source cannot be added
+#define SENSOR_PHASE_AUTO 0xFFFFFFFFUL    ///< Let the scheduler pick the phase
+
+static_assert((SENSOR_WHEEL_SLOTS & (SENSOR_WHEEL_SLOTS - 1)) == 0,
+              "SENSOR_WHEEL_SLOTS must be a power of two");
+static_assert(SENSOR_SCHEDULER_MAX_SOURCES < SENSOR_SOURCE_INVALID,
+              "SENSOR_SCHEDULER_MAX_SOURCES too large");
+
+typedef uint8_t SensorSourceId;
+
+/** Poll callback of a source; @p context is the pointer given to add(). */
+typedef void (*SensorPollFn)(void* context);
+
+/** Called when the schedule changed and the next poll may be earlier than planned. */
+typedef void (*SensorWakeFn)(void* context);
+
+/** Counters of one source since it was added. */
+struct SensorSourceStats {
+    uint32_t runs;           ///< Completed polls
+    uint32_t late;           ///< Polls started later than the source's deadline
+    uint32_t skipped;        ///< Periods missed because the loop was blocked
+    uint32_t maxLatenessMs;  ///< Largest delay between due time and start
+    uint32_t maxRunUs;       ///< Longest poll
+};
+
+/**
+ * @brief Timing-wheel dispatcher for periodic sensor polls.
+ */
+class SensorScheduler {
+public:
+    SensorScheduler();
+
+    /** Set the time that phases of sources added before the first run() count from. */
+    void begin(uint32_t nowMs);
+
+    /**
+     * @brief Register a source.
+     * @param periodMs   Poll period, at least SENSOR_WHEEL_TICK_MS.
+     * @param phaseMs    Delay of the first poll, or SENSOR_PHASE_AUTO.
+     * @param deadlineMs Largest acceptable start delay before the poll counts
+     *                   as late, 0 for none.
+     * @return ID of the source, SENSOR_SOURCE_INVALID if the table is full or
+     *         the arguments are invalid.
+     */
+    SensorSourceId add(const char* name, SensorPollFn poll, void* context, uint32_t periodMs,
+                       uint32_t phaseMs = SENSOR_PHASE_AUTO, uint32_t deadlineMs = 0);
+
+    /** Change the period; the next poll is one new period from the last run() time. */
+    bool setPeriod(SensorSourceId id, uint32_t periodMs);
+    /** Stop or resume polling one source. */
+    void setEnabled(SensorSourceId id, bool enabled);
+    /** Stop or resume polling every source, e.g. while pairing. */
+    void pause(bool paused);
+
+    /**
+     * @brief Have @p wake called after add(), setPeriod(), enabling a source
+     *        and resuming, so a task sleeping until msUntilNext() can look
+     *        again.  It may run on the task that changed the schedule.
+     */
+    void setWakeup(SensorWakeFn wake, void* context);
+
+    /**
+     * @brief Poll every source whose due time has come.
+     * @return Number of polls made.
+     */
+    size_t run(uint32_t nowMs);
+
+    /**
+     * @brief Poll every enabled source once, regardless of its schedule,
+     *        except @p skip.  Used by deep-sleep wakes, which take one
+     *        sample of everything and sleep again.
+     * @return Number of polls made.
+     */
+    size_t pollAll(SensorSourceId skip = SENSOR_SOURCE_INVALID);
+
+    /** Milliseconds from @p nowMs until the next poll, UINT32_MAX if none is scheduled. */
+    uint32_t msUntilNext(uint32_t nowMs) const;
+
+    size_t size() const { return count_; }
+    const char* name(SensorSourceId id) const { return sources_[id].name; }
+    uint32_t period(SensorSourceId id) const { return sources_[id].periodMs; }
+    const SensorSourceStats& stats(SensorSourceId id) const { return sources_[id].stats; }
+
+private:
+    struct Source {
+        char name[SENSOR_SOURCE_NAME_SIZE];
+        SensorPollFn poll;
+        void* context;
+        uint32_t periodMs;
+        uint32_t deadlineMs;
+        uint32_t dueMs;          ///< Next scheduled start
+        SensorSourceId next;     ///< Next source in the same bucket
+        bool enabled;
+        SensorSourceStats stats;
+    };
+
+    static size_t bucketOf(uint32_t dueMs) {
+        return (dueMs / SENSOR_WHEEL_TICK_MS) & (SENSOR_WHEEL_SLOTS - 1);
+    }
+    void link(SensorSourceId id);
+    void unlink(SensorSourceId id);
+    uint32_t autoPhase(uint32_t startMs, uint32_t periodMs) const;
+    void dispatch(SensorSourceId id, uint32_t nowMs);
+    void wake() const {
+        if (wake_) {
+            wake_(wakeContext_);
+        }
+    }
+
+    Source sources_[SENSOR_SCHEDULER_MAX_SOURCES];
+    SensorSourceId buckets_[SENSOR_WHEEL_SLOTS];  ///< Head of each bucket's list
+    uint8_t bucketSize_[SENSOR_WHEEL_SLOTS];
+    size_t count_;
+    uint32_t cursorMs_;  ///< Time of the last run(); buckets up to it were visited
+    bool paused_;
+    SensorWakeFn wake_;
+    void* wakeContext_;
+};
+
+extern SensorScheduler sensorScheduler;  ///< Sources polled by the acquisition task
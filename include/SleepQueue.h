@@ -0,0 +1,186 @@
+/**
+ * @file SleepQueue.h
+ * @brief Deep-sleep sample-and-burst mode: telemetry and dead-band state kept
+ *        in RTC slow memory between wakes.
+ *
+ * In this mode every wake samples the sensor sources once and processQueue()
+ * builds its usual stream/<id>/rpcout messages, with their capture time in a
+ * top-level "ts", into the RTC queue instead of the lanes or the flash outbox.
+ * The radio stays off.  Every burstEvery wakes (or earlier, when the queue
+ * would not take another wake) the device connects, publishes the queue and
+ * goes back to sleep.
+ *
+ * The last published value, its dead-band direction and the registration of
+ * every parameter survive the sleep as well, so a wake only queues the
+ * methods that changed since the last one, exactly as a flush in the
+ * always-on mode would.  Aggregation windows and delta keyframe timers do
+ * not survive; every wake is a keyframe.
+ *
+ * The retained state is a plain struct without constructors: a C++
+ * constructor would run on every boot and wipe it.  A magic number with the
+ * layout size marks valid contents; anything else (power-on, new firmware
+ * with a different layout) starts from scratch.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <type_traits>
+#include "DeviceIdentity.h"
+#include "ParamRegistry.h"
+
+#ifndef SLEEP_QUEUE_BYTES
+#define SLEEP_QUEUE_BYTES 3072       ///< Message bytes kept in RTC memory
+#endif
+
+#ifndef SLEEP_RETAINED_PARAMS
+#define SLEEP_RETAINED_PARAMS 24     ///< Parameters whose dead-band state survives a sleep
+#endif
+
+#ifndef SLEEP_CONNECT_TIMEOUT_MS
+#define SLEEP_CONNECT_TIMEOUT_MS 20000  ///< Burst wake: longest wait for Wi-Fi and MQTT
+#endif
+
+// Assumed currents for averageCurrentUa(); measure the board and override
+#ifndef SLEEP_CURRENT_AWAKE_MA
+#define SLEEP_CURRENT_AWAKE_MA 40    ///< CPU running, radio off
+#endif
+
+#ifndef SLEEP_CURRENT_RADIO_MA
+#define SLEEP_CURRENT_RADIO_MA 120   ///< Wi-Fi connecting and transmitting
+#endif
+
+#ifndef SLEEP_CURRENT_DEEP_UA
+#define SLEEP_CURRENT_DEEP_UA 10     ///< Deep sleep, RTC timer running
+#endif
+
+#define SLEEP_RETAINED_MAGIC 0x31504c53UL  ///< "SLP1"
+
+/** Settings, stored in the "sleep" NVS namespace. */
+struct SleepConfig {
+    bool enabled = false;     ///< Run in deep-sleep mode from the next boot on
+    uint16_t periodSec = 300; ///< Time between wakes
+    uint8_t burstEvery = 6;   ///< Wakes per connection
+};
+
+extern SleepConfig sleepConfig;  ///< Loaded by loadSleepConfig()
+
+/** Header of a queued message, followed by its payload. */
+struct SleepRecordHeader {
+    uint16_t length;
+    uint8_t topic;  ///< Topic of the message
+    uint8_t reserved;
+};
+
+/** Dead-band state of one parameter. */
+struct RetainedParam {
+    char name[PARAM_NAME_SIZE];
+    char method[PARAM_NAME_SIZE];
+    uint8_t precision;
+    uint8_t aggregate;
+    bool sent;
+    int8_t lastDirection;
+    uint8_t lastSent[sizeof(SampleValue)];  ///< SampleValue copied as bytes, see SleepRetained
+};
+
+/** Wake timing since the retained state was created. */
+struct SleepStats {
+    uint32_t wakes;           ///< All wakes
+    uint32_t bursts;          ///< Wakes that connected
+    uint32_t failedBursts;    ///< Of those, the ones that could not publish everything
+    uint32_t sampleWakes;     ///< Wakes since the last burst that only sampled
+    uint32_t sampleMsTotal;   ///< Their awake time, boot to sleep
+    uint32_t sampleMsMax;
+    uint32_t publishMs;       ///< Time to publish of the last burst, boot to queue drained
+    uint32_t dropped;         ///< Messages that did not fit the queue
+};
+
+/** Everything kept in RTC slow memory.  Plain data, see the file comment. */
+struct SleepRetained {
+    uint32_t magic;
+    uint32_t layout;
+    uint16_t used;            ///< Queue bytes in use
+    uint16_t records;         ///< Messages in the queue
+    uint16_t largestWake;     ///< Most queue bytes a single wake added
+    uint8_t wakesSinceBurst;
+    uint8_t paramCount;
+    SleepStats stats;
+    RetainedParam params[SLEEP_RETAINED_PARAMS];
+    uint8_t queue[SLEEP_QUEUE_BYTES];
+};
+static_assert(std::is_trivial<SleepRetained>::value, "SleepRetained must not have constructors");
+
+/**
+ * @brief Message queue and dead-band memory across deep sleeps.
+ *
+ * Operates on a SleepRetained that lives in RTC memory on the device (and in
+ * ordinary memory in the benchmark).  Used by one task only.
+ */
+class SleepQueue {
+public:
+    explicit SleepQueue(SleepRetained& state);
+
+    /**
+     * @brief Validate the retained state and start a wake.
+     * @return true if the state survived from the previous wake.
+     */
+    bool begin();
+
+    /** Messages built by processQueue() while offline go here. */
+    void setActive(bool active) { active_ = active; }
+    bool active() const { return active_; }
+
+    /** Append a message. @return false if the queue has no room for it. */
+    bool append(Topic topic, const char* payload, size_t length);
+
+    /**
+     * @brief Read the message at byte @p offset of the queue.
+     * @return Offset of the next message, 0 if there is none at @p offset.
+     */
+    size_t read(size_t offset, Topic& topic, const char*& payload, uint16_t& length) const;
+
+    /** Drop the first @p bytes (whole messages, as returned by read()). */
+    void consume(size_t bytes);
+
+    size_t used() const { return state_.used; }
+    size_t records() const { return state_.records; }
+    size_t free() const { return SLEEP_QUEUE_BYTES - state_.used; }
+
+    /** Copy the dead-band state of every registered parameter. Caller holds dataQueueMutex. */
+    void retain(const ParamRegistry& registry);
+
+    /**
+     * @brief Register the retained parameters again, in their original order,
+     *        with their last published value.  Caller holds dataQueueMutex.
+     * @return Parameters restored.
+     */
+    size_t restore(ParamRegistry& registry) const;
+
+    /** This wake should connect: @p burstEvery reached or the queue nearly full. */
+    bool burstDue(uint8_t burstEvery) const;
+
+    /** A wake that only sampled took @p awakeMs. */
+    void endSampleWake(uint32_t awakeMs);
+
+    /** A burst wake published the queue (or failed to) after @p publishMs. */
+    void endBurst(uint32_t publishMs, bool complete);
+
+    const SleepStats& stats() const { return state_.stats; }
+
+    /**
+     * @brief Average current over one burst cycle, from the assumed
+     *        SLEEP_CURRENT_* figures.
+     */
+    static uint32_t averageCurrentUa(uint32_t sampleMs, uint32_t publishMs, uint32_t periodSec,
+                                     uint8_t burstEvery);
+
+private:
+    void reset();
+
+    SleepRetained& state_;
+    bool active_;
+    uint16_t usedAtWake_;  ///< Queue bytes when the wake started
+};
+
+extern SleepRetained sleepRetained;  ///< RTC_DATA_ATTR on the device
+extern SleepQueue sleepQueue;
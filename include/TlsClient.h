@@ -0,0 +1,34 @@
+/**
+ * @file TlsClient.h
+ * @brief WiFiClientSecure that resumes TLS sessions from the TlsSessions cache.
+ *
+ * The handshake of WiFiClientSecure (start_ssl_client) sets up and runs the
+ * mbedTLS context in one call, leaving no point to offer a cached session.
+ * TlsClient runs the same steps itself for the CA-certificate and insecure
+ * modes, offers the cached session before the handshake, stores the new one
+ * afterwards and records the handshake time.  The connection is then handed
+ * to WiFiClientSecure unchanged, so reading, writing and stop() are the
+ * library's.  Client certificates, PSK and the IDF bundle keep the library
+ * handshake.
+ */
+
+#pragma once
+
+#include <WiFiClientSecure.h>
+#include "TlsSession.h"
+
+class TlsClient : public WiFiClientSecure {
+public:
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) override;
+    int connect(const char* host, uint16_t port) override;
+    int connect(const char* host, uint16_t port, int32_t timeout) override;
+
+private:
+    /** Mode handled here; anything else goes to the library handshake. */
+    bool resumable() const;
+    int open(IPAddress ip, uint16_t port, const char* host);
+    bool openSocket(IPAddress ip, uint16_t port);
+    int handshake(const char* peer, uint16_t port, bool& offered, bool& resumed);
+    void keepSession(const char* peer, uint16_t port);
+};
@@ -0,0 +1,135 @@
+/**
+ * @file TlsSession.h
+ * @brief TLS session cache for resumed handshakes and the handshake-time
+ *        histogram that shows whether resumption works.
+ *
+ * After every full handshake TlsClient serialises the negotiated session
+ * (session ID, ticket and master secret; without the server certificate,
+ * which a resumed handshake does not need) and stores it here under the
+ * host and port.  The next connection to that peer offers it; if the server
+ * still knows the session or accepts the ticket, the handshake skips the
+ * certificate chain and the asymmetric crypto.  A server that refuses simply
+ * runs a full handshake, so a stale entry costs nothing but its bytes.
+ *
+ * With TLS_SESSION_RTC the slots live in RTC slow memory and survive deep
+ * sleep and software resets, like the SleepQueue state (see there for why
+ * the retained struct has no constructors).  RTC memory holds the session
+ * secrets in clear, as the heap does while the device runs.
+ *
+ * The MQTT WebSocket client creates its own TLS client and cannot resume;
+ * its transport openings are recorded in the histogram as a separate kind.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <type_traits>
+
+#ifndef TLS_SESSION_SLOTS
+#define TLS_SESSION_SLOTS 2          ///< Peers with a cached session (token and config server)
+#endif
+
+#ifndef TLS_SESSION_BYTES
+#define TLS_SESSION_BYTES 512        ///< Serialised session incl. ticket
+#endif
+
+#ifndef TLS_SESSION_RTC
+#define TLS_SESSION_RTC 1            ///< 1: keep the sessions in RTC memory across resets
+#endif
+
+#define TLS_HOST_SIZE 64             ///< Host name incl. '\0'
+#define TLS_HISTOGRAM_BUCKETS 8      ///< < 100, 200, 400 ... 6400 ms and above
+#define TLS_HISTOGRAM_FIRST_MS 100
+#define TLS_RETAINED_MAGIC 0x31534c54UL  ///< "TLS1"
+
+/** What a recorded handshake was. */
+enum class HandshakeKind : uint8_t {
+    Full,       ///< HTTPS, certificate chain verified
+    Resumed,    ///< HTTPS, cached session accepted
+    WebSocket,  ///< MQTT transport: TCP, TLS and WebSocket upgrade
+    Count
+};
+
+/** Handshake times of one kind since boot. */
+struct HandshakeHistogram {
+    uint32_t counts[TLS_HISTOGRAM_BUCKETS];
+    uint32_t total;
+    uint64_t totalMs;
+    uint32_t maxMs;
+};
+
+/** Cache and handshake counters since boot. */
+struct TlsStats {
+    HandshakeHistogram kind[static_cast<size_t>(HandshakeKind::Count)];
+    uint32_t offered;   ///< Handshakes that offered a cached session
+    uint32_t failed;    ///< Handshakes that failed (not counted in the histogram)
+    uint32_t stored;    ///< Sessions stored
+    uint32_t tooLarge;  ///< Sessions that did not fit TLS_SESSION_BYTES
+};
+
+/** One cached session. */
+struct TlsSessionSlot {
+    char host[TLS_HOST_SIZE];
+    uint16_t port;
+    uint16_t length;  ///< 0: slot free
+    uint32_t stamp;   ///< Last use, for replacing the oldest slot
+    uint8_t data[TLS_SESSION_BYTES];
+};
+
+/** Everything kept across resets.  Plain data. */
+struct TlsRetained {
+    uint32_t magic;
+    uint32_t layout;
+    uint32_t clock;  ///< Last stamp handed out
+    TlsSessionSlot slots[TLS_SESSION_SLOTS];
+};
+static_assert(std::is_trivial<TlsRetained>::value, "TlsRetained must not have constructors");
+
+/**
+ * @brief Session slots and handshake statistics.  Not locked; TlsClient
+ *        serialises access from its tasks.
+ */
+class TlsSessions {
+public:
+    explicit TlsSessions(TlsRetained& state);
+
+    /** Cached session for @p host:@p port, nullptr if there is none. */
+    const TlsSessionSlot* find(const char* host, uint16_t port);
+
+    /**
+     * @brief Store the session of @p host:@p port, replacing its old one or
+     *        the least recently used slot.
+     * @return false if it does not fit TLS_SESSION_BYTES.
+     */
+    bool store(const char* host, uint16_t port, const uint8_t* data, size_t length);
+
+    /** Drop the session of @p host:@p port, e.g. after a failed resumption. */
+    void forget(const char* host, uint16_t port);
+
+    /** Slots in use. */
+    size_t size();
+
+    /** Count a handshake of @p ms.  @p offered: a cached session was offered. */
+    void recordHandshake(HandshakeKind kind, uint32_t ms, bool offered);
+    void recordFailure(bool offered);
+
+    const TlsStats& stats() const { return stats_; }
+
+    /** Smallest bucket limit covering @p percent of the handshakes of @p kind. */
+    uint32_t percentileMs(HandshakeKind kind, uint8_t percent) const;
+
+    static size_t bucket(uint32_t ms);
+    /** Upper limit of @p bucket; the last one reports UINT32_MAX. */
+    static uint32_t bucketLimitMs(size_t bucket);
+    static const char* kindName(HandshakeKind kind);
+
+private:
+    void validate();
+    TlsSessionSlot* slot(const char* host, uint16_t port);
+
+    TlsRetained& state_;
+    TlsStats stats_;
+};
+
+extern TlsRetained tlsRetained;  ///< RTC_DATA_ATTR on the device with TLS_SESSION_RTC
+extern TlsSessions tlsSessions;
@@ -0,0 +1,67 @@
+/**
+ * @file WindowAggregate.h
+ * @brief Streaming min/max/mean/count and Welford variance of the samples a
+ *        parameter received since it was last published.
+ *
+ * Producers can sample fast (10-100 Hz) while processQueue() still publishes
+ * once per flush: the published value stays the latest sample and the
+ * aggregate describes everything in between, so spikes are not lost.  Single
+ * precision keeps a slot small and uses the ESP32 FPU; it is meant for
+ * analog signals such as current or flow, not for large counters.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#define PARAM_AGG_NONE 0x00      ///< Publish the latest sample only
+#define PARAM_AGG_STATS 0x01     ///< Also min, max, mean and count
+#define PARAM_AGG_VARIANCE 0x03  ///< Also the sample variance (includes STATS)
+#define PARAM_AGG_HISTORY 0x04   ///< Also the timestamped samples, see SampleHistory.h
+
+struct WindowAggregate {
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float m2;  ///< Sum of squared deviations from the mean
+
+    void reset() {
+        count = 0;
+        min = max = mean = m2 = 0.0f;
+    }
+
+    void add(float x) {
+        if (count == 0 || x < min) {
+            min = x;
+        }
+        if (count == 0 || x > max) {
+            max = x;
+        }
+        count++;
+        const float delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    /** Combine with the aggregate of another window (Chan et al.). */
+    void merge(const WindowAggregate& other) {
+        if (other.count == 0) {
+            return;
+        }
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+        const uint32_t total = count + other.count;
+        const float delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * (static_cast<float>(count) * other.count / total);
+        min = other.min < min ? other.min : min;
+        max = other.max > max ? other.max : max;
+        count = total;
+    }
+
+    /** Sample variance (n - 1), 0 below two samples. */
+    float variance() const { return count > 1 ? m2 / (count - 1) : 0.0f; }
+};
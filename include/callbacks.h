@@ -3,6 +3,7 @@
 #include "SmoothLED.h"
 #include "globalConfig.h"
 #include "MutexLock.h"
+#include "SensorScheduler.h"
 #include <WiFi.h>
 
 /**
@@ -25,8 +26,6 @@ extern TaskHandle_t readSerialCommandsHandle;
 extern TaskHandle_t updateLEDsHandle;
 
 extern Ticker setTimeTicker;             ///< Periodic time synchronization
-extern Ticker ticker1min;                ///< One‑minute data polling ticker
-extern Ticker ticker10sec;               ///< Regular sensor polling ticker
 
 #ifdef CALIBRATION_MODE
 extern void calibrationModeStart();
@@ -52,10 +51,9 @@ inline void buttonTaskDelete() {
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
-    // Stop all active timers so they do not fire during reconfiguration.
-    ticker10sec.detach();
+    // Stop all active timers and sensor polling during reconfiguration.
+    sensorScheduler.pause(true);
     setTimeTicker.detach();
-    ticker1min.detach();
 
     if (updateLEDsHandle != NULL) {
         vTaskDelete(updateLEDsHandle);
@@ -127,21 +125,11 @@ inline void prepareForPairing(void *pvParameters) {
  *        via MQTT.
  */
 inline void sendWifiRSSI() {
-    static String jsonTemplate =
-        "{\"jsonrpc\":\"2.0\",\"method\":\"sensor-data\",\"params\":{\"wifi\":{\"value\":PLACEHOLDER}}}";
-
     int myRSSI = WiFi.RSSI();
     Serial.printf("Уровень сигнала WiFi: %d dBm\n", myRSSI);
 
-    String jsonMessage = jsonTemplate;
-    jsonMessage.replace("PLACEHOLDER", String(myRSSI));
-
-    // Enqueue JSON message for later MQTT transmission.
-    {
-        MutexLock lock(dataQueueMutex);
-        dataQueue["wifi"] = std::unique_ptr<DataItem>(
-            new GenericDataItem("wifi", String(myRSSI), "sensor-data"));
-        Serial.printf("Queue: Queued WiFi RSSI data: %s\n", jsonMessage.c_str());
-    }
+    // Store the sample in its registry slot for the next processQueue().
+    static ParamId wifiParam = registerParam("wifi", "sensor-data");
+    queueParam(wifiParam, myRSSI);
 }
 
@@ -7,6 +7,7 @@
 
 #include "globalConfig.h"
 extern void buttonTaskDelete();
+void applyPowerConfig();
 void saveTimeToNVS(time_t currentTime);
 void restoreTimeFromRTC();
 bool otaInProgress = false;
@@ -168,6 +169,10 @@ update_result_t doOTAUpdate(const char *firmwareUrl, UpdateProgressCallback prog
 #include <time.h>
 #include "TZ.h"
 #include "cert.h"
+#include "MqttInflight.h"
+#include "Outbox.h"
+#include "PowerMonitor.h"
+#include "SleepQueue.h"
 
 // Объявление функций из mqttProcess.h. Можно дописывать любые другие функции
 extern void subscribeTo();
@@ -184,7 +189,29 @@ extern void subscribeToTimeExchange();
 #define MQTT_CONNECT_BAD_CREDENTIALS 4
 #define MQTT_CONNECT_UNAUTHORIZED 5
 
-WebSocketsClient mqttclient;
+/**
+ * @brief WebSocket transport of the MQTT client that also shows the broker's
+ *        bytes to the QoS 1 in-flight window (see MqttInflight.h), which
+ *        needs the PUBACKs the library ignores.
+ */
+class MqttTransport : public WebSocketsClient {
+protected:
+    void runCbEvent(WStype_t type, uint8_t* payload, size_t length) override {
+        if (type == WStype_BIN) {
+            mqttInflight.receive(payload, length, millis());
+        } else if (type == WStype_CONNECTED) {
+            mqttInflight.reconnected();
+        }
+        WebSocketsClient::runCbEvent(type, payload, length);
+    }
+};
+
+/** MqttInflight transport: one MQTT packet per WebSocket frame. */
+bool sendMqttPacket(const uint8_t* packet, size_t length, void* context) {
+    return static_cast<MqttTransport*>(context)->sendBIN(const_cast<uint8_t*>(packet), length);
+}
+
+MqttTransport mqttclient;
 MQTTPubSub::PubSubClient<MQTT_BUFFER_SIZE> mqtt;
 unsigned long lastMsg = 0;
 #define MSG_BUFFER_SIZE (1024)
@@ -292,6 +319,344 @@ void restoreTimeFromRTC() {
 }
 
 
+/**
+ * @brief Persist the runtime dead-band rules, serialized by the caller under
+ *        deadBandMutex, to the "deadband" NVS namespace.  Called without the
+ *        lock: the flash write must not stall sampling.
+ */
+void saveDeadBandRules(const uint8_t* blob, size_t len) {
+    prefs.begin("deadband", false);
+    prefs.putBytes("rules", blob, len);
+    prefs.end();
+}
+
+/**
+ * @brief Load dead-band rules saved by saveDeadBandRules(), if any.
+ */
+void loadDeadBandRules() {
+    uint8_t blob[DeadBandTable::maxSerializedSize()];
+    prefs.begin("deadband", true);
+    size_t len = prefs.getBytes("rules", blob, sizeof(blob));
+    prefs.end();
+    if (len == 0) {
+        return;  // Never saved
+    }
+
+    MutexLock lock(deadBandMutex);
+    if (deadBandTable.deserialize(blob, len)) {
+        Serial.printf("Loaded %u dead-band rules from NVS\n",
+                      (unsigned)deadBandTable.customRuleCount());
+    } else {
+        Serial.println("Stored dead-band rules are invalid, using defaults");
+    }
+}
+
+/**
+ * @brief Apply dead-band rules received on command/<id>/deadband and store
+ *        them in NVS.
+ *
+ * Payload example:
+ * {"id":1,"reset":false,
+ *  "rules":[{"pattern":"current","match":"prefix","kind":"absolute",
+ *            "threshold":0.5,"hysteresis":0.1,"alarm":false}],
+ *  "remove":[{"pattern":"r00","match":"name"}]}
+ * "alarm":true sends changes of matching parameters on the alarm lane.
+ */
+void handleDeadBandCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("Dead-band command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    bool ok = true;
+    uint8_t blob[DeadBandTable::maxSerializedSize()];
+    size_t len;
+    {
+        MutexLock lock(deadBandMutex);
+        if (doc["reset"] | false) {
+            deadBandTable.resetRules();
+        }
+        for (JsonObject item : doc["remove"].as<JsonArray>()) {
+            DeadBandMatch match;
+            if (!DeadBandTable::parseMatch(item["match"].as<const char*>(), match) ||
+                !deadBandTable.removeRule(item["pattern"] | "", match)) {
+                ok = false;
+            }
+        }
+        for (JsonObject item : doc["rules"].as<JsonArray>()) {
+            DeadBandRule rule = {};
+            const char* pattern = item["pattern"] | "";
+            if (strlen(pattern) >= sizeof(rule.pattern) ||
+                !DeadBandTable::parseMatch(item["match"].as<const char*>(), rule.match) ||
+                !DeadBandTable::parseKind(item["kind"].as<const char*>(), rule.kind)) {
+                ok = false;
+                continue;
+            }
+            strncpy(rule.pattern, pattern, sizeof(rule.pattern) - 1);
+            rule.threshold = item["threshold"] | 0.0f;
+            rule.hysteresis = item["hysteresis"] | 0.0f;
+            rule.flags = (item["alarm"] | false) ? DEADBAND_FLAG_ALARM : 0;
+            if (!deadBandTable.setRule(rule)) {
+                ok = false;
+            }
+        }
+        // The buffer always fits; no rules left (after "reset") store an empty set
+        len = deadBandTable.serialize(blob, sizeof(blob));
+    }
+    saveDeadBandRules(blob, len);
+
+    Serial.printf("Dead-band rules updated, %u runtime rules active\n",
+                  (unsigned)deadBandTable.customRuleCount());
+    if (ok) {
+        sendNvsSuccessResponse(id);
+    } else {
+        sendErrorResponse(id, "Invalid dead-band rule");
+    }
+}
+
+/**
+ * @brief Load the outbox settings from the "outbox" NVS namespace.
+ */
+void loadOutboxConfig() {
+    prefs.begin("outbox", true);
+    outboxConfig.enabled = prefs.getBool("enabled", outboxConfig.enabled);
+    outboxConfig.drainPerSec = prefs.getUShort("drainPerSec", outboxConfig.drainPerSec);
+    prefs.end();
+}
+
+/**
+ * @brief Apply outbox settings received on command/<id>/outbox and store
+ *        them in NVS.
+ *
+ * Payload example:
+ * {"id":1,"enabled":true,"drainPerSec":10,"clear":false}
+ * "drainPerSec":0 pauses the replay, "clear":true deletes stored messages.
+ */
+void handleOutboxCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("Outbox command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    outboxConfig.enabled = doc["enabled"] | outboxConfig.enabled;
+    outboxConfig.drainPerSec = doc["drainPerSec"] | outboxConfig.drainPerSec;
+    if (doc["clear"] | false) {
+        outbox.clear();
+    }
+
+    prefs.begin("outbox", false);
+    prefs.putBool("enabled", outboxConfig.enabled);
+    prefs.putUShort("drainPerSec", outboxConfig.drainPerSec);
+    prefs.end();
+
+    OutboxStats stats = outbox.stats();
+    Serial.printf("Outbox %s, drain %u/s, %u bytes stored, %u appended, %u replayed, %u corrupt\n",
+                  outboxConfig.enabled ? "enabled" : "disabled",
+                  (unsigned)outboxConfig.drainPerSec, (unsigned)outbox.backlogBytes(),
+                  (unsigned)stats.appended, (unsigned)stats.replayed, (unsigned)stats.corrupt);
+    sendNvsSuccessResponse(id);
+}
+
+/**
+ * @brief Load the telemetry settings from the "telemetry" NVS namespace.
+ */
+void loadTelemetryConfig() {
+    prefs.begin("telemetry", true);
+    telemetryConfig.format = prefs.getUChar("format", 0) == 1 ? TelemetryFormat::Cbor : TelemetryFormat::Json;
+    telemetryConfig.delta = prefs.getBool("delta", telemetryConfig.delta);
+    telemetryConfig.keyframeSec = prefs.getUShort("keyframeSec", telemetryConfig.keyframeSec);
+    prefs.end();
+}
+
+/**
+ * @brief Apply telemetry settings received on command/<id>/telemetry and
+ *        store them in NVS.
+ *
+ * Payload example:
+ * {"id":1,"format":"cbor","delta":true,"keyframeSec":300}
+ * Every field is optional.  "json" publishes on stream/<id>/rpcout, "cbor"
+ * on stream/<id>/rpcout-cbor; command responses stay JSON on
+ * stream/<id>/rpcout.  "delta" sends only changed parameters between full
+ * keyframes every "keyframeSec".
+ */
+void handleTelemetryCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("Telemetry command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    if (doc["format"].is<const char*>()) {
+        const char* format = doc["format"];
+        if (strcmp(format, "json") == 0) {
+            telemetryConfig.format = TelemetryFormat::Json;
+        } else if (strcmp(format, "cbor") == 0) {
+            telemetryConfig.format = TelemetryFormat::Cbor;
+        } else {
+            sendErrorResponse(id, "Unknown telemetry format");
+            return;
+        }
+    }
+    telemetryConfig.delta = doc["delta"] | telemetryConfig.delta;
+    telemetryConfig.keyframeSec = doc["keyframeSec"] | telemetryConfig.keyframeSec;
+
+    prefs.begin("telemetry", false);
+    prefs.putUChar("format", static_cast<uint8_t>(telemetryConfig.format));
+    prefs.putBool("delta", telemetryConfig.delta);
+    prefs.putUShort("keyframeSec", telemetryConfig.keyframeSec);
+    prefs.end();
+
+    Serial.printf("Telemetry %s, %s, keyframe every %u s\n",
+                  telemetryConfig.format == TelemetryFormat::Cbor ? "cbor" : "json",
+                  telemetryConfig.delta ? "delta" : "full", (unsigned)telemetryConfig.keyframeSec);
+    sendNvsSuccessResponse(id);
+}
+
+/**
+ * @brief Load the power settings from the "power" NVS namespace.
+ */
+void loadPowerConfig() {
+    prefs.begin("power", true);
+    powerConfig.lightSleep = prefs.getBool("lightSleep", powerConfig.lightSleep);
+    powerConfig.listenInterval = prefs.getUChar("listenInterval", powerConfig.listenInterval);
+    powerConfig.pollMs = prefs.getUShort("pollMs", powerConfig.pollMs);
+    powerConfig.report = prefs.getBool("report", powerConfig.report);
+    prefs.end();
+}
+
+/**
+ * @brief Apply power settings received on command/<id>/power and store them
+ *        in NVS.
+ *
+ * Payload example:
+ * {"id":1,"lightSleep":true,"listenInterval":0,"pollMs":1000,"report":true}
+ * Every field is optional.  "listenInterval" takes effect at the next Wi-Fi
+ * association; "report" publishes awake-ms/asleep-ms/wakeups every polling
+ * interval (method "power").
+ */
+void handlePowerCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("Power command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    const uint16_t pollMs = doc["pollMs"] | powerConfig.pollMs;
+    if (pollMs < 100 || pollMs > 10000) {
+        sendErrorResponse(id, "pollMs must be 100..10000");
+        return;
+    }
+    powerConfig.lightSleep = doc["lightSleep"] | powerConfig.lightSleep;
+    powerConfig.listenInterval = doc["listenInterval"] | powerConfig.listenInterval;
+    powerConfig.pollMs = pollMs;
+    powerConfig.report = doc["report"] | powerConfig.report;
+
+    prefs.begin("power", false);
+    prefs.putBool("lightSleep", powerConfig.lightSleep);
+    prefs.putUChar("listenInterval", powerConfig.listenInterval);
+    prefs.putUShort("pollMs", powerConfig.pollMs);
+    prefs.putBool("report", powerConfig.report);
+    prefs.end();
+
+    applyPowerConfig();
+    Serial.printf("Power mode %s, listen interval %u, poll %u ms, report %s\n",
+                  PowerMonitor::modeName(powerMonitor.mode()),
+                  (unsigned)powerConfig.listenInterval, (unsigned)powerConfig.pollMs,
+                  powerConfig.report ? "on" : "off");
+    sendNvsSuccessResponse(id);
+}
+
+/**
+ * @brief Load the deep-sleep settings from the "sleep" NVS namespace.
+ */
+void loadSleepConfig() {
+    prefs.begin("sleep", true);
+    sleepConfig.enabled = prefs.getBool("enabled", sleepConfig.enabled);
+    sleepConfig.periodSec = prefs.getUShort("periodSec", sleepConfig.periodSec);
+    sleepConfig.burstEvery = prefs.getUChar("burstEvery", sleepConfig.burstEvery);
+    prefs.end();
+}
+
+/**
+ * @brief Store deep-sleep settings received on command/<id>/sleep.
+ *
+ * Payload example: {"id":1,"enabled":true,"periodSec":300,"burstEvery":6}
+ * Every field is optional.  Enabling takes effect at the next boot (send
+ * command/<id>/reboot); a unit in deep-sleep mode only listens during its
+ * burst wakes and returns to the always-on mode right after a burst that
+ * received "enabled":false.
+ */
+void handleSleepCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("Sleep command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    const uint16_t periodSec = doc["periodSec"] | sleepConfig.periodSec;
+    const uint8_t burstEvery = doc["burstEvery"] | sleepConfig.burstEvery;
+    if (periodSec < 10 || burstEvery == 0) {
+        sendErrorResponse(id, "periodSec must be >= 10 and burstEvery >= 1");
+        return;
+    }
+    sleepConfig.enabled = doc["enabled"] | sleepConfig.enabled;
+    sleepConfig.periodSec = periodSec;
+    sleepConfig.burstEvery = burstEvery;
+
+    prefs.begin("sleep", false);
+    prefs.putBool("enabled", sleepConfig.enabled);
+    prefs.putUShort("periodSec", sleepConfig.periodSec);
+    prefs.putUChar("burstEvery", sleepConfig.burstEvery);
+    prefs.end();
+
+    Serial.printf("Deep sleep %s, wake every %u s, connect every %u wakes\n",
+                  sleepConfig.enabled ? "on" : "off", (unsigned)sleepConfig.periodSec,
+                  (unsigned)sleepConfig.burstEvery);
+    sendNvsSuccessResponse(id);
+}
+
+/**
+ * @brief Load the QoS 1 in-flight window size from the "mqtt" NVS namespace.
+ */
+void loadMqttConfig() {
+    prefs.begin("mqtt", true);
+    mqttInflight.setWindow(prefs.getUChar("window", mqttInflight.window()));
+    prefs.end();
+}
+
+/**
+ * @brief Apply MQTT settings received on command/<id>/mqtt and store them
+ *        in NVS.
+ *
+ * Payload example:
+ * {"id":1,"window":4}
+ * "window" is the number of QoS 1 messages in flight at once,
+ * 1..MQTT_INFLIGHT_WINDOW; 1 waits for every PUBACK.
+ */
+void handleMqttCommand(const String &payload) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload)) {
+        Serial.println("MQTT command: invalid JSON");
+        return;
+    }
+    int64_t id = doc["id"] | (int64_t)0;
+    const unsigned window = doc["window"] | (unsigned)mqttInflight.window();
+    if (window < 1 || window > MQTT_INFLIGHT_WINDOW) {
+        sendErrorResponse(id, "Invalid window");
+        return;
+    }
+    mqttInflight.setWindow(window);
+
+    prefs.begin("mqtt", false);
+    prefs.putUChar("window", mqttInflight.window());
+    prefs.end();
+
+    Serial.printf("MQTT QoS 1 window %u\n", (unsigned)mqttInflight.window());
+    sendNvsSuccessResponse(id);
+}
+
 /**
  * @brief Throttled progress callback used during OTA updates.
  *        Prints the completion percentage at most once every three seconds to
@@ -358,38 +723,58 @@ void reconnect(String mqttL, String mqttP) {
  
     if (!mqtt.isConnected()) {
         Serial.print("Attempting MQTT connection...");
-        String clientId = "ESP32#" + getChipID();
-
         // Попытка подключения
-        if (mqtt.connect(clientId.c_str(), mqttL.c_str(), mqttP.c_str())) {
+        if (mqtt.connect(deviceIdentity.clientId(), mqttL.c_str(), mqttP.c_str())) {
             Serial.println("MQTT connected");
-            //mqtt.publish("stream/" + getChipID() + "/version", versionf);
-            String topic = "stream/" + getChipID() + "/version";
-            String payload = versionf;
 
-            // Добавляем сообщение в очередь MQTT
-            enqueueMQTTMessage(topic, payload, false, 0);
-            //Serial.printf("Enqueued MQTT version message: Topic: %s, Payload: %s\n", topic.c_str(), payload.c_str());
+            // Добавляем сообщение в очередь MQTT (управляющая полоса)
+            enqueueMQTTMessage(deviceIdentity.topic(Topic::Version), versionf, strlen(versionf),
+                               false, 0, MqttLane::Control);
             
             // Вызов функций из mqttProcess.h
             subscribeTo();
             subscribeToTimeExchange();
 
             // Подписка на команды обновления
-            mqtt.subscribe("command/" + getChipID() + "/upgrade", 1, [](const String &payload, const size_t size) {
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandUpgrade), 1, [](const String &payload, const size_t size) {
                 static String url = payload;  // Сохраняем URL в статической переменной для доступности в задаче
                 buttonTaskDelete();
                 xTaskCreate(otaTask, "OTA Update", 10000, &url, 4, NULL);  // Создаем задачу с высоким приоритетом
             });
+            // Dead-band thresholds pushed from the cloud
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandDeadBand), 1, [](const String &payload, const size_t size) {
+                handleDeadBandCommand(payload);
+            });
+            // Store-and-forward settings
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandOutbox), 1, [](const String &payload, const size_t size) {
+                handleOutboxCommand(payload);
+            });
+            // Telemetry encoding (JSON or CBOR)
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandTelemetry), 1, [](const String &payload, const size_t size) {
+                handleTelemetryCommand(payload);
+            });
+            // Light sleep and awake/asleep reporting
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandPower), 1, [](const String &payload, const size_t size) {
+                handlePowerCommand(payload);
+            });
+            // Deep-sleep sample-and-burst mode
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandSleep), 1, [](const String &payload, const size_t size) {
+                handleSleepCommand(payload);
+            });
+            // QoS 1 in-flight window
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandMqtt), 1, [](const String &payload, const size_t size) {
+                handleMqttCommand(payload);
+            });
             // Подписка на команду /restart
-            mqtt.subscribe("command/" + getChipID() + "/reboot", 1, [](const String &payload, const size_t size) {
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandReboot), 1, [](const String &payload, const size_t size) {
                 Serial.println("Received /restart command. Restarting ESP...");
+                outbox.flush();  // Не терять накопленные в RAM сообщения
                 delay(1000);  // Небольшая задержка для выполнения всех операций
                 ESP.restart();  // Перезагрузка ESP
             });
 
             // Подписка на команду /reset
-            mqtt.subscribe("command/" + getChipID() + "/reset", 1, [](const String &payload, const size_t size) {
+            mqtt.subscribe(deviceIdentity.topic(Topic::CommandReset), 1, [](const String &payload, const size_t size) {
                 Serial.println("Received /reset command. Performing full reset...");
 
                 // Очистка всех пространств NVS через Preferences
@@ -404,6 +789,8 @@ void reconnect(String mqttL, String mqttP) {
                     Serial.printf("Cleared NVS namespace: %s\n", ns);
                 }
 
+                outbox.clear();
+
                 Serial.println("Reset complete. Restarting ESP...");
                 delay(1000);  // Небольшая задержка для завершения операций
                 ESP.restart();  // Перезагрузка после очистки
@@ -4,272 +4,455 @@
  * @file serverDataExchange.h
  * @brief Helper functions for HTTP communication with the cloud backend during
  *        OAuth device flow.  The routines here implement polling for tokens as
- *        well as retrieval of configuration files.  Functions are intentionally
- *        synchronous because they are executed in dedicated FreeRTOS tasks.
+ *        well as retrieval of configuration files.  Requests are queued for
+ *        the HTTP worker task (see HttpQueue.h) and answered through
+ *        callbacks on the network task, so callers never wait for the server.
  */
 
-unsigned long lastRequestTime = 0; // Переменная для хранения времени последнего запроса
-extern WiFiClientSecure secureClient;
+#include "HttpsPool.h"
+#include "HttpQueue.h"
+#include "HttpBodyStream.h"
+
+#ifndef OAUTH_TOKEN_SIZE
+#define OAUTH_TOKEN_SIZE 1536         ///< Access or refresh token incl. '\0'
+#endif
+
+#ifndef OAUTH_DEVICE_CODE_SIZE
+#define OAUTH_DEVICE_CODE_SIZE 256
+#endif
+
+#ifndef OAUTH_USER_CODE_SIZE
+#define OAUTH_USER_CODE_SIZE 16
+#endif
+
+#ifndef SERVER_URL_SIZE
+#define SERVER_URL_SIZE 160           ///< URL in a device code or config response incl. '\0'
+#endif
+
+extern SemaphoreHandle_t httpQueueMutex;
+extern TlsClient httpsClients[HTTPS_POOL_SLOTS];
+extern SemaphoreHandle_t httpsMutex;
+
+uint32_t submitHttp(HttpMethod method, const String& url, const String& body, HttpParser parser,
+                    void* target, HttpCallback callback, void* context);
+
+// Поля ответов, которые используются; остальное отбрасывается фильтром при разборе
+
+/** Token response of the device flow poll and of the refresh. */
+struct TokenResponse {
+    char accessToken[OAUTH_TOKEN_SIZE];
+    char refreshToken[OAUTH_TOKEN_SIZE];
+    int32_t expiresIn;
+};
+
+struct DeviceCodeResponse {
+    char deviceCode[OAUTH_DEVICE_CODE_SIZE];
+    char userCode[OAUTH_USER_CODE_SIZE];
+    char verificationUrl[SERVER_URL_SIZE];
+};
+
+struct ConfigResponse {
+    char authUrl[SERVER_URL_SIZE];
+    char tokenUrl[SERVER_URL_SIZE];
+    char mqttUrl[SERVER_URL_SIZE];
+    char cloudApiUrl[SERVER_URL_SIZE];
+    char configUrl[SERVER_URL_SIZE];
+};
+
+// Poll and refresh share one buffer: httpQueue runs one request per target at a time
+TokenResponse tokenResponse;
+DeviceCodeResponse deviceCodeResponse;
+ConfigResponse configResponse;
 
 /**
- * @brief Perform an HTTPS POST request.
- * @param url           Target URL.
- * @param data          Form encoded body.
- * @param[out] response Response body on success.
- * @param[out] responseCode HTTP status code.
- * @return true on success, false otherwise.
+ * @brief One request over the kept connection to its host (see HttpsPool.h).
+ *        Holds httpsMutex while it exists, so the maintenance pass does not
+ *        close a connection in use.  URLs other than https:// use a
+ *        connection of their own.
  */
-bool sendHttpPost(String url, String data, String &response, int &responseCode) {
-    // Проверка наличия URL
-    if (url.length() == 0) {
-        Serial.println("Error: URL is empty");
-        return false;
+class PooledRequest {
+public:
+    explicit PooledRequest(const String& url) : lock_(httpsMutex), lease_{-1, false}, reused_(false) {
+        char host[HTTPS_HOST_SIZE];
+        uint16_t port;
+        if (!url.startsWith("https://") ||
+            !HttpsPool::parseUrl(url.c_str(), host, sizeof(host), port)) {
+            http_.begin(url);
+            return;
+        }
+        lease_ = httpsPool.acquire(host, port, millis());
+        TlsClient& client = httpsClients[lease_.slot];
+        if (lease_.close) {
+            client.stop();
+        }
+        client.setCACert(cert_bundle);
+        reused_ = client.connected();
+        http_.setReuse(true);
+        http_.begin(client, url);
     }
 
-    // Проверка подключения к Wi-Fi
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("Error: WiFi not connected");
-        return false;
+    ~PooledRequest() {
+        http_.end();  // Leaves the connection open if the server allows it
+        if (lease_.slot >= 0) {
+            httpsPool.release(lease_.slot, millis(), reused_, httpsClients[lease_.slot].connected());
+        }
     }
 
-    // Проверка частоты запросов
-    unsigned long currentTime = millis();
-    if (currentTime - lastRequestTime < 3000) { // 3000 миллисекунд = 3 секунды
-    //    Serial.println("Error: Requests are too frequent");
-        return false;
+    HTTPClient& http() { return http_; }
+
+    /** Close the connection after this request, e.g. when the body was not read to its end. */
+    void discardConnection() { http_.setReuse(false); }
+
+    /**
+     * @brief The request failed on a kept connection before the server can
+     *        have seen it: most likely closed by the server meanwhile.  Worth
+     *        one more try on a new connection.
+     */
+    bool retryable(int code) {
+        if (lease_.slot < 0 || !reused_ ||
+            (code != HTTPC_ERROR_SEND_HEADER_FAILED && code != HTTPC_ERROR_SEND_PAYLOAD_FAILED &&
+             code != HTTPC_ERROR_NOT_CONNECTED)) {
+            return false;
+        }
+        httpsPool.countRetry();
+        return true;
     }
-    HTTPClient http;
 
+    PooledRequest(const PooledRequest&) = delete;
+    PooledRequest& operator=(const PooledRequest&) = delete;
 
-    http.begin(secureClient, url);
-    http.addHeader("Content-Type", "application/x-www-form-urlencoded");
+private:
+    MutexLock lock_;
+    HttpsLease lease_;
+    bool reused_;
+    HTTPClient http_;
+};
 
-    int httpResponseCode = http.POST(data);
-    bool returnF;
-    if (httpResponseCode > 0) {
-        response = http.getString();
-        responseCode = httpResponseCode;
-        returnF = true;
-    } else {
-        returnF = false;
-    }
-
-    Serial.println("STEP1, URL: " + String(url) + " DATA: " + String(data) + " RESPONSE: " + String(response) + " RESPONSECODE: " + String(responseCode));
-    http.end();
-    
-    // Обновление времени последнего запроса при успешной отправке
-    if (returnF) {
-        lastRequestTime = currentTime;
+/**
+ * @brief Close the pooled connections idle for HTTPS_IDLE_MS.  Called from
+ *        the network task's maintenance pass; skipped while another task is
+ *        in the middle of a request.
+ */
+void closeIdleHttps() {
+    if (xSemaphoreTake(httpsMutex, 0) != pdTRUE) {
+        return;
     }
-    
-    return returnF;
+    int8_t slot;
+    while ((slot = httpsPool.nextIdle(millis())) >= 0) {
+        httpsClients[slot].stop();
     }
-
-
-unsigned long lastDeviceCodeExchangeTime = 0; // Переменная для хранения времени последнего вызова функции
+    xSemaphoreGive(httpsMutex);
+}
 
 /**
- * @brief Request a temporary device and user code from the authorization
- *        server.  This is the first step of the OAuth device flow.
- * @param authUrl         Endpoint for the device code request.
- * @param[out] deviceCode Received device code.
- * @param[out] userCode   Code that the user must enter on the verification page.
- * @param[out] verificationUrl Full URL where the user should enter the code.
+ * @brief Close every pooled connection, e.g. before the Wi-Fi link is reset.
+ *        Skipped while the HTTP worker is in the middle of a request; the
+ *        request fails with the link and its connection is not kept.
  */
-void performDeviceCodeExchange(String authUrl, String &deviceCode, String &userCode, String &verificationUrl) {
-    unsigned long currentTime = millis();
-    if (currentTime - lastDeviceCodeExchangeTime < 3000) { // 3000 миллисекунд = 3 секунды
-      //  Serial.println("Error: Device code exchange requests are too frequent");
+void closeAllHttps() {
+    if (xSemaphoreTake(httpsMutex, 0) != pdTRUE) {
         return;
     }
+    for (TlsClient& client : httpsClients) {
+        client.stop();
+    }
+    httpsPool.closeAll();
+    xSemaphoreGive(httpsMutex);
+}
 
-    String responce;
-    int responceCode;
-    if (sendHttpPost(authUrl, "client_id=controller01&scope=mqtt-streaming", responce, responceCode)) {
-        if (responceCode == 200) {
-            JsonDocument jsonDoc; // Добавляем размер буфера для JSON-документа
-            Serial.println(responce);
-            DeserializationError error = deserializeJson(jsonDoc, responce);
-
-            if (error) {
-                Serial.println("Error parsing JSON response");
-            } else {
-                deviceCode = jsonDoc["device_code"].as<String>();
-                userCode = jsonDoc["user_code"].as<String>();
-                verificationUrl = jsonDoc["verification_uri_complete"].as<String>();
-            }
-        }
-        Serial.println("STEP2, AUTHURL: " + String(authUrl) + " DEVICECODE: " + String(deviceCode) + " USERCODE: " + String(userCode) + " VERURL: " + String(verificationUrl));
-    } else {
-        Serial.println("Error on HTTP request!!!");
+/** Copy string @p value into @p buffer; false if it is missing or does not fit. */
+bool copyJsonString(JsonVariantConst value, char* buffer, size_t size) {
+    const char* text = value.as<const char*>();
+    const size_t length = text ? strlen(text) : 0;
+    if (!text || length >= size) {
+        buffer[0] = '\0';
+        return false;
     }
-    
-    // Обновление времени последнего вызова функции
-    lastDeviceCodeExchangeTime = currentTime;
+    memcpy(buffer, text, length + 1);
+    return true;
 }
 
 /**
- * @brief Poll the token endpoint until the user authorises the device and an
- *        access token becomes available.
- * @param tokenUrl      Token endpoint URL.
- * @param[out] accessToken  Returned access token.
- * @param[out] refreshToken Returned refresh token.
- * @param deviceCode    Device code obtained earlier.
+ * @brief Deserialize @p body, keeping only the members set in @p filter.
+ *        The document holds just those strings, not the whole response (the
+ *        id_token and scope alone are more than 1 KB).
  */
-void performTokenExchange(String tokenUrl, String &accessToken, String &refreshToken, String deviceCode)
-{
-    static unsigned long lastInvocationTime = 0;
-    unsigned long currentMillis = millis();
-
-    // Проверка, прошло ли 3 секунды с последнего вызова
-    if (currentMillis - lastInvocationTime < 3000) {
-        //Serial.println("Function called too frequently. Skipping execution.");
-        return;
+bool deserializeFiltered(Stream& body, JsonDocument& doc, const JsonDocument& filter) {
+    const DeserializationError error =
+        deserializeJson(doc, body, DeserializationOption::Filter(filter));
+    if (error) {
+        Serial.printf("Error parsing JSON response: %s\n", error.c_str());
+        return false;
     }
+    return true;
+}
 
-    lastInvocationTime = currentMillis;
-
-    int httpResponseCode;
-    String responce;
-    if (sendHttpPost(tokenUrl, "client_id=controller01&grant_type=urn:ietf:params:oauth:grant-type:device_code"
-                               "&scopes=mqtt-streaming"
-                               "&device_code=" +
-                                   deviceCode,
-                     responce, httpResponseCode))
-    {
+/**
+ * @brief HttpParser for token responses; true if an access token came.
+ *        The refresh token is optional: an empty refreshToken means the
+ *        server did not rotate it and the stored one stays valid.  A token
+ *        longer than OAUTH_TOKEN_SIZE fails the response rather than being
+ *        lost silently.
+ */
+bool parseTokenResponse(Stream& body, void* target) {
+    TokenResponse& fields = *static_cast<TokenResponse*>(target);
+    JsonDocument filter;
+    filter["access_token"] = true;
+    filter["refresh_token"] = true;
+    filter["expires_in"] = true;
+    JsonDocument doc;
+    if (!deserializeFiltered(body, doc, filter)) {
+        return false;
+    }
+    fields.expiresIn = doc["expires_in"] | 0;
+    if (!copyJsonString(doc["access_token"], fields.accessToken, sizeof(fields.accessToken))) {
+        const char* token = doc["access_token"].as<const char*>();
+        Serial.printf("Token response: access_token %s\n",
+                      token ? "longer than OAUTH_TOKEN_SIZE" : "missing");
+        return false;
+    }
+    if (!copyJsonString(doc["refresh_token"], fields.refreshToken, sizeof(fields.refreshToken)) &&
+        doc["refresh_token"].is<const char*>()) {
+        Serial.println("Token response: refresh_token longer than OAUTH_TOKEN_SIZE");
+        return false;
+    }
+    return true;
+}
 
-        Serial.println("Response: " + responce);
+/** HttpParser for the device code response. */
+bool parseDeviceCodeResponse(Stream& body, void* target) {
+    DeviceCodeResponse& fields = *static_cast<DeviceCodeResponse*>(target);
+    JsonDocument filter;
+    filter["device_code"] = true;
+    filter["user_code"] = true;
+    filter["verification_uri_complete"] = true;
+    JsonDocument doc;
+    if (!deserializeFiltered(body, doc, filter)) {
+        return false;
+    }
+    return copyJsonString(doc["device_code"], fields.deviceCode, sizeof(fields.deviceCode)) &
+           copyJsonString(doc["user_code"], fields.userCode, sizeof(fields.userCode)) &
+           copyJsonString(doc["verification_uri_complete"], fields.verificationUrl,
+                          sizeof(fields.verificationUrl));
+}
 
-        if (httpResponseCode == 200)
-        {
-            JsonDocument jsonDoc;
-            DeserializationError error = deserializeJson(jsonDoc, responce);
+/** HttpParser for the config file; all five URLs must be there. */
+bool parseConfigResponse(Stream& body, void* target) {
+    ConfigResponse& fields = *static_cast<ConfigResponse*>(target);
+    JsonDocument filter;
+    filter["authUrl"] = true;
+    filter["tokenUrl"] = true;
+    filter["mqttUrl"] = true;
+    filter["cloudApiUrl"] = true;
+    filter["configUrl"] = true;
+    JsonDocument doc;
+    if (!deserializeFiltered(body, doc, filter)) {
+        return false;
+    }
+    return copyJsonString(doc["authUrl"], fields.authUrl, sizeof(fields.authUrl)) &
+           copyJsonString(doc["tokenUrl"], fields.tokenUrl, sizeof(fields.tokenUrl)) &
+           copyJsonString(doc["mqttUrl"], fields.mqttUrl, sizeof(fields.mqttUrl)) &
+           copyJsonString(doc["cloudApiUrl"], fields.cloudApiUrl, sizeof(fields.cloudApiUrl)) &
+           copyJsonString(doc["configUrl"], fields.configUrl, sizeof(fields.configUrl));
+}
 
-            if (error)
-            {
-                Serial.println("Error parsing JSON response");
+/**
+ * @brief Perform one queued request over the pooled connection of its host.
+ *        Runs on the HTTP worker task only (see HttpQueue.h).  A 200
+ *        response of a job with a parser is read straight from the
+ *        connection into the job's target; other responses are returned as
+ *        text (error bodies are short).
+ * @param job           Request taken from httpQueue.
+ * @param[out] response Response body if the server answered and no parser read it.
+ * @param[out] parsed   The parser filled the target.
+ * @return HTTP status code, or a negative HTTPClient error.
+ */
+int performHttpRequest(const HttpJob& job, String &response, bool &parsed) {
+    static const char* headerKeys[] = {"Transfer-Encoding"};
+    int responseCode = 0;
+    parsed = false;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // Соединение с хостом сохраняется между запросами (keep-alive)
+        PooledRequest request(job.url);
+        HTTPClient& http = request.http();
+        http.collectHeaders(headerKeys, 1);
+        if (job.method == HttpMethod::Post) {
+            http.addHeader("Content-Type", "application/x-www-form-urlencoded");
+            responseCode = http.POST(job.body);
+        } else {
+            responseCode = http.GET();
+        }
+        if (responseCode == HTTP_CODE_OK && job.parser) {
+            // Тело разбирается прямо из соединения, без копии в String
+            HttpBodyStream body(http.getStream(), http.getSize(),
+                                http.header("Transfer-Encoding").equalsIgnoreCase("chunked"));
+            parsed = job.parser(body, job.target);
+            if (!body.finish()) {
+                request.discardConnection();
             }
-            else
-            {
-                accessToken = jsonDoc["access_token"].as<String>();
-                refreshToken = jsonDoc["refresh_token"].as<String>();
-                expiresIn = jsonDoc["expires_in"].as<int>();
-
-                prefs.begin("nvs", false);
+        } else if (responseCode > 0) {
+            response = http.getString();
+        } else if (attempt == 0 && request.retryable(responseCode)) {
+            continue;
+        }
+        break;
+    }
 
-                // Проверяем, изменился ли refreshToken
-                String existingRefreshToken = prefs.getString("refreshToken", "");
-                if (refreshToken != existingRefreshToken) {
-                    prefs.putString("refreshToken", refreshToken);
-                }
+    Serial.println("STEP1, URL: " + job.url + " DATA: " + job.body + " RESPONSE: " +
+                   (parsed ? String("parsed") : response) + " RESPONSECODE: " + String(responseCode));
+    return responseCode;
+}
 
-                prefs.putString("accessToken", accessToken);
-                prefs.putInt("expiresIn", expiresIn);
+/** Device code response: store the codes the user needs for pairing. */
+void onDeviceCode(const HttpResult& result, void* context) {
+    if (result.parsed) {
+        deviceCode = deviceCodeResponse.deviceCode;
+        userCode = deviceCodeResponse.userCode;
+        verificationUrl = deviceCodeResponse.verificationUrl;
+    } else if (result.code <= 0) {
+        Serial.println("Error on HTTP request!!!");
+    }
+    Serial.println("STEP2, AUTHURL: " + String(authUrl) + " DEVICECODE: " + String(deviceCode) + " USERCODE: " + String(userCode) + " VERURL: " + String(verificationUrl));
+}
 
-                Serial.println("TOKENURL: " + String(tokenUrl) + " ACCESSTOKEN: " + String(accessToken) + 
-                            " REFRESHTOKEN: " + String(refreshToken) + " DEVICECOD!: " + String(deviceCode));
-                prefs.end();                    
+/**
+ * @brief Request a temporary device and user code from the authorization
+ *        server.  This is the first step of the OAuth device flow.  Returns
+ *        at once; onDeviceCode() stores deviceCode, userCode and
+ *        verificationUrl when the answer arrives.
+ * @param authUrl         Endpoint for the device code request.
+ */
+void performDeviceCodeExchange(const String& authUrl) {
+    submitHttp(HttpMethod::Post, authUrl, "client_id=controller01&scope=mqtt-streaming",
+               parseDeviceCodeResponse, &deviceCodeResponse, onDeviceCode, nullptr);
+}
 
+/** Token poll response: store the tokens once the user has authorised the device. */
+void onDeviceToken(const HttpResult& result, void* context) {
+    // Пока пользователь не подтвердил устройство, сервер отвечает 400 (authorization_pending)
+    if (result.parsed)
+    {
+        accessToken = tokenResponse.accessToken;
+        expiresIn = tokenResponse.expiresIn;
+
+        prefs.begin("nvs", false);
+
+        // Пустой refresh_token не затирает сохранённый
+        if (tokenResponse.refreshToken[0] != '\0') {
+            refreshToken = tokenResponse.refreshToken;
+            // Проверяем, изменился ли refreshToken
+            String existingRefreshToken = prefs.getString("refreshToken", "");
+            if (refreshToken != existingRefreshToken) {
+                prefs.putString("refreshToken", refreshToken);
             }
         }
+
+        prefs.putString("accessToken", accessToken);
+        prefs.putInt("expiresIn", expiresIn);
+
+        Serial.println("TOKENURL: " + String(tokenUrl) + " ACCESSTOKEN: " + String(accessToken) + 
+                    " REFRESHTOKEN: " + String(refreshToken) + " DEVICECOD!: " + String(deviceCode));
+        prefs.end();
     }
 }
 
 /**
- * @brief Refresh an expiring access token using a refresh token.
+ * @brief Poll the token endpoint until the user authorises the device and an
+ *        access token becomes available.  Safe to call on every maintenance
+ *        pass: a poll already queued or running is not repeated, and polls
+ *        start at least HTTP_MIN_INTERVAL_MS apart.  onDeviceToken() stores
+ *        the tokens.
+ * @param tokenUrl      Token endpoint URL.
+ * @param deviceCode    Device code obtained earlier.
  */
-void performTokenUpdate(String tokenUrl, String &accessToken, String &refreshtoken)
+void performTokenExchange(const String& tokenUrl, const String& deviceCode)
 {
-    //mqttUrl = prefs.getString("mqttUrl", "");("Before HTTP request");
-    int httpResponseCode;
-    String responce;
-    if (sendHttpPost(tokenUrl, "client_id=controller01&grant_type=refresh_token&refresh_token=" + refreshtoken,
-                     responce, httpResponseCode))
-    {
-
-        Serial.println("Response: " + responce);
-        if (httpResponseCode > 0)
-        {
-            
-            Serial.println("HTTP Response code: " + String(httpResponseCode));
-            Serial.println("Response: " + responce);
-            if (httpResponseCode == 200)
-            {
-                // Разбор и обработка JSON-ответа
-                JsonDocument jsonDoc;
-                DeserializationError error = deserializeJson(jsonDoc, responce);
-
-                if (error)
-                {
-                    Serial.println("Error parsing JSON response");
-                }
-                else
-                {
-                    // Извлечение значений из JSON
-                    const char *localaccessToken = jsonDoc["access_token"];
-                    const char *localrefreshToken = jsonDoc["refresh_token"];
-                    int expiresIn = jsonDoc["expires_in"];
-
-                    // Вывод полученных значений
-                    Serial.println("Access Token: " + String(localaccessToken));
-                    accessToken = String(localaccessToken);
-                    Serial.println("Refresh Token: " + String(localrefreshToken));
-                    refreshtoken = String(localrefreshToken);
-                    Serial.println("Expires In: " + String(expiresIn));
-
-                    prefs.begin("nvs", false);
-                    // Чтение текущего значения expires_in из NVS
-                    int currentExpiresIn = prefs.getInt("expiresIn", 0);
-
-                    // Сравнение и обновление значений в NVS
-                    if (currentExpiresIn != expiresIn)
-                    {
-                        Serial.println("Updating NVS with new expires_in value");
-                        prefs.putInt("expiresIn", expiresIn);
-                    }
-
-                    prefs.putString("accessToken", accessToken);
-                    prefs.putString("refreshToken", refreshtoken);
-                    prefs.end();
-
-                }
-            }
-        }
-    }
+    submitHttp(HttpMethod::Post, tokenUrl,
+               "client_id=controller01&grant_type=urn:ietf:params:oauth:grant-type:device_code"
+               "&scopes=mqtt-streaming"
+               "&device_code=" +
+                   deviceCode,
+               parseTokenResponse, &tokenResponse, onDeviceToken, nullptr);
 }
 
+/**
+ * @brief Queue the refresh of an expiring access token.
+ * @return false if the queue is full.
+ */
+bool performTokenUpdate(const String& tokenUrl, const String& refreshtoken, HttpCallback callback,
+                        void* context)
+{
+    return submitHttp(HttpMethod::Post, tokenUrl,
+                      "client_id=controller01&grant_type=refresh_token&refresh_token=" + refreshtoken,
+                      parseTokenResponse, &tokenResponse, callback, context) != 0;
+}
 
 /**
- * @brief Download the configuration file from the cloud and update locally
- *        stored URLs only when they changed.
+ * @brief Take the tokens from a refresh response and store them.  A
+ *        response without a refresh token keeps @p refreshtoken.
+ * @return true if a new access token was received and stored.
  */
-void fetchAndStoreConfig(const String& inputConfigUrl) {
-    // Обновляем глобальную переменную configUrl
-    configUrl = inputConfigUrl;
+bool parseTokenUpdate(const HttpResult& result, String &accessToken, String &refreshtoken)
+{
+    if (result.code > 0)
+    {
+        
+        Serial.println("HTTP Response code: " + String(result.code));
+        // Ответ уже разобран рабочей задачей HTTP в tokenResponse
+        if (result.parsed)
+        {
+            const char *localaccessToken = tokenResponse.accessToken;
+            const char *localrefreshToken = tokenResponse.refreshToken;
+            int expiresIn = tokenResponse.expiresIn;
+
+            // Вывод полученных значений
+            Serial.println("Access Token: " + String(localaccessToken));
+            accessToken = String(localaccessToken);
+            // Сервер может не менять refresh token: тогда остаётся прежний
+            if (localrefreshToken[0] != '\0') {
+                Serial.println("Refresh Token: " + String(localrefreshToken));
+                refreshtoken = String(localrefreshToken);
+            }
+            Serial.println("Expires In: " + String(expiresIn));
 
-    // Создаем объект HTTPClient
-    HTTPClient http;
-    http.begin(configUrl);  // Открываем URL
+            Preferences store;
+            store.begin("nvs", false);
+            // Чтение текущего значения expires_in из NVS
+            int currentExpiresIn = store.getInt("expiresIn", 0);
 
-    int httpCode = http.GET();  // Выполняем GET-запрос
+            // Сравнение и обновление значений в NVS
+            if (currentExpiresIn != expiresIn)
+            {
+                Serial.println("Updating NVS with new expires_in value");
+                store.putInt("expiresIn", expiresIn);
+            }
 
-    if (httpCode > 0) { // Проверяем код ответа
-        String payload = http.getString();  // Получаем тело ответа
+            store.putString("accessToken", accessToken);
+            if (localrefreshToken[0] != '\0') {
+                store.putString("refreshToken", refreshtoken);
+            }
+            store.end();
+            return true;
+        }
+    }
+    return false;
+}
 
-        // Создаем объект для парсинга JSON
-        JsonDocument jsonDocument;
-        DeserializationError error = deserializeJson(jsonDocument, payload);
 
-        if (!error) {  // Проверяем на ошибки парсинга
+/** Config file response: update locally stored URLs only when they changed. */
+void onConfig(const HttpResult& result, void* context) {
+    const int httpCode = result.code;
+    if (httpCode > 0) { // Проверяем код ответа
+        if (result.parsed) {  // Проверяем на ошибки парсинга
         
             prefs.begin("nvs", false);
 
-            // Получаем новые значения из JSON
-            String newAuthUrl = jsonDocument["authUrl"].as<String>();
-            String newTokenUrl = jsonDocument["tokenUrl"].as<String>();
-            String newMqttUrl = jsonDocument["mqttUrl"].as<String>();
-            String newCloudApiUrl = jsonDocument["cloudApiUrl"].as<String>();
-            String newConfigUrl = jsonDocument["configUrl"].as<String>();
+            // Новые значения, разобранные рабочей задачей HTTP
+            const char* newAuthUrl = configResponse.authUrl;
+            const char* newTokenUrl = configResponse.tokenUrl;
+            const char* newMqttUrl = configResponse.mqttUrl;
+            const char* newCloudApiUrl = configResponse.cloudApiUrl;
+            const char* newConfigUrl = configResponse.configUrl;
 
             // Флаг для отслеживания изменений
             bool updated = false;
@@ -317,7 +500,15 @@ void fetchAndStoreConfig(const String& inputConfigUrl) {
     } else {
         Serial.printf("HTTP GET failed, code: %d\n", httpCode);
     }
-
-    http.end();  // Закрываем HTTP соединение
 }
 
+/**
+ * @brief Download the configuration file from the cloud; onConfig() applies
+ *        it when the answer arrives.
+ */
+void fetchAndStoreConfig(const String& inputConfigUrl) {
+    // Обновляем глобальную переменную configUrl
+    configUrl = inputConfigUrl;
+    submitHttp(HttpMethod::Get, configUrl, String(), parseConfigResponse, &configResponse, onConfig,
+               nullptr);
+}
@@ -6,6 +6,8 @@
 #include <Preferences.h>
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
+#include "TlsClient.h"
+#include "HttpsPool.h"
 #include <ArduinoJson.h>
 #include "BLEWiFiConfig.h"
 #include <Wire.h>
@@ -38,13 +40,17 @@ extern Preferences prefs;        ///< Generic application preferences
 extern Preferences pref;         ///< Additional namespace
 extern Preferences preferences;  ///< Wi‑Fi credentials storage
 
-extern WiFiClientSecure secureClient; ///< TLS client configured with CA bundle
+extern TlsClient httpsClients[HTTPS_POOL_SLOTS];  ///< Kept HTTPS connections, one per HttpsPool slot
 
 extern void checkMemory(const char* stage);
 
 // Synchronisation primitives shared between modules
 extern SemaphoreHandle_t mqttMutex;
 extern SemaphoreHandle_t dataQueueMutex;
+extern SemaphoreHandle_t deadBandMutex;
+extern SemaphoreHandle_t tlsMutex;      ///< Guards tlsSessions
+extern SemaphoreHandle_t httpsMutex;    ///< Guards httpsPool and httpsClients
+extern SemaphoreHandle_t httpQueueMutex; ///< Guards httpQueue
 
 #endif // SETTINGS_H
 
@@ -3,6 +3,70 @@
 #define SETUPTASK_H
 #include "globalConfig.h"
 #include "MutexLock.h"
+#include "SensorScheduler.h"
+#include "Pipeline.h"
+#include "PowerMonitor.h"
+#include "SleepQueue.h"
+#include "MqttReconnect.h"
+#include "TlsSession.h"
+#include "esp_pm.h"
+#include "esp_wifi.h"
+#include "esp_sleep.h"
+#include <LittleFS.h>
+
+#ifndef PIPELINE_TASKS
+#define PIPELINE_TASKS 1                    ///< 0: everything runs from loop() as before
+#endif
+
+#ifndef PIPELINE_ACQUISITION_STACK_SIZE
+#define PIPELINE_ACQUISITION_STACK_SIZE 4096
+#endif
+
+#ifndef PIPELINE_ACQUISITION_PRIORITY
+#define PIPELINE_ACQUISITION_PRIORITY 3     ///< Above the loop task and the network stage
+#endif
+
+#ifndef PIPELINE_NETWORK_STACK_SIZE
+#define PIPELINE_NETWORK_STACK_SIZE 8192    ///< TLS and HTTP, as the Arduino loop task
+#endif
+
+#ifndef PIPELINE_NETWORK_PRIORITY
+#define PIPELINE_NETWORK_PRIORITY 2
+#endif
+
+#ifndef PIPELINE_NETWORK_POLL_MS
+#define PIPELINE_NETWORK_POLL_MS 100        ///< Longest wait for an event before the socket is polled
+#endif
+
+#ifndef PIPELINE_MAINTENANCE_MS
+#define PIPELINE_MAINTENANCE_MS 1000        ///< Period of connection and token upkeep
+#endif
+
+#ifndef HTTP_WORKER_STACK_SIZE
+#define HTTP_WORKER_STACK_SIZE 8192         ///< TLS handshake and HTTPClient
+#endif
+
+#ifndef HTTP_WORKER_PRIORITY
+#define HTTP_WORKER_PRIORITY 1              ///< Below the network stage
+#endif
+
+#ifndef HTTP_WORKER_POLL_MS
+#define HTTP_WORKER_POLL_MS 1000            ///< Queue check while Wi-Fi is down
+#endif
+
+#ifndef PIPELINE_MAX_SLEEP_MS
+#define PIPELINE_MAX_SLEEP_MS 5000          ///< Longest acquisition sleep, well inside the watchdog
+#endif
+
+// Биты pipelineEvents
+#define PIPELINE_EVENT_TIMER        (1 << 0)  ///< Maintenance timer fired
+#define PIPELINE_EVENT_CONNECTIVITY (1 << 1)  ///< Wi-Fi link came up or went down
+#define PIPELINE_EVENT_QUEUE        (1 << 2)  ///< A message was queued for publishing
+#define PIPELINE_EVENT_SCHEDULE     (1 << 3)  ///< Sensor schedule changed (loop() mode only)
+#define PIPELINE_EVENT_HTTP         (1 << 4)  ///< An HTTP request finished, callbacks due
+#define PIPELINE_EVENTS_ALL                                                        \
+    (PIPELINE_EVENT_TIMER | PIPELINE_EVENT_CONNECTIVITY | PIPELINE_EVENT_QUEUE | \
+     PIPELINE_EVENT_SCHEDULE | PIPELINE_EVENT_HTTP)
 
 /**
  * @file setupTasks.h
@@ -13,16 +77,27 @@
  */
 
 //=========== Объявление функций ===========
-void sensorsPolling();
-void ticker10secCallback();
-void oneMinPolling();
-void ticker1minCallback();
-extern void processMQTTQueue();
+void registerSensorSources();
+void pollWifiRssi(void* context);
+void flushTelemetry(void* context);
+void oneMinPolling(void* context);
+void httpWorkerTask(void* parameter);
+
+SensorSourceId telemetrySource = SENSOR_SOURCE_INVALID;  ///< Skipped by deep-sleep wakes
+
+/** Token refresh handed to the HTTP worker; the globals are updated by the network task. */
+struct TokenRefreshJob {
+    String accessToken;
+    String refreshToken;
+    bool ok;
+    volatile bool running;
+    volatile bool done;
+};
+
+TokenRefreshJob tokenRefreshJob;
 
 volatile unsigned long lastLoopTime = 0;
 const unsigned long loopTimeout = 300000; 
-volatile bool dataReadyForSend = false;
-volatile bool oneMinCallback = false;
 
 
 // Задача мониторинга Loop
@@ -77,12 +152,27 @@ void initializePreferences() {
     Serial.println(refreshToken);
     expiresIn = prefs.getInt("expiresIn");
     prefs.end();
+    loadDeadBandRules();
+    loadOutboxConfig();
+    loadTelemetryConfig();
+    loadPowerConfig();
+    loadSleepConfig();
    
    Serial.println(">>>>>>>>>>>>> VERSION FIRMWARE: " + String(versionf));
-   Serial.println(">>>>>>>>>>>>> DeviceID: " + getChipID());
+   Serial.printf(">>>>>>>>>>>>> DeviceID: %s\n", deviceIdentity.chipId());
    Serial.println(configUrl);
 }
 
+/**
+ * @brief Mount LittleFS and open the telemetry outbox on it.
+ */
+void initializeStorage() {
+    initFileSystem();
+    if (!outbox.begin(LittleFS)) {
+        Serial.println("Outbox unavailable, telemetry is not stored while offline");
+    }
+}
+
 void initializeWiFi() {
     WiFi.mode(WIFI_STA);  // Режим вайфай станции
     WiFi.setAutoReconnect(true);
@@ -91,37 +181,250 @@ void initializeWiFi() {
     bool credentialsLoaded = bleWiFiConfig.loadWiFiCredentials(ssid, password);
     bleWiFiConfig.connectToWiFi(ssid, password);
     vTaskDelay(1000 / portTICK_PERIOD_MS);
+    applyPowerConfig();
+}
+
+/**
+ * @brief Switch between full performance and the duty-cycled light-sleep mode
+ *        (see PowerMonitor.h).
+ *
+ * Automatic light sleep needs CONFIG_PM_ENABLE and
+ * CONFIG_FREERTOS_USE_TICKLESS_IDLE in the sdkconfig; without tickless idle
+ * only frequency scaling is enabled.  The radio uses modem sleep in both
+ * modes: WIFI_PS_MIN_MODEM wakes for every DTIM beacon, WIFI_PS_MAX_MODEM
+ * every listenInterval beacons (from the next association on).
+ */
+void applyPowerConfig() {
+    PowerMode mode = PowerMode::Performance;
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = 240;
+    pm.min_freq_mhz = powerConfig.lightSleep ? 80 : 240;
+    pm.light_sleep_enable = powerConfig.lightSleep;
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err == ESP_ERR_NOT_SUPPORTED && powerConfig.lightSleep) {
+        Serial.println("Power: light sleep needs CONFIG_FREERTOS_USE_TICKLESS_IDLE, frequency scaling only");
+        pm.light_sleep_enable = false;
+        err = esp_pm_configure(&pm);
+        mode = PowerMode::FrequencyScaling;
+    } else if (powerConfig.lightSleep) {
+        mode = PowerMode::LightSleep;
+    }
+    if (err != ESP_OK) {
+        Serial.printf("Power: esp_pm_configure failed: %s\n", esp_err_to_name(err));
+        mode = PowerMode::Performance;
+    }
+#else
+    if (powerConfig.lightSleep) {
+        Serial.println("Power: CONFIG_PM_ENABLE is off, staying at full clock");
+    }
+#endif
+    powerMonitor.setMode(mode);
+
+    if (powerConfig.listenInterval > 0) {
+        wifi_config_t config;
+        if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+            config.sta.listen_interval = powerConfig.listenInterval;
+            esp_wifi_set_config(WIFI_IF_STA, &config);
+        }
+        WiFi.setSleep(WIFI_PS_MAX_MODEM);
+    } else {
+        WiFi.setSleep(WIFI_PS_MIN_MODEM);
+    }
+
+    // The LED fades run on a timer that would keep the CPU awake
+    if (updateLEDsHandle) {
+        if (mode == PowerMode::LightSleep) {
+            vTaskSuspend(updateLEDsHandle);
+            smoothLED1.setState(_OFF);
+            smoothLED2.setState(_OFF);
+        } else {
+            vTaskResume(updateLEDsHandle);
+        }
+    }
+}
+//=========== События ===========
+
+EventGroupHandle_t pipelineEvents;  ///< What the network side (or loop()) waits for
+TimerHandle_t maintenanceTimer;
+TaskHandle_t acquisitionTaskHandle = NULL;
+TaskHandle_t networkTaskHandle = NULL;
+
+void onMaintenanceTimer(TimerHandle_t timer) {
+    xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_TIMER);
+}
+
+void onWifiEvent(arduino_event_id_t event) {
+    xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_CONNECTIVITY);
+}
+
+/** MqttLanes notification: a message is waiting. */
+void onMessageQueued(void* context) {
+    xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_QUEUE);
+}
+
+/** SensorScheduler notification: the next poll may be earlier than planned. */
+void onScheduleChanged(void* context) {
+    if (acquisitionTaskHandle) {
+        xTaskNotifyGive(acquisitionTaskHandle);
+    } else {
+        xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_SCHEDULE);
+    }
+}
+
+/**
+ * @brief Create the event group and connect its sources: the maintenance
+ *        timer, Wi-Fi link changes, queued messages and schedule changes.
+ *        Tasks block on these instead of polling flags.
+ */
+void initializeEvents() {
+    pipelineEvents = xEventGroupCreate();
+    // The first pass checks the connection right away
+    xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_TIMER);
+    maintenanceTimer = xTimerCreate("maintenance", pdMS_TO_TICKS(PIPELINE_MAINTENANCE_MS), pdTRUE,
+                                    NULL, onMaintenanceTimer);
+    xTimerStart(maintenanceTimer, 0);
+    WiFi.onEvent(onWifiEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent(onWifiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    mqttLanes.setNotify(onMessageQueued, NULL);
+    sensorScheduler.setWakeup(onScheduleChanged, NULL);
+}
+
+//=========== HTTP-запросы ===========
+
+TaskHandle_t httpWorkerHandle = NULL;
+
+/**
+ * @brief Queue an HTTP request for the worker (see HttpQueue.h).  Returns at
+ *        once; @p parser fills @p target on the worker, @p callback runs on
+ *        the network task when the answer is in.
+ * @return Request ID, 0 if the queue is full.
+ */
+uint32_t submitHttp(HttpMethod method, const String& url, const String& body, HttpParser parser,
+                    void* target, HttpCallback callback, void* context) {
+    uint32_t id;
+    {
+        MutexLock lock(httpQueueMutex);
+        id = httpQueue.submit(method, url, body, parser, target, callback, context, millis());
+    }
+    if (id == 0) {
+        Serial.println("HTTP queue full: " + url);
+    } else if (httpWorkerHandle) {
+        xTaskNotifyGive(httpWorkerHandle);
+    }
+    return id;
+}
+
+/**
+ * @brief HTTP worker: performs the queued requests one at a time over the
+ *        pooled connections and wakes the network task for the callbacks.
+ *        The only task that waits for an HTTPS server.
+ */
+void httpWorkerTask(void* parameter) {
+    HttpJob job;
+    for (;;) {
+        const bool connected = WiFi.status() == WL_CONNECTED;
+        bool ready = false;
+        uint32_t wait;
+        {
+            MutexLock lock(httpQueueMutex);
+            if (httpQueue.expire(millis()) > 0) {
+                xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_HTTP);
+            }
+            if (connected) {
+                ready = httpQueue.next(millis(), job);
+            }
+            wait = httpQueue.msUntilNext(millis());
+        }
+        if (ready) {
+            String response;
+            bool parsed;
+            const int code = performHttpRequest(job, response, parsed);
+            {
+                MutexLock lock(httpQueueMutex);
+                httpQueue.complete(job.id, code, response, parsed);
+            }
+            xEventGroupSetBits(pipelineEvents, PIPELINE_EVENT_HTTP);
+            continue;
+        }
+        // Ждём новый запрос, срок ограничения частоты или появления WiFi
+        TickType_t ticks = portMAX_DELAY;
+        if (wait != UINT32_MAX) {
+            ticks = pdMS_TO_TICKS(connected ? min<uint32_t>(wait, HTTP_WORKER_POLL_MS)
+                                            : HTTP_WORKER_POLL_MS) + 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
 }
+
+/** Run the callbacks of finished requests.  Network task (or loop()) only. */
+void dispatchHttp() {
+    HttpResult result;
+    HttpCallback callbacks[HTTP_WAITERS];
+    void* contexts[HTTP_WAITERS];
+    uint8_t waiters;
+    for (;;) {
+        {
+            MutexLock lock(httpQueueMutex);
+            if (!httpQueue.takeFinished(result, callbacks, contexts, waiters)) {
+                return;
+            }
+        }
+        // Без блокировки: колбэк может поставить новый запрос
+        for (uint8_t i = 0; i < waiters; i++) {
+            callbacks[i](result, contexts[i]);
+        }
+        {
+            MutexLock lock(httpQueueMutex);
+            httpQueue.dispatched(result.id);
+        }
+        // A request may have waited for this one's target
+        if (httpWorkerHandle) {
+            xTaskNotifyGive(httpWorkerHandle);
+        }
+    }
+}
+
 TaskHandle_t readSerialCommandsHandle;
 TaskHandle_t prepareForPairingHandle;
 TaskHandle_t updateLEDsHandle;
 
 Ticker setTimeTicker;
-Ticker ticker1min;
-Ticker ticker10sec;
 
-void initializeTasks() {
+/**
+ * @brief State every boot needs, including a deep-sleep wake: mutexes,
+ *        identity, events and the sensor sources.  Starts no task.
+ */
+void initializeRuntime() {
     mqttMutex = xSemaphoreCreateMutex();
     dataQueueMutex = xSemaphoreCreateMutex();
-    
+    deviceIdentity.begin();  // chip ID и топики вычисляются один раз
+    initializeEvents();
+    registerSensorSources();
+    WDTWrapper::init(30);
+}
+
+/** HTTP worker (token, device code, config requests); also used by burst wakes. */
+void startHttpWorker() {
+    if (httpWorkerHandle) {
+        return;
+    }
+    xTaskCreatePinnedToCore(httpWorkerTask, "httpWorker", HTTP_WORKER_STACK_SIZE, NULL,
+                            HTTP_WORKER_PRIORITY, &httpWorkerHandle, PRO_CPU_NUM);
+}
+
+/** Tasks of the always-on mode; a deep-sleep wake does not start them. */
+void initializeTasks() {
+    startHttpWorker();
     xTaskCreate(readSerialCommands, "readSerialCommands", 2750, NULL, 2, &readSerialCommandsHandle);
     xTaskCreate(prepareForPairing, "prepareForPairing", 2000, NULL, 1, &prepareForPairingHandle);
     xTaskCreate(updateLEDs, "updateLEDs", 2500, NULL, 1, &updateLEDsHandle);
-    //xTaskCreate(processMQTTQueueTask, "MQTTQueueTask", 4096, NULL, 1, NULL);
     //xTaskCreate(monitorLoopTask, "MonitorLoop", 2048, NULL, 1, NULL);
-    prefs.begin("nvs", false);
-    float pollingInterval = prefs.getFloat("pollingInterval", 10.0);
-    prefs.end();
-    ticker10sec.attach(pollingInterval, ticker10secCallback); 
-    ticker1min.attach(60, ticker1minCallback);
     setTimeTicker.attach(432000, setDateTime);
-    WDTWrapper::init(30);
 
     if (configUrl.length() != 0 && WiFi.status() == WL_CONNECTED) {
-    fetchAndStoreConfig(configUrl);  // Вызываем функцию только при наличии подключения
-}
-
-    
+        fetchAndStoreConfig(configUrl);  // Вызываем функцию только при наличии подключения
+    }
 }
 
 void initializeIndication() {
@@ -136,9 +439,13 @@ void initializeMQTT() {
     setDateTime();
     mqtt.setKeepAliveTimeout(15);
     mqttclient.beginSslWithCA(mqttUrl.c_str(), 443, "/", cert_bundle, "arduino");
-    mqttclient.setReconnectInterval(2000);
+    mqttclient.setReconnectInterval(MQTT_TRANSPORT_TIMEOUT_MS);  // Attempts are paced by mqttReconnect
     mqttclient.enableHeartbeat(15000, 3000, 3);
     mqtt.begin(mqttclient);
+    mqttInflight.setTransport(sendMqttPacket, &mqttclient);
+    mqttInflight.setDropHandler(storeDroppedMessage, nullptr);
+    loadMqttConfig();
+    mqttReconnect.seed(esp_random());  // Every device retries on its own schedule
     Serial.println(mqttUrl);
     checkMemory("После initializeMQTT");
 }
@@ -152,8 +459,8 @@ void checkWiFiAndMQTTConnection() {
     const unsigned long timeout = 300000;   // Таймаут ожидания подключения, 100 секунд
     unsigned long currentTime = millis();
 
-    // Проверяем состояние подключения WiFi и MQTT
-    if (WiFi.status() != WL_CONNECTED || !mqtt.isConnected()) {
+    // Проверяем состояние подключения WiFi; MQTT переподключает mqttReconnect
+    if (WiFi.status() != WL_CONNECTED) {
         if (lastCheckTime == 0) {
             // Запоминаем время начала попыток подключения
             lastCheckTime = currentTime;
@@ -176,10 +483,8 @@ void checkWiFiAndMQTTConnection() {
             }
             //vTaskDelay(1000 / portTICK_PERIOD_MS);
 
-            if (!secureClient.connected()) {
-            secureClient.stop(); // Остановка перед переинициализацией
-            secureClient = WiFiClientSecure();
-}
+            // Соединения пула закрываются; кэш TLS-сессий остаётся
+            closeAllHttps();
 
 
             // Инициализируем WiFi заново
@@ -205,17 +510,59 @@ void updateMQTT() {
 
 void handleTokenExchange() {
     if (WiFi.status() == WL_CONNECTED && accessToken.isEmpty()) {
+        // Повторные вызовы не дублируют запрос в очереди HTTP
         if (deviceCode.isEmpty()) {
-            performDeviceCodeExchange(authUrl, deviceCode, userCode, verificationUrl);
+            performDeviceCodeExchange(authUrl);
         } else {
-            if (accessToken.isEmpty()) {
-                performTokenExchange(tokenUrl, accessToken, refreshToken, deviceCode);  
-                             
-            }
+            performTokenExchange(tokenUrl, deviceCode);
         }        
     }
 }
 
+//=========== Переподключение MQTT ===========
+
+/** Refresh response, run by dispatchHttp(). */
+void onTokenRefresh(const HttpResult& result, void* context) {
+    TokenRefreshJob* job = static_cast<TokenRefreshJob*>(context);
+    job->ok = parseTokenUpdate(result, job->accessToken, job->refreshToken);
+    job->done = true;
+}
+
+/** Queue a token refresh for the HTTP worker, unless one is running. */
+bool startTokenRefresh() {
+    if (tokenRefreshJob.running || refreshToken.isEmpty()) {
+        return false;
+    }
+    tokenRefreshJob.accessToken = accessToken;
+    tokenRefreshJob.refreshToken = refreshToken;
+    tokenRefreshJob.ok = false;
+    tokenRefreshJob.done = false;
+    tokenRefreshJob.running = true;
+    if (!performTokenUpdate(tokenUrl, tokenRefreshJob.refreshToken, onTokenRefresh, &tokenRefreshJob)) {
+        tokenRefreshJob.running = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Take over the tokens of a finished refresh.
+ * @return true if a refresh finished since the last call; @p ok tells whether it succeeded.
+ */
+bool collectTokenRefresh(bool& ok) {
+    if (!tokenRefreshJob.running || !tokenRefreshJob.done) {
+        return false;
+    }
+    ok = tokenRefreshJob.ok;
+    if (ok) {
+        accessToken = tokenRefreshJob.accessToken;
+        refreshToken = tokenRefreshJob.refreshToken;
+    }
+    tokenRefreshJob.running = false;
+    return true;
+}
+
+/** Refresh the token ahead of its expiry, out of line. */
 void manageTokenRefresh() {
     static unsigned long lastTokenUpdate = 0;  // Статическая переменная для отслеживания времени последнего обновления токена
     // Проверяем подключение к WiFi и наличие рефреш-токена
@@ -226,50 +573,133 @@ void manageTokenRefresh() {
     unsigned long currentTime = millis();
     // Проверка с защитой от переполнения millis()
     if ((long)(currentTime - lastTokenUpdate) >= (expiresIn * 1000L) / 1.1) {
-        performTokenUpdate(tokenUrl, accessToken, refreshToken);
-        lastTokenUpdate = currentTime;  // Сброс таймера после успешного обновления токенов
-        // Serial.println("Token updated.");
+        if (startTokenRefresh()) {
+            lastTokenUpdate = currentTime;  // Сброс таймера после успешного обновления токенов
+        }
     }
 }
 
+/** Queue the figures of a successful connect as method "connection". */
+void reportConnect() {
+    const ConnStats& stats = mqttReconnect.stats();
+    uint32_t failures = 0;
+    for (uint32_t count : stats.failures) {
+        failures += count;
+    }
+    static ParamId connectParam = registerParam("connect-ms", "connection");
+    static ParamId outageParam = registerParam("outage-ms", "connection");
+    static ParamId failuresParam = registerParam("failures", "connection");
+    queueParam(connectParam, stats.lastConnectMs);
+    queueParam(outageParam, stats.lastOutageMs);
+    queueParam(failuresParam, failures);
+}
 
-void handleMQTTConnection() {
-    static byte reconnectCount = 0;
-    static unsigned long lastCheckTime = 0;
-    const unsigned long checkInterval = 5000; // Проверяем подключение каждые 10 секунд
-    unsigned long currentMillis = millis();
+/**
+ * @brief Queue handshake count, mean and 90th percentile per kind (see
+ *        TlsSession.h) as method "tls".  The full histogram: serial "ts".
+ */
+void reportTls() {
+    static ParamId params[static_cast<size_t>(HandshakeKind::Count)][3] = {};
+    static bool registered = false;
+    if (!registered) {
+        char name[PARAM_NAME_SIZE];
+        for (size_t i = 0; i < static_cast<size_t>(HandshakeKind::Count); i++) {
+            const char* kind = TlsSessions::kindName(static_cast<HandshakeKind>(i));
+            snprintf(name, sizeof(name), "%s-n", kind);
+            params[i][0] = registerParam(name, "tls");
+            snprintf(name, sizeof(name), "%s-ms", kind);
+            params[i][1] = registerParam(name, "tls");
+            snprintf(name, sizeof(name), "%s-p90-ms", kind);
+            params[i][2] = registerParam(name, "tls");
+        }
+        registered = true;
+    }
+    MutexLock lock(tlsMutex);
+    for (size_t i = 0; i < static_cast<size_t>(HandshakeKind::Count); i++) {
+        const HandshakeHistogram& histogram = tlsSessions.stats().kind[i];
+        if (histogram.total == 0) {
+            continue;
+        }
+        queueParam(params[i][0], histogram.total);
+        queueParam(params[i][1], static_cast<uint32_t>(histogram.totalMs / histogram.total));
+        queueParam(params[i][2], tlsSessions.percentileMs(static_cast<HandshakeKind>(i), 90));
+    }
+}
 
-    // Проверяем наличие accessToken и refreshToken    
+/**
+ * @brief Advance the reconnect state machine (see MqttReconnect.h) and carry
+ *        out its action.  Called on every network pass; returns at once
+ *        unless a transport is opened or CONNECT is sent, which block the
+ *        network task for the TLS handshake or the CONNACK wait.
+ */
+void handleMQTTConnection() {
+    // Проверяем наличие accessToken и refreshToken
     if (accessToken.length() == 0) {
        return; // Пропускаем попытки подключения, если токены отсутствуют
     }
 
-    manageTokenRefresh();
-
-    if (currentMillis - lastCheckTime > checkInterval) {
-        lastCheckTime = currentMillis;
-
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    bool refreshed;
+    if (collectTokenRefresh(refreshed)) {
+        mqttReconnect.tokenRefreshDone(millis(), refreshed);
+        reportTls();
+    }
+    if (mqttReconnect.state() == ConnState::Connected) {
+        manageTokenRefresh();
+    }
 
-        if (!mqtt.isConnected()) {
-            Serial.println("MQTT disconnected. Attempting to reconnect...");            
+    static uint32_t transportStartMs = 0;
+    const ConnState before = mqttReconnect.state();
+    ConnAction action = mqttReconnect.step(millis(), WiFi.status() == WL_CONNECTED,
+                                           mqttclient.isConnected(), mqtt.isConnected());
+    switch (action) {
+        case ConnAction::OpenTransport:
+            // One connection attempt of the WebSocket client, no retries of its own
+            mqttclient.setReconnectInterval(0);
+            transportStartMs = millis();
+            updateMQTT();
+            mqttclient.setReconnectInterval(MQTT_TRANSPORT_TIMEOUT_MS);
+            break;
+        case ConnAction::SendConnect:
+            {
+                // The WebSocket client cannot resume sessions; its handshakes are counted apart
+                MutexLock lock(tlsMutex);
+                tlsSessions.recordHandshake(HandshakeKind::WebSocket, millis() - transportStartMs,
+                                            false);
+            }
             reconnect("device-token", accessToken);
-
-            if (mqtt.isConnected()) {
-                Serial.println("MQTT reconnected successfully.");                
-                reconnectCount = 0;
-            } else {
-                Serial.println("Reconnect attempt failed.");
-                if (reconnectCount >= 2) {
-                    Serial.println("Maximum reconnect attempts reached. Updating tokens...");
-                    performTokenUpdate(tokenUrl, accessToken, refreshToken);
-                    reconnectCount = 0;
-                    reconnect("device-token", accessToken); // Попытка переподключения с новыми токенами
-                } else {
-                    reconnectCount++;
-                }
+            action = mqttReconnect.connectResult(millis(), mqtt.isConnected(), mqtt.getReturnCode());
+            if (action == ConnAction::CloseTransport) {
+                mqttclient.disconnect();
             }
-        }
+            break;
+        case ConnAction::StartTokenRefresh:
+            Serial.println("MQTT: refreshing the token...");
+            if (!startTokenRefresh()) {
+                mqttReconnect.tokenRefreshDone(millis(), false);
+            }
+            break;
+        case ConnAction::CloseTransport:
+            mqttclient.disconnect();
+            break;
+        default:
+            break;
+    }
+
+    const ConnState state = mqttReconnect.state();
+    if (state == before) {
+        return;
+    }
+    if (state == ConnState::Connected) {
+        Serial.printf("MQTT connected in %u ms after %u ms outage\n",
+                      (unsigned)mqttReconnect.stats().lastConnectMs,
+                      (unsigned)mqttReconnect.stats().lastOutageMs);
+        reportConnect();
+        reportTls();
+    } else if (state == ConnState::Backoff) {
+        Serial.printf("MQTT %s, retry in %u ms (failure %u in a row)\n",
+                      MqttReconnect::stateName(before),
+                      (unsigned)mqttReconnect.stats().lastBackoffMs,
+                      (unsigned)mqttReconnect.failuresInRow());
     }
 }
 
@@ -281,96 +711,321 @@ void mqttDisconnectTask()
     Serial.println("MQTT disconnected by command");
 }
 
-void processMQTTQueueTask(void* pvParameters) {
-    unsigned long lastMgmtCall = 0;
-    for (;;) {
-        if (otaInProgress) {
-            mqtt.disconnect();
-            mqttclient.disconnect();
-            vTaskDelete(NULL);
-            return;
-        }
+/**
+ * @brief Disconnect once an OTA update has started; the update runs in otaTask.
+ * @return true while the update is in progress.
+ */
+bool stopNetworkForOta() {
+    static bool stopped = false;
+    if (!otaInProgress) {
+        return false;
+    }
+    if (!stopped) {
+        mqtt.disconnect();
+        mqttclient.disconnect();
+        stopped = true;
+    }
+    return true;
+}
 
-        unsigned long now = millis();
-        // Раз в 15 секунд вызываем "тяжелые" сервисные функции
-        if (now - lastMgmtCall >= 20000) {
-            handleTokenExchange();
-            handleMQTTConnection();
-            #ifndef AQUASYNC1
-            checkWiFiAndMQTTConnection();
-            #endif
-            lastMgmtCall = now;
-        }
+/**
+ * @brief One pass over the network side.  Connection upkeep and the token
+ *        exchange run when the maintenance timer fired or the Wi-Fi link
+ *        changed; HTTP callbacks, incoming MQTT traffic and publishing on
+ *        every pass.
+ * @return Messages published.
+ */
+uint32_t serviceNetwork(EventBits_t events) {
+    dispatchHttp();
+    if (events & (PIPELINE_EVENT_TIMER | PIPELINE_EVENT_CONNECTIVITY)) {
+        #ifndef AQUASYNC1
+        checkWiFiAndMQTTConnection();
+        #endif // AQUASYNC
+        handleTokenExchange();
+        closeIdleHttps();
+    }
+    handleMQTTConnection();
+    if (mqttReconnect.transportActive()) {
+        updateMQTT();
+    }
+    const uint32_t publishedBefore = mqttDrainStats().published;
+    processMQTTQueue();
+    return mqttDrainStats().published - publishedBefore;
+}
 
-        if (mqtt.isConnected()) {
-            updateMQTT();
-            processMQTTQueue();
-        }
+/**
+ * @brief How long to wait for the next event after a pass that published
+ *        @p published messages: not at all while a budget cut the drain
+ *        short, else until the socket has to be polled again.
+ */
+TickType_t networkWaitTicks(uint32_t published) {
+    const bool backlog = mqttLanes.size() > 0 || !outbox.empty();
+    const uint32_t pollMs = powerConfig.lightSleep ? powerConfig.pollMs : PIPELINE_NETWORK_POLL_MS;
+    return published > 0 && backlog ? 0 : pdMS_TO_TICKS(pollMs);
+}
 
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+//=========== Конвейер: сбор данных (APP_CPU) и сеть (PRO_CPU) ===========
+
+/**
+ * @brief Acquisition stage: polls the sensor sources when they are due and
+ *        sleeps until the next one or until the schedule changes.  Never
+ *        touches the network.
+ */
+void acquisitionTask(void* parameter) {
+    WDTWrapper::addThisTask();
+    for (;;) {
+        WDTWrapper::reset();
+        const unsigned long start = micros();
+        const size_t polls = otaInProgress ? 0 : sensorScheduler.run(millis());
+        pipeline.recordCycle(PipelineStage::Acquisition, micros() - start, polls == 0);
+
+        // One tick more: waking a tick early would only mean a second wake-up
+        const uint32_t wait = min<uint32_t>(sensorScheduler.msUntilNext(millis()),
+                                            PIPELINE_MAX_SLEEP_MS);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait) + 1);
+    }
+}
+
+/**
+ * @brief Network stage: owns Wi-Fi, MQTT and HTTP.  Sleeps until a message is
+ *        queued, the link changes or the maintenance timer fires, and at most
+ *        PIPELINE_NETWORK_POLL_MS to read incoming traffic.  A blocking MQTT
+ *        TLS handshake only delays this task; HTTP runs in httpWorkerTask.
+ */
+void networkTask(void* parameter) {
+    WDTWrapper::addThisTask();
+    TickType_t wait = 0;
+    for (;;) {
+        const EventBits_t events = xEventGroupWaitBits(
+            pipelineEvents, PIPELINE_EVENTS_ALL & ~PIPELINE_EVENT_SCHEDULE, pdTRUE, pdFALSE, wait);
+        WDTWrapper::reset();
+        const unsigned long start = micros();
+        uint32_t published = 0;
+        if (!stopNetworkForOta()) {
+            published = serviceNetwork(events);
+        }
+        pipeline.recordCycle(PipelineStage::Network, micros() - start,
+                             events == 0 && published == 0);
+        wait = networkWaitTicks(published);
     }
 }
 
+/**
+ * @brief Start the acquisition and network tasks.  Call at the end of setup(),
+ *        after the MQTT client is configured; loopTasks() then only feeds the
+ *        watchdog.  Does nothing when built with PIPELINE_TASKS=0.
+ */
+void startPipeline() {
+#if PIPELINE_TASKS
+    pipeline.setRunning(true);
+    xTaskCreatePinnedToCore(networkTask, "network", PIPELINE_NETWORK_STACK_SIZE, NULL,
+                            PIPELINE_NETWORK_PRIORITY, &networkTaskHandle, PRO_CPU_NUM);
+    xTaskCreatePinnedToCore(acquisitionTask, "acquisition", PIPELINE_ACQUISITION_STACK_SIZE,
+                            NULL, PIPELINE_ACQUISITION_PRIORITY, &acquisitionTaskHandle,
+                            APP_CPU_NUM);
+#endif
+}
+
 
 void loopTasks() {
     WDTWrapper::addThisTask(); // Первый вызов — регистрирует задачу loop
     WDTWrapper::reset();       // Сбросить WDT (каждая итерация)
+    if (pipeline.running()) {
+        // Опрос датчиков и сеть работают в задачах конвейера
+        lastLoopTime = millis();
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        return;
+    }
     // Если обновление в процессе, функция не выполняется
-    if (otaInProgress) {
-        mqtt.disconnect();
-        mqttclient.disconnect();
+    if (stopNetworkForOta()) {
+        vTaskDelay(PIPELINE_NETWORK_POLL_MS / portTICK_PERIOD_MS);
         return;  // Прекращаем выполнение, если запущена задача обновления
     }
 
-    // Выполняем задачи только если обновление не запущено
-    #ifndef AQUASYNC1
-    checkWiFiAndMQTTConnection();
-    #endif // AQUASYNC
-    updateMQTT();
-    handleTokenExchange();
-    handleMQTTConnection();
-    processMQTTQueue();
-
-    if (dataReadyForSend) {
-        Serial.println("Processing data queue...");
-        sensorsPolling();
-        dataReadyForSend = false;  // Сбрасываем флаг
-    }
-    if (oneMinCallback) {
-        Serial.println("Processing data queue...");
-        oneMinPolling();
-        oneMinCallback = false;  // Сбрасываем флаг
-    }
+    // Ждём события, срока опроса датчика или опроса сокета
+    static TickType_t networkWait = 0;
+    const TickType_t sensorWait =
+        pdMS_TO_TICKS(min<uint32_t>(sensorScheduler.msUntilNext(millis()), PIPELINE_MAX_SLEEP_MS)) + 1;
+    const EventBits_t events = xEventGroupWaitBits(pipelineEvents, PIPELINE_EVENTS_ALL, pdTRUE,
+                                                   pdFALSE, min(networkWait, sensorWait));
+    WDTWrapper::reset();
+    const unsigned long start = micros();
+    const uint32_t published = serviceNetwork(events);
+    networkWait = networkWaitTicks(published);
+
+    // Опрос источников данных, срок которых наступил
+    const size_t polls = sensorScheduler.run(millis());
+    pipeline.recordCycle(PipelineStage::Network, micros() - start,
+                         events == 0 && published == 0 && polls == 0);
 
     lastLoopTime = millis();
-
-
 }
 
 
 //=========== Общие функции для опроса датчиков и отправки в MQTT ===========
-void ticker10secCallback() {
-    dataReadyForSend = true; // Устанавливаем флаг
-}
-void ticker1minCallback() {
-    oneMinCallback = true; // Устанавливаем флаг
-}
 
+/**
+ * @brief Register the built-in data sources with sensorScheduler.
+ *
+ * Wi-Fi RSSI and the telemetry flush run every "pollingInterval" seconds
+ * (NVS, default 10).  The flush is placed one wheel tick before the end of
+ * each period so the samples taken in that period go out with it.  Drivers
+ * add their own sources here with the period their sensor needs.
+ */
+void registerSensorSources() {
+    prefs.begin("nvs", false);
+    float pollingInterval = prefs.getFloat("pollingInterval", 10.0);
+    prefs.end();
+    const uint32_t pollingMs = max<uint32_t>(pollingInterval * 1000, 2 * SENSOR_WHEEL_TICK_MS);
+
+    sensorScheduler.begin(millis());
+    sensorScheduler.add("wifi", pollWifiRssi, nullptr, pollingMs, 0, pollingMs / 2);
+    telemetrySource = sensorScheduler.add("telemetry", flushTelemetry, nullptr, pollingMs,
+                                          pollingMs - SENSOR_WHEEL_TICK_MS, pollingMs / 2);
+    sensorScheduler.add("1min", oneMinPolling, nullptr, 60000);
+}
 
-void sensorsPolling() { 
-if (accessToken.isEmpty()) {
+void pollWifiRssi(void* context) {
+    if (accessToken.isEmpty() || WiFi.status() != WL_CONNECTED) {
         return;  // Пропускаем опрос датчиков, если токен отсутствует
     }
-    sendWifiRSSI();   
-    processQueue();    
+    sendWifiRSSI();
+}
+
+/**
+ * @brief Close the awake/asleep interval that ends with this flush and, if
+ *        enabled, queue it for the next one.
+ */
+void reportPower() {
+    const PowerInterval interval = powerMonitor.close(micros(), pipeline.stats());
+    if (!powerConfig.report || interval.durationMs == 0) {
+        return;
+    }
+    static ParamId awakeParam = registerParam("awake-ms", "power");
+    static ParamId asleepParam = registerParam("asleep-ms", "power");
+    static ParamId wakeupsParam = registerParam("wakeups", "power");
+    queueParam(awakeParam, interval.awakeMs);
+    queueParam(asleepParam, interval.asleepMs);
+    queueParam(wakeupsParam, interval.wakeups);
 }
 
+void flushTelemetry(void* context) {
+    if (accessToken.isEmpty()) {
+        return;
+    }
+    // Bulk lane nearly full: the samples wait in the registry (see Pipeline.h)
+    if (!pipeline.admitFlush(mqttLanes.lane(MqttLane::Bulk), mqtt.isConnected())) {
+        return;
+    }
+    processQueue();
+    if (powerConfig.report || powerConfig.lightSleep) {
+        reportPower();
+    }
+}
 
-void oneMinPolling() { 
-if (accessToken.isEmpty()) {
+void oneMinPolling(void* context) {
+    if (accessToken.isEmpty()) {
         return;  // Пропускаем опрос датчиков, если токен отсутствует
     }
 }
 
+//=========== Глубокий сон: замер и пакетная отправка ===========
+
+/**
+ * @brief This boot runs in deep-sleep mode: enabled, paired, and the button
+ *        not held.  Holding the button while the unit wakes starts the
+ *        always-on mode once, e.g. to reconfigure it over BLE.
+ */
+bool sleepModeSelected() {
+    return sleepConfig.enabled && !accessToken.isEmpty() && digitalRead(buttonPin) == HIGH;
+}
+
+/** Queue the wake timing of the last cycle as method "sleep". */
+void queueSleepStats() {
+    const SleepStats& stats = sleepQueue.stats();
+    const uint32_t sampleMs = stats.sampleWakes ? stats.sampleMsTotal / stats.sampleWakes : 0;
+    static ParamId wakesParam = registerParam("wakes", "sleep");
+    static ParamId sampleParam = registerParam("sample-ms", "sleep");
+    static ParamId sampleMaxParam = registerParam("sample-ms-max", "sleep");
+    static ParamId publishParam = registerParam("publish-ms", "sleep");
+    static ParamId currentParam = registerParam("avg-ua", "sleep");
+    queueParam(wakesParam, stats.wakes);
+    queueParam(sampleParam, sampleMs);
+    queueParam(sampleMaxParam, stats.sampleMsMax);
+    queueParam(publishParam, stats.publishMs);
+    queueParam(currentParam, SleepQueue::averageCurrentUa(sampleMs, stats.publishMs,
+                                                          sleepConfig.periodSec,
+                                                          sleepConfig.burstEvery));
+}
+
+/**
+ * @brief One wake of the deep-sleep mode (see SleepQueue.h): sample every
+ *        source once into the RTC queue, connect and publish it every
+ *        burstEvery wakes, then sleep until the next period.  Does not return.
+ */
+void runSleepCycle() {
+    const unsigned long wakeMs = millis();
+    const bool retained = sleepQueue.begin();
+    {
+        MutexLock lock(dataQueueMutex);
+        sleepQueue.restore(paramRegistry);
+    }
+    const bool burst = sleepQueue.burstDue(sleepConfig.burstEvery);
+    Serial.printf("Deep-sleep wake %u%s, %u messages queued%s\n",
+                  (unsigned)sleepQueue.stats().wakes, retained ? "" : " (cold start)",
+                  (unsigned)sleepQueue.records(), burst ? ", publishing" : "");
+
+    // The flush of this wake goes to the RTC queue, so it is published in order
+    sleepQueue.setActive(true);
+    sensorScheduler.pollAll(telemetrySource);
+    if (burst) {
+        queueSleepStats();
+    }
+    processQueue();
+    sleepQueue.setActive(false);
+
+    if (burst) {
+        const unsigned long deadline = millis() + SLEEP_CONNECT_TIMEOUT_MS;
+        bool complete = false;
+        startHttpWorker();  // Token refresh
+        initializeWiFi();
+        while (WiFi.status() != WL_CONNECTED && (long)(millis() - deadline) < 0) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+        if (WiFi.status() == WL_CONNECTED) {
+            initializeMQTT();
+            while (!mqtt.isConnected() && (long)(millis() - deadline) < 0) {
+                dispatchHttp();  // Token refresh
+                handleMQTTConnection();
+                if (mqttReconnect.transportActive()) {
+                    updateMQTT();
+                }
+                vTaskDelay(pdMS_TO_TICKS(20));
+            }
+            complete = publishSleepQueue(deadline, updateMQTT);
+            mqtt.disconnect();
+        }
+        sleepQueue.endBurst(millis() - wakeMs, complete);
+        Serial.printf("Burst %s after %lu ms, %u messages left\n", complete ? "done" : "failed",
+                      millis() - wakeMs, (unsigned)sleepQueue.records());
+        WiFi.disconnect(true);
+        WiFi.mode(WIFI_OFF);
+    } else {
+        sleepQueue.endSampleWake(millis() - wakeMs);
+    }
+    {
+        MutexLock lock(dataQueueMutex);
+        sleepQueue.retain(paramRegistry);
+    }
+    if (!sleepConfig.enabled) {
+        ESP.restart();  // Switched off during the burst: come back always-on
+    }
+
+    const uint64_t periodUs = sleepConfig.periodSec * 1000000ULL;
+    const uint64_t awakeUs = (uint64_t)(millis() - wakeMs) * 1000ULL;
+    esp_sleep_enable_timer_wakeup(periodUs > awakeUs ? periodUs - awakeUs : 1000000ULL);
+    Serial.flush();
+    esp_deep_sleep_start();
+}
 
 #endif // SETUPTASK_H
\ No newline at end of file
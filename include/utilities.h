@@ -43,6 +43,11 @@ extern const char* hw_code;
 String getChipID();
 void readSerialCommands(void *pvParameters);
 void processCommand(const String& command);
+void printQueueStats();
+void printSchedulerStats();
+void printPowerStats();
+void printConnectionStats();
+void printTlsStats();
 void initFileSystem();
 const char *stringToConstChar(String str);
 extern void checkWiFiAndMQTTConnection();
@@ -63,8 +68,8 @@ void resetPCA9555();
 /**
  * @brief Thin wrapper around the ESP task watchdog functions.
  *
- * The class ensures that watchdog initialization and task registration happen
- * only once and provides a static reset() method that can be called from
+ * The class ensures that watchdog initialization and the registration of each
+ * task happen only once and provides a static reset() method that can be called from
  * anywhere.
  */
 class WDTWrapper {
@@ -77,11 +82,10 @@ public:
         }
     }
 
+    /** Subscribe the calling task once; every task that feeds the watchdog calls it. */
     static void addThisTask() {
-        static bool added = false;
-        if (!added) {
+        if (esp_task_wdt_status(NULL) == ESP_ERR_NOT_FOUND) {
             esp_task_wdt_add(NULL);
-            added = true;
         }
     }
 
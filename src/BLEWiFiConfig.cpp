@@ -135,7 +135,6 @@ void BLEWiFiConfig::connectToWiFi(const char* ssid, const char* password) {
     if (WiFi.status() == WL_CONNECTED) {
         Serial.println("Connected to WiFi successfully");
         Serial.println("IP Address: " + WiFi.localIP().toString());
-        secureClient.setCACert(cert_bundle);
         wifiConnected = true;
     } else {
         Serial.println("Failed to connect to WiFi. Check settings.");
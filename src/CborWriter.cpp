@@ -0,0 +1,207 @@
+/**
+ * @file CborWriter.cpp
+ * @brief Implementation of the fixed-buffer CBOR writer.
+ */
+
+#include "CborWriter.h"
+
+#include <cmath>
+
+namespace {
+
+// Major types (RFC 8949, section 3.1)
+const uint8_t kUnsigned = 0;
+const uint8_t kNegative = 1;
+const uint8_t kText = 3;
+
+const uint8_t kArrayIndefinite = 0x9F;
+const uint8_t kMapIndefinite = 0xBF;
+const uint8_t kBreak = 0xFF;
+const uint8_t kNull = 0xF6;
+const uint8_t kFloat32 = 0xFA;
+const uint8_t kFloat64 = 0xFB;
+
+const double kPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+const uint8_t kMaxRoundedPrecision = 9;
+const double kMaxExactInteger = 9007199254740992.0;  ///< 2^53
+
+}  // namespace
+
+CborWriter::CborWriter(char* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {
+    reset();
+}
+
+void CborWriter::reset() {
+    length_ = 0;
+    overflow_ = capacity_ == 0;
+}
+
+void CborWriter::reset(char* buffer, size_t capacity) {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    reset();
+}
+
+void CborWriter::rewind(const Mark& position) {
+    length_ = position.length;
+    overflow_ = capacity_ == 0;
+}
+
+void CborWriter::append(const uint8_t* data, size_t size) {
+    if (overflow_) {
+        return;
+    }
+    if (size > remaining()) {
+        overflow_ = true;
+        return;
+    }
+    memcpy(buffer_ + length_, data, size);
+    length_ += size;
+}
+
+void CborWriter::appendHead(uint8_t major, uint64_t argument) {
+    uint8_t head[9];
+    size_t size;
+    head[0] = major << 5;
+    if (argument < 24) {
+        head[0] |= argument;
+        size = 1;
+    } else if (argument <= 0xFF) {
+        head[0] |= 24;
+        size = 2;
+    } else if (argument <= 0xFFFF) {
+        head[0] |= 25;
+        size = 3;
+    } else if (argument <= 0xFFFFFFFFull) {
+        head[0] |= 26;
+        size = 5;
+    } else {
+        head[0] |= 27;
+        size = 9;
+    }
+    // Big-endian argument after the initial byte
+    for (size_t i = size - 1; i > 0; i--) {
+        head[i] = static_cast<uint8_t>(argument);
+        argument >>= 8;
+    }
+    append(head, size);
+}
+
+CborWriter& CborWriter::beginObject() {
+    appendByte(kMapIndefinite);
+    return *this;
+}
+
+CborWriter& CborWriter::endObject() {
+    appendByte(kBreak);
+    return *this;
+}
+
+CborWriter& CborWriter::beginArray() {
+    appendByte(kArrayIndefinite);
+    return *this;
+}
+
+CborWriter& CborWriter::endArray() {
+    appendByte(kBreak);
+    return *this;
+}
+
+CborWriter& CborWriter::key(const char* name) { return value(name ? name : ""); }
+
+CborWriter& CborWriter::value(const char* text) {
+    if (!text) {
+        return valueNull();
+    }
+    const size_t size = strlen(text);
+    appendHead(kText, size);
+    append(reinterpret_cast<const uint8_t*>(text), size);
+    return *this;
+}
+
+CborWriter& CborWriter::value(long long number) {
+    if (number < 0) {
+        // -1 - n, computed without overflowing for LLONG_MIN
+        appendHead(kNegative, ~static_cast<uint64_t>(number));
+    } else {
+        appendHead(kUnsigned, static_cast<uint64_t>(number));
+    }
+    return *this;
+}
+
+CborWriter& CborWriter::value(bool flag) { return value(flag ? 1LL : 0LL); }
+
+CborWriter& CborWriter::value(double number, uint8_t precision) {
+    if (!std::isfinite(number)) {
+        return valueNull();
+    }
+    double rounded = number;
+    double unit = 0.0;  // Half of the last published decimal
+    if (precision <= kMaxRoundedPrecision) {
+        const double scale = kPow10[precision];
+        rounded = std::round(number * scale) / scale;
+        unit = 0.5 / scale;
+    }
+    if (rounded == std::floor(rounded) && fabs(rounded) < kMaxExactInteger) {
+        return value(static_cast<long long>(rounded));
+    }
+
+    const float single = static_cast<float>(rounded);
+    if (unit > 0.0 && fabs(static_cast<double>(single) - rounded) < unit * 0.1) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        uint8_t item[5] = {kFloat32, static_cast<uint8_t>(bits >> 24),
+                           static_cast<uint8_t>(bits >> 16), static_cast<uint8_t>(bits >> 8),
+                           static_cast<uint8_t>(bits)};
+        append(item, sizeof(item));
+        return *this;
+    }
+    uint64_t bits;
+    memcpy(&bits, &rounded, sizeof(bits));
+    uint8_t item[9];
+    item[0] = kFloat64;
+    for (size_t i = 8; i > 0; i--) {
+        item[i] = static_cast<uint8_t>(bits);
+        bits >>= 8;
+    }
+    append(item, sizeof(item));
+    return *this;
+}
+
+CborWriter& CborWriter::value(const SampleValue& sample, uint8_t precision) {
+    switch (sample.type) {
+        case SampleType::Int32:
+            return value(static_cast<long long>(sample.i32));
+        case SampleType::Int64:
+            return value(static_cast<long long>(sample.i64));
+        case SampleType::Float:
+            return value(static_cast<double>(sample.f32), precision);
+        case SampleType::Double:
+            return value(sample.f64, precision);
+        case SampleType::Bool:
+            return value(sample.b);
+        case SampleType::Text:
+            return value(sample.str);
+        default:
+            return valueNull();
+    }
+}
+
+CborWriter& CborWriter::valueNull() {
+    appendByte(kNull);
+    return *this;
+}
+
+CborWriter& CborWriter::beginRpc(const char* method) {
+    beginObject();
+    key("jsonrpc").value("2.0");
+    key("method").value(method);
+    key("params").beginObject();
+    return *this;
+}
+
+CborWriter& CborWriter::endRpc() {
+    endObject();
+    endObject();
+    return *this;
+}
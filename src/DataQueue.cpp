@@ -4,195 +4,782 @@
  */
 
 #include "DataQueue.h"
+#include "Outbox.h"
+#include "SleepQueue.h"
 
-// Actual storage for global containers declared in the header
-std::map<String, std::unique_ptr<DataItem>> dataQueue;
-std::queue<MQTTMessage> mqttQueue;
-std::mutex mqttQueueMutex;
-std::map<String, float> lastSentValues;  ///< last published values per parameter
+TelemetryConfig telemetryConfig;
+
+namespace {
+
+// Room kept for ,"ts":<epoch ms> in messages written to the outbox
+const size_t kTimestampRoom = 24;
+// Room kept for ,"delta":1 in delta messages
+const size_t kDeltaRoom = 16;
 
 /**
- * @brief Flush accumulated sensor data to the MQTT message queue.
- *
- * The function groups parameters by RPC method and decides whether a method
- * should be sent based on the difference between new and previously sent
- * values. Only changed parameters are published to reduce traffic.
+ * @brief Destination of the messages built by processQueue(): a slot of an
+ *        MQTT lane while connected, otherwise a scratch buffer that is
+ *        appended to the outbox (or, in deep-sleep mode, the RTC queue)
+ *        together with its capture time.
  */
-void processQueue() {
-    static std::map<String, bool> methodShouldBeSent; // send flag per method
+class MessageSink {
+public:
+    MessageSink(Topic topic, MqttRing* lane, uint64_t timestampMs, bool delta)
+        : topicId_(topic), topic_(deviceIdentity.topic(topic)),
+          topicLength_(deviceIdentity.topicLength(topic)), lane_(lane), slot_(nullptr), timestampMs_(timestampMs), delta_(delta) {}
 
-    if (!mqtt.isConnected()) {
-        Serial.println("MQTT not connected. Queue will not be processed.");
+    /** Start a message. @return false if the lane is full. */
+    template <typename Writer>
+    bool open(Writer& json, const char* method) {
+        static char scratch[MQTT_BUFFER_SIZE];
+        const size_t capacity = mqttPayloadCapacity(topicLength_) + 1;
+        if (lane_) {
+            slot_ = lane_->reserve();
+            if (!slot_) {
+                return false;
+            }
+            slot_->topic = topic_;
+            slot_->qos = MQTT_TELEMETRY_QOS;
+            json.reset(slot_->payload, capacity);
+        } else {
+            json.reset(scratch, capacity);
+        }
+        json.beginRpc(method);
+        return true;
+    }
+
+    /** Bytes that must stay free for close(). */
+    size_t closingRoom() const {
+        return 2 + (lane_ ? 0 : kTimestampRoom) + (delta_ ? kDeltaRoom : 0);
+    }
+
+    /** Finish the message; an @p empty one is not sent. */
+    template <typename Writer>
+    void close(Writer& json, bool empty) {
+        json.endObject();
+        if (delta_) {
+            json.key("delta").value(true);
+        }
+        if (!lane_ && timestampMs_) {
+            json.key("ts").value(static_cast<long long>(timestampMs_));
+        }
+        json.endObject();
+        if (lane_) {
+            // A slot cannot be handed back; an empty one is committed with
+            // length 0 and skipped by processMQTTQueue().
+            slot_->length = empty ? 0 : json.length();
+            lane_->commit(slot_);
+            slot_ = nullptr;
+            return;
+        }
+        if (empty) {
+            return;
+        }
+        if (sleepQueue.active()) {
+            if (!sleepQueue.append(topicId_, json.c_str(), json.length())) {
+                Serial.println("Sleep queue full, telemetry lost.");
+            }
+        } else if (!outbox.append(topic_, json.c_str(), json.length(), timestampMs_,
+                                  MQTT_TELEMETRY_QOS)) {
+            Serial.println("Outbox rejected a message, telemetry lost.");
+        }
+    }
+
+private:
+    Topic topicId_;
+    const char* topic_;
+    size_t topicLength_;
+    MqttRing* lane_;
+    MqttSlot* slot_;
+    uint64_t timestampMs_;
+    bool delta_;
+};
+
+/** Configuration of a slot, copied under dataQueueMutex for one flush. */
+struct ParamConfig {
+    MethodId method;
+    uint8_t precision;
+    uint8_t aggregate;
+    uint8_t history;
+};
+
+/**
+ * @brief Write the unpublished history samples numbered before @p end as
+ *        `"t0":<epoch ms>,"samples":[[dt,v],...]`, dt in ms after t0.
+ */
+template <typename Writer>
+void writeHistory(Writer& json, const ParamConfig& config, uint32_t end) {
+    MutexLock lock(dataQueueMutex);
+    const SampleHistory& history = paramRegistry.history(config.history);
+    uint32_t number = history.first();
+    if (static_cast<int32_t>(end - number) <= 0) {
         return;
     }
+    const uint64_t t0 = history.at(number).timestampMs;
+    json.key("t0").value(static_cast<long long>(t0));
+    json.key("samples").beginArray();
+    for (; number != end; number++) {
+        const HistorySample& sample = history.at(number);
+        json.beginArray();
+        json.value(static_cast<long long>(sample.timestampMs - t0));
+        json.value(sample.value, config.precision);
+        json.endArray();
+    }
+    json.endArray();
+}
 
-    // Transfer ownership of queued items into a local container
-    std::map<String, std::unique_ptr<DataItem>> localQueue;
+/**
+ * @brief Write `"name":{"value":...,"ts":...}` for one parameter, followed by
+ *        its window statistics and sample history when it keeps them.
+ */
+template <typename Writer>
+void writeParam(Writer& json, const char* name, const ParamConfig& config,
+                const SampleValue& value, uint64_t timestampMs, const WindowAggregate& window,
+                uint32_t historyEnd) {
+    json.key(name).beginObject();
+    json.key("value").value(value, config.precision);
+    if (timestampMs) {
+        json.key("ts").value(static_cast<long long>(timestampMs));
+    }
+    if (window.count > 0) {
+        json.key("min").value(window.min, config.precision);
+        json.key("max").value(window.max, config.precision);
+        json.key("mean").value(window.mean, config.precision);
+        json.key("count").value(static_cast<unsigned long>(window.count));
+        if ((config.aggregate & PARAM_AGG_VARIANCE) == PARAM_AGG_VARIANCE) {
+            json.key("var").value(window.variance(), min(config.precision + 2, 9));
+        }
+    }
+    if (config.aggregate & PARAM_AGG_HISTORY) {
+        writeHistory(json, config, historyEnd);
+    }
+    json.endObject();
+}
+
+}  // namespace
+
+/**
+ * @brief Store the value of a DataItem in its registry slot.
+ */
+void queueDataItem(const DataItem& item) {
+    String name = item.getParamName();
+    String method = item.getMethodType();
+    const uint64_t timestampMs = epochMillis();
     {
         MutexLock lock(dataQueueMutex);
-        if (dataQueue.empty()) {
+        ParamId id = paramRegistry.registerParam(name.c_str(), method.c_str(),
+                                                 item.getPrecision(), item.getAggregate());
+        if (id != PARAM_INVALID) {
+            paramRegistry.store(id, item.getValue(), timestampMs);
             return;
         }
-        localQueue = std::move(dataQueue);
     }
+    Serial.printf("Cannot register parameter [%s] for [%s]\n", name.c_str(), method.c_str());
+}
 
-    // Step 1: group parameters by method and determine if method needs sending
-    std::map<String, std::vector<std::pair<String, float>>> methodParams;
+/**
+ * @brief Flush accumulated sensor data to the MQTT message queue.
+ *
+ * The function collects the registry slots that received a sample since the
+ * last call, groups them by RPC method and decides whether a method should be
+ * sent based on the difference between new and previously sent values, using
+ * the thresholds of deadBandTable. Only changed methods are published to
+ * reduce traffic.
+ *
+ * Every value carries its acquisition time ("ts", epoch ms) once the clock is
+ * set.  Parameters registered with PARAM_AGG_* flags also publish min, max,
+ * mean, count (and variance) of every sample since their last publication,
+ * and with PARAM_AGG_HISTORY the timestamped samples themselves; the window
+ * of a parameter that is not sent keeps accumulating, and a full history
+ * forces its method out so no sample is overwritten unpublished.
+ *
+ * With telemetryConfig.delta only the parameters that crossed their dead
+ * band are sent (the message gets a top-level "delta":1), and every
+ * keyframeSec each method is sent in full, including parameters that
+ * received no new sample, so the server can rebuild the complete state.
+ *
+ * Messages are JSON on stream/<id>/rpcout, or CBOR with the same structure
+ * on stream/<id>/rpcout-cbor when telemetryConfig.format selects it.
+ *
+ * While MQTT is down the messages go to the outbox instead (when
+ * outboxConfig.enabled) with a top-level "ts" capture time, and are replayed
+ * by processMQTTQueue() after reconnecting.  In deep-sleep mode they go to
+ * the RTC queue of sleepQueue (see SleepQueue.h).
+ */
+void processQueue() {
+    // Scratch state, reused between calls to keep the flush allocation free
+    static ParamId batch[PARAM_REGISTRY_SIZE];         // slots flushed this call
+    static SampleValue batchValue[PARAM_REGISTRY_SIZE];  // their pending values
+    static uint64_t batchMs[PARAM_REGISTRY_SIZE];        // acquisition times
+    static uint32_t batchHistoryEnd[PARAM_REGISTRY_SIZE];  // history samples to publish
+    static bool batchHistoryFull[PARAM_REGISTRY_SIZE];
+    static bool batchChanged[PARAM_REGISTRY_SIZE];       // crossed the dead band
+    static WindowAggregate batchWindow[PARAM_REGISTRY_SIZE];  // and sample windows
+    static ParamConfig batchConfig[PARAM_REGISTRY_SIZE];  // and configurations
+    static uint16_t nextInMethod[PARAM_REGISTRY_SIZE]; // batch chain per method
+    static uint16_t methodHead[PARAM_METHOD_COUNT];
+    static uint16_t methodTail[PARAM_METHOD_COUNT];
+    static bool methodShouldBeSent[PARAM_METHOD_COUNT];
+    static bool methodIsAlarm[PARAM_METHOD_COUNT];
+    static bool methodKeyframe[PARAM_METHOD_COUNT];      // send every parameter
+    static bool methodKeyframeSent[PARAM_METHOD_COUNT];
+    static unsigned long methodKeyframeMs[PARAM_METHOD_COUNT];
+    const uint16_t endOfChain = PARAM_INVALID;
 
-    for (const auto& item : localQueue) {
-        String methodType = item.second->getMethodType();
-        String paramName  = item.second->getParamName();
-        float newValue    = item.second->getParamValue().toFloat();
+    const bool online = mqtt.isConnected();
+    if (!online && !sleepQueue.active() && !(outboxConfig.enabled && outbox.ready())) {
+        Serial.println("MQTT not connected. Queue will not be processed.");
+        return;
+    }
 
-        if (methodType.isEmpty() || paramName.isEmpty()) {
-            Serial.println("Error: Method type or parameter name is empty, skipping this item.");
-            continue;
-        }
+    // In delta mode a method is a keyframe when it was never sent in full or
+    // its keyframe interval has passed; otherwise every message is complete.
+    const bool delta = telemetryConfig.delta;
+    const unsigned long now = millis();
+    const unsigned long keyframeMs = telemetryConfig.keyframeSec * 1000UL;
 
-        if (methodShouldBeSent.find(methodType) == methodShouldBeSent.end()) {
-            methodShouldBeSent[methodType] = false;
+    // Take the pending samples out of the registry, together with the
+    // unchanged parameters of methods due for a keyframe
+    size_t count = 0;
+    size_t methodCount = 0;
+    {
+        MutexLock lock(dataQueueMutex);
+        methodCount = paramRegistry.methodCount();
+        for (size_t m = 0; m < methodCount; m++) {
+            methodKeyframe[m] = !delta || !methodKeyframeSent[m] ||
+                                (keyframeMs && now - methodKeyframeMs[m] >= keyframeMs);
+        }
+        for (ParamId id = 0; id < paramRegistry.size(); id++) {
+            ParamSlot& slot = paramRegistry.slot(id);
+            if (slot.dirty || (delta && methodKeyframe[slot.method] && slot.flush.sent)) {
+                batch[count] = id;
+                batchValue[count] = slot.pending;
+                batchMs[count] = slot.pendingMs;
+                const bool hasHistory = slot.history != PARAM_NO_HISTORY;
+                batchHistoryEnd[count] = hasHistory ? paramRegistry.history(slot.history).written : 0;
+                batchHistoryFull[count] = hasHistory && (slot.aggregate & PARAM_AGG_HISTORY) &&
+                                          paramRegistry.history(slot.history).full();
+                batchWindow[count] = slot.window;
+                slot.window.reset();
+                batchConfig[count] = {slot.method, slot.precision, slot.aggregate, slot.history};
+                slot.dirty = false;
+                count++;
+            }
         }
+    }
+    if (count == 0) {
+        return;
+    }
 
-        methodParams[methodType].push_back({paramName, newValue});
+    // Step 1: group parameters by method and determine if method needs sending
+    for (size_t m = 0; m < methodCount; m++) {
+        methodHead[m] = endOfChain;
+        methodShouldBeSent[m] = false;
+        methodIsAlarm[m] = false;
+    }
+    {
+        MutexLock bandLock(deadBandMutex);
+        for (size_t i = 0; i < count; i++) {
+            const MethodId m = batchConfig[i].method;
+            nextInMethod[i] = endOfChain;
+            if (methodHead[m] == endOfChain) {
+                methodHead[m] = i;
+            } else {
+                nextInMethod[methodTail[m]] = i;
+            }
+            methodTail[m] = i;
 
-        // Compare with last sent value to decide on sending
-        bool wasSent = (lastSentValues.find(paramName) != lastSentValues.end());
-        if (wasSent) {
-            float lastValue = lastSentValues[paramName];
-            if (paramName.startsWith("current") || paramName.startsWith("flow")) {
-                if (abs(newValue - lastValue) >= 0.3) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("voltage")) {
-                if (abs(newValue - lastValue) >= 5.0) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("power")) {
-                float change = (abs(newValue - lastValue) / lastValue) * 100.0;
-                if (change >= 5.0) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("energy")) {
-                if (abs(newValue - lastValue) >= 100.0) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("vbat")) {
-                if (abs(newValue - lastValue) >= 0.2) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("gauge")) {
-                if (abs(newValue - lastValue) >= 0.1) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName == "r00") {
-                if (abs(newValue - lastValue) >= 3.0) {
-                    methodShouldBeSent[methodType] = true;
-                }
-            } else if (paramName.startsWith("t0") ||
-                       paramName.startsWith("target-temp") ||
-                       paramName.startsWith("schedule-status")) {
-                if (abs(newValue - lastValue) >= 1.0) {
-                    methodShouldBeSent[methodType] = true;
+            // Parameters never sent before, or whose history is full, always
+            // send their full method.
+            // Text, or a sample whose type changed, is compared as a whole.
+            ParamSlot& slot = paramRegistry.slot(batch[i]);
+            ParamFlushState& state = slot.flush;
+            const SampleValue& value = batchValue[i];
+            bool changed;
+            if (!state.sent || batchHistoryFull[i]) {
+                changed = true;
+            } else if (!value.isNumeric() || value.type != state.lastSent.type) {
+                changed = !value.equals(state.lastSent);
+            } else {
+                changed = deadBandTable.exceeded(state.band, slot.name, state.lastSent.toDouble(),
+                                                 value.toDouble());
+            }
+            batchChanged[i] = changed;
+            if (delta && methodKeyframe[m]) {
+                methodShouldBeSent[m] = true;
+            }
+            if (changed) {
+                methodShouldBeSent[m] = true;
+                // A changed alarm parameter moves its whole method to the alarm lane
+                if (deadBandTable.ruleFor(state.band, slot.name).flags & DEADBAND_FLAG_ALARM) {
+                    methodIsAlarm[m] = true;
                 }
-            } else if (paramName.startsWith("cons")) {
-                if (abs(newValue - lastValue) >= 1.0) {
-                    methodShouldBeSent[methodType] = true;
+            }
+        }
+    }
+
+    // Step 2: create messages for methods that require sending, written
+    // straight into ring slots (or the outbox).  A method whose parameters do
+    // not fit one MQTT packet is split into several messages with the same
+    // method name.  The writer is JsonWriter or CborWriter, see
+    // telemetryConfig.  A delta message skips the unchanged parameters.
+    // @return false if the lane filled up before the method was queued.
+    auto writeMethod = [&](auto& json, MessageSink& sink, MethodId m) {
+        const char* method = paramRegistry.methodName(m);
+        bool messageOpen = false;
+        size_t paramsInMessage = 0;
+        for (uint16_t i = methodHead[m]; i != endOfChain; i = nextInMethod[i]) {
+            if (!methodKeyframe[m] && !batchChanged[i]) {
+                continue;
+            }
+            ParamSlot& slot = paramRegistry.slot(batch[i]);
+            for (;;) {
+                if (!messageOpen) {
+                    messageOpen = sink.open(json, method);
+                    if (!messageOpen) {
+                        break;
+                    }
+                    paramsInMessage = 0;
                 }
-            } else if (paramName.startsWith("active") ||
-                       paramName.startsWith("leak") ||
-                       paramName.startsWith("plugged") ||
-                       paramName.startsWith("methane")) {
-                if (newValue != lastValue) {
-                    methodShouldBeSent[methodType] = true;
+                const auto beforeParam = json.mark();
+                writeParam(json, slot.name, batchConfig[i], batchValue[i], batchMs[i],
+                           batchWindow[i], batchHistoryEnd[i]);
+                // Leave room for the closing braces
+                if (!json.overflow() && json.remaining() >= sink.closingRoom()) {
+                    paramsInMessage++;
+                    break;
                 }
-            } else {
-                float change = (abs(newValue - lastValue) / lastValue) * 100.0;
-                if (change >= 5.0) {
-                    methodShouldBeSent[methodType] = true;
+                json.rewind(beforeParam);
+                if (paramsInMessage == 0) {
+                    Serial.printf("Parameter [%s] does not fit an MQTT packet, dropped\n",
+                                  slot.name);
+                    break;
                 }
+                sink.close(json, false);
+                messageOpen = false;
+            }
+            if (!messageOpen) {
+                // Lane full: leave the rest of the method for the next change
+                Serial.printf("MQTT lane full. Method [%s] not queued.\n", method);
+                return false;
             }
+            if (paramsInMessage == 0) {
+                continue;
+            }
+
+            ParamFlushState& state = slot.flush;
+            if (state.sent && batchValue[i].isNumeric()) {
+                DeadBandTable::markSent(state.band, state.lastSent.toDouble(),
+                                        batchValue[i].toDouble());
+            }
+            state.lastSent = batchValue[i];
+            state.sent = true;
+            batchWindow[i].count = 0;  // published
+            if (batchConfig[i].aggregate & PARAM_AGG_HISTORY) {
+                MutexLock lock(dataQueueMutex);
+                paramRegistry.history(batchConfig[i].history).consume(batchHistoryEnd[i]);
+            }
+        }
+        if (messageOpen) {
+            sink.close(json, paramsInMessage == 0);
+        }
+        return true;
+    };
+
+    const bool cbor = telemetryConfig.format == TelemetryFormat::Cbor;
+    const uint64_t timestampMs = online ? 0 : epochMillis();
+    for (size_t m = 0; m < methodCount; m++) {
+        if (methodHead[m] == endOfChain || !methodShouldBeSent[m]) {
+            continue;
+        }
+        MqttRing* lane =
+            online ? &mqttLanes.lane(methodIsAlarm[m] ? MqttLane::Alarm : MqttLane::Bulk) : nullptr;
+        MessageSink sink(cbor ? Topic::RpcOutCbor : Topic::RpcOut, lane, timestampMs,
+                         !methodKeyframe[m]);
+        bool queued;
+        if (cbor) {
+            CborWriter writer(nullptr, 0);
+            queued = writeMethod(writer, sink, m);
         } else {
-            // Parameter never sent before - send full method
-            methodShouldBeSent[methodType] = true;
+            JsonWriter writer(nullptr, 0);
+            queued = writeMethod(writer, sink, m);
+        }
+        if (delta && methodKeyframe[m] && queued) {
+            methodKeyframeSent[m] = true;
+            methodKeyframeMs[m] = now;
         }
     }
 
-    // Step 2: create messages for methods that require sending
-    for (auto& methodIter : methodParams) {
-        const String& method = methodIter.first;
-        auto& paramList = methodIter.second;
-
-        if (methodShouldBeSent[method]) {
-            String jsonMessage = "{\"jsonrpc\":\"2.0\",\"method\":\"" + method + "\",\"params\":{";
+    // Windows of parameters that were not published carry over to the next
+    // flush, merged with the samples that arrived meanwhile
+    MutexLock lock(dataQueueMutex);
+    for (size_t i = 0; i < count; i++) {
+        if (batchWindow[i].count > 0) {
+            paramRegistry.slot(batch[i]).window.merge(batchWindow[i]);
+        }
+    }
+}
 
-            bool firstParam = true;
-            for (auto& kv : paramList) {
-                const String& paramName = kv.first;
-                float paramValue = kv.second;
+/**
+ * @brief Copy an MQTT message into a free slot of @p lane.
+ */
+bool enqueueMQTTMessage(const char* topic, const char* payload, size_t length, bool retain,
+                        uint8_t qos, MqttLane lane) {
+    if (mqttLanes.lane(lane).push(topic, payload, length, retain, qos)) {
+        return true;
+    }
+    Serial.printf("MQTT %s lane full or message too large. Dropping message for [%s].\n",
+                  MqttLanes::laneName(lane), topic);
+    return false;
+}
 
-                if (!firstParam) {
-                    jsonMessage += ",";
-                }
-                jsonMessage += "\"" + paramName + "\":{\"value\":" + String(paramValue, 2) + "}";
-                firstParam = false;
-            }
-            jsonMessage += "}}";
+bool enqueueMQTTMessage(const String& topic, const String& payload, bool retain, int qos,
+                        MqttLane lane) {
+    return enqueueMQTTMessage(topic.c_str(), payload.c_str(), payload.length(), retain,
+                              static_cast<uint8_t>(qos), lane);
+}
 
-            String topic = "stream/" + String(getChipID()) + "/rpcout";
-            enqueueMQTTMessage(topic, jsonMessage, false, 0);
+/**
+ * @brief Hand a message to the in-flight window (QoS 1) or to the library.
+ *        Called with mqttMutex held.
+ * @param[out] packetId Window packet ID of a QoS 1 message, otherwise 0.
+ */
+static bool publishMessage(const String& topic, uint8_t* payload, size_t length, bool retain,
+                           uint8_t qos, uint16_t& packetId) {
+    packetId = 0;
+    if (qos == 1) {
+        packetId = mqttInflight.publish(topic.c_str(), payload, length, retain, millis());
+        return packetId != 0;
+    }
+    return mqtt.publish(topic, payload, length, retain, qos);
+}
 
-            for (auto& kv : paramList) {
-                lastSentValues[kv.first] = kv.second;
-            }
+// Packet IDs of lane messages in the in-flight window, 0: free.  Outbox and
+// RTC records are not listed: their publishers send them again themselves.
+static uint16_t laneIds[MQTT_INFLIGHT_WINDOW];
 
-            methodShouldBeSent[method] = false;
+static void rememberLaneId(uint16_t packetId) {
+    for (uint16_t& id : laneIds) {
+        if (id == 0 || mqttInflight.delivery(id) != MqttDelivery::InFlight) {
+            id = packetId;
+            return;
         }
     }
+}
 
-    // Step 3: clear local copy
-    localQueue.clear();
+void storeDroppedMessage(uint16_t packetId, const char* topic, size_t topicLength,
+                         const uint8_t* payload, size_t length, void* context) {
+    uint16_t* lane = nullptr;
+    for (uint16_t& id : laneIds) {
+        if (id == packetId) {
+            lane = &id;
+        }
+    }
+    if (!lane) {
+        return;
+    }
+    *lane = 0;
+    // Replayed from the outbox, without the retain flag and capture time
+    char name[MQTT_RING_TOPIC_SIZE];
+    bool stored = false;
+    if (topicLength < sizeof(name) && outboxConfig.enabled) {
+        memcpy(name, topic, topicLength);
+        name[topicLength] = '\0';
+        stored = outbox.append(name, reinterpret_cast<const char*>(payload), length, 0, 1);
+    }
+    if (!stored) {
+        Serial.println("MQTT message given up by the in-flight window, lost.");
+    }
 }
 
 /**
- * @brief Add an MQTT message to the queue.
+ * @brief Publish the next outbox record if the replay rate allows it.
+ *
+ * Replay is paced by a token bucket refilled at outboxConfig.drainPerSec
+ * messages per second (at most one second of burst), so a long backlog does
+ * not crowd out live traffic.  QoS 1 records are pipelined through the
+ * in-flight window: the packet IDs of the records sent are kept oldest
+ * first, and a record leaves the outbox once it and every record before it
+ * are acknowledged.  If the window gives one up, replay starts again from
+ * that record.
+ * @return Payload bytes published, -1 if nothing was published.
  */
-void enqueueMQTTMessage(const String& topic, const String& payload, bool retain, int qos) {
-    std::lock_guard<std::mutex> lock(mqttQueueMutex);
+static int replayOutbox() {
+    static OutboxRecord record;
+    static String topic;
+    static uint8_t attempts = 0;
+    static unsigned long lastRefill = 0;
+    static uint32_t credit = 0;  // 1000 per message
+    static uint16_t sentIds[OUTBOX_READ_AHEAD];  // Of the sent records, oldest first; 0: QoS 0
+    static size_t sentCount = 0;
 
-    if (mqttQueue.size() >= 10) {
-        Serial.println("Queue full. Dropping oldest message.");
-        mqttQueue.pop();
+    if (sentCount != outbox.sentCount()) {
+        // The outbox dropped a segment or was cleared under the sent records
+        sentCount = 0;
+        outbox.rewind();
+    }
+    while (sentCount > 0) {
+        const MqttDelivery delivery = sentIds[0] == 0 ? MqttDelivery::Acknowledged
+                                                      : mqttInflight.delivery(sentIds[0]);
+        if (delivery == MqttDelivery::InFlight) {
+            break;
+        }
+        if (delivery == MqttDelivery::Dropped) {
+            sentCount = 0;  // Again from this record
+            outbox.rewind();
+            break;
+        }
+        outbox.advance();
+        memmove(sentIds, sentIds + 1, --sentCount * sizeof(sentIds[0]));
     }
 
-    mqttQueue.push({topic, payload, retain, qos});
+    const uint32_t rate = outboxConfig.drainPerSec;
+    const unsigned long now = millis();
+    credit = min<uint32_t>(credit + min(now - lastRefill, 1000UL) * rate, rate * 1000);
+    lastRefill = now;
+    if (credit < 1000 || !outbox.peek(record)) {
+        return -1;
+    }
+    if (record.qos == 1 && mqttInflight.full()) {
+        return -1;  // Until a PUBACK frees the window
+    }
+    topic = record.topic;
+
+    bool publishResult;
+    uint16_t packetId;
+    {
+        MutexLock lock(mqttMutex);
+        publishResult = publishMessage(topic, reinterpret_cast<uint8_t*>(record.payload),
+                                       record.length, false, record.qos, packetId);
+    }
+    if (!publishResult) {
+        Serial.printf("MQTT Replay Failed: Topic: %s, Payload: %s\n", record.topic,
+                      record.payload);
+        if (attempts < MQTT_RING_MAX_ATTEMPTS) {
+            attempts++;
+        }
+        if (attempts < MQTT_RING_MAX_ATTEMPTS || sentCount > 0) {
+            return -1;  // Given up only as the oldest record
+        }
+        Serial.println("Stored MQTT message dropped after repeated failures.");
+        attempts = 0;
+        outbox.markSent();
+        outbox.advance();
+        return -1;
+    }
+    attempts = 0;
+    credit -= 1000;
+    outbox.markSent();
+    if (packetId == 0 && sentCount == 0) {
+        outbox.advance();  // QoS 0: done once sent
+    } else {
+        sentIds[sentCount++] = packetId;  // advance() once acknowledged, in order
+    }
+    return record.length;
 }
 
 /**
- * @brief Publish one message from the MQTT queue if the client is connected.
+ * @brief Publish one message: the head of the highest-priority lane, or an
+ *        outbox record when the lanes are empty.
+ *
+ * The message is published directly from its slot; a QoS 1 message leaves
+ * it for the in-flight window, which waits for the PUBACK and, if it gives
+ * the message up, hands it to storeDroppedMessage().  On failure it
+ * stays at the head of its lane so ordering is kept, and is dropped after
+ * MQTT_RING_MAX_ATTEMPTS.  A full window is not a failure: the message waits.
+ * @return Payload bytes published (0 for a skipped empty message), -1 if
+ *         there was nothing to publish or the publish failed.
  */
-void processMQTTQueue() {
+static int publishNext() {
+    MqttRing* lane = mqttLanes.next();
+    if (!lane) {
+        return replayOutbox();
+    }
+    MqttSlot* message = lane->peek();
+    if (!message) {
+        mqttLanes.done(lane);
+        return -1;
+    }
+    if (message->length == 0) {
+        lane->pop(false);
+        mqttLanes.done(lane);
+        return 0;
+    }
+    if (message->qos == 1 && mqttInflight.full()) {
+        mqttLanes.done(lane);
+        return -1;  // Until a PUBACK frees the window
+    }
+
+    bool publishResult;
+    uint16_t packetId;
+    {
+        MutexLock lock(mqttMutex);
+        publishResult = publishMessage(message->topic,
+                                       reinterpret_cast<uint8_t*>(message->payload),
+                                       message->length, message->retain, message->qos, packetId);
+    }
+    int result = -1;
+    if (!publishResult) {
+        Serial.printf("MQTT Publish Failed: Topic: %s, Payload: %s\n", message->topic.c_str(),
+                      message->payload);
+        if (!lane->retryOrDrop(message)) {
+            Serial.println("MQTT message dropped after repeated failures.");
+        }
+    } else {
+        result = message->length;
+        if (packetId != 0) {
+            rememberLaneId(packetId);  // To the outbox if the window gives it up
+        }
+        lane->pop(true);
+    }
+    mqttLanes.done(lane);
+    return result;
+}
+
+static MqttDrainStats drainStats = {};
+
+/**
+ * @brief Publish queued messages while the client is connected.
+ *
+ * Lanes are served in priority order (see MqttLanes::next()); when they are
+ * empty, messages stored in the outbox while offline are replayed oldest
+ * first.  Publishing continues until nothing is left, a publish fails, the
+ * QoS 1 window is full (see MqttInflight.h), or @p timeBudgetMs /
+ * @p byteBudget is used up, yielding between messages.
+ * Successful publishes are logged once per call rather than per message:
+ * printing every payload at 115200 baud cost more than publishing it.
+ */
+void processMQTTQueue(uint32_t timeBudgetMs, size_t byteBudget) {
+    static unsigned long windowStart = 0;
+    static uint32_t windowCount = 0;
+
+    outbox.tick(millis());
     if (!mqtt.isConnected()) {
         return;
     }
-
-    MQTTMessage message;
     {
-        std::lock_guard<std::mutex> lock(mqttQueueMutex);
-        if (!mqttQueue.empty()) {
-            message = mqttQueue.front();
-            mqttQueue.pop();
-        } else {
-            return;
+        // Unacknowledged messages go before new ones
+        MutexLock lock(mqttMutex);
+        mqttInflight.retransmit(millis());
+    }
+
+    const unsigned long start = micros();
+    uint32_t published = 0;
+    size_t bytes = 0;
+    for (;;) {
+        const int sent = publishNext();
+        if (sent < 0) {
+            break;
         }
+        if (sent > 0) {
+            published++;
+            bytes += sent;
+        }
+        if (bytes >= byteBudget) {
+            drainStats.byteBudgetStops++;
+            break;
+        }
+        if (micros() - start >= timeBudgetMs * 1000UL) {
+            drainStats.timeBudgetStops++;
+            break;
+        }
+        taskYIELD();
+    }
+    if (published > 0) {
+        Serial.printf("MQTT published %u messages, %u bytes in %lu us\n", (unsigned)published,
+                      (unsigned)bytes, micros() - start);
     }
 
-    MutexLock lock(mqttMutex);
-    bool publishResult = mqtt.publish(message.topic.c_str(), message.payload.c_str(), message.retain, message.qos);
-    if (!publishResult) {
-        Serial.printf("MQTT Publish Failed: Topic: %s, Payload: %s\n", message.topic.c_str(), message.payload.c_str());
-        enqueueMQTTMessage(message.topic, message.payload, message.retain, message.qos);
-    } else {
-        Serial.printf("MQTT Publish Success: Topic: %s, Payload: %s\n", message.topic.c_str(), message.payload.c_str());
+    drainStats.calls++;
+    drainStats.published += published;
+    drainStats.bytes += bytes;
+    windowCount += published;
+    const unsigned long now = millis();
+    if (now - windowStart >= 1000) {
+        drainStats.ratePerSec = windowCount * 1000UL / (now - windowStart);
+        drainStats.peakRatePerSec = max(drainStats.peakRatePerSec, drainStats.ratePerSec);
+        windowStart = now;
+        windowCount = 0;
     }
 }
 
+MqttDrainStats mqttDrainStats() { return drainStats; }
+
+/**
+ * Records are published straight through the in-flight window and leave the
+ * RTC queue oldest first, each once its PUBACK came (a QoS 0 record once it
+ * was sent).  When the window gives a record up, it and the records after it
+ * are published again.  processMQTTQueue() runs in between for the
+ * retransmissions and whatever the lanes hold.
+ */
+bool publishSleepQueue(unsigned long deadline, void (*poll)()) {
+    struct Unacked {
+        uint16_t packetId;  ///< 0: QoS 0, done once sent
+        uint16_t bytes;     ///< Queue bytes of the record
+    };
+    static String topicName;
+    Unacked unacked[MQTT_INFLIGHT_WINDOW];
+    size_t unackedCount = 0;
+    size_t sentBytes = 0;  // Queue bytes published and not acknowledged yet
+    while (sleepQueue.used() > 0) {
+        if ((long)(millis() - deadline) >= 0 || !mqtt.isConnected()) {
+            return false;
+        }
+        bool progress = false;
+        while (unackedCount > 0) {
+            const Unacked& oldest = unacked[0];
+            const MqttDelivery delivery = oldest.packetId == 0
+                                              ? MqttDelivery::Acknowledged
+                                              : mqttInflight.delivery(oldest.packetId);
+            if (delivery == MqttDelivery::InFlight) {
+                break;
+            }
+            if (delivery == MqttDelivery::Dropped) {
+                unackedCount = 0;  // Again from the oldest
+                sentBytes = 0;
+                break;
+            }
+            sleepQueue.consume(oldest.bytes);
+            sentBytes -= oldest.bytes;
+            memmove(unacked, unacked + 1, --unackedCount * sizeof(Unacked));
+            progress = true;
+        }
+
+        Topic topic;
+        const char* payload;
+        uint16_t length;
+        size_t next;
+        while (unackedCount < MQTT_INFLIGHT_WINDOW &&
+               !(MQTT_TELEMETRY_QOS == 1 && mqttInflight.full()) &&
+               (next = sleepQueue.read(sentBytes, topic, payload, length)) != 0) {
+            topicName = deviceIdentity.topic(topic);
+            bool publishResult;
+            uint16_t packetId;
+            {
+                MutexLock lock(mqttMutex);
+                uint8_t* bytes = reinterpret_cast<uint8_t*>(const_cast<char*>(payload));
+                publishResult = publishMessage(topicName, bytes, length, false,
+                                               MQTT_TELEMETRY_QOS, packetId);
+            }
+            if (!publishResult) {
+                break;
+            }
+            unacked[unackedCount++] = {packetId, static_cast<uint16_t>(next - sentBytes)};
+            sentBytes = next;
+            progress = true;
+        }
+        if (sentBytes == 0 && sleepQueue.used() > 0 &&
+            sleepQueue.read(0, topic, payload, length) == 0) {
+            Serial.println("Sleep queue corrupt, dropped.");
+            sleepQueue.consume(sleepQueue.used());
+            return false;
+        }
+
+        poll();
+        processMQTTQueue();
+        if (!progress) {
+            vTaskDelay(1);
+        }
+    }
+    return true;
+}
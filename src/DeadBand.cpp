@@ -0,0 +1,220 @@
+/**
+ * @file DeadBand.cpp
+ * @brief Implementation of the dead-band rule table.
+ */
+
+#include "DeadBand.h"
+
+namespace {
+
+/** Built-in rules, evaluated after the runtime ones.  Order matters. */
+const DeadBandRule kDefaultRules[] = {
+    {"current", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 0.3f, 0.0f},
+    {"flow", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 0.3f, 0.0f},
+    {"voltage", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 5.0f, 0.0f},
+    {"power", DeadBandMatch::Prefix, DeadBandKind::Relative, 0, 5.0f, 0.0f},
+    {"energy", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 100.0f, 0.0f},
+    {"vbat", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 0.2f, 0.0f},
+    {"gauge", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 0.1f, 0.0f},
+    {"r00", DeadBandMatch::Name, DeadBandKind::Absolute, 0, 3.0f, 0.0f},
+    {"t0", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 1.0f, 0.0f},
+    {"target-temp", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 1.0f, 0.0f},
+    {"schedule-status", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 1.0f, 0.0f},
+    {"cons", DeadBandMatch::Prefix, DeadBandKind::Absolute, 0, 1.0f, 0.0f},
+    {"active", DeadBandMatch::Prefix, DeadBandKind::Exact, 0, 0.0f, 0.0f},
+    {"leak", DeadBandMatch::Prefix, DeadBandKind::Exact, DEADBAND_FLAG_ALARM, 0.0f, 0.0f},
+    {"plugged", DeadBandMatch::Prefix, DeadBandKind::Exact, 0, 0.0f, 0.0f},
+    {"methane", DeadBandMatch::Prefix, DeadBandKind::Exact, DEADBAND_FLAG_ALARM, 0.0f, 0.0f},
+    // Catch-all: 5 % relative change.
+    {"", DeadBandMatch::Prefix, DeadBandKind::Relative, 0, 5.0f, 0.0f},
+};
+const size_t kDefaultCount = sizeof(kDefaultRules) / sizeof(kDefaultRules[0]);
+
+const uint8_t kBlobMagic = 0xDB;
+const uint8_t kBlobVersion = 1;
+
+bool matches(const DeadBandRule& rule, const char* name) {
+    if (rule.match == DeadBandMatch::Name) {
+        return strcmp(name, rule.pattern) == 0;
+    }
+    return strncmp(name, rule.pattern, strlen(rule.pattern)) == 0;
+}
+
+}  // namespace
+
+DeadBandTable deadBandTable;
+
+DeadBandTable::DeadBandTable() : customCount_(0), generation_(1) {}
+
+void DeadBandTable::invalidate() {
+    // Generation 0 is reserved so that a default-constructed state never
+    // looks resolved.
+    if (++generation_ == 0) {
+        generation_ = 1;
+    }
+}
+
+size_t DeadBandTable::ruleCount() const { return customCount_ + kDefaultCount; }
+
+const DeadBandRule& DeadBandTable::ruleAt(size_t index) const {
+    if (index < customCount_) {
+        return custom_[index];
+    }
+    index -= customCount_;
+    return kDefaultRules[index < kDefaultCount ? index : kDefaultCount - 1];
+}
+
+uint8_t DeadBandTable::resolve(const char* name) const {
+    const size_t count = ruleCount();
+    for (size_t i = 0; i < count; i++) {
+        if (matches(ruleAt(i), name)) {
+            return static_cast<uint8_t>(i);
+        }
+    }
+    return static_cast<uint8_t>(count - 1);
+}
+
+const DeadBandRule& DeadBandTable::ruleFor(DeadBandState& state, const char* name) {
+    if (state.rule == DEADBAND_UNRESOLVED || state.generation != generation_) {
+        state.rule = resolve(name);
+        state.generation = generation_;
+    }
+    return ruleAt(state.rule);
+}
+
+bool DeadBandTable::exceeded(DeadBandState& state, const char* name, double lastValue,
+                             double newValue) {
+    const DeadBandRule& rule = ruleFor(state, name);
+
+    // Doubles keep large counters (energy) exact well past float range.
+    const double delta = newValue - lastValue;
+    if (rule.kind == DeadBandKind::Exact) {
+        return delta != 0.0;
+    }
+
+    double change = fabs(delta);
+    if (rule.kind == DeadBandKind::Relative) {
+        if (lastValue == 0.0) {
+            // Any move away from zero counts; avoids dividing by zero.
+            return newValue != 0.0;
+        }
+        change = change / fabs(lastValue) * 100.0;
+    }
+
+    double threshold = rule.threshold;
+    const int8_t direction = delta > 0.0 ? 1 : (delta < 0.0 ? -1 : 0);
+    if (direction != 0 && state.lastDirection != 0 && direction != state.lastDirection) {
+        threshold += rule.hysteresis;
+    }
+    return change >= threshold;
+}
+
+void DeadBandTable::markSent(DeadBandState& state, double lastValue, double newValue) {
+    if (newValue > lastValue) {
+        state.lastDirection = 1;
+    } else if (newValue < lastValue) {
+        state.lastDirection = -1;
+    }
+}
+
+bool DeadBandTable::setRule(const DeadBandRule& rule) {
+    if (rule.pattern[DEADBAND_PATTERN_SIZE - 1] != '\0' || rule.threshold < 0.0f ||
+        rule.hysteresis < 0.0f) {
+        return false;
+    }
+    for (size_t i = 0; i < customCount_; i++) {
+        if (custom_[i].match == rule.match && strcmp(custom_[i].pattern, rule.pattern) == 0) {
+            custom_[i] = rule;
+            invalidate();
+            return true;
+        }
+    }
+    if (customCount_ >= DEADBAND_MAX_CUSTOM_RULES) {
+        return false;
+    }
+    // Newest rule first so that a later, more specific override wins.
+    memmove(&custom_[1], &custom_[0], customCount_ * sizeof(DeadBandRule));
+    custom_[0] = rule;
+    customCount_++;
+    invalidate();
+    return true;
+}
+
+bool DeadBandTable::removeRule(const char* pattern, DeadBandMatch match) {
+    for (size_t i = 0; i < customCount_; i++) {
+        if (custom_[i].match == match && strcmp(custom_[i].pattern, pattern) == 0) {
+            memmove(&custom_[i], &custom_[i + 1], (customCount_ - i - 1) * sizeof(DeadBandRule));
+            customCount_--;
+            invalidate();
+            return true;
+        }
+    }
+    return false;
+}
+
+void DeadBandTable::resetRules() {
+    customCount_ = 0;
+    invalidate();
+}
+
+size_t DeadBandTable::serialize(uint8_t* out, size_t size) const {
+    const size_t needed = 4 + customCount_ * sizeof(DeadBandRule);
+    if (!out || size < needed) {
+        return 0;
+    }
+    out[0] = kBlobMagic;
+    out[1] = kBlobVersion;
+    out[2] = customCount_;
+    out[3] = sizeof(DeadBandRule);
+    memcpy(out + 4, custom_, customCount_ * sizeof(DeadBandRule));
+    return needed;
+}
+
+bool DeadBandTable::deserialize(const uint8_t* data, size_t size) {
+    if (!data || size < 4 || data[0] != kBlobMagic ||
+        data[1] != kBlobVersion ||
+        data[3] != sizeof(DeadBandRule) || data[2] > DEADBAND_MAX_CUSTOM_RULES ||
+        size < 4 + data[2] * sizeof(DeadBandRule)) {
+        return false;
+    }
+    DeadBandRule rules[DEADBAND_MAX_CUSTOM_RULES];
+    memcpy(rules, data + 4, data[2] * sizeof(DeadBandRule));
+    for (size_t i = 0; i < data[2]; i++) {
+        if (rules[i].pattern[DEADBAND_PATTERN_SIZE - 1] != '\0' ||
+            static_cast<uint8_t>(rules[i].kind) > static_cast<uint8_t>(DeadBandKind::Exact) ||
+            static_cast<uint8_t>(rules[i].match) > static_cast<uint8_t>(DeadBandMatch::Name)) {
+            return false;
+        }
+    }
+    memcpy(custom_, rules, data[2] * sizeof(DeadBandRule));
+    customCount_ = data[2];
+    invalidate();
+    return true;
+}
+
+bool DeadBandTable::parseKind(const char* text, DeadBandKind& kind) {
+    if (!text) {
+        return false;
+    }
+    if (strcmp(text, "absolute") == 0) {
+        kind = DeadBandKind::Absolute;
+    } else if (strcmp(text, "relative") == 0) {
+        kind = DeadBandKind::Relative;
+    } else if (strcmp(text, "exact") == 0) {
+        kind = DeadBandKind::Exact;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool DeadBandTable::parseMatch(const char* text, DeadBandMatch& match) {
+    if (!text || strcmp(text, "prefix") == 0) {
+        match = DeadBandMatch::Prefix;
+    } else if (strcmp(text, "name") == 0) {
+        match = DeadBandMatch::Name;
+    } else {
+        return false;
+    }
+    return true;
+}
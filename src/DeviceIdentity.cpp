@@ -0,0 +1,79 @@
+/**
+ * @file DeviceIdentity.cpp
+ * @brief Chip ID and topic table construction.
+ */
+
+#include "DeviceIdentity.h"
+
+DeviceIdentity deviceIdentity;
+
+namespace {
+
+/** How each Topic is formed around the chip ID. */
+struct TopicPattern {
+    Topic topic;
+    const char* prefix;
+    const char* suffix;
+};
+
+constexpr TopicPattern kTopicPatterns[] = {
+    {Topic::RpcOut, "stream/", "/rpcout"},
+    {Topic::RpcOutCbor, "stream/", "/rpcout-cbor"},
+    {Topic::Version, "stream/", "/version"},
+    {Topic::TimeEcho, "time/", ""},
+    {Topic::CommandTime, "command/", "/time"},
+    {Topic::CommandUpgrade, "command/", "/upgrade"},
+    {Topic::CommandDeadBand, "command/", "/deadband"},
+    {Topic::CommandOutbox, "command/", "/outbox"},
+    {Topic::CommandTelemetry, "command/", "/telemetry"},
+    {Topic::CommandPower, "command/", "/power"},
+    {Topic::CommandSleep, "command/", "/sleep"},
+    {Topic::CommandMqtt, "command/", "/mqtt"},
+    {Topic::CommandReboot, "command/", "/reboot"},
+    {Topic::CommandReset, "command/", "/reset"},
+};
+static_assert(sizeof(kTopicPatterns) / sizeof(kTopicPatterns[0]) ==
+                  static_cast<size_t>(Topic::Count),
+              "Every Topic needs a pattern");
+
+}  // namespace
+
+DeviceIdentity::DeviceIdentity() : ready_(false), chipId_(), clientId_(), topics_(), topicLengths_() {}
+
+void DeviceIdentity::begin() {
+    if (ready_) {
+        return;
+    }
+    uint8_t mac[6];
+    readDeviceMac(mac);
+    snprintf(chipId_, sizeof(chipId_), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2],
+             mac[3], mac[4], mac[5]);
+    snprintf(clientId_, sizeof(clientId_), "ESP32#%s", chipId_);
+    for (const TopicPattern& pattern : kTopicPatterns) {
+        const size_t index = static_cast<size_t>(pattern.topic);
+        const int length = snprintf(topics_[index], sizeof(topics_[index]), "%s%s%s",
+                                    pattern.prefix, chipId_, pattern.suffix);
+        topicLengths_[index] = length;
+    }
+    ready_ = true;
+}
+
+const char* DeviceIdentity::chipId() {
+    begin();
+    return chipId_;
+}
+
+const char* DeviceIdentity::clientId() {
+    begin();
+    return clientId_;
+}
+
+const char* DeviceIdentity::topic(Topic topic) {
+    begin();
+    return topics_[static_cast<size_t>(topic)];
+}
+
+size_t DeviceIdentity::topicLength(Topic topic) {
+    begin();
+    return topicLengths_[static_cast<size_t>(topic)];
+}
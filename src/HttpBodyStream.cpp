@@ -0,0 +1,140 @@
+/**
+ * @file HttpBodyStream.cpp
+ * @brief Implementation of the HTTP body reader.
+ */
+
+#include "HttpBodyStream.h"
+
+HttpBodyStream::HttpBodyStream(Stream& source, int32_t length, bool chunked)
+    : source_(source),
+      remaining_(chunked ? 0 : length),
+      chunked_(chunked),
+      done_(!chunked && length == 0),
+      failed_(false),
+      peeked_(-1),
+      bodyBytes_(0) {}
+
+int HttpBodyStream::sourceRead() {
+    uint8_t c;
+    return source_.readBytes(&c, 1) == 1 ? c : -1;
+}
+
+bool HttpBodyStream::readLine(char* line, size_t size) {
+    size_t length = 0;
+    for (;;) {
+        const int c = sourceRead();
+        if (c < 0) {
+            return false;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (length + 1 >= size) {
+            return false;
+        }
+        line[length++] = static_cast<char>(c);
+    }
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    line[length] = '\0';
+    return true;
+}
+
+bool HttpBodyStream::startChunk() {
+    char line[HTTP_CHUNK_LINE_MAX];
+    if (!readLine(line, sizeof(line))) {
+        failed_ = true;
+        return false;
+    }
+    // Size in hex, optionally followed by ";extension"
+    char* end;
+    const unsigned long size = strtoul(line, &end, 16);
+    if (end == line || (*end != '\0' && *end != ';' && *end != ' ') || size > INT32_MAX) {
+        failed_ = true;
+        return false;
+    }
+    if (size == 0) {
+        // Last chunk: skip the trailer fields up to the empty line
+        do {
+            if (!readLine(line, sizeof(line))) {
+                failed_ = true;
+                return false;
+            }
+        } while (line[0] != '\0');
+        done_ = true;
+        return false;
+    }
+    remaining_ = static_cast<int32_t>(size);
+    return true;
+}
+
+int HttpBodyStream::read() {
+    if (peeked_ >= 0) {
+        const int c = peeked_;
+        peeked_ = -1;
+        return c;
+    }
+    if (done_ || failed_) {
+        return -1;
+    }
+    if (chunked_ && remaining_ == 0 && !startChunk()) {
+        return -1;
+    }
+    const int c = sourceRead();
+    if (c < 0) {
+        // Without a length the body ends with the connection
+        if (remaining_ < 0) {
+            done_ = true;
+        } else {
+            failed_ = true;
+        }
+        return -1;
+    }
+    bodyBytes_++;
+    if (remaining_ > 0 && --remaining_ == 0) {
+        if (!chunked_) {
+            done_ = true;
+        } else {
+            char line[HTTP_CHUNK_LINE_MAX];
+            // CRLF after the chunk data
+            if (!readLine(line, sizeof(line)) || line[0] != '\0') {
+                failed_ = true;
+            }
+        }
+    }
+    return c;
+}
+
+int HttpBodyStream::peek() {
+    if (peeked_ < 0) {
+        peeked_ = read();
+    }
+    return peeked_;
+}
+
+int HttpBodyStream::available() {
+    if (peeked_ >= 0) {
+        return 1;
+    }
+    if (done_ || failed_) {
+        return 0;
+    }
+    const int buffered = source_.available();
+    if (remaining_ > 0) {
+        return min<int>(buffered, remaining_);
+    }
+    // Next chunk not started yet: at least its size line is there
+    return remaining_ < 0 ? buffered : 0;
+}
+
+bool HttpBodyStream::finish() {
+    peeked_ = -1;
+    for (size_t skipped = 0; skipped < HTTP_BODY_DRAIN_MAX; skipped++) {
+        if (read() < 0) {
+            break;
+        }
+    }
+    // A body that ends with the connection leaves nothing to reuse
+    return done_ && !failed_ && remaining_ >= 0;
+}
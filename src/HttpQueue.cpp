@@ -0,0 +1,237 @@
+/**
+ * @file HttpQueue.cpp
+ * @brief Implementation of the HTTP worker's request queue.
+ */
+
+#include "HttpQueue.h"
+
+HttpQueue httpQueue;
+
+HttpQueue::HttpQueue() : entries_(), endpoints_(), nextId_(1), stats_() {}
+
+uint32_t HttpQueue::endpointHash(const String& url) {
+    // FNV-1a over scheme, host and path
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < url.length() && url[i] != '?' && url[i] != '#'; i++) {
+        hash = (hash ^ static_cast<uint8_t>(url[i])) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+uint32_t HttpQueue::msUntilAllowed(uint32_t endpoint, uint32_t nowMs) const {
+    for (const Endpoint& entry : endpoints_) {
+        if (entry.hash == endpoint) {
+            const uint32_t elapsed = nowMs - entry.lastStartMs;
+            return elapsed >= HTTP_MIN_INTERVAL_MS ? 0 : HTTP_MIN_INTERVAL_MS - elapsed;
+        }
+    }
+    return 0;
+}
+
+bool HttpQueue::targetBusy(const void* target) const {
+    if (!target) {
+        return false;
+    }
+    for (const Entry& entry : entries_) {
+        if (entry.target == target &&
+            (entry.state == State::Running || entry.state == State::Finished ||
+             entry.state == State::Dispatching)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpQueue::started(uint32_t endpoint, uint32_t nowMs) {
+    Endpoint* slot = &endpoints_[0];
+    for (Endpoint& entry : endpoints_) {
+        if (entry.hash == endpoint) {
+            slot = &entry;
+            break;
+        }
+        // Otherwise replace the endpoint used longest ago
+        if (entry.hash == 0 ||
+            (slot->hash != 0 && nowMs - entry.lastStartMs > nowMs - slot->lastStartMs)) {
+            slot = &entry;
+        }
+    }
+    slot->hash = endpoint;
+    slot->lastStartMs = nowMs;
+}
+
+uint32_t HttpQueue::submit(HttpMethod method, const String& url, const String& body,
+                           HttpParser parser, void* target, HttpCallback callback, void* context,
+                           uint32_t nowMs) {
+    stats_.submitted++;
+    for (Entry& entry : entries_) {
+        if ((entry.state != State::Queued && entry.state != State::Running) ||
+            entry.method != method || entry.parser != parser || entry.target != target ||
+            entry.url != url || entry.body != body) {
+            continue;
+        }
+        for (uint8_t i = 0; i < entry.waiters; i++) {
+            if (entry.callbacks[i] == callback && entry.contexts[i] == context) {
+                stats_.deduplicated++;
+                return entry.id;
+            }
+        }
+        if (entry.waiters < HTTP_WAITERS) {
+            entry.callbacks[entry.waiters] = callback;
+            entry.contexts[entry.waiters] = context;
+            entry.waiters++;
+            stats_.deduplicated++;
+            return entry.id;
+        }
+    }
+
+    for (Entry& entry : entries_) {
+        if (entry.state != State::Free) {
+            continue;
+        }
+        entry.state = State::Queued;
+        entry.id = nextId_++;
+        if (nextId_ == 0) {
+            nextId_ = 1;
+        }
+        entry.method = method;
+        entry.endpoint = endpointHash(url);
+        entry.delayed = msUntilAllowed(entry.endpoint, nowMs) > 0;
+        entry.queuedMs = nowMs;
+        entry.url = url;
+        entry.body = body;
+        entry.parser = parser;
+        entry.target = target;
+        entry.waiters = 0;
+        if (callback) {
+            entry.callbacks[0] = callback;
+            entry.contexts[0] = context;
+            entry.waiters = 1;
+        }
+        return entry.id;
+    }
+    stats_.rejected++;
+    return 0;
+}
+
+bool HttpQueue::next(uint32_t nowMs, HttpJob& job) {
+    Entry* oldest = nullptr;
+    for (Entry& entry : entries_) {
+        if (entry.state != State::Queued) {
+            continue;
+        }
+        if (msUntilAllowed(entry.endpoint, nowMs) > 0) {
+            entry.delayed = true;
+            continue;
+        }
+        if (targetBusy(entry.target)) {
+            continue;
+        }
+        // IDs grow, so the smallest one was queued first
+        if (!oldest || static_cast<int32_t>(entry.id - oldest->id) < 0) {
+            oldest = &entry;
+        }
+    }
+    if (!oldest) {
+        return false;
+    }
+    oldest->state = State::Running;
+    started(oldest->endpoint, nowMs);
+    stats_.delayed += oldest->delayed;
+    stats_.maxWaitMs = max(stats_.maxWaitMs, nowMs - oldest->queuedMs);
+    job.id = oldest->id;
+    job.method = oldest->method;
+    job.url = oldest->url;
+    job.body = oldest->body;
+    job.parser = oldest->parser;
+    job.target = oldest->target;
+    return true;
+}
+
+void HttpQueue::complete(uint32_t id, int code, const String& body, bool parsed) {
+    for (Entry& entry : entries_) {
+        if (entry.state == State::Running && entry.id == id) {
+            entry.state = State::Finished;
+            entry.result.id = id;
+            entry.result.code = code;
+            entry.result.parsed = parsed;
+            entry.result.body = body;
+            if (code > 0) {
+                stats_.completed++;
+            } else {
+                stats_.failed++;
+            }
+            return;
+        }
+    }
+}
+
+size_t HttpQueue::expire(uint32_t nowMs) {
+    size_t expired = 0;
+    for (Entry& entry : entries_) {
+        if (entry.state == State::Queued && nowMs - entry.queuedMs >= HTTP_QUEUE_TIMEOUT_MS) {
+            entry.state = State::Finished;
+            entry.result.id = entry.id;
+            entry.result.code = 0;
+            entry.result.parsed = false;
+            entry.result.body = String();
+            stats_.expired++;
+            expired++;
+        }
+    }
+    return expired;
+}
+
+bool HttpQueue::takeFinished(HttpResult& result, HttpCallback callbacks[HTTP_WAITERS],
+                             void* contexts[HTTP_WAITERS], uint8_t& waiters) {
+    Entry* oldest = nullptr;
+    for (Entry& entry : entries_) {
+        if (entry.state == State::Finished &&
+            (!oldest || static_cast<int32_t>(entry.id - oldest->id) < 0)) {
+            oldest = &entry;
+        }
+    }
+    if (!oldest) {
+        return false;
+    }
+    result = oldest->result;
+    for (uint8_t i = 0; i < oldest->waiters; i++) {
+        callbacks[i] = oldest->callbacks[i];
+        contexts[i] = oldest->contexts[i];
+    }
+    waiters = oldest->waiters;
+    // Give the strings' heap back now, not when the slot is reused
+    oldest->state = State::Dispatching;
+    oldest->url = String();
+    oldest->body = String();
+    oldest->result.body = String();
+    return true;
+}
+
+void HttpQueue::dispatched(uint32_t id) {
+    for (Entry& entry : entries_) {
+        if (entry.state == State::Dispatching && entry.id == id) {
+            entry.state = State::Free;
+            entry.target = nullptr;
+            return;
+        }
+    }
+}
+
+uint32_t HttpQueue::msUntilNext(uint32_t nowMs) const {
+    uint32_t wait = UINT32_MAX;
+    for (const Entry& entry : entries_) {
+        // A busy target is freed by dispatched(), which the glue signals
+        if (entry.state == State::Queued && !targetBusy(entry.target)) {
+            wait = min(wait, msUntilAllowed(entry.endpoint, nowMs));
+        }
+    }
+    return wait;
+}
+
+size_t HttpQueue::pending() const {
+    size_t count = 0;
+    for (const Entry& entry : entries_) {
+        count += entry.state == State::Queued || entry.state == State::Running;
+    }
+    return count;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file HttpsPool.cpp
+ * @brief Implementation of the HTTPS connection bookkeeping.
+ */
+
+#include "HttpsPool.h"
+
+HttpsPool httpsPool;
+
+HttpsPool::HttpsPool() : slots_(), stats_() {}
+
+bool HttpsPool::parseUrl(const char* url, char* host, size_t hostSize, uint16_t& port) {
+    const char* start;
+    if (strncmp(url, "https://", 8) == 0) {
+        start = url + 8;
+        port = 443;
+    } else if (strncmp(url, "http://", 7) == 0) {
+        start = url + 7;
+        port = 80;
+    } else {
+        return false;
+    }
+    const char* end = start;
+    while (*end && *end != ':' && *end != '/' && *end != '?') {
+        end++;
+    }
+    const size_t length = end - start;
+    if (length == 0 || length >= hostSize) {
+        return false;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+    if (*end == ':') {
+        const long value = strtol(end + 1, nullptr, 10);
+        if (value <= 0 || value > UINT16_MAX) {
+            return false;
+        }
+        port = static_cast<uint16_t>(value);
+    }
+    return true;
+}
+
+HttpsLease HttpsPool::acquire(const char* host, uint16_t port, uint32_t nowMs) {
+    stats_.requests++;
+    HttpsLease lease = {-1, false};
+    for (int8_t i = 0; i < HTTPS_POOL_SLOTS; i++) {
+        Slot& slot = slots_[i];
+        if (slot.port == port && strncmp(slot.host, host, HTTPS_HOST_SIZE) == 0) {
+            lease.slot = i;
+            if (slot.open && nowMs - slot.lastUsedMs >= HTTPS_IDLE_MS) {
+                lease.close = true;
+                slot.open = false;
+                stats_.idleClosed++;
+            }
+            return lease;
+        }
+    }
+    // New host: a closed slot, else the least recently used connection
+    lease.slot = 0;
+    for (int8_t i = 0; i < HTTPS_POOL_SLOTS; i++) {
+        const Slot& slot = slots_[i];
+        if (!slot.open) {
+            lease.slot = i;
+            break;
+        }
+        if (nowMs - slot.lastUsedMs > nowMs - slots_[lease.slot].lastUsedMs) {
+            lease.slot = i;
+        }
+    }
+    Slot& slot = slots_[lease.slot];
+    if (slot.open) {
+        lease.close = true;
+        slot.open = false;
+        stats_.evicted++;
+    }
+    strncpy(slot.host, host, HTTPS_HOST_SIZE - 1);
+    slot.host[HTTPS_HOST_SIZE - 1] = '\0';
+    slot.port = port;
+    return lease;
+}
+
+void HttpsPool::release(int8_t slot, uint32_t nowMs, bool reused, bool keptOpen) {
+    if (slot < 0 || slot >= HTTPS_POOL_SLOTS) {
+        return;
+    }
+    slots_[slot].open = keptOpen;
+    slots_[slot].lastUsedMs = nowMs;
+    if (reused) {
+        stats_.reused++;
+    } else {
+        stats_.opened++;
+    }
+}
+
+int8_t HttpsPool::nextIdle(uint32_t nowMs) {
+    for (int8_t i = 0; i < HTTPS_POOL_SLOTS; i++) {
+        Slot& slot = slots_[i];
+        if (slot.open && nowMs - slot.lastUsedMs >= HTTPS_IDLE_MS) {
+            slot.open = false;
+            stats_.idleClosed++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void HttpsPool::closeAll() {
+    for (Slot& slot : slots_) {
+        slot.open = false;
+    }
+}
+
+size_t HttpsPool::open() const {
+    size_t count = 0;
+    for (const Slot& slot : slots_) {
+        count += slot.open;
+    }
+    return count;
+}
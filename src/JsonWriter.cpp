@@ -0,0 +1,317 @@
+/**
+ * @file JsonWriter.cpp
+ * @brief Implementation of the fixed-buffer JSON writer.
+ */
+
+#include "JsonWriter.h"
+
+#include <cmath>
+
+namespace {
+
+const char kHex[] = "0123456789abcdef";
+
+const uint64_t kPow10[] = {1ull,        10ull,        100ull,        1000ull,
+                           10000ull,    100000ull,    1000000ull,    10000000ull,
+                           100000000ull, 1000000000ull};
+const uint8_t kMaxFixedPrecision = 9;
+const double kMaxFixedMagnitude = 1e9;  ///< Larger values go through snprintf
+
+}  // namespace
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {
+    reset();
+}
+
+void JsonWriter::reset() {
+    length_ = 0;
+    commaBits_ = 0;
+    depth_ = 0;
+    afterKey_ = false;
+    overflow_ = capacity_ == 0;
+    if (capacity_) {
+        buffer_[0] = '\0';
+    }
+}
+
+void JsonWriter::reset(char* buffer, size_t capacity) {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    reset();
+}
+
+void JsonWriter::rewind(const Mark& position) {
+    length_ = position.length;
+    commaBits_ = position.commaBits;
+    depth_ = position.depth;
+    afterKey_ = position.afterKey;
+    overflow_ = capacity_ == 0;
+    if (capacity_) {
+        buffer_[length_] = '\0';
+    }
+}
+
+void JsonWriter::append(const char* data, size_t size) {
+    if (overflow_) {
+        return;
+    }
+    if (size > remaining()) {
+        overflow_ = true;
+        return;
+    }
+    memcpy(buffer_ + length_, data, size);
+    length_ += size;
+    buffer_[length_] = '\0';
+}
+
+void JsonWriter::appendChar(char c) { append(&c, 1); }
+
+void JsonWriter::separate() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+    const uint32_t bit = 1u << depth_;
+    if (commaBits_ & bit) {
+        appendChar(',');
+    }
+    commaBits_ |= bit;
+}
+
+void JsonWriter::push(char open) {
+    separate();
+    appendChar(open);
+    if (depth_ + 1 >= JSON_WRITER_MAX_DEPTH) {
+        overflow_ = true;
+        return;
+    }
+    depth_++;
+    commaBits_ &= ~(1u << depth_);
+}
+
+void JsonWriter::pop(char close) {
+    if (depth_ > 0) {
+        depth_--;
+    }
+    afterKey_ = false;
+    appendChar(close);
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    push('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    pop('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    push('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    pop(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name) {
+    separate();
+    appendEscaped(name ? name : "");
+    appendChar(':');
+    afterKey_ = true;
+    return *this;
+}
+
+void JsonWriter::appendEscaped(const char* text) {
+    appendChar('"');
+    const char* run = text;
+    for (const char* p = text;; p++) {
+        const uint8_t c = static_cast<uint8_t>(*p);
+        if (c != 0 && c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Copy the plain run in one go, then the escape sequence.
+        append(run, p - run);
+        run = p + 1;
+        if (c == 0) {
+            break;
+        }
+        char escape[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t size = 2;
+        switch (c) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = kHex[c >> 4];
+                escape[5] = kHex[c & 0x0F];
+                size = 6;
+                break;
+        }
+        append(escape, size);
+    }
+    appendChar('"');
+}
+
+void JsonWriter::appendInteger(int64_t number) {
+    char digits[21];
+    size_t pos = sizeof(digits);
+    uint64_t magnitude = number < 0 ? 0 - static_cast<uint64_t>(number) : number;
+    do {
+        digits[--pos] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (number < 0) {
+        digits[--pos] = '-';
+    }
+    append(digits + pos, sizeof(digits) - pos);
+}
+
+JsonWriter& JsonWriter::value(const char* text) {
+    if (!text) {
+        return valueNull();
+    }
+    separate();
+    appendEscaped(text);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(unsigned long number) {
+    separate();
+    appendInteger(static_cast<int64_t>(number));
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(long long number) {
+    separate();
+    appendInteger(number);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    separate();
+    // Flags are published as 0/1 like the other digital inputs.
+    appendChar(flag ? '1' : '0');
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number, uint8_t precision) {
+    if (!std::isfinite(number)) {
+        return valueNull();
+    }
+    separate();
+    if (precision > kMaxFixedPrecision || fabs(number) >= kMaxFixedMagnitude) {
+        char text[40];
+        int n = snprintf(text, sizeof(text), "%.*f", precision, number);
+        if (n < 0 || static_cast<size_t>(n) >= sizeof(text)) {
+            overflow_ = true;
+            return *this;
+        }
+        append(text, n);
+        return *this;
+    }
+
+    // Scale to an integer once and print the two halves; same rounding as
+    // printf for the value range used by telemetry.
+    const uint64_t scale = kPow10[precision];
+    const double scaled = fabs(number) * static_cast<double>(scale) + 0.5;
+    const uint64_t fixed = static_cast<uint64_t>(scaled);
+    const uint64_t whole = fixed / scale;
+    uint64_t fraction = fixed % scale;
+
+    char digits[24];
+    size_t pos = sizeof(digits);
+    for (uint8_t i = 0; i < precision; i++) {
+        digits[--pos] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+    }
+    if (precision) {
+        digits[--pos] = '.';
+    }
+    uint64_t w = whole;
+    do {
+        digits[--pos] = static_cast<char>('0' + w % 10);
+        w /= 10;
+    } while (w);
+    if (number < 0 && fixed != 0) {
+        digits[--pos] = '-';
+    }
+    append(digits + pos, sizeof(digits) - pos);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const SampleValue& sample, uint8_t precision) {
+    switch (sample.type) {
+        case SampleType::Int32:
+            return value(static_cast<long long>(sample.i32));
+        case SampleType::Int64:
+            return value(static_cast<long long>(sample.i64));
+        case SampleType::Float:
+            return value(static_cast<double>(sample.f32), precision);
+        case SampleType::Double:
+            return value(sample.f64, precision);
+        case SampleType::Bool:
+            return value(sample.b);
+        case SampleType::Text:
+            return value(sample.str);
+        default:
+            return valueNull();
+    }
+}
+
+JsonWriter& JsonWriter::valueNull() {
+    separate();
+    append("null", 4);
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(const char* json) {
+    separate();
+    append(json, strlen(json));
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginRpc(const char* method) {
+    beginObject();
+    key("jsonrpc").value("2.0");
+    key("method").value(method);
+    key("params").beginObject();
+    return *this;
+}
+
+JsonWriter& JsonWriter::endRpc() {
+    endObject();
+    endObject();
+    return *this;
+}
+
+JsonWriter& JsonWriter::rpcResult(int64_t id, const char* result) {
+    beginObject();
+    key("jsonrpc").value("2.0");
+    key("id").value(static_cast<long long>(id));
+    key("result").value(result);
+    endObject();
+    return *this;
+}
+
+JsonWriter& JsonWriter::rpcError(int64_t id, const char* code, const char* message) {
+    beginObject();
+    key("jsonrpc").value("2.0");
+    key("id").value(static_cast<long long>(id));
+    key("error").beginObject();
+    key("code").value(code);
+    key("message").value(message);
+    endObject();
+    endObject();
+    return *this;
+}
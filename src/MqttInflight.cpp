@@ -0,0 +1,254 @@
+/**
+ * @file MqttInflight.cpp
+ * @brief Implementation of the QoS 1 in-flight window.
+ */
+
+#include "MqttInflight.h"
+
+namespace {
+
+const uint8_t kPublish = 0x30;
+const uint8_t kPubAck = 0x40;
+const uint8_t kQos1 = 0x02;
+const uint8_t kDup = 0x08;
+const uint8_t kRetain = 0x01;
+
+}  // namespace
+
+MqttInflight mqttInflight;
+
+MqttInflight::MqttInflight()
+    : entries_(), window_(MQTT_INFLIGHT_WINDOW), send_(nullptr), sendContext_(nullptr),
+      drop_(nullptr), dropContext_(nullptr), lastId_(0xFFFF), droppedIds_(), droppedNext_(0), order_(0), stats_(),
+      phase_(Phase::Header), type_(0), remaining_(0), lengthShift_(0), body_(), bodyLength_(0) {}
+
+void MqttInflight::setTransport(MqttSendFn send, void* context) {
+    send_ = send;
+    sendContext_ = context;
+}
+
+void MqttInflight::setDropHandler(MqttDropFn drop, void* context) {
+    drop_ = drop;
+    dropContext_ = context;
+}
+
+void MqttInflight::setWindow(size_t window) {
+    window_ = max<size_t>(1, min<size_t>(window, MQTT_INFLIGHT_WINDOW));
+}
+
+size_t MqttInflight::size() const {
+    size_t count = 0;
+    for (const Entry& entry : entries_) {
+        count += entry.id != 0;
+    }
+    return count;
+}
+
+uint16_t MqttInflight::nextPacketId() {
+    for (;;) {
+        lastId_ = lastId_ == 0xFFFF ? MQTT_PACKET_ID_FIRST : lastId_ + 1;
+        // An ID still in flight, or dropped recently, would be ambiguous in delivery()
+        bool used = recentlyDropped(lastId_);
+        for (const Entry& entry : entries_) {
+            used |= entry.id == lastId_;
+        }
+        if (!used) {
+            return lastId_;
+        }
+    }
+}
+
+uint16_t MqttInflight::publish(const char* topic, const uint8_t* payload, size_t length,
+                               bool retain, uint32_t nowMs) {
+    if (!send_ || full()) {
+        return 0;
+    }
+    Entry* entry = nullptr;
+    for (Entry& candidate : entries_) {
+        if (candidate.id == 0) {
+            entry = &candidate;
+            break;
+        }
+    }
+    const size_t topicLength = strlen(topic);
+    const uint32_t remaining = 2 + topicLength + 2 + length;
+    uint8_t header[5];
+    size_t headerLength = 0;
+    header[headerLength++] = kPublish | kQos1 | (retain ? kRetain : 0);
+    uint32_t value = remaining;
+    do {
+        header[headerLength] = value & 0x7F;
+        value >>= 7;
+        header[headerLength++] |= value ? 0x80 : 0;
+    } while (value && headerLength < sizeof(header));
+    if (!entry || value || headerLength + remaining > MQTT_INFLIGHT_PACKET_SIZE) {
+        return 0;
+    }
+
+    const uint16_t id = nextPacketId();
+    uint8_t* out = entry->packet;
+    memcpy(out, header, headerLength);
+    out += headerLength;
+    *out++ = topicLength >> 8;
+    *out++ = topicLength & 0xFF;
+    memcpy(out, topic, topicLength);
+    out += topicLength;
+    *out++ = id >> 8;
+    *out++ = id & 0xFF;
+    memcpy(out, payload, length);
+    out += length;
+    entry->length = out - entry->packet;
+    entry->id = id;
+    entry->sends = 1;
+    entry->due = false;
+    entry->order = order_++;
+    entry->firstSentMs = nowMs;
+    entry->sentMs = nowMs;
+
+    // Kept before the send: the PUBACK may be read while sending
+    const uint32_t inFlight = size();
+    if (!send_(entry->packet, entry->length, sendContext_)) {
+        entry->id = 0;
+        return 0;
+    }
+    stats_.sent++;
+    stats_.highWater = max(stats_.highWater, inFlight);
+    return id;
+}
+
+bool MqttInflight::recentlyDropped(uint16_t id) const {
+    for (uint16_t dropped : droppedIds_) {
+        if (dropped == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MqttDelivery MqttInflight::delivery(uint16_t id) const {
+    for (const Entry& entry : entries_) {
+        if (entry.id == id) {
+            return MqttDelivery::InFlight;
+        }
+    }
+    return recentlyDropped(id) ? MqttDelivery::Dropped : MqttDelivery::Acknowledged;
+}
+
+void MqttInflight::acknowledge(uint16_t id, uint32_t nowMs) {
+    for (Entry& entry : entries_) {
+        if (entry.id == id) {
+            const uint32_t ackMs = nowMs - entry.firstSentMs;
+            stats_.acknowledged++;
+            stats_.ackMsTotal += ackMs;
+            stats_.ackMsMax = max(stats_.ackMsMax, ackMs);
+            entry.id = 0;
+            return;
+        }
+    }
+    stats_.unknownAcks++;
+}
+
+void MqttInflight::dropEntry(Entry& entry) {
+    stats_.dropped++;
+    droppedIds_[droppedNext_] = entry.id;
+    droppedNext_ = (droppedNext_ + 1) % MQTT_INFLIGHT_DROPPED_IDS;
+    const uint16_t id = entry.id;
+    entry.id = 0;
+    if (!drop_) {
+        return;
+    }
+    // Fixed header, topic length, topic, packet ID, payload
+    size_t pos = 1;
+    while (entry.packet[pos++] & 0x80) {
+    }
+    const size_t topicLength = (entry.packet[pos] << 8) | entry.packet[pos + 1];
+    const char* topic = reinterpret_cast<const char*>(entry.packet + pos + 2);
+    pos += 2 + topicLength + 2;
+    drop_(id, topic, topicLength, entry.packet + pos, entry.length - pos, dropContext_);
+}
+
+void MqttInflight::receive(const uint8_t* data, size_t length, uint32_t nowMs) {
+    // Packets may be split over WebSocket frames or share one
+    for (size_t i = 0; i < length; i++) {
+        const uint8_t byte = data[i];
+        switch (phase_) {
+            case Phase::Header:
+                type_ = byte & 0xF0;
+                remaining_ = 0;
+                lengthShift_ = 0;
+                bodyLength_ = 0;
+                phase_ = Phase::Length;
+                break;
+            case Phase::Length:
+                remaining_ |= static_cast<uint32_t>(byte & 0x7F) << lengthShift_;
+                lengthShift_ += 7;
+                if (byte & 0x80) {
+                    if (lengthShift_ >= 28) {
+                        phase_ = Phase::Header;  // Malformed; the library drops the link
+                    }
+                    break;
+                }
+                phase_ = remaining_ ? Phase::Body : Phase::Header;
+                break;
+            case Phase::Body: {
+                // Skip over the rest of other packets in one step
+                const size_t take = min<size_t>(remaining_, length - i);
+                if (type_ == kPubAck) {
+                    for (size_t k = 0; k < take && bodyLength_ < sizeof(body_); k++) {
+                        body_[bodyLength_++] = data[i + k];
+                    }
+                }
+                remaining_ -= take;
+                i += take - 1;
+                if (remaining_ == 0) {
+                    if (type_ == kPubAck && bodyLength_ == sizeof(body_)) {
+                        acknowledge((body_[0] << 8) | body_[1], nowMs);
+                    }
+                    phase_ = Phase::Header;
+                }
+                break;
+            }
+        }
+    }
+}
+
+void MqttInflight::reconnected() {
+    phase_ = Phase::Header;
+    for (Entry& entry : entries_) {
+        entry.due = entry.id != 0;
+    }
+}
+
+size_t MqttInflight::retransmit(uint32_t nowMs) {
+    size_t sent = 0;
+    for (;;) {
+        Entry* oldest = nullptr;
+        for (Entry& entry : entries_) {
+            if (entry.id == 0 || (!entry.due && nowMs - entry.sentMs < MQTT_INFLIGHT_TIMEOUT_MS)) {
+                continue;
+            }
+            if (!oldest || static_cast<int32_t>(entry.order - oldest->order) < 0) {
+                oldest = &entry;
+            }
+        }
+        if (!oldest) {
+            return sent;
+        }
+        if (!oldest->due && oldest->sends >= MQTT_INFLIGHT_MAX_SENDS) {
+            dropEntry(*oldest);
+            continue;
+        }
+        oldest->packet[0] |= kDup;
+        if (!send_ || !send_(oldest->packet, oldest->length, sendContext_)) {
+            return sent;  // Link down: due again after the reconnect
+        }
+        // The link, not the broker, lost the copies resent after a reconnect
+        if (!oldest->due) {
+            oldest->sends++;
+        }
+        oldest->due = false;
+        oldest->sentMs = nowMs;
+        stats_.retransmitted++;
+        sent++;
+    }
+}
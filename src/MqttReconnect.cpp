@@ -0,0 +1,213 @@
+/**
+ * @file MqttReconnect.cpp
+ * @brief Implementation of the MQTT reconnect state machine.
+ */
+
+#include "MqttReconnect.h"
+
+MqttReconnect mqttReconnect;
+
+namespace {
+
+// CONNACK codes that mean the credentials were not accepted
+const int kBadCredentials = 4;
+const int kNotAuthorized = 5;
+
+bool reached(uint32_t nowMs, uint32_t deadlineMs) {
+    return static_cast<int32_t>(nowMs - deadlineMs) >= 0;
+}
+
+}  // namespace
+
+MqttReconnect::MqttReconnect()
+    : state_(ConnState::Offline), failuresInRow_(0), refreshStarted_(false), deadlineMs_(0),
+      attemptStartMs_(0), connectedMs_(0), outageStartMs_(0), rng_(0x9e3779b9), stats_() {}
+
+void MqttReconnect::seed(uint32_t seed) { rng_ = seed ? seed : 0x9e3779b9; }
+
+uint32_t MqttReconnect::nextRandom() {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    return rng_;
+}
+
+uint32_t MqttReconnect::backoffWindowMs(uint8_t failures) {
+    uint32_t window = MQTT_BACKOFF_BASE_MS;
+    for (uint8_t i = 1; i < failures && window < MQTT_BACKOFF_CAP_MS; i++) {
+        window *= 2;
+    }
+    return min<uint32_t>(window, MQTT_BACKOFF_CAP_MS);
+}
+
+ConnAction MqttReconnect::backoff(uint32_t nowMs) {
+    const uint32_t window = backoffWindowMs(failuresInRow_);
+    stats_.lastBackoffMs = nextRandom() % (window + 1);
+    deadlineMs_ = nowMs + stats_.lastBackoffMs;
+    state_ = ConnState::Backoff;
+    return ConnAction::CloseTransport;
+}
+
+ConnAction MqttReconnect::fail(uint32_t nowMs, ConnFailure failure, bool refreshToken) {
+    stats_.failures[static_cast<size_t>(failure)]++;
+    if (failuresInRow_ < UINT8_MAX) {
+        failuresInRow_++;
+    }
+    if (refreshToken || failuresInRow_ % MQTT_TOKEN_REFRESH_AFTER == 0) {
+        state_ = ConnState::TokenRefresh;
+        refreshStarted_ = false;
+        deadlineMs_ = nowMs + MQTT_TOKEN_REFRESH_TIMEOUT_MS;
+        return ConnAction::CloseTransport;
+    }
+    return backoff(nowMs);
+}
+
+ConnAction MqttReconnect::step(uint32_t nowMs, bool linkUp, bool transportUp, bool mqttUp) {
+    switch (state_) {
+        case ConnState::Connected:
+            if (mqttUp) {
+                if (failuresInRow_ && nowMs - connectedMs_ >= MQTT_STABLE_MS) {
+                    failuresInRow_ = 0;
+                }
+                return ConnAction::None;
+            }
+            outageStartMs_ = nowMs;
+            if (!linkUp) {
+                stats_.failures[static_cast<size_t>(ConnFailure::Lost)]++;
+                state_ = ConnState::Offline;
+                return ConnAction::CloseTransport;
+            }
+            return fail(nowMs, ConnFailure::Lost, false);
+
+        case ConnState::Offline:
+            if (!linkUp) {
+                return ConnAction::None;
+            }
+            // Link back: everybody behind the same access point sees it at once
+            backoff(nowMs);
+            if (stats_.attempts == 0) {
+                deadlineMs_ = nowMs;
+            }
+            return ConnAction::None;
+
+        case ConnState::TokenRefresh:
+            // A refresh that is already running is allowed to finish
+            if (!refreshStarted_) {
+                if (!linkUp) {
+                    return ConnAction::None;
+                }
+                refreshStarted_ = true;
+                stats_.tokenRefreshes++;
+                return ConnAction::StartTokenRefresh;
+            }
+            if (reached(nowMs, deadlineMs_)) {
+                refreshStarted_ = false;
+                return fail(nowMs, ConnFailure::TokenRefresh, false);
+            }
+            return ConnAction::None;
+
+        default:
+            break;
+    }
+
+    if (!linkUp) {
+        state_ = ConnState::Offline;
+        return ConnAction::CloseTransport;
+    }
+    switch (state_) {
+        case ConnState::Backoff:
+            if (!reached(nowMs, deadlineMs_)) {
+                return ConnAction::None;
+            }
+            state_ = ConnState::Transport;
+            attemptStartMs_ = nowMs;
+            deadlineMs_ = nowMs + MQTT_TRANSPORT_TIMEOUT_MS;
+            stats_.attempts++;
+            return ConnAction::OpenTransport;
+
+        case ConnState::Transport:
+            if (transportUp) {
+                state_ = ConnState::Connecting;
+                deadlineMs_ = nowMs + MQTT_CONNACK_TIMEOUT_MS;
+                return ConnAction::SendConnect;
+            }
+            if (reached(nowMs, deadlineMs_)) {
+                return fail(nowMs, ConnFailure::TransportTimeout, false);
+            }
+            return ConnAction::None;
+
+        case ConnState::Connecting:
+            if (mqttUp) {
+                return connectResult(nowMs, true, 0);
+            }
+            if (reached(nowMs, deadlineMs_) || !transportUp) {
+                return fail(nowMs, ConnFailure::ConnackTimeout, false);
+            }
+            return ConnAction::None;
+
+        default:
+            return ConnAction::None;
+    }
+}
+
+ConnAction MqttReconnect::connectResult(uint32_t nowMs, bool accepted, int returnCode) {
+    if (state_ != ConnState::Connecting) {
+        return ConnAction::None;
+    }
+    if (accepted) {
+        state_ = ConnState::Connected;
+        connectedMs_ = nowMs;
+        stats_.connects++;
+        stats_.lastConnectMs = nowMs - attemptStartMs_;
+        stats_.maxConnectMs = max(stats_.maxConnectMs, stats_.lastConnectMs);
+        stats_.totalConnectMs += stats_.lastConnectMs;
+        stats_.lastOutageMs = nowMs - outageStartMs_;
+        return ConnAction::None;
+    }
+    // Codes outside 1..5 (timeouts, transport errors) are counted as "no code"
+    const size_t code = returnCode > 0 && returnCode < MQTT_RETURN_CODES ? returnCode : 0;
+    stats_.refused[code]++;
+    return fail(nowMs, ConnFailure::Refused, code == kBadCredentials || code == kNotAuthorized);
+}
+
+void MqttReconnect::tokenRefreshDone(uint32_t nowMs, bool ok) {
+    if (state_ != ConnState::TokenRefresh || !refreshStarted_) {
+        return;
+    }
+    refreshStarted_ = false;
+    if (!ok) {
+        fail(nowMs, ConnFailure::TokenRefresh, false);
+        return;
+    }
+    backoff(nowMs);
+}
+
+uint32_t MqttReconnect::msUntilAttempt(uint32_t nowMs) const {
+    if (state_ != ConnState::Backoff || reached(nowMs, deadlineMs_)) {
+        return 0;
+    }
+    return deadlineMs_ - nowMs;
+}
+
+const char* MqttReconnect::stateName(ConnState state) {
+    switch (state) {
+        case ConnState::Offline: return "offline";
+        case ConnState::Backoff: return "backoff";
+        case ConnState::Transport: return "transport";
+        case ConnState::Connecting: return "connecting";
+        case ConnState::TokenRefresh: return "token refresh";
+        case ConnState::Connected: return "connected";
+        default: return "?";
+    }
+}
+
+const char* MqttReconnect::failureName(ConnFailure failure) {
+    switch (failure) {
+        case ConnFailure::TransportTimeout: return "transport timeout";
+        case ConnFailure::Refused: return "refused";
+        case ConnFailure::ConnackTimeout: return "connack timeout";
+        case ConnFailure::Lost: return "lost";
+        case ConnFailure::TokenRefresh: return "token refresh";
+        default: return "?";
+    }
+}
@@ -0,0 +1,236 @@
+/**
+ * @file MqttRing.cpp
+ * @brief Implementation of the outgoing MQTT rings and priority lanes.
+ */
+
+#include "MqttRing.h"
+
+namespace {
+
+MqttSlot controlSlots[MQTT_LANE_CONTROL_SLOTS];
+MqttSlot alarmSlots[MQTT_LANE_ALARM_SLOTS];
+MqttSlot bulkSlots[MQTT_LANE_BULK_SLOTS];
+
+// Replies keep their order (the cloud retries a rejected command); for
+// telemetry the newest sample is worth more than the oldest.
+MqttRing controlRing(controlSlots, MQTT_LANE_CONTROL_SLOTS, MqttDropPolicy::DropNewest);
+MqttRing alarmRing(alarmSlots, MQTT_LANE_ALARM_SLOTS, MqttDropPolicy::DropOldest);
+MqttRing bulkRing(bulkSlots, MQTT_LANE_BULK_SLOTS, MqttDropPolicy::DropOldest);
+
+}  // namespace
+
+MqttLanes mqttLanes;
+
+MqttRing::MqttRing(MqttSlot* slots, uint32_t capacity, MqttDropPolicy policy)
+    : slots_(slots), capacity_(capacity), policy_(policy), notify_(nullptr),
+      notifyContext_(nullptr), consumer_(false), enqueuePos_(0),
+      dequeuePos_(0), enqueued_(0), published_(0), retries_(0), overflows_(0), evicted_(0),
+      dropped_(0), highWater_(0) {
+    for (uint32_t i = 0; i < capacity_; i++) {
+        slots_[i].topic.reserve(MQTT_RING_TOPIC_SIZE);
+        slots_[i].payload[0] = '\0';
+        slots_[i].length = 0;
+        slots_[i].retain = false;
+        slots_[i].qos = 0;
+        slots_[i].attempts = 0;
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+MqttSlot* MqttRing::reserve() {
+    bool triedEviction = false;
+    uint32_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+        MqttSlot& slot = slots_[pos & (capacity_ - 1)];
+        const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        const int32_t diff = static_cast<int32_t>(sequence - pos);
+        if (diff == 0) {
+            // Slot is free for this position; claim it.
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.length = 0;
+                slot.payload[0] = '\0';
+                slot.retain = false;
+                slot.qos = 0;
+                slot.attempts = 0;
+                const uint32_t used = pos + 1 - dequeuePos_.load(std::memory_order_relaxed);
+                uint32_t peak = highWater_.load(std::memory_order_relaxed);
+                while (used > peak &&
+                       !highWater_.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+                }
+                return &slot;
+            }
+        } else if (diff < 0) {
+            // The consumer has not released this slot yet: ring is full.  A
+            // DropOldest ring evicts its head, but only while nobody is
+            // publishing from it.
+            if (policy_ == MqttDropPolicy::DropOldest && !triedEviction) {
+                triedEviction = true;
+                if (lockConsumer()) {
+                    if (peek()) {
+                        evicted_.fetch_add(1, std::memory_order_relaxed);
+                        release();
+                    }
+                    unlockConsumer();
+                }
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void MqttRing::commit(MqttSlot* slot) {
+    // The claimed position is one behind the sequence the consumer waits for.
+    const uint32_t pos = slot->sequence.load(std::memory_order_relaxed);
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    if (notify_) {
+        notify_(notifyContext_);
+    }
+}
+
+bool MqttRing::push(const char* topic, const char* payload, size_t length, bool retain,
+                    uint8_t qos) {
+    if (length > MqttSlot::payloadCapacity()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    MqttSlot* slot = reserve();
+    if (!slot) {
+        return false;
+    }
+    slot->topic = topic;
+    memcpy(slot->payload, payload, length);
+    slot->payload[length] = '\0';
+    slot->length = length;
+    slot->retain = retain;
+    slot->qos = qos;
+    commit(slot);
+    return true;
+}
+
+bool MqttRing::lockConsumer() {
+    bool expected = false;
+    return consumer_.compare_exchange_strong(expected, true, std::memory_order_acquire);
+}
+
+void MqttRing::unlockConsumer() { consumer_.store(false, std::memory_order_release); }
+
+MqttSlot* MqttRing::peek() {
+    return ready() ? &slots_[dequeuePos_.load(std::memory_order_relaxed) & (capacity_ - 1)]
+                   : nullptr;
+}
+
+void MqttRing::release() {
+    const uint32_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    MqttSlot& slot = slots_[pos & (capacity_ - 1)];
+    slot.sequence.store(pos + capacity_, std::memory_order_release);
+    dequeuePos_.store(pos + 1, std::memory_order_relaxed);
+}
+
+void MqttRing::pop(bool published) {
+    (published ? published_ : dropped_).fetch_add(1, std::memory_order_relaxed);
+    release();
+}
+
+bool MqttRing::retryOrDrop(MqttSlot* slot) {
+    if (++slot->attempts >= MQTT_RING_MAX_ATTEMPTS) {
+        pop(false);
+        return false;
+    }
+    retries_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t MqttRing::size() const {
+    return enqueuePos_.load(std::memory_order_relaxed) -
+           dequeuePos_.load(std::memory_order_relaxed);
+}
+
+bool MqttRing::ready() const {
+    const uint32_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    const MqttSlot& slot = slots_[pos & (capacity_ - 1)];
+    return slot.sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+void MqttRing::setNotify(MqttRingNotifyFn notify, void* context) {
+    notify_ = notify;
+    notifyContext_ = context;
+}
+
+MqttRingStats MqttRing::stats() const {
+    MqttRingStats s;
+    s.enqueued = enqueued_.load(std::memory_order_relaxed);
+    s.published = published_.load(std::memory_order_relaxed);
+    s.retries = retries_.load(std::memory_order_relaxed);
+    s.overflows = overflows_.load(std::memory_order_relaxed);
+    s.evicted = evicted_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.highWater = highWater_.load(std::memory_order_relaxed);
+    return s;
+}
+
+MqttLanes::MqttLanes() : lanes_{&controlRing, &alarmRing, &bulkRing}, skipped_() {}
+
+MqttRing* MqttLanes::next() {
+    const size_t count = static_cast<size_t>(MqttLane::Count);
+
+    // Anti-starvation: the lowest lane that waited too long goes first.
+    size_t chosen = count;
+    for (size_t i = count; i-- > 0;) {
+        if (skipped_[i] >= MQTT_LANE_STARVATION_LIMIT && lanes_[i]->ready()) {
+            chosen = i;
+            break;
+        }
+    }
+    // Otherwise strict priority.
+    for (size_t i = 0; chosen == count && i < count; i++) {
+        if (lanes_[i]->ready()) {
+            chosen = i;
+        }
+    }
+    if (chosen == count || !lanes_[chosen]->lockConsumer()) {
+        return nullptr;
+    }
+
+    skipped_[chosen] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i != chosen && lanes_[i]->ready() && skipped_[i] < UINT8_MAX) {
+            skipped_[i]++;
+        }
+    }
+    return lanes_[chosen];
+}
+
+void MqttLanes::done(MqttRing* ring) { ring->unlockConsumer(); }
+
+size_t MqttLanes::size() const {
+    size_t total = 0;
+    for (const MqttRing* ring : lanes_) {
+        total += ring->size();
+    }
+    return total;
+}
+
+void MqttLanes::setNotify(MqttRingNotifyFn notify, void* context) {
+    for (MqttRing* ring : lanes_) {
+        ring->setNotify(notify, context);
+    }
+}
+
+const char* MqttLanes::laneName(MqttLane lane) {
+    switch (lane) {
+        case MqttLane::Control:
+            return "control";
+        case MqttLane::Alarm:
+            return "alarm";
+        case MqttLane::Bulk:
+            return "bulk";
+        default:
+            return "?";
+    }
+}
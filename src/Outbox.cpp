@@ -0,0 +1,529 @@
+/**
+ * @file Outbox.cpp
+ * @brief Implementation of the LittleFS telemetry outbox.
+ */
+
+#include "Outbox.h"
+#include <stddef.h>
+#include "MutexLock.h"
+
+Outbox outbox;
+OutboxConfig outboxConfig;
+
+namespace {
+
+const char* const kSegmentSuffix = ".seg";
+
+struct OutboxCursor {
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t crc;
+};
+
+// CRC-32 (IEEE 802.3), one nibble at a time to keep the table in 64 bytes
+uint32_t crc32Update(uint32_t crc, const void* data, size_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+uint32_t headerCrc(OutboxRecordHeader header) {
+    header.crc = 0;
+    return crc32Update(0, &header, sizeof(header));
+}
+
+bool headerPlausible(const OutboxRecordHeader& header) {
+    return header.magic == OUTBOX_RECORD_MAGIC && header.topicLength > 0 &&
+           header.topicLength < MQTT_RING_TOPIC_SIZE && header.payloadLength < MQTT_BUFFER_SIZE;
+}
+
+size_t recordSize(const OutboxRecordHeader& header) {
+    return sizeof(OutboxRecordHeader) + header.topicLength + header.payloadLength;
+}
+
+// Segment number of "00000012.seg", false for any other file name
+bool parseSegmentName(const char* name, uint32_t& segment) {
+    char* end = nullptr;
+    unsigned long value = strtoul(name, &end, 10);
+    if (end == name || strcmp(end, kSegmentSuffix) != 0) {
+        return false;
+    }
+    segment = value;
+    return true;
+}
+
+}  // namespace
+
+Outbox::Outbox()
+    : fs_(nullptr), dir_(), mutex_(nullptr), readSegment_(0), readOffset_(0), writeSegment_(0),
+      writeSize_(0), peekedSize_(0), sentSizes_(), sentCount_(0), sentBytes_(0),
+      readFileSegment_(0), sequence_(0), sinceCursorSave_(0), buffer_(), buffered_(0),
+      bufferedSinceMs_(0), stats_() {}
+
+bool Outbox::begin(fs::FS& fs, const char* dir) {
+    if (strlen(dir) >= sizeof(dir_)) {
+        return false;
+    }
+    if (!mutex_) {
+        mutex_ = xSemaphoreCreateMutex();
+    }
+    MutexLock lock(mutex_);
+    fs_ = nullptr;
+    readFile_.close();
+    strcpy(dir_, dir);
+    if (!fs.exists(dir_) && !fs.mkdir(dir_)) {
+        Serial.printf("Outbox: cannot create %s\n", dir_);
+        return false;
+    }
+    fs_ = &fs;
+
+    // Find the oldest and newest segment
+    bool found = false;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    File root = fs.open(dir_);
+    for (File entry = root.openNextFile(); entry; entry = root.openNextFile()) {
+        uint32_t segment;
+        if (!entry.isDirectory() && parseSegmentName(entry.name(), segment)) {
+            first = found ? min(first, segment) : segment;
+            last = found ? max(last, segment) : segment;
+            found = true;
+        }
+    }
+    root.close();
+
+    loadCursor();
+    buffered_ = 0;
+    forgetSent();
+    if (!found) {
+        readOffset_ = 0;
+        writeSegment_ = readSegment_;
+        writeSize_ = 0;
+    } else {
+        if (readSegment_ < first || readSegment_ > last) {
+            readSegment_ = first;
+            readOffset_ = 0;
+        }
+        writeSegment_ = last;
+        writeSize_ = validLength(last);
+        char path[48];
+        segmentPath(last, path, sizeof(path));
+        File file = fs.open(path, FILE_READ);
+        if (file && file.size() > writeSize_) {
+            // Torn tail after a power loss: never append behind garbage
+            Serial.printf("Outbox: segment %s has a torn tail at %u\n", path, (unsigned)writeSize_);
+            writeSegment_ = last + 1;
+            writeSize_ = 0;
+        }
+    }
+    Serial.printf("Outbox: segments %u..%u, replay from %u:%u\n", (unsigned)readSegment_,
+                  (unsigned)writeSegment_, (unsigned)readSegment_, (unsigned)readOffset_);
+    return true;
+}
+
+void Outbox::segmentPath(uint32_t segment, char* path, size_t size) const {
+    snprintf(path, size, "%s/%08u%s", dir_, (unsigned)segment, kSegmentSuffix);
+}
+
+void Outbox::cursorPath(char* path, size_t size) const { snprintf(path, size, "%s/cursor", dir_); }
+
+bool Outbox::append(const char* topic, const char* payload, size_t length, uint64_t timestampMs,
+                    uint8_t qos) {
+    const size_t topicLength = strlen(topic);
+    if (!ready() || topicLength == 0 || topicLength >= MQTT_RING_TOPIC_SIZE ||
+        length >= MQTT_BUFFER_SIZE) {
+        stats_.rejected++;
+        return false;
+    }
+    MutexLock lock(mutex_);
+
+    OutboxRecordHeader header = {};
+    header.magic = OUTBOX_RECORD_MAGIC;
+    header.timestampMs = timestampMs;
+    header.sequence = sequence_++;
+    header.payloadLength = length;
+    header.topicLength = topicLength;
+    header.qos = qos;
+    const size_t size = recordSize(header);
+
+    // Records never straddle segments
+    if (writeSize_ + buffered_ > 0 && writeSize_ + buffered_ + size > OUTBOX_SEGMENT_SIZE) {
+        flushLocked();
+        writeSegment_++;
+        writeSize_ = 0;
+        enforceSegmentLimit();
+    }
+    if (buffered_ + size > sizeof(buffer_)) {
+        flushLocked();
+    }
+
+    uint32_t crc = headerCrc(header);
+    crc = crc32Update(crc, topic, topicLength);
+    header.crc = crc32Update(crc, payload, length);
+    if (buffered_ == 0) {
+        bufferedSinceMs_ = millis();
+    }
+    memcpy(buffer_ + buffered_, &header, sizeof(header));
+    memcpy(buffer_ + buffered_ + sizeof(header), topic, topicLength);
+    memcpy(buffer_ + buffered_ + sizeof(header) + topicLength, payload, length);
+    buffered_ += size;
+    stats_.appended++;
+    return true;
+}
+
+void Outbox::flush() {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    flushLocked();
+}
+
+void Outbox::tick(uint32_t nowMs) {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    if (buffered_ > 0 && nowMs - bufferedSinceMs_ >= OUTBOX_FLUSH_INTERVAL_MS) {
+        flushLocked();
+    }
+}
+
+bool Outbox::flushLocked() {
+    if (buffered_ == 0) {
+        return true;
+    }
+    char path[48];
+    segmentPath(writeSegment_, path, sizeof(path));
+    File file = fs_->open(path, FILE_APPEND);
+    const size_t written = file ? file.write(buffer_, buffered_) : 0;
+    file.close();
+    stats_.flashWrites++;
+    stats_.bytesWritten += written;
+    if (written != buffered_) {
+        // Flash full or failing: the buffered records are lost; continue in a
+        // fresh segment so nothing is appended behind a partial record
+        Serial.printf("Outbox: write to %s failed (%u of %u bytes)\n", path, (unsigned)written,
+                      (unsigned)buffered_);
+        buffered_ = 0;
+        if (written > 0) {
+            writeSegment_++;
+            writeSize_ = 0;
+            enforceSegmentLimit();
+        }
+        return false;
+    }
+    writeSize_ += written;
+    buffered_ = 0;
+    if (writeSegment_ == readFileSegment_) {
+        // A handle opened before the append may not see the new records
+        readFile_.close();
+    }
+    return true;
+}
+
+/**
+ * @brief Open readSegment_ for peek(), unless it is open already: replay
+ *        reads one record after the other from the same handle.
+ */
+bool Outbox::openReadFile() {
+    if (readFile_ && readFileSegment_ == readSegment_) {
+        return true;
+    }
+    char path[48];
+    segmentPath(readSegment_, path, sizeof(path));
+    readFile_ = fs_->open(path, FILE_READ);
+    readFileSegment_ = readSegment_;
+    return static_cast<bool>(readFile_);
+}
+
+bool Outbox::peek(OutboxRecord& record) {
+    if (!ready()) {
+        return false;
+    }
+    MutexLock lock(mutex_);
+    peekedSize_ = 0;
+    if (sentCount_ == OUTBOX_READ_AHEAD) {
+        return false;
+    }
+    for (;;) {
+        const uint32_t offset = readOffset_ + sentBytes_;
+        if (readSegment_ == writeSegment_ && offset >= writeSize_) {
+            if (buffered_ == 0 || !flushLocked() || offset >= writeSize_) {
+                return false;
+            }
+        }
+
+        const size_t fileSize = openReadFile() ? readFile_.size() : 0;
+        if (offset >= fileSize) {
+            if (sentCount_ > 0) {
+                return false;  // Next segment once the sent records are consumed
+            }
+            // Fully replayed (or missing) older segment
+            if (readSegment_ == writeSegment_) {
+                // The write segment lost data behind our back: start over
+                writeSegment_++;
+                writeSize_ = 0;
+            }
+            dropReadSegment();
+            continue;
+        }
+
+        // After the previous record the handle is where the next one starts
+        File& file = readFile_;
+        OutboxRecordHeader header;
+        bool valid = (file.position() == offset || file.seek(offset)) &&
+                     file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) ==
+                         sizeof(header) &&
+                     headerPlausible(header) && offset + recordSize(header) <= fileSize &&
+                     file.read(reinterpret_cast<uint8_t*>(record.topic), header.topicLength) ==
+                         header.topicLength &&
+                     file.read(reinterpret_cast<uint8_t*>(record.payload),
+                               header.payloadLength) == header.payloadLength;
+        if (valid) {
+            uint32_t crc = headerCrc(header);
+            crc = crc32Update(crc, record.topic, header.topicLength);
+            valid = crc32Update(crc, record.payload, header.payloadLength) == header.crc;
+        }
+        if (!valid && sentCount_ > 0) {
+            return false;  // Dealt with once it is the oldest record
+        }
+        if (!valid) {
+            char path[48];
+            segmentPath(readSegment_, path, sizeof(path));
+            stats_.corrupt++;
+            Serial.printf("Outbox: corrupt record in %s at %u, skipping segment\n", path,
+                          (unsigned)readOffset_);
+            if (readSegment_ == writeSegment_) {
+                // Start clean so later appends stay readable
+                readFile_.close();
+                fs_->remove(path);
+                writeSegment_++;
+                writeSize_ = 0;
+            }
+            dropReadSegment();
+            continue;
+        }
+
+        record.topic[header.topicLength] = '\0';
+        record.payload[header.payloadLength] = '\0';
+        record.length = header.payloadLength;
+        record.qos = header.qos;
+        record.timestampMs = header.timestampMs;
+        peekedSize_ = recordSize(header);
+        return true;
+    }
+}
+
+void Outbox::markSent() {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    if (peekedSize_ == 0 || sentCount_ == OUTBOX_READ_AHEAD) {
+        return;
+    }
+    sentSizes_[sentCount_++] = peekedSize_;
+    sentBytes_ += peekedSize_;
+    peekedSize_ = 0;
+}
+
+void Outbox::advance() {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    if (sentCount_ == 0) {
+        return;
+    }
+    readOffset_ += sentSizes_[0];
+    sentBytes_ -= sentSizes_[0];
+    memmove(sentSizes_, sentSizes_ + 1, --sentCount_ * sizeof(sentSizes_[0]));
+    stats_.replayed++;
+
+    if (readSegment_ == writeSegment_ && readOffset_ >= writeSize_ && buffered_ == 0) {
+        // Everything replayed: free the flash and start over in a new segment
+        char path[48];
+        segmentPath(readSegment_, path, sizeof(path));
+        readFile_.close();
+        fs_->remove(path);
+        writeSegment_++;
+        writeSize_ = 0;
+        readSegment_ = writeSegment_;
+        readOffset_ = 0;
+        saveCursor();
+    } else if (++sinceCursorSave_ >= OUTBOX_CURSOR_SAVE_EVERY) {
+        saveCursor();
+    }
+}
+
+void Outbox::rewind() {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    forgetSent();
+}
+
+size_t Outbox::sentCount() {
+    if (!ready()) {
+        return 0;
+    }
+    MutexLock lock(mutex_);
+    return sentCount_;
+}
+
+void Outbox::forgetSent() {
+    peekedSize_ = 0;
+    sentCount_ = 0;
+    sentBytes_ = 0;
+}
+
+void Outbox::dropReadSegment() {
+    char path[48];
+    segmentPath(readSegment_, path, sizeof(path));
+    readFile_.close();
+    fs_->remove(path);
+    readSegment_++;
+    readOffset_ = 0;
+    forgetSent();
+    saveCursor();
+}
+
+void Outbox::enforceSegmentLimit() {
+    while (writeSegment_ - readSegment_ + 1 > OUTBOX_MAX_SEGMENTS) {
+        stats_.droppedSegments++;
+        Serial.printf("Outbox: full, dropping segment %u\n", (unsigned)readSegment_);
+        dropReadSegment();
+    }
+}
+
+void Outbox::loadCursor() {
+    char path[48];
+    cursorPath(path, sizeof(path));
+    OutboxCursor cursor = {};
+    File file = fs_->open(path, FILE_READ);
+    const bool valid =
+        file && file.read(reinterpret_cast<uint8_t*>(&cursor), sizeof(cursor)) == sizeof(cursor) &&
+        cursor.magic == OUTBOX_RECORD_MAGIC &&
+        crc32Update(0, &cursor, offsetof(OutboxCursor, crc)) == cursor.crc;
+    readSegment_ = valid ? cursor.segment : 0;
+    readOffset_ = valid ? cursor.offset : 0;
+}
+
+void Outbox::saveCursor() {
+    OutboxCursor cursor;
+    cursor.magic = OUTBOX_RECORD_MAGIC;
+    cursor.segment = readSegment_;
+    cursor.offset = readOffset_;
+    cursor.crc = crc32Update(0, &cursor, offsetof(OutboxCursor, crc));
+
+    // Write aside and rename, so a power loss leaves the old or the new cursor
+    char path[48];
+    char temp[sizeof(path) + 4];
+    cursorPath(path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    File file = fs_->open(temp, FILE_WRITE);
+    if (file && file.write(reinterpret_cast<const uint8_t*>(&cursor), sizeof(cursor)) ==
+                    sizeof(cursor)) {
+        file.close();
+        fs_->rename(temp, path);
+    }
+    sinceCursorSave_ = 0;
+}
+
+size_t Outbox::validLength(uint32_t segment) {
+    char path[48];
+    segmentPath(segment, path, sizeof(path));
+    File file = fs_->open(path, FILE_READ);
+    const size_t fileSize = file ? file.size() : 0;
+    size_t offset = 0;
+    uint8_t chunk[128];
+    OutboxRecordHeader header;
+    while (offset + sizeof(header) <= fileSize) {
+        if (!file.seek(offset) ||
+            file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+            !headerPlausible(header) || offset + recordSize(header) > fileSize) {
+            break;
+        }
+        uint32_t crc = headerCrc(header);
+        size_t left = header.topicLength + header.payloadLength;
+        while (left > 0) {
+            const size_t n = file.read(chunk, min(left, sizeof(chunk)));
+            if (n == 0) {
+                break;
+            }
+            crc = crc32Update(crc, chunk, n);
+            left -= n;
+        }
+        if (left > 0 || crc != header.crc) {
+            break;
+        }
+        sequence_ = header.sequence + 1;
+        offset += recordSize(header);
+    }
+    return offset;
+}
+
+bool Outbox::empty() {
+    if (!ready()) {
+        return true;
+    }
+    MutexLock lock(mutex_);
+    return readSegment_ == writeSegment_ && readOffset_ >= writeSize_ && buffered_ == 0;
+}
+
+size_t Outbox::backlogBytes() {
+    if (!ready()) {
+        return 0;
+    }
+    MutexLock lock(mutex_);
+    size_t total = buffered_;
+    for (uint32_t segment = readSegment_; segment <= writeSegment_; segment++) {
+        char path[48];
+        segmentPath(segment, path, sizeof(path));
+        File file = fs_->open(path, FILE_READ);
+        total += file ? file.size() : 0;
+    }
+    return total > readOffset_ ? total - readOffset_ : 0;
+}
+
+size_t Outbox::segmentCount() {
+    if (!ready()) {
+        return 0;
+    }
+    MutexLock lock(mutex_);
+    const bool writeSegmentUsed = writeSize_ > 0 || buffered_ > 0;
+    return writeSegment_ - readSegment_ + (writeSegmentUsed ? 1 : 0);
+}
+
+OutboxStats Outbox::stats() const { return stats_; }
+
+void Outbox::clear() {
+    if (!ready()) {
+        return;
+    }
+    MutexLock lock(mutex_);
+    readFile_.close();
+    for (uint32_t segment = readSegment_; segment <= writeSegment_; segment++) {
+        char path[48];
+        segmentPath(segment, path, sizeof(path));
+        fs_->remove(path);
+    }
+    buffered_ = 0;
+    forgetSent();
+    writeSegment_++;
+    writeSize_ = 0;
+    readSegment_ = writeSegment_;
+    readOffset_ = 0;
+    saveCursor();
+}
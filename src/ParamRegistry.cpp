@@ -0,0 +1,174 @@
+/**
+ * @file ParamRegistry.cpp
+ * @brief Implementation of the parameter interning table.
+ */
+
+#include "ParamRegistry.h"
+
+ParamRegistry paramRegistry;
+
+ParamRegistry::ParamRegistry()
+    : slots_(), histories_(), historyCount_(0), methods_(), index_(), count_(0), methodCount_(0) {}
+
+uint32_t ParamRegistry::hash(const char* name) {
+    // FNV-1a: cheap and good enough for a few hundred short names.
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= static_cast<uint8_t>(*name++);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int ParamRegistry::internMethod(const char* method) {
+    for (uint16_t i = 0; i < methodCount_; i++) {
+        if (strcmp(methods_[i], method) == 0) {
+            return i;
+        }
+    }
+    if (methodCount_ >= PARAM_METHOD_COUNT) {
+        return -1;
+    }
+    strcpy(methods_[methodCount_], method);
+    return methodCount_++;
+}
+
+ParamId ParamRegistry::find(const char* name) const {
+    const size_t mask = paramIndexSize() - 1;
+    for (size_t i = hash(name) & mask;; i = (i + 1) & mask) {
+        uint16_t entry = index_[i];
+        if (entry == 0) {
+            return PARAM_INVALID;
+        }
+        if (strcmp(slots_[entry - 1].name, name) == 0) {
+            return entry - 1;
+        }
+    }
+}
+
+void ParamRegistry::setAggregate(ParamSlot& slot, uint8_t aggregate) {
+    if ((aggregate & PARAM_AGG_HISTORY) && slot.history == PARAM_NO_HISTORY) {
+        if (historyCount_ < PARAM_HISTORY_SLOTS) {
+            slot.history = historyCount_++;
+            histories_[slot.history].reset();
+        } else {
+            aggregate &= ~PARAM_AGG_HISTORY;
+        }
+    }
+    if (slot.aggregate != aggregate) {
+        slot.aggregate = aggregate;
+        slot.window.reset();
+    }
+}
+
+void ParamRegistry::store(ParamId id, const SampleValue& value, uint64_t timestampMs) {
+    ParamSlot& slot = slots_[id];
+    slot.store(value, timestampMs);
+    // A ring stays with its parameter once assigned, even if history is turned off
+    if ((slot.aggregate & PARAM_AGG_HISTORY) && value.isNumeric()) {
+        histories_[slot.history].add(timestampMs, value);
+    }
+}
+
+ParamId ParamRegistry::registerParam(const char* name, const char* method, uint8_t precision,
+                                     uint8_t aggregate) {
+    return intern(name, method, precision, aggregate, false);
+}
+
+ParamId ParamRegistry::findOrRegister(const char* name, const char* method) {
+    return intern(name, method, 2, PARAM_AGG_NONE, true);
+}
+
+ParamId ParamRegistry::intern(const char* name, const char* method, uint8_t precision,
+                              uint8_t aggregate, bool keepSettings) {
+    if (!name || !method || !*name || !*method || strlen(name) >= PARAM_NAME_SIZE ||
+        strlen(method) >= PARAM_NAME_SIZE) {
+        return PARAM_INVALID;
+    }
+
+    const size_t mask = paramIndexSize() - 1;
+    size_t bucket = hash(name) & mask;
+    for (; index_[bucket] != 0; bucket = (bucket + 1) & mask) {
+        ParamSlot& existing = slots_[index_[bucket] - 1];
+        if (strcmp(existing.name, name) == 0) {
+            if (strcmp(methods_[existing.method], method) != 0) {
+                int methodId = internMethod(method);
+                if (methodId < 0) {
+                    return PARAM_INVALID;
+                }
+                existing.method = static_cast<MethodId>(methodId);
+            }
+            if (!keepSettings) {
+                existing.precision = precision;
+                setAggregate(existing, aggregate);
+            }
+            return index_[bucket] - 1;
+        }
+    }
+
+    if (count_ >= PARAM_REGISTRY_SIZE) {
+        return PARAM_INVALID;
+    }
+    int methodId = internMethod(method);
+    if (methodId < 0) {
+        return PARAM_INVALID;
+    }
+
+    ParamSlot& slot = slots_[count_];
+    strcpy(slot.name, name);
+    slot.method = static_cast<MethodId>(methodId);
+    slot.dirty = false;
+    slot.precision = precision;
+    slot.aggregate = PARAM_AGG_NONE;
+    slot.history = PARAM_NO_HISTORY;
+    slot.pendingMs = 0;
+    slot.pending = SampleValue();
+    slot.window.reset();
+    slot.flush.sent = false;
+    slot.flush.lastSent = SampleValue();
+    slot.flush.band = DeadBandState();
+    setAggregate(slot, aggregate);
+    index_[bucket] = count_ + 1;
+    return count_++;
+}
+
+ParamId registerParam(const char* name, const char* method, uint8_t precision,
+                      uint8_t aggregate) {
+    MutexLock lock(dataQueueMutex);
+    ParamId id = paramRegistry.registerParam(name, method, precision, aggregate);
+    if (id == PARAM_INVALID) {
+        Serial.printf("Cannot register parameter [%s] for [%s]\n", name ? name : "",
+                      method ? method : "");
+    } else if (paramRegistry.slot(id).aggregate != aggregate) {
+        Serial.printf("No sample history left for parameter [%s]\n", name);
+    }
+    return id;
+}
+
+void queueParam(ParamId id, const SampleValue& value) {
+    queueParam(id, value, epochMillis());
+}
+
+void queueParam(ParamId id, const SampleValue& value, uint64_t timestampMs) {
+    if (id == PARAM_INVALID) {
+        return;
+    }
+    MutexLock lock(dataQueueMutex);
+    paramRegistry.store(id, value, timestampMs);
+}
+
+void queueParam(const char* name, const SampleValue& value, const char* method) {
+    if (!name) {
+        return;
+    }
+    const uint64_t timestampMs = epochMillis();
+    MutexLock lock(dataQueueMutex);
+    // Keep the precision and aggregation of an already registered name.
+    const ParamId id = paramRegistry.findOrRegister(name, method);
+    if (id == PARAM_INVALID) {
+        Serial.printf("Cannot register parameter [%s] for [%s]\n", name,
+                      method ? method : "");
+        return;
+    }
+    paramRegistry.store(id, value, timestampMs);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file Pipeline.cpp
+ * @brief Implementation of the acquisition / network pipeline counters.
+ */
+
+#include "Pipeline.h"
+
+Pipeline pipeline;
+
+Pipeline::Pipeline() : stats_(), enqueuedAtFlush_(0), deferred_(0), running_(false) {}
+
+bool Pipeline::admitFlush(const MqttRing& bulk, bool online) {
+    // Room for as many messages as went into the lane since the previous flush
+    const uint32_t enqueued = bulk.stats().enqueued;
+    const size_t previous = stats_.flushes ? enqueued - enqueuedAtFlush_ : 0;
+    const size_t needed = min<size_t>(max<size_t>(previous, PIPELINE_FLUSH_MIN_FREE_SLOTS),
+                                      bulk.capacity());
+    const size_t free = bulk.capacity() - bulk.size();
+    if (online && free < needed) {
+        if (deferred_ < PIPELINE_MAX_DEFERRED_FLUSHES) {
+            deferred_++;
+            stats_.deferredFlushes++;
+            return false;
+        }
+        stats_.forcedFlushes++;
+    }
+    deferred_ = 0;
+    enqueuedAtFlush_ = enqueued;
+    stats_.flushes++;
+    return true;
+}
+
+void Pipeline::recordCycle(PipelineStage stage, uint32_t us, bool idle) {
+    PipelineStageStats& s = stats_.stage[static_cast<size_t>(stage)];
+    s.cycles++;
+    s.idle += idle;
+    s.busyUs += us;
+    const uint32_t rest = s.busyRestUs + us;
+    s.busyMs += rest / 1000;
+    s.busyRestUs = rest % 1000;
+    s.maxCycleUs = max(s.maxCycleUs, us);
+}
+
+const char* Pipeline::stageName(PipelineStage stage) {
+    switch (stage) {
+        case PipelineStage::Acquisition: return "acquisition";
+        case PipelineStage::Network: return "network";
+        default: return "?";
+    }
+}
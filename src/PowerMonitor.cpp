@@ -0,0 +1,60 @@
+/**
+ * @file PowerMonitor.cpp
+ * @brief Implementation of the per-interval awake/asleep accounting.
+ */
+
+#include "PowerMonitor.h"
+
+PowerConfig powerConfig;
+PowerMonitor powerMonitor;
+
+PowerMonitor::PowerMonitor()
+    : mode_(PowerMode::Performance), started_(false), startUs_(0), busyAtStart_(0),
+      cyclesAtStart_(0), last_(), totalAwakeMs_(0), totalAsleepMs_(0) {}
+
+uint32_t PowerMonitor::busyUs(const PipelineStats& stats) {
+    uint32_t total = 0;  // Modulo 2^32 like the counters
+    for (const PipelineStageStats& stage : stats.stage) {
+        total += stage.busyUs;
+    }
+    return total;
+}
+
+uint32_t PowerMonitor::cycles(const PipelineStats& stats) {
+    uint32_t total = 0;
+    for (const PipelineStageStats& stage : stats.stage) {
+        total += stage.cycles;
+    }
+    return total;
+}
+
+PowerInterval PowerMonitor::close(uint32_t nowUs, const PipelineStats& stats) {
+    const uint32_t busy = busyUs(stats);
+    const uint32_t wakeups = cycles(stats);
+    PowerInterval interval = {};
+    if (started_) {
+        interval.durationMs = (nowUs - startUs_) / 1000;
+        // Both cores add up; an interval cannot be more than fully awake
+        // Wrap-safe: the interval is shorter than the 71 min of a 32-bit µs count
+        interval.awakeMs = min<uint32_t>((busy - busyAtStart_) / 1000, interval.durationMs);
+        interval.asleepMs = interval.durationMs - interval.awakeMs;
+        interval.wakeups = wakeups - cyclesAtStart_;
+        totalAwakeMs_ += interval.awakeMs;
+        totalAsleepMs_ += interval.asleepMs;
+        last_ = interval;
+    }
+    started_ = true;
+    startUs_ = nowUs;
+    busyAtStart_ = busy;
+    cyclesAtStart_ = wakeups;
+    return interval;
+}
+
+const char* PowerMonitor::modeName(PowerMode mode) {
+    switch (mode) {
+        case PowerMode::Performance: return "performance";
+        case PowerMode::FrequencyScaling: return "frequency scaling";
+        case PowerMode::LightSleep: return "light sleep";
+        default: return "?";
+    }
+}
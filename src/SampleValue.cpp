@@ -0,0 +1,88 @@
+/**
+ * @file SampleValue.cpp
+ * @brief Conversions for typed telemetry samples.
+ */
+
+#include "SampleValue.h"
+#include "JsonWriter.h"
+
+SampleValue SampleValue::text(const char* s) {
+    SampleValue v;
+    v.type = SampleType::Text;
+    strncpy(v.str, s ? s : "", SAMPLE_TEXT_SIZE - 1);
+    v.str[SAMPLE_TEXT_SIZE - 1] = '\0';
+    return v;
+}
+
+SampleValue SampleValue::parse(const char* s) {
+    if (!s) {
+        return SampleValue();
+    }
+    if (strcmp(s, "true") == 0) {
+        return SampleValue(true);
+    }
+    if (strcmp(s, "false") == 0) {
+        return SampleValue(false);
+    }
+    char* end = nullptr;
+    long long integer = strtoll(s, &end, 10);
+    if (end != s && *end == '\0') {
+        if (integer >= INT32_MIN && integer <= INT32_MAX) {
+            return SampleValue(static_cast<int>(integer));
+        }
+        return SampleValue(integer);
+    }
+    double real = strtod(s, &end);
+    if (end != s && *end == '\0') {
+        return SampleValue(real);
+    }
+    return text(s);
+}
+
+double SampleValue::toDouble() const {
+    switch (type) {
+        case SampleType::Int32:
+            return i32;
+        case SampleType::Int64:
+            return static_cast<double>(i64);
+        case SampleType::Float:
+            return f32;
+        case SampleType::Double:
+            return f64;
+        case SampleType::Bool:
+            return b ? 1.0 : 0.0;
+        default:
+            return 0.0;
+    }
+}
+
+bool SampleValue::equals(const SampleValue& other) const {
+    if (type != other.type) {
+        return false;
+    }
+    switch (type) {
+        case SampleType::Int32:
+            return i32 == other.i32;
+        case SampleType::Int64:
+            return i64 == other.i64;
+        case SampleType::Float:
+            return f32 == other.f32;
+        case SampleType::Double:
+            return f64 == other.f64;
+        case SampleType::Bool:
+            return b == other.b;
+        case SampleType::Text:
+            return strcmp(str, other.str) == 0;
+        default:
+            return true;
+    }
+}
+
+size_t SampleValue::format(char* out, size_t size, uint8_t precision) const {
+    if (!out || size == 0) {
+        return 0;
+    }
+    JsonWriter json(out, size);
+    json.value(*this, precision);
+    return json.overflow() ? 0 : json.length();
+}
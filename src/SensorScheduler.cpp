@@ -0,0 +1,207 @@
+/**
+ * @file SensorScheduler.cpp
+ * @brief Implementation of the timing-wheel sensor scheduler.
+ */
+
+#include "SensorScheduler.h"
+
+SensorScheduler sensorScheduler;
+
+SensorScheduler::SensorScheduler()
+    : sources_(), bucketSize_(), count_(0), cursorMs_(0), paused_(false), wake_(nullptr),
+      wakeContext_(nullptr) {
+    for (size_t b = 0; b < SENSOR_WHEEL_SLOTS; b++) {
+        buckets_[b] = SENSOR_SOURCE_INVALID;
+    }
+}
+
+void SensorScheduler::begin(uint32_t nowMs) { cursorMs_ = nowMs; }
+
+void SensorScheduler::pause(bool paused) {
+    paused_ = paused;
+    if (!paused) {
+        wake();
+    }
+}
+
+void SensorScheduler::setWakeup(SensorWakeFn wake, void* context) {
+    wake_ = wake;
+    wakeContext_ = context;
+}
+
+void SensorScheduler::link(SensorSourceId id) {
+    const size_t bucket = bucketOf(sources_[id].dueMs);
+    sources_[id].next = buckets_[bucket];
+    buckets_[bucket] = id;
+    bucketSize_[bucket]++;
+}
+
+void SensorScheduler::unlink(SensorSourceId id) {
+    const size_t bucket = bucketOf(sources_[id].dueMs);
+    for (SensorSourceId* link = &buckets_[bucket]; *link != SENSOR_SOURCE_INVALID;
+         link = &sources_[*link].next) {
+        if (*link == id) {
+            *link = sources_[id].next;
+            bucketSize_[bucket]--;
+            return;
+        }
+    }
+}
+
+uint32_t SensorScheduler::autoPhase(uint32_t startMs, uint32_t periodMs) const {
+    // Least loaded bucket within the first period (or one revolution)
+    const uint32_t span = min<uint32_t>(periodMs, SENSOR_WHEEL_SLOTS * SENSOR_WHEEL_TICK_MS);
+    uint32_t best = 0;
+    uint8_t bestLoad = 0xFF;
+    for (uint32_t offset = 0; offset < span; offset += SENSOR_WHEEL_TICK_MS) {
+        const uint8_t load = bucketSize_[bucketOf(startMs + offset)];
+        if (load < bestLoad) {
+            best = offset;
+            bestLoad = load;
+            if (load == 0) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+SensorSourceId SensorScheduler::add(const char* name, SensorPollFn poll, void* context,
+                                    uint32_t periodMs, uint32_t phaseMs, uint32_t deadlineMs) {
+    if (count_ >= SENSOR_SCHEDULER_MAX_SOURCES || !poll || !name ||
+        strlen(name) >= SENSOR_SOURCE_NAME_SIZE || periodMs < SENSOR_WHEEL_TICK_MS) {
+        return SENSOR_SOURCE_INVALID;
+    }
+    const SensorSourceId id = count_++;
+    Source& source = sources_[id];
+    strcpy(source.name, name);
+    source.poll = poll;
+    source.context = context;
+    source.periodMs = periodMs;
+    source.deadlineMs = deadlineMs;
+    source.dueMs = cursorMs_ + (phaseMs == SENSOR_PHASE_AUTO ? autoPhase(cursorMs_, periodMs)
+                                                             : phaseMs);
+    source.enabled = true;
+    source.stats = SensorSourceStats();
+    link(id);
+    wake();
+    return id;
+}
+
+bool SensorScheduler::setPeriod(SensorSourceId id, uint32_t periodMs) {
+    if (id >= count_ || periodMs < SENSOR_WHEEL_TICK_MS) {
+        return false;
+    }
+    Source& source = sources_[id];
+    if (source.enabled) {
+        unlink(id);
+    }
+    source.periodMs = periodMs;
+    source.dueMs = cursorMs_ + periodMs;
+    if (source.enabled) {
+        link(id);
+        wake();
+    }
+    return true;
+}
+
+void SensorScheduler::setEnabled(SensorSourceId id, bool enabled) {
+    if (id >= count_ || sources_[id].enabled == enabled) {
+        return;
+    }
+    Source& source = sources_[id];
+    source.enabled = enabled;
+    if (enabled) {
+        source.dueMs = cursorMs_ + source.periodMs;
+        link(id);
+        wake();
+    } else {
+        unlink(id);
+    }
+}
+
+void SensorScheduler::dispatch(SensorSourceId id, uint32_t nowMs) {
+    Source& source = sources_[id];
+    const uint32_t lateness = nowMs - source.dueMs;
+    if (source.deadlineMs && lateness > source.deadlineMs) {
+        source.stats.late++;
+    }
+    source.stats.maxLatenessMs = max(source.stats.maxLatenessMs, lateness);
+
+    const unsigned long start = micros();
+    source.poll(source.context);
+    source.stats.maxRunUs = max<uint32_t>(source.stats.maxRunUs, micros() - start);
+    source.stats.runs++;
+
+    // Stay on the original phase; periods that already passed are skipped
+    source.dueMs += source.periodMs;
+    if (static_cast<int32_t>(nowMs - source.dueMs) >= 0) {
+        const uint32_t missed = (nowMs - source.dueMs) / source.periodMs + 1;
+        source.stats.skipped += missed;
+        source.dueMs += missed * source.periodMs;
+    }
+}
+
+size_t SensorScheduler::run(uint32_t nowMs) {
+    if (paused_) {
+        return 0;
+    }
+    // Visit every bucket from the last run() up to now, at most one revolution.
+    // The bucket of the last run() is visited again: a source may have been
+    // scheduled later within the same tick.
+    const uint32_t lastTick = nowMs / SENSOR_WHEEL_TICK_MS;
+    uint32_t steps = lastTick - cursorMs_ / SENSOR_WHEEL_TICK_MS;
+    if (steps >= SENSOR_WHEEL_SLOTS) {
+        steps = SENSOR_WHEEL_SLOTS - 1;
+    }
+    size_t polls = 0;
+    for (uint32_t tick = lastTick - steps;; tick++) {
+        SensorSourceId id = buckets_[tick & (SENSOR_WHEEL_SLOTS - 1)];
+        while (id != SENSOR_SOURCE_INVALID) {
+            const SensorSourceId next = sources_[id].next;
+            if (static_cast<int32_t>(sources_[id].dueMs - nowMs) <= 0) {
+                unlink(id);
+                dispatch(id, nowMs);
+                link(id);
+                polls++;
+            }
+            id = next;
+        }
+        if (tick == lastTick) {
+            break;
+        }
+    }
+    cursorMs_ = nowMs;
+    return polls;
+}
+
+size_t SensorScheduler::pollAll(SensorSourceId skip) {
+    size_t polls = 0;
+    for (SensorSourceId id = 0; id < count_; id++) {
+        Source& source = sources_[id];
+        if (!source.enabled || id == skip) {
+            continue;
+        }
+        const unsigned long start = micros();
+        source.poll(source.context);
+        source.stats.maxRunUs = max<uint32_t>(source.stats.maxRunUs, micros() - start);
+        source.stats.runs++;
+        polls++;
+    }
+    return polls;
+}
+
+uint32_t SensorScheduler::msUntilNext(uint32_t nowMs) const {
+    if (paused_) {
+        return UINT32_MAX;
+    }
+    uint32_t soonest = UINT32_MAX;
+    for (size_t id = 0; id < count_; id++) {
+        if (!sources_[id].enabled) {
+            continue;
+        }
+        const int32_t wait = static_cast<int32_t>(sources_[id].dueMs - nowMs);
+        soonest = min<uint32_t>(soonest, wait > 0 ? wait : 0);
+    }
+    return soonest;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file SleepQueue.cpp
+ * @brief Implementation of the RTC-retained queue of the deep-sleep mode.
+ */
+
+#include "SleepQueue.h"
+
+SleepConfig sleepConfig;
+RTC_DATA_ATTR SleepRetained sleepRetained;
+SleepQueue sleepQueue(sleepRetained);
+
+SleepQueue::SleepQueue(SleepRetained& state) : state_(state), active_(false), usedAtWake_(0) {}
+
+void SleepQueue::reset() {
+    memset(&state_, 0, sizeof(state_));
+    state_.magic = SLEEP_RETAINED_MAGIC;
+    state_.layout = sizeof(SleepRetained);
+}
+
+bool SleepQueue::begin() {
+    const bool retained = state_.magic == SLEEP_RETAINED_MAGIC &&
+                          state_.layout == sizeof(SleepRetained) &&
+                          state_.used <= SLEEP_QUEUE_BYTES &&
+                          state_.paramCount <= SLEEP_RETAINED_PARAMS;
+    if (!retained) {
+        reset();
+    }
+    state_.stats.wakes++;
+    usedAtWake_ = state_.used;
+    return retained;
+}
+
+bool SleepQueue::append(Topic topic, const char* payload, size_t length) {
+    const size_t size = sizeof(SleepRecordHeader) + length;
+    if (size > free()) {
+        state_.stats.dropped++;
+        return false;
+    }
+    SleepRecordHeader header = {static_cast<uint16_t>(length), static_cast<uint8_t>(topic), 0};
+    memcpy(state_.queue + state_.used, &header, sizeof(header));
+    memcpy(state_.queue + state_.used + sizeof(header), payload, length);
+    state_.used += size;
+    state_.records++;
+    return true;
+}
+
+size_t SleepQueue::read(size_t offset, Topic& topic, const char*& payload,
+                        uint16_t& length) const {
+    if (offset + sizeof(SleepRecordHeader) > state_.used) {
+        return 0;
+    }
+    SleepRecordHeader header;
+    memcpy(&header, state_.queue + offset, sizeof(header));
+    const size_t end = offset + sizeof(header) + header.length;
+    if (end > state_.used || header.topic >= static_cast<uint8_t>(Topic::Count)) {
+        return 0;
+    }
+    topic = static_cast<Topic>(header.topic);
+    payload = reinterpret_cast<const char*>(state_.queue + offset + sizeof(header));
+    length = header.length;
+    return end;
+}
+
+void SleepQueue::consume(size_t bytes) {
+    bytes = min<size_t>(bytes, state_.used);
+    // Count the messages that go
+    size_t offset = 0;
+    Topic topic;
+    const char* payload;
+    uint16_t length;
+    while (offset < bytes) {
+        const size_t next = read(offset, topic, payload, length);
+        if (next == 0) {
+            break;
+        }
+        offset = next;
+        state_.records--;
+    }
+    memmove(state_.queue, state_.queue + bytes, state_.used - bytes);
+    state_.used -= bytes;
+    usedAtWake_ = min(usedAtWake_, state_.used);
+}
+
+void SleepQueue::retain(const ParamRegistry& registry) {
+    const size_t count = min<size_t>(registry.size(), SLEEP_RETAINED_PARAMS);
+    for (ParamId id = 0; id < count; id++) {
+        const ParamSlot& slot = registry.slot(id);
+        RetainedParam& param = state_.params[id];
+        strcpy(param.name, slot.name);
+        strcpy(param.method, registry.methodName(slot.method));
+        param.precision = slot.precision;
+        param.aggregate = slot.aggregate;
+        param.sent = slot.flush.sent;
+        param.lastDirection = slot.flush.band.lastDirection;
+        memcpy(param.lastSent, &slot.flush.lastSent, sizeof(SampleValue));
+    }
+    state_.paramCount = count;
+}
+
+size_t SleepQueue::restore(ParamRegistry& registry) const {
+    size_t restored = 0;
+    for (size_t i = 0; i < state_.paramCount; i++) {
+        const RetainedParam& param = state_.params[i];
+        const ParamId id =
+            registry.registerParam(param.name, param.method, param.precision, param.aggregate);
+        if (id == PARAM_INVALID) {
+            continue;
+        }
+        // The rule index is resolved again against the rules of this boot
+        ParamSlot& slot = registry.slot(id);
+        slot.flush.sent = param.sent;
+        slot.flush.band.lastDirection = param.lastDirection;
+        memcpy(&slot.flush.lastSent, param.lastSent, sizeof(SampleValue));
+        restored++;
+    }
+    return restored;
+}
+
+bool SleepQueue::burstDue(uint8_t burstEvery) const {
+    return state_.wakesSinceBurst + 1 >= burstEvery || free() < state_.largestWake;
+}
+
+void SleepQueue::endSampleWake(uint32_t awakeMs) {
+    state_.largestWake = max<uint16_t>(state_.largestWake, state_.used - usedAtWake_);
+    if (state_.wakesSinceBurst < UINT8_MAX) {
+        state_.wakesSinceBurst++;
+    }
+    state_.stats.sampleWakes++;
+    state_.stats.sampleMsTotal += awakeMs;
+    state_.stats.sampleMsMax = max(state_.stats.sampleMsMax, awakeMs);
+}
+
+void SleepQueue::endBurst(uint32_t publishMs, bool complete) {
+    state_.wakesSinceBurst = 0;
+    state_.stats.bursts++;
+    state_.stats.failedBursts += !complete;
+    state_.stats.publishMs = publishMs;
+    state_.stats.sampleWakes = 0;
+    state_.stats.sampleMsTotal = 0;
+    state_.stats.sampleMsMax = 0;
+}
+
+uint32_t SleepQueue::averageCurrentUa(uint32_t sampleMs, uint32_t publishMs, uint32_t periodSec,
+                                      uint8_t burstEvery) {
+    if (periodSec == 0 || burstEvery == 0) {
+        return 0;
+    }
+    // Charge of one cycle in mA*ms, spread over burstEvery periods
+    const uint64_t chargeMaMs = static_cast<uint64_t>(sampleMs) * (burstEvery - 1) *
+                                    SLEEP_CURRENT_AWAKE_MA +
+                                static_cast<uint64_t>(publishMs) * SLEEP_CURRENT_RADIO_MA;
+    const uint64_t cycleMs = static_cast<uint64_t>(periodSec) * 1000 * burstEvery;
+    return chargeMaMs * 1000 / cycleMs + SLEEP_CURRENT_DEEP_UA;
+}
@@ -0,0 +1,236 @@
+/**
+ * @file TlsClient.cpp
+ * @brief Implementation of the session-resuming TLS client.
+ */
+
+#include "TlsClient.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/platform.h>
+#include "MutexLock.h"
+
+extern SemaphoreHandle_t tlsMutex;
+
+namespace {
+
+const char kPersonalisation[] = "umec-tls";
+const int kDefaultTimeoutMs = 30000;  // As start_ssl_client
+
+uint8_t sessionBuffer[TLS_SESSION_BYTES];  // Guarded by tlsMutex
+
+}  // namespace
+
+bool TlsClient::resumable() const {
+    return !_pskIdent && !_cert && !_use_ca_bundle && (_CA_cert || _use_insecure);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+    if (!resumable()) {
+        return WiFiClientSecure::connect(ip, port);
+    }
+    return open(ip, port, nullptr);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+    _timeout = timeout;
+    return connect(ip, port);
+}
+
+int TlsClient::connect(const char* host, uint16_t port) {
+    if (!resumable()) {
+        return WiFiClientSecure::connect(host, port);
+    }
+    IPAddress address;
+    if (!WiFi.hostByName(host, address)) {
+        return 0;
+    }
+    return open(address, port, host);
+}
+
+int TlsClient::connect(const char* host, uint16_t port, int32_t timeout) {
+    _timeout = timeout;
+    return connect(host, port);
+}
+
+int TlsClient::open(IPAddress ip, uint16_t port, const char* host) {
+    char peer[TLS_HOST_SIZE];
+    strncpy(peer, host ? host : ip.toString().c_str(), sizeof(peer) - 1);
+    peer[sizeof(peer) - 1] = '\0';
+
+    if (sslclient->socket >= 0) {
+        stop();
+    }
+    const uint32_t startMs = millis();
+    bool offered = false;
+    bool resumed = false;
+    const int ret = openSocket(ip, port) ? handshake(peer, port, offered, resumed) : -1;
+    if (ret != 0) {
+        Serial.printf("TLS: connection to %s:%u failed (%d)\n", peer, (unsigned)port, ret);
+        _lastError = ret;
+        stop();
+        MutexLock lock(tlsMutex);
+        if (offered) {
+            tlsSessions.forget(peer, port);
+        }
+        tlsSessions.recordFailure(offered);
+        return 0;
+    }
+    keepSession(peer, port);
+    {
+        MutexLock lock(tlsMutex);
+        tlsSessions.recordHandshake(resumed ? HandshakeKind::Resumed : HandshakeKind::Full,
+                                    millis() - startMs, offered);
+    }
+    _lastError = 0;
+    _connected = true;
+    return 1;
+}
+
+bool TlsClient::openSocket(IPAddress ip, uint16_t port) {
+    const int fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return false;
+    }
+    sslclient->socket = fd;  // Closed by stop() on failure
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = static_cast<uint32_t>(ip);
+    address.sin_port = htons(port);
+    if (lwip_connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 &&
+        errno != EINPROGRESS) {
+        return false;
+    }
+
+    const int timeoutMs = _timeout > 0 ? _timeout : kDefaultTimeoutMs;
+    struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    if (select(fd + 1, nullptr, &writable, nullptr, &timeout) <= 0) {
+        return false;
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        return false;
+    }
+
+    const int enable = 1;
+    timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    lwip_setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    lwip_setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    lwip_setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    return true;
+}
+
+int TlsClient::handshake(const char* peer, uint16_t port, bool& offered, bool& resumed) {
+    sslclient_context* context = sslclient;
+    int ret;
+
+    // Same set-up as start_ssl_client
+    mbedtls_entropy_init(&context->entropy_ctx);
+    ret = mbedtls_ctr_drbg_seed(&context->drbg_ctx, mbedtls_entropy_func, &context->entropy_ctx,
+                                reinterpret_cast<const unsigned char*>(kPersonalisation),
+                                sizeof(kPersonalisation) - 1);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = mbedtls_ssl_config_defaults(&context->ssl_conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        return ret;
+    }
+    if (_alpn_protos && (ret = mbedtls_ssl_conf_alpn_protocols(&context->ssl_conf, _alpn_protos)) != 0) {
+        return ret;
+    }
+    if (_use_insecure) {
+        mbedtls_ssl_conf_authmode(&context->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
+    } else {
+        mbedtls_x509_crt_init(&context->ca_cert);
+        ret = mbedtls_x509_crt_parse(&context->ca_cert,
+                                     reinterpret_cast<const unsigned char*>(_CA_cert),
+                                     strlen(_CA_cert) + 1);
+        if (ret < 0) {
+            mbedtls_x509_crt_free(&context->ca_cert);
+            return ret;
+        }
+        mbedtls_ssl_conf_ca_chain(&context->ssl_conf, &context->ca_cert, nullptr);
+        mbedtls_ssl_conf_authmode(&context->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    }
+    mbedtls_ssl_conf_rng(&context->ssl_conf, mbedtls_ctr_drbg_random, &context->drbg_ctx);
+    if ((ret = mbedtls_ssl_setup(&context->ssl_ctx, &context->ssl_conf)) != 0) {
+        return ret;
+    }
+    if ((ret = mbedtls_ssl_set_hostname(&context->ssl_ctx, peer)) != 0) {
+        return ret;
+    }
+    mbedtls_ssl_set_bio(&context->ssl_ctx, &context->socket, mbedtls_net_send, mbedtls_net_recv,
+                        nullptr);
+
+    {
+        MutexLock lock(tlsMutex);
+        const TlsSessionSlot* cached = tlsSessions.find(peer, port);
+        if (cached) {
+            mbedtls_ssl_session session;
+            mbedtls_ssl_session_init(&session);
+            offered = mbedtls_ssl_session_load(&session, cached->data, cached->length) == 0 &&
+                      mbedtls_ssl_set_session(&context->ssl_ctx, &session) == 0;
+            mbedtls_ssl_session_free(&session);
+        }
+    }
+
+    // Step by step: a server that accepts the session goes from ServerHello
+    // straight to ChangeCipherSpec and never sends its certificate
+    bool certificate = false;
+    const uint32_t startMs = millis();
+    while (context->ssl_ctx.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        certificate |= context->ssl_ctx.state == MBEDTLS_SSL_SERVER_CERTIFICATE;
+        ret = mbedtls_ssl_handshake_step(&context->ssl_ctx);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            if (millis() - startMs > context->handshake_timeout) {
+                return MBEDTLS_ERR_SSL_TIMEOUT;
+            }
+            vTaskDelay(2);
+        } else if (ret != 0) {
+            return ret;
+        }
+    }
+    if (!_use_insecure && mbedtls_ssl_get_verify_result(&context->ssl_ctx) != 0) {
+        return MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
+    }
+    // The parsed CA chain is only needed for the handshake
+    if (!_use_insecure) {
+        mbedtls_ssl_conf_ca_chain(&context->ssl_conf, nullptr, nullptr);
+        mbedtls_x509_crt_free(&context->ca_cert);
+    }
+    resumed = offered && !certificate;
+    return 0;
+}
+
+void TlsClient::keepSession(const char* peer, uint16_t port) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(&sslclient->ssl_ctx, &session) == 0) {
+#if defined(MBEDTLS_SSL_KEEP_PEER_CERTIFICATE)
+        // A resumed handshake does not look at the certificate again
+        if (session.peer_cert) {
+            mbedtls_x509_crt_free(session.peer_cert);
+            mbedtls_free(session.peer_cert);
+            session.peer_cert = nullptr;
+        }
+#endif
+        MutexLock lock(tlsMutex);
+        size_t length = 0;
+        const int ret =
+            mbedtls_ssl_session_save(&session, sessionBuffer, sizeof(sessionBuffer), &length);
+        if (ret == 0 || ret == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+            // Too large: store() counts it and drops the old session
+            tlsSessions.store(peer, port, sessionBuffer, length);
+        }
+    }
+    mbedtls_ssl_session_free(&session);
+}
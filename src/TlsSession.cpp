@@ -0,0 +1,150 @@
+/**
+ * @file TlsSession.cpp
+ * @brief Implementation of the TLS session cache and handshake histogram.
+ */
+
+#include "TlsSession.h"
+
+#if TLS_SESSION_RTC
+RTC_DATA_ATTR TlsRetained tlsRetained;
+#else
+TlsRetained tlsRetained;
+#endif
+TlsSessions tlsSessions(tlsRetained);
+
+TlsSessions::TlsSessions(TlsRetained& state) : state_(state), stats_() {}
+
+void TlsSessions::validate() {
+    if (state_.magic == TLS_RETAINED_MAGIC && state_.layout == sizeof(TlsRetained)) {
+        return;
+    }
+    memset(&state_, 0, sizeof(state_));
+    state_.magic = TLS_RETAINED_MAGIC;
+    state_.layout = sizeof(TlsRetained);
+}
+
+TlsSessionSlot* TlsSessions::slot(const char* host, uint16_t port) {
+    validate();
+    for (TlsSessionSlot& entry : state_.slots) {
+        if (entry.length && entry.port == port &&
+            strncmp(entry.host, host, TLS_HOST_SIZE) == 0) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+const TlsSessionSlot* TlsSessions::find(const char* host, uint16_t port) {
+    TlsSessionSlot* entry = slot(host, port);
+    if (entry && entry->length <= TLS_SESSION_BYTES) {
+        entry->stamp = ++state_.clock;
+        return entry;
+    }
+    return nullptr;
+}
+
+bool TlsSessions::store(const char* host, uint16_t port, const uint8_t* data, size_t length) {
+    if (length > TLS_SESSION_BYTES) {
+        // The old session would only be offered again and again
+        stats_.tooLarge++;
+        forget(host, port);
+        return false;
+    }
+    if (length == 0) {
+        return false;
+    }
+    TlsSessionSlot* entry = slot(host, port);
+    if (!entry) {
+        entry = &state_.slots[0];
+        for (TlsSessionSlot& candidate : state_.slots) {
+            if (candidate.length == 0) {
+                entry = &candidate;
+                break;
+            }
+            if (candidate.stamp < entry->stamp) {
+                entry = &candidate;
+            }
+        }
+        strncpy(entry->host, host, TLS_HOST_SIZE - 1);
+        entry->host[TLS_HOST_SIZE - 1] = '\0';
+        entry->port = port;
+    }
+    memcpy(entry->data, data, length);
+    entry->length = length;
+    entry->stamp = ++state_.clock;
+    stats_.stored++;
+    return true;
+}
+
+void TlsSessions::forget(const char* host, uint16_t port) {
+    TlsSessionSlot* entry = slot(host, port);
+    if (entry) {
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+size_t TlsSessions::size() {
+    validate();
+    size_t used = 0;
+    for (const TlsSessionSlot& entry : state_.slots) {
+        used += entry.length != 0;
+    }
+    return used;
+}
+
+size_t TlsSessions::bucket(uint32_t ms) {
+    size_t index = 0;
+    uint32_t limit = TLS_HISTOGRAM_FIRST_MS;
+    while (index + 1 < TLS_HISTOGRAM_BUCKETS && ms >= limit) {
+        index++;
+        limit *= 2;
+    }
+    return index;
+}
+
+uint32_t TlsSessions::bucketLimitMs(size_t bucket) {
+    if (bucket + 1 >= TLS_HISTOGRAM_BUCKETS) {
+        return UINT32_MAX;
+    }
+    return static_cast<uint32_t>(TLS_HISTOGRAM_FIRST_MS) << bucket;
+}
+
+void TlsSessions::recordHandshake(HandshakeKind kind, uint32_t ms, bool offered) {
+    HandshakeHistogram& histogram = stats_.kind[static_cast<size_t>(kind)];
+    histogram.counts[bucket(ms)]++;
+    histogram.total++;
+    histogram.totalMs += ms;
+    histogram.maxMs = max(histogram.maxMs, ms);
+    stats_.offered += offered;
+}
+
+void TlsSessions::recordFailure(bool offered) {
+    stats_.failed++;
+    stats_.offered += offered;
+}
+
+uint32_t TlsSessions::percentileMs(HandshakeKind kind, uint8_t percent) const {
+    const HandshakeHistogram& histogram = stats_.kind[static_cast<size_t>(kind)];
+    if (histogram.total == 0) {
+        return 0;
+    }
+    const uint64_t wanted = (static_cast<uint64_t>(histogram.total) * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < TLS_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram.counts[i];
+        if (seen >= wanted) {
+            // The open last bucket is bounded by the slowest handshake
+            return min(bucketLimitMs(i), histogram.maxMs);
+        }
+    }
+    return histogram.maxMs;
+}
+
+const char* TlsSessions::kindName(HandshakeKind kind) {
+    switch (kind) {
+        case HandshakeKind::Full: return "full";
+        case HandshakeKind::Resumed: return "resumed";
+        case HandshakeKind::WebSocket: return "ws";
+        default: return "?";
+    }
+}
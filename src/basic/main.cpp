@@ -38,17 +38,23 @@ SmoothLED smoothLED2(LED_SERVER, 0, 255, 20, 5); ///< LED for server state
  * @brief Arduino setup function. Initializes all required subsystems.
  */
 void setup() {
-    initializeTasks();
+    initializeRuntime();
     initializeSerial();
     initializeSensors();
     initializePreferences();
+    initializeStorage();
+    if (sleepModeSelected()) {
+        runSleepCycle();  // Samples, maybe publishes, and sleeps; never returns
+    }
+    initializeTasks();
     initializeWiFi();
     initializeIndication();
     initializeMQTT();
+    startPipeline();
 }
 
 /**
- * @brief Arduino loop function. Delegates work to scheduled tasks.
+ * @brief Arduino loop function. Idles while the pipeline tasks run.
  */
 void loop() {
   loopTasks();
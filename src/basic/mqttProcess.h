@@ -23,12 +23,12 @@ void subscribeTo() {}
  * the server it is immediately echoed back to acknowledge reception.
  */
 void subscribeToTimeExchange() {
-    mqtt.subscribe("command/" + String(getChipID()) + "/time", 2,
+    mqtt.subscribe(deviceIdentity.topic(Topic::CommandTime), 2,
                    [](const String &payload, const size_t size) {
         Serial.print("Получена команда /time/ от ");
         Serial.print(payload);
 
-        mqtt.publish("time/" + getChipID(), payload);
+        mqtt.publish(deviceIdentity.topic(Topic::TimeEcho), payload);
     });
 }
 
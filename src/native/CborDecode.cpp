@@ -0,0 +1,232 @@
+/**
+ * @file CborDecode.cpp
+ * @brief CBOR to JSON conversion for the host benchmark.
+ */
+
+#include "CborDecode.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const int kMaxDepth = 16;
+
+class Decoder {
+public:
+    Decoder(const uint8_t* data, size_t length) : data_(data), end_(data + length) {}
+
+    bool item(std::string& out, int depth);
+    bool done() const { return data_ == end_; }
+
+private:
+    bool byte(uint8_t& value) {
+        if (data_ == end_) {
+            return false;
+        }
+        value = *data_++;
+        return true;
+    }
+
+    bool bigEndian(size_t size, uint64_t& value) {
+        if (static_cast<size_t>(end_ - data_) < size) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < size; i++) {
+            value = (value << 8) | *data_++;
+        }
+        return true;
+    }
+
+    /** Argument of the initial byte; @p indefinite is set for additional info 31. */
+    bool argument(uint8_t info, uint64_t& value, bool& indefinite) {
+        indefinite = false;
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+        switch (info) {
+            case 24: return bigEndian(1, value);
+            case 25: return bigEndian(2, value);
+            case 26: return bigEndian(4, value);
+            case 27: return bigEndian(8, value);
+            case 31:
+                indefinite = true;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool atBreak() {
+        if (data_ != end_ && *data_ == 0xFF) {
+            data_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool text(uint64_t size, std::string& out);
+    bool container(bool map, uint64_t count, bool indefinite, std::string& out, int depth);
+    static void number(double value, int digits, std::string& out);
+
+    const uint8_t* data_;
+    const uint8_t* end_;
+};
+
+bool Decoder::text(uint64_t size, std::string& out) {
+    if (static_cast<uint64_t>(end_ - data_) < size) {
+        return false;
+    }
+    out += '"';
+    for (uint64_t i = 0; i < size; i++) {
+        const uint8_t c = *data_++;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+    return true;
+}
+
+bool Decoder::container(bool map, uint64_t count, bool indefinite, std::string& out,
+                        int depth) {
+    out += map ? '{' : '[';
+    for (uint64_t i = 0; indefinite || i < count; i++) {
+        if (indefinite && atBreak()) {
+            break;
+        }
+        if (i > 0) {
+            out += ',';
+        }
+        if (map) {
+            // JSON keys must be text
+            uint8_t initial;
+            uint64_t size;
+            bool keyIndefinite;
+            if (!byte(initial) || initial >> 5 != 3 ||
+                !argument(initial & 0x1F, size, keyIndefinite) || keyIndefinite ||
+                !text(size, out)) {
+                return false;
+            }
+            out += ':';
+        }
+        if (!item(out, depth + 1)) {
+            return false;
+        }
+    }
+    out += map ? '}' : ']';
+    return true;
+}
+
+void Decoder::number(double value, int digits, std::string& out) {
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char text[40];
+    snprintf(text, sizeof(text), "%.*g", digits, value);
+    out += text;
+}
+
+bool Decoder::item(std::string& out, int depth) {
+    uint8_t initial;
+    if (depth > kMaxDepth || !byte(initial)) {
+        return false;
+    }
+    const uint8_t major = initial >> 5;
+    const uint8_t info = initial & 0x1F;
+    if (major == 7) {
+        uint64_t bits;
+        switch (info) {
+            case 20: out += "false"; return true;
+            case 21: out += "true"; return true;
+            case 22:
+            case 23: out += "null"; return true;
+            case 25: {
+                if (!bigEndian(2, bits)) {
+                    return false;
+                }
+                // IEEE 754 half precision
+                const int exponent = (bits >> 10) & 0x1F;
+                const double mantissa = bits & 0x3FF;
+                double value = exponent == 0    ? std::ldexp(mantissa, -24)
+                               : exponent == 31 ? (mantissa == 0 ? INFINITY : NAN)
+                                                : std::ldexp(mantissa + 1024, exponent - 25);
+                number(bits & 0x8000 ? -value : value, 5, out);
+                return true;
+            }
+            case 26: {
+                if (!bigEndian(4, bits)) {
+                    return false;
+                }
+                const uint32_t word = static_cast<uint32_t>(bits);
+                float value;
+                memcpy(&value, &word, sizeof(value));
+                number(value, 9, out);
+                return true;
+            }
+            case 27: {
+                if (!bigEndian(8, bits)) {
+                    return false;
+                }
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                number(value, 17, out);
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    uint64_t value = 0;
+    bool indefinite;
+    if (!argument(info, value, indefinite)) {
+        return false;
+    }
+    char digits[24];
+    switch (major) {
+        case 0:
+            if (indefinite) {
+                return false;
+            }
+            snprintf(digits, sizeof(digits), "%llu", static_cast<unsigned long long>(value));
+            out += digits;
+            return true;
+        case 1:
+            if (indefinite) {
+                return false;
+            }
+            // -1 - n
+            snprintf(digits, sizeof(digits), "-%llu",
+                     static_cast<unsigned long long>(value) + 1ULL);
+            out += digits;
+            return true;
+        case 3:
+            return !indefinite && text(value, out);
+        case 4:
+            return container(false, value, indefinite, out, depth);
+        case 5:
+            return container(true, value, indefinite, out, depth);
+        default:
+            return false;  // byte strings and tags are not used by the device
+    }
+}
+
+}  // namespace
+
+bool cborToJson(const uint8_t* data, size_t length, std::string& json) {
+    json.clear();
+    Decoder decoder(data, length);
+    return decoder.item(json, 0) && decoder.done();
+}
@@ -0,0 +1,21 @@
+/**
+ * @file CborDecode.h
+ * @brief Host-side CBOR decoder for checking CborWriter output.
+ *
+ * Converts the subset of CBOR the device emits (integers, text, definite and
+ * indefinite arrays and maps, simple values, half/single/double floats) to
+ * compact JSON text, which is also what a server would make of a telemetry
+ * message.  Byte strings and tags are rejected.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Decode exactly one data item spanning @p length bytes.
+ * @return false on malformed or unsupported input, or trailing bytes.
+ */
+bool cborToJson(const uint8_t* data, size_t length, std::string& json);
@@ -0,0 +1,2138 @@
+/**
+ * @file main.cpp
+ * @brief Host benchmark for the telemetry hot path (`pio run -e native`).
+ *
+ * The benchmark links the real DataQueue.cpp against the Arduino shim in
+ * src/native/shim and replays the work done on every telemetry period of
+ * sensorScheduler: producers store samples, processQueue() groups them into
+ * JSON-RPC messages and processMQTTQueue() hands them to the (stubbed) MQTT
+ * client.  For each parameter set it reports wall time, heap allocations and
+ * bytes emitted per cycle so that changes to the hot path can be compared
+ * against a baseline.  The final rows compare the String-concatenation
+ * message building used before JsonWriter with JsonWriter on identical
+ * messages, compare publishing the latest sample with publishing window
+ * aggregates or sample histories, schedule sensor sources on the timing
+ * wheel, sample through a stalling network side in one loop and in the
+ * acquisition / network pipeline, count wake-ups of polling and
+ * event-driven task loops, compare full and delta messages of a wide method and JSON and CBOR
+ * payload sizes, and run an hour of offline flushes through the LittleFS
+ * outbox (backed by a temporary host directory) followed by a reboot and the
+ * replay.  QoS 1 telemetry goes through the in-flight window to a loopback
+ * broker; the last rows send a backlog over a lossy link with windows of
+ * 1, 2 and MQTT_INFLIGHT_WINDOW messages.
+ *
+ * The scenarios that check correctness (lane choice, CBOR against JSON,
+ * outbox recovery, the deep-sleep burst, body streams, the in-flight window)
+ * return false when a check fails, and the benchmark then exits with
+ * status 1.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CborDecode.h"
+#include "DataQueue.h"
+#include "HeapTrace.h"
+#include "HttpBodyStream.h"
+#include "HttpQueue.h"
+#include "HttpsPool.h"
+#include "MqttReconnect.h"
+#include "Outbox.h"
+#include "Pipeline.h"
+#include "PowerMonitor.h"
+#include "SensorScheduler.h"
+#include "SleepQueue.h"
+#include "TlsSession.h"
+
+// ---------------------------------------------------------------------------
+// Globals normally provided by settings.cpp / mqttFunc.h / utilities.cpp
+// ---------------------------------------------------------------------------
+
+MQTTPubSub::PubSubClient<MQTT_BUFFER_SIZE> mqtt;
+SemaphoreHandle_t dataQueueMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t mqttMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t deadBandMutex = xSemaphoreCreateMutex();
+
+fs::LittleFSFS LittleFS;
+
+void readDeviceMac(uint8_t mac[6]) {
+    const uint8_t fixed[6] = {0xA0, 0xB1, 0xC2, 0xD3, 0xE4, 0xF5};
+    memcpy(mac, fixed, sizeof(fixed));
+}
+
+// Route every C++ allocation through the counters as well.
+void* operator new(size_t size) {
+    void* ptr = HeapTrace::traceMalloc(size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { HeapTrace::traceFree(ptr); }
+void operator delete[](void* ptr) noexcept { HeapTrace::traceFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { HeapTrace::traceFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { HeapTrace::traceFree(ptr); }
+
+namespace {
+
+// ---------------------------------------------------------------------------
+// Synthetic device model
+// ---------------------------------------------------------------------------
+
+/** Deterministic xorshift generator so runs are repeatable. */
+struct Rng {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    /** Uniform value in [0, 1). */
+    float unit() { return (next() & 0xFFFFFF) / 16777216.0f; }
+};
+
+/** Prefix, typical magnitude and per-tick noise of a simulated register. */
+struct ParamKind {
+    const char* prefix;
+    float base;
+    float noise;
+};
+
+// Mix of names matching the dead-band rules in processQueue().  Noise is
+// chosen so that roughly a fifth of the samples cross their threshold.
+const ParamKind kKinds[] = {
+    {"current", 12.0f, 0.4f}, {"voltage", 230.0f, 6.0f}, {"power", 2700.0f, 160.0f},
+    {"energy", 152340.0f, 120.0f}, {"vbat", 3.9f, 0.25f}, {"gauge", 1.5f, 0.12f},
+    {"t0", 21.0f, 1.2f}, {"cons", 40.0f, 1.2f}, {"leak", 0.0f, 0.0f},
+    {"active", 1.0f, 0.0f}, {"flow", 3.0f, 0.4f}, {"humidity", 45.0f, 3.0f},
+};
+const size_t kKindCount = sizeof(kKinds) / sizeof(kKinds[0]);
+
+/** Registers grouped into RPC methods the way Modbus devices report them. */
+const size_t kParamsPerMethod = 10;
+
+struct SimParam {
+    ParamId id;
+    float value;
+    float noise;
+    bool binary;
+};
+
+std::vector<SimParam> makeParams(size_t count, uint8_t aggregate = PARAM_AGG_NONE) {
+    std::vector<SimParam> params;
+    params.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const ParamKind& kind = kKinds[i % kKindCount];
+        char name[32];
+        char method[32];
+        snprintf(name, sizeof(name), "%s-%u", kind.prefix, static_cast<unsigned>(i));
+        snprintf(method, sizeof(method), "modbus-%u", static_cast<unsigned>(i / kParamsPerMethod));
+        params.push_back(
+            {registerParam(name, method, 2, aggregate), kind.base, kind.noise, kind.noise == 0.0f});
+    }
+    return params;
+}
+
+/** Advance every simulated register by one polling interval. */
+void stepValues(std::vector<SimParam>& params, Rng& rng) {
+    for (auto& p : params) {
+        if (p.binary) {
+            // Digital inputs flip rarely.
+            if (rng.unit() < 0.02f) {
+                p.value = p.value > 0.5f ? 0.0f : 1.0f;
+            }
+        } else {
+            p.value += (rng.unit() * 2.0f - 1.0f) * p.noise;
+        }
+    }
+}
+
+/** What a sensor driver does: one registry slot write per sample. */
+void produce(const std::vector<SimParam>& params) {
+    for (const auto& p : params) {
+        // Digital inputs are reported as flags, everything else as floats.
+        queueParam(p.id, p.binary ? SampleValue(p.value > 0.5f) : SampleValue(p.value));
+    }
+}
+
+/** Report a failed check of a scenario. @return @p ok */
+bool check(bool ok, const char* what) {
+    if (!ok) {
+        Serial.setMuted(false);
+        Serial.printf("CHECK FAILED: %s\n", what);
+    }
+    return ok;
+}
+
+/** Publish everything that processQueue() left in the MQTT queue. */
+void drain() {
+    for (;;) {
+        if (mqttLanes.size() == 0) {
+            return;
+        }
+        processMQTTQueue();
+    }
+}
+
+/** publishSleepQueue() poll: the loopback broker answers synchronously. */
+void pollNothing() {}
+
+/** A QoS 1 PUBLISH packet as MqttInflight encodes it. */
+struct PublishPacket {
+    bool dup;
+    bool retain;
+    uint16_t id;
+    char topic[128];
+    const uint8_t* payload;
+    size_t length;
+};
+
+bool decodePublish(const uint8_t* packet, size_t length, PublishPacket& out) {
+    if (length < 2 || (packet[0] & 0xF6) != 0x32) {
+        return false;
+    }
+    size_t pos = 1;
+    uint32_t remaining = 0;
+    for (uint8_t shift = 0; pos < length && shift < 28; shift += 7) {
+        remaining |= static_cast<uint32_t>(packet[pos] & 0x7F) << shift;
+        if (!(packet[pos++] & 0x80)) {
+            break;
+        }
+    }
+    if (pos + remaining != length || remaining < 4) {
+        return false;
+    }
+    const size_t topicLength = (packet[pos] << 8) | packet[pos + 1];
+    if (topicLength >= sizeof(out.topic) || pos + 2 + topicLength + 2 > length) {
+        return false;
+    }
+    memcpy(out.topic, packet + pos + 2, topicLength);
+    out.topic[topicLength] = '\0';
+    pos += 2 + topicLength;
+    out.dup = packet[0] & 0x08;
+    out.retain = packet[0] & 0x01;
+    out.id = (packet[pos] << 8) | packet[pos + 1];
+    out.payload = packet + pos + 2;
+    out.length = length - pos - 2;
+    return true;
+}
+
+/**
+ * MqttInflight transport of the benchmarks that only count what leaves the
+ * device: the mqtt stand-in accounts the publish and the PUBACK comes back
+ * at once, so QoS 1 telemetry costs what QoS 0 did.
+ */
+bool loopbackBroker(const uint8_t* packet, size_t length, void* context) {
+    static String topic;
+    PublishPacket publish;
+    if (!decodePublish(packet, length, publish)) {
+        return false;
+    }
+    topic = publish.topic;
+    if (!mqtt.publish(topic, const_cast<uint8_t*>(publish.payload), publish.length,
+                      publish.retain, 1)) {
+        return false;
+    }
+    const uint8_t ack[] = {0x40, 0x02, static_cast<uint8_t>(publish.id >> 8),
+                           static_cast<uint8_t>(publish.id)};
+    mqttInflight.receive(ack, sizeof(ack), millis());
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Measurement helpers
+// ---------------------------------------------------------------------------
+
+/** Accumulated cost of one benchmark phase. */
+struct PhaseStats {
+    uint64_t nanos = 0;
+    uint64_t allocs = 0;
+    uint64_t logBytes = 0;
+};
+
+/** Measure a callable and add its cost to @p stats. */
+template <typename Fn>
+void measure(PhaseStats& stats, Fn&& fn) {
+    HeapTrace::Counters before = HeapTrace::snapshot();
+    size_t logBefore = Serial.bytesWritten();
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    stats.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    stats.allocs += HeapTrace::snapshot().allocs - before.allocs;
+    stats.logBytes += Serial.bytesWritten() - logBefore;
+}
+
+void printRow(size_t params, const char* phase, const PhaseStats& stats, size_t cycles,
+              double bytes, double msgs) {
+    Serial.printf("%6u  %-14s %12.0f %12.1f %10.1f %10.1f %10.1f\n",
+                  static_cast<unsigned>(params), phase,
+                  static_cast<double>(stats.nanos) / cycles,
+                  static_cast<double>(stats.allocs) / cycles,
+                  static_cast<double>(stats.logBytes) / cycles, bytes, msgs);
+}
+
+void runScenario(size_t paramCount) {
+    std::vector<SimParam> params = makeParams(paramCount);
+    Rng rng{0x12345678u ^ static_cast<uint32_t>(paramCount)};
+    const size_t cycles = std::max<size_t>(50, 50000 / paramCount);
+
+    // Warm-up: the first flush always sends every method.
+    Serial.setMuted(true);
+    produce(params);
+    processQueue();
+    drain();
+    mqtt.resetCounters();
+
+    PhaseStats produceStats;
+    PhaseStats processStats;
+    PhaseStats drainStats;
+    for (size_t c = 0; c < cycles; c++) {
+        stepValues(params, rng);
+        measure(produceStats, [&] { produce(params); });
+        measure(processStats, [] { processQueue(); });
+        measure(drainStats, [] { drain(); });
+    }
+    Serial.setMuted(false);
+
+    const double bytes = static_cast<double>(mqtt.payloadBytes()) / cycles;
+    const double msgs = static_cast<double>(mqtt.published()) / cycles;
+    PhaseStats total;
+    total.nanos = produceStats.nanos + processStats.nanos + drainStats.nanos;
+    total.allocs = produceStats.allocs + processStats.allocs + drainStats.allocs;
+    total.logBytes = produceStats.logBytes + processStats.logBytes + drainStats.logBytes;
+
+    printRow(paramCount, "produce", produceStats, cycles, 0, 0);
+    printRow(paramCount, "processQueue", processStats, cycles, 0, 0);
+    printRow(paramCount, "drain", drainStats, cycles, bytes, msgs);
+    printRow(paramCount, "cycle", total, cycles, bytes, msgs);
+}
+
+/** Cost of a single enqueue/publish round trip for a typical payload. */
+void runQueueRoundTrip() {
+    const String topic = deviceIdentity.topic(Topic::RpcOut);
+    const String payload =
+        "{\"jsonrpc\":\"2.0\",\"method\":\"sensor-data\",\"params\":{\"wifi\":{\"value\":-61.00}}}";
+    const size_t ops = 100000;
+
+    Serial.setMuted(true);
+    mqtt.resetCounters();
+    PhaseStats stats;
+    measure(stats, [&] {
+        for (size_t i = 0; i < ops; i++) {
+            enqueueMQTTMessage(topic, payload, false, 0);
+            processMQTTQueue();
+        }
+    });
+    Serial.setMuted(false);
+
+    Serial.printf("%6s  %-14s %12.0f %12.1f %10.1f %10.1f %10.1f\n", "1", "enqueue+publish",
+                  static_cast<double>(stats.nanos) / ops, static_cast<double>(stats.allocs) / ops,
+                  static_cast<double>(stats.logBytes) / ops,
+                  static_cast<double>(mqtt.payloadBytes()) / ops,
+                  static_cast<double>(mqtt.published()) / ops);
+}
+
+/**
+ * A producer still filling the head slot of the control lane: the committed
+ * bulk messages behind it must go out in the same drain pass.
+ */
+bool runUncommittedHead() {
+    const String topic = deviceIdentity.topic(Topic::RpcOut);
+    const char* payload = "{\"jsonrpc\":\"2.0\",\"method\":\"sensor-data\",\"params\":{}}";
+    const size_t messages = 4;
+    MqttSlot* filling = mqttLanes.lane(MqttLane::Control).reserve();
+    for (size_t i = 0; i < messages; i++) {
+        enqueueMQTTMessage(topic.c_str(), payload, strlen(payload), false, 0, MqttLane::Bulk);
+    }
+    Serial.setMuted(true);
+    mqtt.resetCounters();
+    processMQTTQueue();
+    const size_t published = mqtt.published();
+    filling->topic = topic;
+    filling->length = 0;  // Skipped by processMQTTQueue()
+    mqttLanes.lane(MqttLane::Control).commit(filling);
+    drain();
+    Serial.setMuted(false);
+    Serial.printf("%6s  %-14s %u of %u bulk messages published past an uncommitted control "
+                  "slot\n", "-", "lane choice", static_cast<unsigned>(published),
+                  static_cast<unsigned>(messages));
+    return check(published == messages, "lanes: uncommitted head stalled the drain");
+}
+
+// ---------------------------------------------------------------------------
+// Serializer comparison: String building as before JsonWriter vs JsonWriter
+// ---------------------------------------------------------------------------
+
+/** processQueue() message body as built before JsonWriter. */
+String legacyRpcMessage(const char* method, const char* const* names, const float* values,
+                        size_t count) {
+    String jsonMessage = "{\"jsonrpc\":\"2.0\",\"method\":\"" + String(method) +
+                         "\",\"params\":{";
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            jsonMessage += ",";
+        }
+        jsonMessage += "\"" + String(names[i]) + "\":{\"value\":" + String(values[i], 2) + "}";
+    }
+    jsonMessage += "}}";
+    return jsonMessage;
+}
+
+/** sendNvsSuccessResponse() body as built before JsonWriter. */
+String legacyRpcResult(int64_t id) {
+    static String jsonTemplate = "{\"jsonrpc\":\"2.0\",\"id\":ID_PLACEHOLDER,\"result\":\"success\"}";
+    String response = jsonTemplate;
+    response.replace("ID_PLACEHOLDER", String(static_cast<long long>(id)));
+    return response;
+}
+
+void printSerializerRow(const char* name, const PhaseStats& stats, size_t ops, size_t bytes) {
+    Serial.printf("%6s  %-14s %12.0f %12.1f %10.1f %10.1f %10.1f\n", "-", name,
+                  static_cast<double>(stats.nanos) / ops,
+                  static_cast<double>(stats.allocs) / ops, 0.0,
+                  static_cast<double>(bytes) / ops, 1.0);
+}
+
+void runSerializerComparison() {
+    const size_t ops = 20000;
+    const char* names[kParamsPerMethod];
+    char nameStorage[kParamsPerMethod][PARAM_NAME_SIZE];
+    float values[kParamsPerMethod];
+    for (size_t i = 0; i < kParamsPerMethod; i++) {
+        snprintf(nameStorage[i], sizeof(nameStorage[i]), "%s%u", kKinds[i % kKindCount].prefix,
+                 static_cast<unsigned>(i));
+        names[i] = nameStorage[i];
+        values[i] = kKinds[i % kKindCount].base;
+    }
+
+    size_t bytes = 0;
+    PhaseStats legacy;
+    measure(legacy, [&] {
+        for (size_t n = 0; n < ops; n++) {
+            values[n % kParamsPerMethod] += 0.01f;
+            bytes += legacyRpcMessage("modbus-0", names, values, kParamsPerMethod).length();
+        }
+    });
+    printSerializerRow("rpc String", legacy, ops, bytes);
+
+    static char buffer[MQTT_BUFFER_SIZE];
+    for (size_t i = 0; i < kParamsPerMethod; i++) {
+        values[i] = kKinds[i % kKindCount].base;
+    }
+    bytes = 0;
+    PhaseStats writer;
+    measure(writer, [&] {
+        JsonWriter json(buffer, sizeof(buffer));
+        for (size_t n = 0; n < ops; n++) {
+            values[n % kParamsPerMethod] += 0.01f;
+            json.reset();
+            json.beginRpc("modbus-0");
+            for (size_t i = 0; i < kParamsPerMethod; i++) {
+                json.key(names[i]).beginObject().key("value").value(values[i], 2).endObject();
+            }
+            json.endRpc();
+            bytes += json.length();
+        }
+    });
+    printSerializerRow("rpc JsonWriter", writer, ops, bytes);
+
+    bytes = 0;
+    PhaseStats legacyResult;
+    measure(legacyResult, [&] {
+        for (size_t n = 0; n < ops; n++) {
+            bytes += legacyRpcResult(1234567890 + n).length();
+        }
+    });
+    printSerializerRow("result String", legacyResult, ops, bytes);
+
+    bytes = 0;
+    PhaseStats writerResult;
+    measure(writerResult, [&] {
+        for (size_t n = 0; n < ops; n++) {
+            char response[96];
+            JsonWriter json(response, sizeof(response));
+            json.rpcResult(1234567890 + n, "success");
+            bytes += json.length();
+        }
+    });
+    printSerializerRow("result Writer", writerResult, ops, bytes);
+}
+
+// ---------------------------------------------------------------------------
+// Several producers against one consumer, as on the device (sensor flush, RPC
+// responses, version publish)
+// ---------------------------------------------------------------------------
+
+void runProducerContention() {
+    const size_t producers = 3;
+    const size_t perProducer = 20000;
+    const char* topic = "stream/A0B1C2D3E4F5/rpcout";
+    const char payload[] = "{\"jsonrpc\":\"2.0\",\"id\":1234567890,\"result\":\"success\"}";
+
+    Serial.setMuted(true);
+    mqtt.resetCounters();
+    MqttRing& ring = mqttLanes.lane(MqttLane::Bulk);
+    const MqttRingStats before = ring.stats();
+    std::atomic<size_t> running(producers);
+    std::vector<std::vector<uint32_t>> latencies(producers);
+    std::vector<std::thread> threads;
+    HeapTrace::Counters heapBefore = HeapTrace::snapshot();
+    for (size_t t = 0; t < producers; t++) {
+        latencies[t].reserve(perProducer * 64);
+        threads.emplace_back([&, t] {
+            for (size_t n = 0; n < perProducer; n++) {
+                // A full ring is retried after yielding, so every message
+                // eventually goes out and overflows measure back-pressure.
+                for (;;) {
+                    auto start = std::chrono::steady_clock::now();
+                    bool queued = ring.push(topic, payload, sizeof(payload) - 1, false, 0);
+                    auto end = std::chrono::steady_clock::now();
+                    latencies[t].push_back(static_cast<uint32_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                            .count()));
+                    if (queued) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+            running--;
+        });
+    }
+    while (running > 0 || mqttLanes.size() > 0) {
+        processMQTTQueue();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const uint64_t allocs = HeapTrace::snapshot().allocs - heapBefore.allocs;
+    Serial.setMuted(false);
+
+    std::vector<uint32_t> all;
+    for (auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+    const MqttRingStats after = ring.stats();
+    Serial.printf("\n%u producers x %u enqueues, bulk lane of %u slots\n",
+                  static_cast<unsigned>(producers), static_cast<unsigned>(perProducer),
+                  static_cast<unsigned>(ring.capacity()));
+    Serial.printf("  push ns p50 %u  p99 %u  max %u\n", all[all.size() / 2],
+                  all[all.size() * 99 / 100], all.back());
+    Serial.printf("  published %u  evicted %u  overflows %u  dropped %u  allocs %llu\n",
+                  after.published - before.published, after.evicted - before.evicted,
+                  after.overflows - before.overflows, after.dropped - before.dropped,
+                  static_cast<unsigned long long>(allocs));
+}
+
+/**
+ * Publishes needed before a command acknowledgement goes out when it is
+ * queued behind a full telemetry lane, on @p ackLane.
+ */
+size_t ackPosition(MqttLane ackLane) {
+    const char* topic = "stream/A0B1C2D3E4F5/rpcout";
+    const char telemetry[] = "{\"jsonrpc\":\"2.0\",\"method\":\"modbus-0\",\"params\":{}}";
+    const char ack[] = "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":\"success\"}";
+    MqttRing& bulk = mqttLanes.lane(MqttLane::Bulk);
+    MqttRing& ackRing = mqttLanes.lane(ackLane);
+    while (bulk.size() < bulk.capacity() - (ackLane == MqttLane::Bulk ? 1 : 0)) {
+        bulk.push(topic, telemetry, sizeof(telemetry) - 1, false, 0);
+    }
+    const uint32_t publishedBefore = ackRing.stats().published;
+    enqueueMQTTMessage(topic, ack, sizeof(ack) - 1, false, 0, ackLane);
+    const size_t ackIndex = ackRing.size();
+    size_t publishes = 0;
+    while (ackRing.stats().published - publishedBefore < ackIndex) {
+        processMQTTQueue(0, 0);  // one message per call
+        publishes++;
+    }
+    drain();
+    return publishes;
+}
+
+void runAckLatency() {
+    Serial.setMuted(true);
+    const size_t shared = ackPosition(MqttLane::Bulk);
+    const size_t laned = ackPosition(MqttLane::Control);
+    Serial.setMuted(false);
+    Serial.printf("\nCommand ack behind a full telemetry lane: published after %u publishes "
+                  "in a shared FIFO, %u on the control lane\n",
+                  static_cast<unsigned>(shared), static_cast<unsigned>(laned));
+}
+
+/** Fill every lane, then count processMQTTQueue() calls until all are empty. */
+size_t callsToDrainFullLanes(uint32_t timeBudgetMs, size_t byteBudget) {
+    const char* topic = "stream/A0B1C2D3E4F5/rpcout";
+    char telemetry[320];
+    const int length = snprintf(telemetry, sizeof(telemetry),
+                                "{\"jsonrpc\":\"2.0\",\"method\":\"modbus-0\",\"params\":{%s}}",
+                                std::string(260, ' ').c_str());
+    for (size_t i = 0; i < static_cast<size_t>(MqttLane::Count); i++) {
+        MqttRing& lane = mqttLanes.lane(static_cast<MqttLane>(i));
+        while (lane.size() < lane.capacity()) {
+            lane.push(topic, telemetry, length, false, 0);
+        }
+    }
+    size_t calls = 0;
+    while (mqttLanes.size() > 0) {
+        processMQTTQueue(timeBudgetMs, byteBudget);
+        calls++;
+    }
+    return calls;
+}
+
+void runBacklogDrain() {
+    Serial.setMuted(true);
+    const size_t single = callsToDrainFullLanes(0, 0);
+    mqtt.resetCounters();
+    PhaseStats stats;
+    size_t budgeted = 0;
+    measure(stats, [&] { budgeted = callsToDrainFullLanes(MQTT_DRAIN_TIME_BUDGET_MS,
+                                                          MQTT_DRAIN_BYTE_BUDGET); });
+    Serial.setMuted(false);
+    Serial.printf("Backlog of %u messages after reconnect: drained in %u loop iterations one "
+                  "message per call, %u with the %u ms / %u B budget (%.0f ns per message)\n",
+                  static_cast<unsigned>(mqtt.published()), static_cast<unsigned>(single),
+                  static_cast<unsigned>(budgeted), MQTT_DRAIN_TIME_BUDGET_MS,
+                  MQTT_DRAIN_BYTE_BUDGET,
+                  static_cast<double>(stats.nanos) / mqtt.published());
+}
+
+// ---------------------------------------------------------------------------
+// Window aggregation: fast sampling between flushes
+// ---------------------------------------------------------------------------
+
+/**
+ * 100 parameters sampled 100 times per flush (10 Hz at the default 10 s
+ * polling) with the latest value only and with min/max/mean/count/variance.
+ */
+void runAggregation() {
+    const size_t samplesPerFlush = 100;
+    const size_t cycles = 50;
+    Serial.printf("\n%6s  %-14s %12s %12s %10s %10s\n", "params", "aggregate", "ns/sample",
+                  "allocs/cycle", "MQTT B", "msgs");
+    const uint8_t modes[] = {PARAM_AGG_NONE, PARAM_AGG_VARIANCE};
+    for (uint8_t aggregate : modes) {
+        std::vector<SimParam> params = makeParams(100, aggregate);
+        Rng rng{0xa9917u};
+        Serial.setMuted(true);
+        produce(params);
+        processQueue();
+        drain();
+        mqtt.resetCounters();
+
+        PhaseStats sampling;
+        PhaseStats flush;
+        for (size_t c = 0; c < cycles; c++) {
+            stepValues(params, rng);
+            measure(sampling, [&] {
+                for (size_t s = 0; s < samplesPerFlush; s++) {
+                    for (const auto& p : params) {
+                        const float jitter = (rng.unit() * 2.0f - 1.0f) * p.noise * 0.25f;
+                        queueParam(p.id, p.binary ? SampleValue(p.value > 0.5f)
+                                                  : SampleValue(p.value + jitter));
+                    }
+                }
+            });
+            measure(flush, [] {
+                processQueue();
+                drain();
+            });
+        }
+        Serial.setMuted(false);
+        Serial.printf("%6u  %-14s %12.1f %12.1f %10.1f %10.1f\n",
+                      static_cast<unsigned>(params.size()),
+                      aggregate == PARAM_AGG_NONE ? "latest" : "min/max/mean",
+                      static_cast<double>(sampling.nanos) / (cycles * samplesPerFlush * params.size()),
+                      static_cast<double>(sampling.allocs + flush.allocs) / cycles,
+                      static_cast<double>(mqtt.payloadBytes()) / cycles,
+                      static_cast<double>(mqtt.published()) / cycles);
+    }
+}
+
+/**
+ * One method of 10 parameters sampled 1600 times: processQueue() after every
+ * sample (dead band decides what is sent) against a history of
+ * PARAM_HISTORY_DEPTH timestamped samples published in one message.
+ */
+void runHistory() {
+    const size_t samples = 1600;
+    const uint8_t modes[] = {PARAM_AGG_NONE, PARAM_AGG_HISTORY};
+    for (uint8_t aggregate : modes) {
+        std::vector<SimParam> params = makeParams(kParamsPerMethod, aggregate);
+        Rng rng{0x4157u};
+        const size_t flushEvery = aggregate == PARAM_AGG_NONE ? 1 : PARAM_HISTORY_DEPTH;
+        Serial.setMuted(true);
+        processQueue();
+        drain();
+        mqtt.resetCounters();
+        PhaseStats stats;
+        measure(stats, [&] {
+            for (size_t s = 1; s <= samples; s++) {
+                stepValues(params, rng);
+                produce(params);
+                if (s % flushEvery == 0) {
+                    processQueue();
+                    drain();
+                }
+            }
+        });
+        Serial.setMuted(false);
+        Serial.printf("%u params x %u samples, %s %2u: %4u messages, %6u payload bytes, %.0f ns "
+                      "per sample\n",
+                      static_cast<unsigned>(params.size()), static_cast<unsigned>(samples),
+                      aggregate == PARAM_AGG_NONE ? "flush every" : "history of ",
+                      static_cast<unsigned>(flushEvery),
+                      static_cast<unsigned>(mqtt.published()),
+                      static_cast<unsigned>(mqtt.payloadBytes()),
+                      static_cast<double>(stats.nanos) / (samples * params.size()));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Sensor scheduling on the timing wheel
+// ---------------------------------------------------------------------------
+
+/**
+ * Twelve sources from 100 ms to 60 s over ten simulated minutes, run() every
+ * 10 ms: all phases 0 (what two shared tickers amount to) against
+ * SENSOR_PHASE_AUTO.  Reports polls against the ideal count, the largest
+ * number of polls in one run() call and the cost of a run() call.
+ */
+void runScheduler() {
+    const uint32_t periods[] = {100, 250, 500, 1000, 1000, 1000, 1000, 5000, 10000, 10000,
+                                10000, 60000};
+    const uint32_t durationMs = 600000;
+    const uint32_t stepMs = 10;
+    static uint32_t pollsThisRun;
+    for (bool spread : {false, true}) {
+        SensorScheduler scheduler;
+        scheduler.begin(0);
+        uint64_t ideal = 0;
+        for (uint32_t period : periods) {
+            scheduler.add("sensor", [](void*) { pollsThisRun++; }, nullptr, period,
+                          spread ? SENSOR_PHASE_AUTO : 0, period / 2);
+            ideal += durationMs / period;
+        }
+        uint64_t polls = 0;
+        uint32_t peak = 0;
+        uint32_t bunched = 0;  // run() calls with three or more polls
+        PhaseStats cost;
+        measure(cost, [&] {
+            for (uint32_t t = stepMs; t <= durationMs; t += stepMs) {
+                pollsThisRun = 0;
+                scheduler.run(t);
+                polls += pollsThisRun;
+                peak = max(peak, pollsThisRun);
+                bunched += pollsThisRun >= 3;
+            }
+        });
+        uint32_t late = 0;
+        for (SensorSourceId id = 0; id < scheduler.size(); id++) {
+            late += scheduler.stats(id).late;
+        }
+        Serial.printf("%u sources, phase %s: %llu polls (ideal %llu), late %u, peak %u per "
+                      "run(), %u run() calls with 3+ polls, %.0f ns per run()\n",
+                      static_cast<unsigned>(scheduler.size()), spread ? "auto" : "0   ",
+                      static_cast<unsigned long long>(polls),
+                      static_cast<unsigned long long>(ideal), static_cast<unsigned>(late),
+                      static_cast<unsigned>(peak), static_cast<unsigned>(bunched),
+                      static_cast<double>(cost.nanos) / (durationMs / stepMs));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Acquisition / network pipeline
+// ---------------------------------------------------------------------------
+
+/** State shared by the sources of runPipeline(). */
+struct PipelineBench {
+    std::vector<SimParam> params;
+    Rng rng{0x5eed};
+    Pipeline flow;
+};
+
+/**
+ * 100 parameters sampled every 50 ms and flushed every 200 ms while the
+ * network side blocks for 500 ms once a second, as a TLS handshake against a
+ * slow broker does.  In one loop the stall delays sampling; with the
+ * acquisition stage in its own thread only publishing waits, and a flush is
+ * deferred instead of evicting queued messages while the bulk lane has no
+ * room for it.
+ */
+void runPipeline() {
+    const uint32_t durationMs = 3000;
+    const uint32_t sampleMs = 50;
+    const uint32_t flushMs = 200;
+    const uint32_t stallEveryMs = 1000;
+    const uint32_t stallMs = 500;
+
+    Serial.setMuted(true);
+    Serial.printf("\n");
+    for (bool tasks : {false, true}) {
+        PipelineBench bench;
+        bench.params = makeParams(100);
+        produce(bench.params);
+        processQueue();
+        drain();
+        mqtt.resetCounters();
+        MqttRing& bulk = mqttLanes.lane(MqttLane::Bulk);
+        const MqttRingStats before = bulk.stats();
+
+        SensorScheduler scheduler;
+        const uint32_t start = millis();
+        scheduler.begin(start);
+        const SensorSourceId sampler = scheduler.add(
+            "sample",
+            [](void* context) {
+                PipelineBench& b = *static_cast<PipelineBench*>(context);
+                stepValues(b.params, b.rng);
+                produce(b.params);
+            },
+            &bench, sampleMs, 0, sampleMs);
+        scheduler.add(
+            "telemetry",
+            [](void* context) {
+                PipelineBench& b = *static_cast<PipelineBench*>(context);
+                if (b.flow.admitFlush(mqttLanes.lane(MqttLane::Bulk), mqtt.isConnected())) {
+                    processQueue();
+                }
+            },
+            &bench, flushMs, flushMs - SENSOR_WHEEL_TICK_MS);
+
+        uint32_t nextStall = start + stallEveryMs / 2;
+        auto networkPass = [&] {
+            if (static_cast<int32_t>(millis() - nextStall) >= 0) {
+                delay(stallMs);
+                nextStall += stallEveryMs;
+            }
+            processMQTTQueue();
+        };
+        auto acquisitionPass = [&] {
+            scheduler.run(millis());
+            const uint32_t wait = scheduler.msUntilNext(millis());
+            delay(min<uint32_t>(max<uint32_t>(wait, 1), 10));
+        };
+
+        if (tasks) {
+            std::atomic<bool> stop(false);
+            std::thread network([&] {
+                while (!stop) {
+                    networkPass();
+                    delay(1);
+                }
+            });
+            while (millis() - start < durationMs) {
+                acquisitionPass();
+            }
+            stop = true;
+            network.join();
+        } else {
+            while (millis() - start < durationMs) {
+                networkPass();
+                acquisitionPass();
+            }
+        }
+        drain();
+
+        const SensorSourceStats& sampled = scheduler.stats(sampler);
+        const MqttRingStats after = bulk.stats();
+        const PipelineStats& flow = bench.flow.stats();
+        Serial.setMuted(false);
+        Serial.printf("pipeline %-5s: %u samples (ideal %u), skipped %u, max lateness %u ms; "
+                      "flushes %u deferred %u; bulk evicted %u overflows %u; %u published\n",
+                      tasks ? "tasks" : "loop", static_cast<unsigned>(sampled.runs),
+                      static_cast<unsigned>(durationMs / sampleMs),
+                      static_cast<unsigned>(sampled.skipped),
+                      static_cast<unsigned>(sampled.maxLatenessMs),
+                      static_cast<unsigned>(flow.flushes),
+                      static_cast<unsigned>(flow.deferredFlushes),
+                      after.evicted - before.evicted, after.overflows - before.overflows,
+                      static_cast<unsigned>(mqtt.published()));
+        Serial.setMuted(true);
+    }
+    Serial.setMuted(false);
+}
+
+// ---------------------------------------------------------------------------
+// Event-driven task loops
+// ---------------------------------------------------------------------------
+
+/**
+ * Ten simulated minutes of the default sources (Wi-Fi and telemetry every
+ * 10 s, one-minute housekeeping) plus a 1 s Modbus poll whose period a
+ * command halves after five minutes.  Counts task wake-ups when the
+ * acquisition task wakes every wheel tick and the network task every 10 ms,
+ * against sleeping until the next due poll, queued message, maintenance tick
+ * or schedule change with a 100 ms socket poll.  A wake-up is idle when it
+ * polled no source, or found no message and no maintenance due.
+ */
+void runEventLoop() {
+    const uint32_t durationMs = 600000;
+    const uint32_t commandAtMs = 300000;
+    const uint32_t maintenanceMs = 1000;
+    const uint32_t socketPollMs = 100;
+    static bool scheduleChanged;
+    static std::vector<uint32_t>* queuedAt;
+    static uint32_t nowMs;
+    for (bool events : {false, true}) {
+        std::vector<uint32_t> messages;
+        queuedAt = &messages;
+        SensorScheduler scheduler;
+        scheduler.begin(0);
+        scheduler.add("wifi", [](void*) {}, nullptr, 10000, 0, 5000);
+        scheduler.add("telemetry", [](void*) { queuedAt->push_back(nowMs); }, nullptr, 10000,
+                      10000 - SENSOR_WHEEL_TICK_MS, 5000);
+        scheduler.add("1min", [](void*) {}, nullptr, 60000);
+        const SensorSourceId modbus = scheduler.add("modbus", [](void*) {}, nullptr, 1000);
+        scheduler.setWakeup([](void*) { scheduleChanged = true; }, nullptr);
+
+        // Acquisition task
+        uint32_t wakeups = 0;
+        uint32_t idle = 0;
+        bool commandDone = false;
+        for (nowMs = 0; nowMs < durationMs;) {
+            const size_t polls = scheduler.run(nowMs);
+            wakeups++;
+            idle += polls == 0;
+            const uint32_t wait = scheduler.msUntilNext(nowMs);
+            uint32_t next = events ? nowMs + min<uint32_t>(wait, 5000) + 1
+                                   : nowMs + min<uint32_t>(max<uint32_t>(wait, 1),
+                                                           SENSOR_WHEEL_TICK_MS);
+            if (!commandDone && next >= commandAtMs) {
+                commandDone = true;
+                scheduleChanged = false;
+                scheduler.setPeriod(modbus, 500);
+                if (events && scheduleChanged) {
+                    next = commandAtMs;
+                }
+            }
+            nowMs = next;
+        }
+        uint32_t lateness = 0;
+        for (SensorSourceId id = 0; id < scheduler.size(); id++) {
+            lateness = max(lateness, scheduler.stats(id).maxLatenessMs);
+        }
+
+        // Network task, fed by the telemetry flushes above
+        uint32_t netWakeups = 0;
+        uint32_t netIdle = 0;
+        size_t nextMessage = 0;
+        uint32_t nextMaintenance = 0;
+        for (uint32_t t = 0; t < durationMs;) {
+            bool work = false;
+            for (; nextMessage < messages.size() && messages[nextMessage] <= t; nextMessage++) {
+                work = true;
+            }
+            if (t >= nextMaintenance) {
+                work = true;
+                nextMaintenance += maintenanceMs;
+            }
+            netWakeups++;
+            netIdle += !work;
+            if (events) {
+                uint32_t next = min(t + socketPollMs, nextMaintenance);
+                if (nextMessage < messages.size()) {
+                    next = min(next, messages[nextMessage]);
+                }
+                t = next;
+            } else {
+                t += 10;
+            }
+        }
+        Serial.printf("events %-3s: acquisition %5u wake-ups (%5u idle), max lateness %2u ms; "
+                      "network %5u wake-ups (%5u idle), %u messages\n",
+                      events ? "on" : "off", static_cast<unsigned>(wakeups),
+                      static_cast<unsigned>(idle), static_cast<unsigned>(lateness),
+                      static_cast<unsigned>(netWakeups), static_cast<unsigned>(netIdle),
+                      static_cast<unsigned>(messages.size()));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Awake/asleep accounting in light-sleep mode
+// ---------------------------------------------------------------------------
+
+/**
+ * One minute of a battery unit with a 10 s polling interval: the acquisition
+ * task wakes for the RSSI poll and the flush, the network task for the
+ * maintenance tick and every socket poll.  Cycle costs are assumed (flush and
+ * publish 4 ms, other wake-ups 300 us).  Compares the awake share reported
+ * by PowerMonitor for a 100 ms socket poll against the 1000 ms pollMs of
+ * the light-sleep mode.
+ */
+void runPowerMonitor() {
+    const uint32_t intervalMs = 10000;
+    const uint32_t intervals = 6;
+    const uint32_t maintenanceMs = 1000;
+    for (uint32_t pollMs : {100u, 1000u}) {
+        PowerMonitor monitor;
+        PipelineStats stats = {};
+        PipelineStageStats& acquisition = stats.stage[0];
+        PipelineStageStats& network = stats.stage[1];
+        acquisition.busyUs = 0xFFFF0000;  // The counters wrap during the run
+        monitor.close(0, stats);
+        uint32_t worstAwake = 0;
+        for (uint32_t i = 1; i <= intervals; i++) {
+            acquisition.cycles += 2;
+            acquisition.busyUs += 300 + 4000;
+            network.cycles += 1 + intervalMs / maintenanceMs + intervalMs / pollMs;
+            network.busyUs += 4000 + (intervalMs / maintenanceMs + intervalMs / pollMs) * 300;
+            worstAwake = max(worstAwake, monitor.close(i * intervalMs * 1000, stats).awakeMs);
+        }
+        const uint64_t awake = monitor.totalAwakeMs();
+        const uint64_t total = awake + monitor.totalAsleepMs();
+        Serial.printf("poll %4u ms: awake %3u ms of %u ms (%.2f%%), worst interval %u ms, "
+                      "%u wake-ups per interval\n",
+                      static_cast<unsigned>(pollMs), static_cast<unsigned>(awake),
+                      static_cast<unsigned>(total), 100.0 * awake / total,
+                      static_cast<unsigned>(worstAwake),
+                      static_cast<unsigned>(monitor.last().wakeups));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Delta publishing of wide methods
+// ---------------------------------------------------------------------------
+
+/**
+ * One Modbus method of 60 registers where a single register moves per
+ * cycle: every parameter re-sent against only the changed one.  The first
+ * cycle is a keyframe in both modes (in delta mode it also carries the
+ * keyframes of every other registered method and is not counted); on the
+ * device another one follows every keyframeSec.
+ */
+void runDelta() {
+    const size_t registers = 60;
+    const size_t cycles = 60;
+    size_t keyframeBytes = 0;
+    for (bool delta : {false, true}) {
+        telemetryConfig.delta = delta;
+        // Names of the earlier scenarios, moved into one wide method
+        std::vector<ParamId> ids;
+        std::vector<float> values(registers, 100.0f);
+        for (size_t r = 0; r < registers; r++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s-%u", kKinds[r % kKindCount].prefix,
+                     static_cast<unsigned>(r));
+            ids.push_back(registerParam(name, "modbus-wide"));
+        }
+        Serial.setMuted(true);
+        mqtt.resetCounters();
+        for (size_t c = 0; c <= cycles; c++) {
+            if (c > 0) {
+                values[c % registers] *= 1.5f;
+            }
+            for (size_t r = 0; r < registers; r++) {
+                queueParam(ids[r], values[r]);
+            }
+            processQueue();
+            drain();
+            if (c == 0) {
+                if (!delta) {
+                    keyframeBytes = mqtt.payloadBytes();
+                }
+                mqtt.resetCounters();
+            }
+        }
+        Serial.setMuted(false);
+        Serial.printf("%u-register method, one change per cycle, %s: %7.1f payload bytes and "
+                      "%.1f messages per cycle (keyframe %u B)\n",
+                      static_cast<unsigned>(registers), delta ? "delta" : "full ",
+                      static_cast<double>(mqtt.payloadBytes()) / cycles,
+                      static_cast<double>(mqtt.published()) / cycles,
+                      static_cast<unsigned>(keyframeBytes));
+    }
+    telemetryConfig.delta = false;
+}
+
+// ---------------------------------------------------------------------------
+// Telemetry encoding: JSON against CBOR
+// ---------------------------------------------------------------------------
+
+/**
+ * True if both JSON texts are equal apart from number formatting: numbers
+ * must agree to 1e-6 relative (CBOR carries rounded values as floats).
+ */
+bool sameJson(const std::string& a, const std::string& b) {
+    auto numberStart = [](char c) { return c == '-' || (c >= '0' && c <= '9'); };
+    const char* pa = a.c_str();
+    const char* pb = b.c_str();
+    while (*pa && *pb) {
+        if (numberStart(*pa) && numberStart(*pb)) {
+            char* endA;
+            char* endB;
+            const double x = strtod(pa, &endA);
+            const double y = strtod(pb, &endB);
+            if (fabs(x - y) > 1e-6 * std::max(1.0, fabs(x))) {
+                return false;
+            }
+            pa = endA;
+            pb = endB;
+        } else if (*pa++ != *pb++) {
+            return false;
+        }
+    }
+    return *pa == *pb;
+}
+
+/** Same message through either writer, with every value type telemetry uses. */
+template <typename Writer>
+void writeSampleMessage(Writer& writer) {
+    writer.beginRpc("modbus-0");
+    writer.key("current-0").beginObject().key("value").value(SampleValue(12.34f), 2);
+    writer.key("ts").value(1760000000123LL).key("min").value(11.98, 2).endObject();
+    writer.key("energy-3").beginObject().key("value").value(SampleValue(152340.17), 2);
+    writer.key("count").value(42UL).endObject();
+    writer.key("wifi").beginObject().key("value").value(SampleValue(-61), 0).endObject();
+    writer.key("leak-8").beginObject().key("value").value(SampleValue(false), 0).endObject();
+    writer.key("state").beginObject().key("value").value(SampleValue::text("run \"A\""), 0);
+    writer.endObject();
+    writer.key("t0").beginObject().key("value").value(21.5, 0).key("samples").beginArray();
+    writer.beginArray().value(0).value(-0.25, 2).endArray();
+    writer.beginArray().value(1000).value(1e12, 2).endArray();
+    writer.endArray().endObject();
+    writer.endRpc();
+}
+
+/**
+ * Payload bytes of the polling cycle in JSON and in CBOR, and a decode of
+ * every CBOR message with the host decoder.
+ */
+bool runTelemetryFormats() {
+    char jsonBuffer[MQTT_BUFFER_SIZE];
+    char cborBuffer[MQTT_BUFFER_SIZE];
+    JsonWriter json(jsonBuffer, sizeof(jsonBuffer));
+    CborWriter cbor(cborBuffer, sizeof(cborBuffer));
+    writeSampleMessage(json);
+    writeSampleMessage(cbor);
+    std::string decoded;
+    const bool sampleOk = cborToJson(reinterpret_cast<const uint8_t*>(cbor.c_str()),
+                                     cbor.length(), decoded) &&
+                          sameJson(json.c_str(), decoded);
+    Serial.printf("\nReference message: %u B JSON, %u B CBOR, decoded CBOR %s the JSON\n",
+                  static_cast<unsigned>(json.length()), static_cast<unsigned>(cbor.length()),
+                  sampleOk ? "matches" : "DOES NOT match");
+    bool ok = check(sampleOk, "reference message: decoded CBOR differs from the JSON");
+
+    struct Setup {
+        size_t params;
+        uint8_t aggregate;
+        const char* label;
+    };
+    const Setup setups[] = {{100, PARAM_AGG_NONE, "latest"},
+                            {100, PARAM_AGG_VARIANCE, "min/max/mean"},
+                            {kParamsPerMethod, PARAM_AGG_HISTORY, "history"}};
+    const size_t cycles = 50;
+    const char* const kRpcPrefix = "{\"jsonrpc\":\"2.0\",\"method\":\"";
+    Serial.printf("%6s  %-14s %-6s %10s %10s %10s %8s\n", "params", "aggregate", "format",
+                  "MQTT B", "msgs", "B/msg", "decoded");
+    for (const Setup& setup : setups) {
+        for (TelemetryFormat format : {TelemetryFormat::Json, TelemetryFormat::Cbor}) {
+            telemetryConfig.format = format;
+            std::vector<SimParam> params = makeParams(setup.params, setup.aggregate);
+            Rng rng{0xcb0au};
+            Serial.setMuted(true);
+            produce(params);
+            processQueue();
+            drain();
+            mqtt.resetCounters();
+            std::vector<std::string> payloads;
+            mqtt.capture(&payloads);
+            for (size_t c = 0; c < cycles; c++) {
+                stepValues(params, rng);
+                produce(params);
+                processQueue();
+                drain();
+            }
+            mqtt.capture(nullptr);
+            Serial.setMuted(false);
+
+            size_t valid = 0;
+            for (const std::string& payload : payloads) {
+                if (format == TelemetryFormat::Json) {
+                    decoded = payload;
+                } else if (!cborToJson(reinterpret_cast<const uint8_t*>(payload.data()),
+                                       payload.size(), decoded)) {
+                    continue;
+                }
+                if (decoded.compare(0, strlen(kRpcPrefix), kRpcPrefix) == 0) {
+                    valid++;
+                }
+            }
+            Serial.printf("%6u  %-14s %-6s %10.1f %10.1f %10.1f %7u%%\n",
+                          static_cast<unsigned>(params.size()), setup.label,
+                          format == TelemetryFormat::Json ? "json" : "cbor",
+                          static_cast<double>(mqtt.payloadBytes()) / cycles,
+                          static_cast<double>(mqtt.published()) / cycles,
+                          mqtt.published() ? static_cast<double>(mqtt.payloadBytes()) /
+                                                 mqtt.published()
+                                           : 0.0,
+                          static_cast<unsigned>(payloads.empty() ? 0
+                                                                 : valid * 100 / payloads.size()));
+            ok &= check(!payloads.empty() && valid == payloads.size(),
+                        "telemetry formats: payload not a JSON-RPC message");
+        }
+    }
+    telemetryConfig.format = TelemetryFormat::Json;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Store-and-forward: flushes while offline go to the outbox and are replayed
+// ---------------------------------------------------------------------------
+
+/** Flip one byte in the middle of the oldest outbox segment under @p dir. */
+void corruptOldestSegment(const std::string& dir) {
+    std::string oldest;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            const std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0 &&
+                (oldest.empty() || name < oldest)) {
+                oldest = name;
+            }
+        }
+        closedir(d);
+    }
+    if (FILE* f = fopen((dir + "/" + oldest).c_str(), "r+b")) {
+        fseek(f, 0, SEEK_END);
+        const long middle = ftell(f) / 2;
+        fseek(f, middle, SEEK_SET);
+        const int byte = fgetc(f);
+        fseek(f, middle, SEEK_SET);
+        fputc(byte ^ 0x5a, f);
+        fclose(f);
+    }
+}
+
+void removeTree(const std::string& dir) {
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            if (entry->d_name[0] != '.') {
+                const std::string path = dir + "/" + entry->d_name;
+                removeTree(path);
+                remove(path.c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+bool runOutbox() {
+    char root[] = "/tmp/outbox-bench-XXXXXX";
+    if (!mkdtemp(root)) {
+        return check(false, "outbox: no temporary directory");
+    }
+    LittleFS.setRoot(root);
+    outboxConfig.drainPerSec = UINT16_MAX;  // no pacing, measure the replay itself
+
+    std::vector<SimParam> params = makeParams(100);
+    Rng rng{0x0b0c5u};
+    const size_t cycles = 360;  // one hour offline at the default 10 s polling
+
+    Serial.setMuted(true);
+    outbox.begin(LittleFS);
+    mqtt.setConnected(false);
+    PhaseStats offline;
+    for (size_t c = 0; c < cycles; c++) {
+        stepValues(params, rng);
+        produce(params);
+        measure(offline, [] { processQueue(); });
+    }
+    outbox.flush();  // as on /reboot
+    const OutboxStats written = outbox.stats();
+    const size_t storedBytes = outbox.backlogBytes();
+    const size_t segments = outbox.segmentCount();
+
+    // Reboot with one damaged record, then reconnect
+    corruptOldestSegment(std::string(root) + OUTBOX_DIR);
+    outbox.begin(LittleFS);
+    mqtt.setConnected(true);
+    mqtt.resetCounters();
+    PhaseStats replay;
+    size_t replayCalls = 0;
+    measure(replay, [&] {
+        while (!outbox.empty() && replayCalls < 4 * written.appended) {
+            processMQTTQueue();
+            replayCalls++;
+        }
+    });
+    Serial.setMuted(false);
+    const OutboxStats replayed = outbox.stats();
+
+    Serial.printf("\nOutbox, %u offline flushes of %u params: %u records, %u flash writes, "
+                  "%u bytes kept in %u segments (%u oldest dropped), %.0f ns and %.1f allocs "
+                  "per flush\n",
+                  static_cast<unsigned>(cycles), static_cast<unsigned>(params.size()),
+                  static_cast<unsigned>(written.appended),
+                  static_cast<unsigned>(written.flashWrites), static_cast<unsigned>(storedBytes),
+                  static_cast<unsigned>(segments),
+                  static_cast<unsigned>(written.droppedSegments),
+                  static_cast<double>(offline.nanos) / cycles,
+                  static_cast<double>(offline.allocs) / cycles);
+    Serial.printf("Outbox replay after reboot with one flipped byte: %u published in %u calls, "
+                  "%u corrupt segment skips, %.0f ns per message\n",
+                  static_cast<unsigned>(mqtt.published()), static_cast<unsigned>(replayCalls),
+                  static_cast<unsigned>(replayed.corrupt),
+                  mqtt.published() ? static_cast<double>(replay.nanos) / mqtt.published() : 0.0);
+    bool ok = check(outbox.empty() && mqtt.published() > 0, "outbox: replay did not finish");
+    ok &= check(replayed.corrupt == 1, "outbox: flipped byte not detected exactly once");
+
+    // QoS 1 replay through a window whose PUBACKs come only when released
+    static std::vector<uint16_t> unacked;
+    unacked.clear();
+    mqttInflight.setTransport(
+        [](const uint8_t* packet, size_t length, void* context) {
+            PublishPacket publish;
+            if (!decodePublish(packet, length, publish)) {
+                return false;
+            }
+            unacked.push_back(publish.id);
+            return true;
+        },
+        nullptr);
+    const size_t records = 12;
+    for (size_t i = 0; i < records; i++) {
+        char payload[32];
+        const int length =
+            snprintf(payload, sizeof(payload), "{\"seq\":%u}", static_cast<unsigned>(i));
+        outbox.append("bench/outbox", payload, length, 0, 1);
+    }
+    const uint32_t replayedBefore = outbox.stats().replayed;
+    Serial.setMuted(true);
+    processMQTTQueue();
+    const size_t inFlight = unacked.size();
+    const size_t held = outbox.sentCount();
+    size_t rounds = 1;
+    while (!outbox.empty() && rounds < 4 * records) {
+        for (uint16_t id : unacked) {
+            const uint8_t ack[] = {0x40, 0x02, static_cast<uint8_t>(id >> 8),
+                                   static_cast<uint8_t>(id)};
+            mqttInflight.receive(ack, sizeof(ack), millis());
+        }
+        unacked.clear();
+        processMQTTQueue();
+        rounds++;
+    }
+
+    // A lane message the window gives up goes to the outbox
+    enqueueMQTTMessage("bench/lane", "{\"lost\":0}", 10, false, 1, MqttLane::Bulk);
+    processMQTTQueue();
+    const uint32_t appendedBefore = outbox.stats().appended;
+    const uint32_t startMs = millis();
+    for (uint32_t i = 1; i <= MQTT_INFLIGHT_MAX_SENDS; i++) {
+        mqttInflight.retransmit(startMs + i * MQTT_INFLIGHT_TIMEOUT_MS);
+    }
+    const uint32_t rescued = outbox.stats().appended - appendedBefore;
+    unacked.clear();
+    Serial.setMuted(false);
+    mqttInflight.setTransport(loopbackBroker, nullptr);
+    for (size_t i = 0; i < 4 && !outbox.empty(); i++) {
+        processMQTTQueue();
+    }
+    const uint32_t pipelined = outbox.stats().replayed - replayedBefore;
+    Serial.printf("Outbox QoS 1 replay, window %u: %u records in flight at once, %u replayed in "
+                  "%u ack rounds, %u message given up by the window stored\n",
+                  static_cast<unsigned>(mqttInflight.window()), static_cast<unsigned>(inFlight),
+                  static_cast<unsigned>(pipelined), static_cast<unsigned>(rounds),
+                  static_cast<unsigned>(rescued));
+    removeTree(root);
+    ok &= check(inFlight == mqttInflight.window() && held == inFlight,
+                "outbox: replay not pipelined through the window");
+    ok &= check(pipelined == records + 1, "outbox: pipelined replay lost records");
+    ok &= check(rescued == 1 && outbox.empty(), "outbox: message given up by the window lost");
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Deep-sleep sample-and-burst mode
+// ---------------------------------------------------------------------------
+
+/**
+ * One day of an environmental unit waking every 5 minutes: six slowly
+ * drifting parameters in one method, sampled into the RTC queue and
+ * published every burstEvery wakes.  Every wake starts with an empty
+ * registry, as after a deep sleep; "lost" runs forget the dead-band state
+ * the way the unit would without SleepQueue::retain().  The current estimate
+ * assumes 40 ms for a sampling wake and 1.5 s plus 10 ms per message for a
+ * burst.
+ */
+bool runSleepBurst() {
+    const uint32_t periodSec = 300;
+    const uint32_t wakes = 24 * 3600 / periodSec;
+    const uint32_t sampleMs = 40;
+    const char* names[] = {"t0-env", "humidity-env", "vbat-env", "leak-env", "flow-env",
+                           "gauge-env"};
+    const size_t count = sizeof(names) / sizeof(names[0]);
+    struct Run {
+        uint8_t burstEvery;
+        bool retain;
+    };
+    for (const Run& run : {Run{1, true}, Run{6, false}, Run{6, true}, Run{12, true}}) {
+        memset(&sleepRetained, 0, sizeof(sleepRetained));  // power-on
+        Rng rng{0x51ee9};
+        std::vector<float> values = {21.0f, 45.0f, 3.9f, 0.0f, 3.0f, 1.5f};
+        const float drift[] = {0.15f, 0.8f, 0.01f, 0.0f, 0.3f, 0.03f};
+        size_t peakBytes = 0;
+        uint32_t publishMsTotal = 0;
+        Serial.setMuted(true);
+        mqtt.resetCounters();
+        for (uint32_t wake = 0; wake < wakes; wake++) {
+            new (&paramRegistry) ParamRegistry();  // RAM does not survive
+            sleepQueue.begin();
+            if (run.retain) {
+                MutexLock lock(dataQueueMutex);
+                sleepQueue.restore(paramRegistry);
+            }
+            ParamId ids[count];
+            for (size_t i = 0; i < count; i++) {
+                ids[i] = registerParam(names[i], "env");
+                values[i] += drift[i] * (rng.unit() * 2.0f - 1.0f);
+                if (i == 3 && rng.unit() < 0.01f) {
+                    values[i] = values[i] > 0.5f ? 0.0f : 1.0f;
+                }
+                queueParam(ids[i], i == 3 ? SampleValue(values[i] > 0.5f) : SampleValue(values[i]));
+            }
+            const bool burst = sleepQueue.burstDue(run.burstEvery);
+            mqtt.setConnected(false);
+            sleepQueue.setActive(true);
+            processQueue();
+            sleepQueue.setActive(false);
+            peakBytes = max(peakBytes, sleepQueue.used());
+
+            if (burst) {
+                mqtt.setConnected(true);
+                const uint32_t before = mqtt.published();
+                publishSleepQueue(millis() + SLEEP_CONNECT_TIMEOUT_MS, pollNothing);
+                const uint32_t publishMs = 1500 + 10 * (mqtt.published() - before);
+                publishMsTotal += publishMs;
+                sleepQueue.endBurst(publishMs, true);
+            } else {
+                sleepQueue.endSampleWake(sampleMs);
+            }
+            if (run.retain) {
+                MutexLock lock(dataQueueMutex);
+                sleepQueue.retain(paramRegistry);
+            }
+        }
+        mqtt.setConnected(true);
+        Serial.setMuted(false);
+        const SleepStats& stats = sleepQueue.stats();
+        const uint32_t publishMs = stats.bursts ? publishMsTotal / stats.bursts : 0;
+        Serial.printf("burst every %2u, dead band %-8s: %3u messages, %6u B per day, "
+                      "RTC peak %4u B, %u dropped, ~%u uA\n",
+                      static_cast<unsigned>(run.burstEvery), run.retain ? "retained" : "lost",
+                      static_cast<unsigned>(mqtt.published()),
+                      static_cast<unsigned>(mqtt.payloadBytes()),
+                      static_cast<unsigned>(peakBytes), static_cast<unsigned>(stats.dropped),
+                      static_cast<unsigned>(SleepQueue::averageCurrentUa(
+                          sampleMs, publishMs, periodSec, run.burstEvery)));
+    }
+
+    // More short records than the bulk lane has slots, each published once
+    memset(&sleepRetained, 0, sizeof(sleepRetained));
+    sleepQueue.begin();
+    const size_t records = MQTT_LANE_BULK_SLOTS * 3 + 1;
+    char payload[32];
+    for (size_t i = 0; i < records; i++) {
+        const int length = snprintf(payload, sizeof(payload), "{\"seq\":%u}", (unsigned)i);
+        sleepQueue.append(Topic::RpcOut, payload, length);
+    }
+    Serial.setMuted(true);
+    mqtt.resetCounters();
+    const bool complete = publishSleepQueue(millis() + SLEEP_CONNECT_TIMEOUT_MS, pollNothing);
+    Serial.setMuted(false);
+    Serial.printf("burst of %u records: %u published, %s\n", static_cast<unsigned>(records),
+                  static_cast<unsigned>(mqtt.published()),
+                  complete && sleepQueue.used() == 0 ? "queue emptied" : "queue NOT emptied");
+    return check(complete && sleepQueue.used() == 0 && mqtt.published() == records,
+                 "sleep burst: records lost or left in the queue");
+}
+
+// ---------------------------------------------------------------------------
+// Fleet reconnect after a broker restart
+// ---------------------------------------------------------------------------
+
+/**
+ * A fleet loses its connections in the same instant; the broker is back
+ * after 30 s and completes at most 100 CONNECTs per second, refusing the
+ * rest with "server unavailable" after the TLS handshake.  Compares the old
+ * fixed 5 s retry (each device on its own phase, as its check timer happened
+ * to run) with the jittered backoff of MqttReconnect, stepped every 100 ms.
+ * A handshake is a transport opened while the broker is up; an attempt while
+ * it is down fails after MQTT_TRANSPORT_TIMEOUT_MS.
+ */
+void runReconnectStorm() {
+    const size_t devices = 5000;
+    const uint32_t downMs = 30000;
+    const uint32_t acceptPerSec = 100;
+    const uint32_t stepMs = 100;
+    const uint32_t endMs = 900000;
+    for (bool jitter : {false, true}) {
+        std::vector<MqttReconnect> fleet(devices);
+        std::vector<uint32_t> phase(devices);
+        std::vector<bool> up(devices, false);
+        std::vector<bool> transport(devices, false);
+        std::vector<uint32_t> refreshDoneMs(devices, 0);
+        Rng rng{0xf1ee7};
+        for (size_t d = 0; d < devices; d++) {
+            MqttReconnect& r = fleet[d];
+            r.seed(rng.next());
+            phase[d] = rng.next() % 5000;
+            // Connected before the restart: the first attempt after boot is immediate
+            r.step(0, true, false, false);
+            r.step(0, true, false, false);
+            r.step(0, true, true, false);
+            r.connectResult(0, true, 0);
+        }
+        uint32_t handshakes = 0;
+        uint32_t peak = 0;
+        uint32_t inSecond = 0;
+        uint32_t acceptedInSecond = 0;
+        uint32_t connected = 0;
+        uint32_t ms99 = 0;
+        uint32_t msAll = 0;
+        for (uint32_t now = MQTT_STABLE_MS; now < endMs && msAll == 0; now += stepMs) {
+            if (now % 1000 == 0) {
+                peak = max(peak, inSecond);
+                inSecond = 0;
+                acceptedInSecond = 0;
+            }
+            const bool brokerUp = now >= MQTT_STABLE_MS + downMs;
+            // A handshake that the broker may or may not accept
+            auto handshake = [&]() {
+                handshakes++;
+                inSecond++;
+                if (acceptedInSecond >= acceptPerSec) {
+                    return false;
+                }
+                acceptedInSecond++;
+                return true;
+            };
+            for (size_t d = 0; d < devices; d++) {
+                if (up[d]) {
+                    continue;
+                }
+                bool connectedNow = false;
+                if (!jitter) {
+                    if ((now - MQTT_STABLE_MS) % 5000 == (phase[d] / stepMs) * stepMs) {
+                        connectedNow = brokerUp && handshake();
+                    }
+                } else {
+                    MqttReconnect& r = fleet[d];
+                    if (r.state() == ConnState::TokenRefresh && refreshDoneMs[d] &&
+                        now >= refreshDoneMs[d]) {
+                        refreshDoneMs[d] = 0;
+                        r.tokenRefreshDone(now, true);
+                    }
+                    const ConnAction action = r.step(now, true, transport[d], false);
+                    if (action == ConnAction::OpenTransport) {
+                        transport[d] = brokerUp;
+                        if (brokerUp) {
+                            handshakes++;
+                            inSecond++;
+                        }
+                    } else if (action == ConnAction::SendConnect) {
+                        const bool accepted = acceptedInSecond < acceptPerSec;
+                        acceptedInSecond += accepted;
+                        r.connectResult(now, accepted, accepted ? 0 : 3);
+                        connectedNow = accepted;
+                        transport[d] = false;
+                    } else if (action == ConnAction::StartTokenRefresh) {
+                        refreshDoneMs[d] = now + 1000;
+                    }
+                }
+                if (connectedNow) {
+                    up[d] = true;
+                    connected++;
+                    if (connected * 100 >= devices * 99 && ms99 == 0) {
+                        ms99 = now;
+                    }
+                    if (connected == devices) {
+                        msAll = now;
+                    }
+                }
+            }
+        }
+        Serial.printf("%-12s: %u devices, peak %4u handshakes/s, %6u handshakes, 99%% back "
+                      "after %3u s, all after %3u s\n",
+                      jitter ? "full jitter" : "fixed 5 s", static_cast<unsigned>(devices),
+                      static_cast<unsigned>(peak), static_cast<unsigned>(handshakes),
+                      static_cast<unsigned>((ms99 - MQTT_STABLE_MS) / 1000),
+                      static_cast<unsigned>((msAll - MQTT_STABLE_MS) / 1000));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// TLS session resumption
+// ---------------------------------------------------------------------------
+
+/**
+ * A day of HTTPS requests: the token server every 30 min and the config
+ * server every 6 h.  The server accepts a session ticket for 4 h and sends
+ * a fresh one with every handshake.  A full handshake costs 1.5-2.5 s, a
+ * resumed one 0.2-0.3 s (ESP32 at 240 MHz, RSA-2048/ECDHE chain).  The
+ * unit resets (deep sleep) before every request, keeping the cache in RTC
+ * memory or losing it with the RAM.
+ */
+void runTlsSessions() {
+    const uint32_t dayS = 24 * 3600;
+    const uint32_t lifetimeS = 4 * 3600;
+    struct Host {
+        const char* name;
+        uint32_t everyS;
+    };
+    const Host hosts[] = {{"auth.umec.example", 1800}, {"config.umec.example", 6 * 3600}};
+    struct Run {
+        const char* name;
+        bool cache;
+        bool retained;  ///< Slots survive the reset before every request
+    };
+    for (const Run& run : {Run{"no cache", false, false}, Run{"deep sleep, RAM", true, false},
+                           Run{"deep sleep, RTC", true, true}}) {
+        memset(&tlsRetained, 0, sizeof(tlsRetained));
+        new (&tlsSessions) TlsSessions(tlsRetained);
+        Rng rng{0x7152};
+        uint64_t handshakeMs = 0;
+        for (uint32_t now = 0; now < dayS; now += 60) {
+            for (const Host& host : hosts) {
+                if (now % host.everyS != 0) {
+                    continue;
+                }
+                if (!run.retained) {
+                    memset(&tlsRetained, 0, sizeof(tlsRetained));
+                }
+                // The "session" is its issue time; real ones are ~200 B with the ticket
+                const TlsSessionSlot* cached = run.cache ? tlsSessions.find(host.name, 443) : nullptr;
+                uint32_t issued = 0;
+                if (cached) {
+                    memcpy(&issued, cached->data, sizeof(issued));
+                }
+                const bool resumed = cached && now - issued < lifetimeS;
+                const uint32_t ms = resumed ? 200 + rng.next() % 100 : 1500 + rng.next() % 1000;
+                tlsSessions.recordHandshake(resumed ? HandshakeKind::Resumed : HandshakeKind::Full,
+                                            ms, cached != nullptr);
+                handshakeMs += ms;
+                uint8_t session[200] = {};
+                memcpy(session, &now, sizeof(now));
+                if (run.cache) {
+                    tlsSessions.store(host.name, 443, session, sizeof(session));
+                }
+            }
+        }
+        const TlsStats& stats = tlsSessions.stats();
+        const HandshakeHistogram& full = stats.kind[static_cast<size_t>(HandshakeKind::Full)];
+        const HandshakeHistogram& resumed = stats.kind[static_cast<size_t>(HandshakeKind::Resumed)];
+        Serial.printf("%-16s: %2u full (p90 %4u ms), %2u resumed (p90 %3u ms), "
+                      "%5.1f s handshaking per day\n",
+                      run.name, static_cast<unsigned>(full.total),
+                      static_cast<unsigned>(tlsSessions.percentileMs(HandshakeKind::Full, 90)),
+                      static_cast<unsigned>(resumed.total),
+                      static_cast<unsigned>(tlsSessions.percentileMs(HandshakeKind::Resumed, 90)),
+                      handshakeMs / 1000.0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// HTTPS keep-alive
+// ---------------------------------------------------------------------------
+
+/**
+ * Pairing and the first day of a unit: the device-code request, 40 token
+ * polls 3 s apart until the user confirms, the config fetch, then a token
+ * refresh every hour.  Auth and token endpoints share a host; the config
+ * server is another one.  The server keeps idle connections for 60 s.
+ * Counts the TCP+TLS connections opened without and with the pool.
+ */
+void runHttpsPool() {
+    struct Request {
+        uint32_t atMs;
+        const char* url;
+    };
+    std::vector<Request> requests;
+    requests.push_back({0, "https://auth.umec.example/oauth/device"});
+    for (uint32_t i = 0; i < 40; i++) {
+        requests.push_back({3000 + i * 3000, "https://auth.umec.example/oauth/token"});
+    }
+    requests.push_back({125000, "https://config.umec.example:8443/device.json"});
+    for (uint32_t hour = 1; hour <= 24; hour++) {
+        requests.push_back({hour * 3600000, "https://auth.umec.example/oauth/token"});
+    }
+    const uint32_t serverIdleMs = 60000;
+
+    for (const bool pooled : {false, true}) {
+        new (&httpsPool) HttpsPool();
+        uint32_t lastUsed[HTTPS_POOL_SLOTS] = {};
+        bool connected[HTTPS_POOL_SLOTS] = {};
+        uint32_t connects = 0;
+        uint32_t stale = 0;
+        for (const Request& request : requests) {
+            char host[HTTPS_HOST_SIZE];
+            uint16_t port;
+            HttpsPool::parseUrl(request.url, host, sizeof(host), port);
+            const HttpsLease lease = httpsPool.acquire(host, port, request.atMs);
+            bool& open = connected[lease.slot];
+            if (lease.close) {
+                open = false;
+            }
+            // Closed by the server while the pool still kept it
+            if (open && request.atMs - lastUsed[lease.slot] >= serverIdleMs) {
+                open = false;
+                stale++;
+            }
+            const bool reused = open;
+            connects += !reused;
+            open = pooled;
+            lastUsed[lease.slot] = request.atMs + 300;
+            httpsPool.release(lease.slot, request.atMs + 300, reused, open);
+            int8_t idle;
+            while ((idle = httpsPool.nextIdle(request.atMs + 300)) >= 0) {
+                connected[idle] = false;
+            }
+        }
+        const HttpsPoolStats& stats = httpsPool.stats();
+        Serial.printf("%-9s: %u requests, %2u connections, %2u reused, %u closed idle, "
+                      "%u closed by the server first\n",
+                      pooled ? "pooled" : "per call", static_cast<unsigned>(stats.requests),
+                      static_cast<unsigned>(connects), static_cast<unsigned>(stats.reused),
+                      static_cast<unsigned>(stats.idleClosed), static_cast<unsigned>(stale));
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// HTTP request queue
+// ---------------------------------------------------------------------------
+
+/**
+ * The network task asks for the token every 1 s while the user pairs the
+ * device; at 20.5 s a token refresh and a config download come in, and the
+ * config is requested a second time (BLE) at 21 s.  Each request takes
+ * 800 ms.  Compares the old synchronous calls behind a shared 3 s throttle
+ * with the queue: requests sent, dropped and the time callers were blocked.
+ */
+void runHttpQueue() {
+    struct Call {
+        uint32_t atMs;
+        HttpMethod method;
+        const char* url;
+        const char* body;
+    };
+    const char* tokenUrl = "https://auth.umec.example/oauth/token";
+    const char* configUrl = "https://config.umec.example:8443/device.json";
+    std::vector<Call> calls;
+    for (uint32_t t = 0; t < 60000; t += 1000) {
+        calls.push_back({t, HttpMethod::Post, tokenUrl, "grant_type=device_code&device_code=D"});
+    }
+    calls.push_back({20500, HttpMethod::Post, tokenUrl, "grant_type=refresh_token&refresh_token=R"});
+    calls.push_back({20500, HttpMethod::Get, configUrl, ""});
+    calls.push_back({21000, HttpMethod::Get, configUrl, ""});
+    std::sort(calls.begin(), calls.end(),
+              [](const Call& a, const Call& b) { return a.atMs < b.atMs; });
+    const uint32_t requestMs = 800;
+
+    // Before: every POST waits for the server, one within 3 s of the last is dropped
+    {
+        uint32_t lastPost = 0;
+        bool posted = false;
+        uint32_t sent = 0, dropped = 0, blockedMs = 0;
+        bool refreshSent = false;
+        for (const Call& call : calls) {
+            if (call.method == HttpMethod::Post) {
+                if (posted && call.atMs - lastPost < 3000) {
+                    dropped++;
+                    continue;
+                }
+                posted = true;
+                lastPost = call.atMs;
+                refreshSent |= strstr(call.body, "refresh_token") != nullptr;
+            }
+            sent++;
+            blockedMs += requestMs;
+        }
+        Serial.printf("%-9s: %2u calls, %2u sent, %2u dropped, refresh %s, callers blocked %5u ms\n",
+                      "throttle", static_cast<unsigned>(calls.size()),
+                      static_cast<unsigned>(sent), static_cast<unsigned>(dropped),
+                      refreshSent ? "sent" : "dropped", static_cast<unsigned>(blockedMs));
+    }
+
+    // After: submit and return; the worker sends, dedup and rate limit decide when
+    new (&httpQueue) HttpQueue();
+    uint32_t callbacks = 0;
+    bool refreshDone = false;
+    const HttpCallback onResult = [](const HttpResult& result, void* context) {
+        (*static_cast<uint32_t*>(context))++;
+    };
+    size_t nextCall = 0;
+    bool busy = false;
+    uint32_t busyUntil = 0;
+    HttpJob job;
+    uint32_t refreshId = 0;
+    for (uint32_t now = 0; now < 90000; now += 10) {
+        for (; nextCall < calls.size() && calls[nextCall].atMs <= now; nextCall++) {
+            const Call& call = calls[nextCall];
+            const uint32_t id = httpQueue.submit(call.method, call.url, call.body, nullptr,
+                                                 nullptr, onResult, &callbacks, now);
+            if (strstr(call.body, "refresh_token")) {
+                refreshId = id;
+            }
+        }
+        if (busy && now >= busyUntil) {
+            httpQueue.complete(job.id, 200, "{}", false);
+            busy = false;
+        }
+        if (!busy && httpQueue.next(now, job)) {
+            busy = true;
+            busyUntil = now + requestMs;
+        }
+        httpQueue.expire(now);
+        HttpResult result;
+        HttpCallback finished[HTTP_WAITERS];
+        void* contexts[HTTP_WAITERS];
+        uint8_t waiters;
+        while (httpQueue.takeFinished(result, finished, contexts, waiters)) {
+            refreshDone |= result.id == refreshId && result.code == 200;
+            for (uint8_t i = 0; i < waiters; i++) {
+                finished[i](result, contexts[i]);
+            }
+            httpQueue.dispatched(result.id);
+        }
+    }
+    const HttpQueueStats& stats = httpQueue.stats();
+    Serial.printf("%-9s: %2u calls, %2u sent, %2u dropped, refresh %s, callers blocked %5u ms; "
+                  "%u deduplicated, %u rate-limited, max wait %u ms, %u callbacks\n",
+                  "queue", static_cast<unsigned>(stats.submitted),
+                  static_cast<unsigned>(stats.completed + stats.failed),
+                  static_cast<unsigned>(stats.rejected + stats.expired),
+                  refreshDone ? "sent" : "dropped", 0u,
+                  static_cast<unsigned>(stats.deduplicated), static_cast<unsigned>(stats.delayed),
+                  static_cast<unsigned>(stats.maxWaitMs), static_cast<unsigned>(callbacks));
+}
+
+
+// ---------------------------------------------------------------------------
+// Streaming HTTP bodies
+// ---------------------------------------------------------------------------
+
+/** Bytes of a recorded connection, all available at once. */
+class ReplayStream : public Stream {
+public:
+    explicit ReplayStream(const std::string& data) : data_(data), pos_(0) { setTimeout(0); }
+    int available() override { return static_cast<int>(data_.size() - pos_); }
+    int read() override { return pos_ < data_.size() ? static_cast<uint8_t>(data_[pos_++]) : -1; }
+    int peek() override { return pos_ < data_.size() ? static_cast<uint8_t>(data_[pos_]) : -1; }
+    size_t write(uint8_t) override { return 0; }
+    std::string rest() const { return data_.substr(pos_); }
+
+private:
+    std::string data_;
+    size_t pos_;
+};
+
+/**
+ * A token refresh response as an OpenID server sends it (access, refresh and
+ * id token, ~3.7 KB) with Content-Length, chunked in 512 B chunks and cut
+ * short, followed on the same kept connection by the next response.  Reads
+ * it the old way (getString() into a String) and through HttpBodyStream,
+ * and checks that the next response starts where finish() left off.
+ */
+bool runBodyStream() {
+    const std::string accessToken(1320, 'a');
+    const std::string refreshToken(780, 'r');
+    const std::string idToken(1290, 'i');
+    const std::string json = "{\"access_token\":\"" + accessToken +
+                             "\",\"expires_in\":300,\"refresh_expires_in\":1800,"
+                             "\"refresh_token\":\"" + refreshToken +
+                             "\",\"token_type\":\"Bearer\",\"id_token\":\"" + idToken +
+                             "\",\"not-before-policy\":0,\"session_state\":"
+                             "\"5f3c1e0a-8d2b-4c47-9e0f-2b6a4d1c9e77\",\"scope\":"
+                             "\"openid mqtt-streaming profile email\"}";
+    std::string chunked;
+    for (size_t i = 0; i < json.size(); i += 512) {
+        const std::string part = json.substr(i, 512);
+        char size[16];
+        snprintf(size, sizeof(size), "%zx\r\n", part.size());
+        chunked += size + part + "\r\n";
+    }
+    chunked += "0\r\n\r\n";
+    const std::string next = "HTTP/1.1 400 Bad Request\r\n";
+
+    struct Case {
+        const char* name;
+        std::string body;
+        int32_t length;
+        bool chunked;
+        bool complete;  ///< Else the connection drops in the middle of the body
+    };
+    const Case cases[] = {
+        {"length", json, static_cast<int32_t>(json.size()), false, true},
+        {"chunked", chunked, -1, true, true},
+        {"cut short", json.substr(0, 2000), static_cast<int32_t>(json.size()), false, false},
+    };
+    bool ok = true;
+    for (const Case& c : cases) {
+        // Before: the whole body in a String, then the document on top
+        ReplayStream copied(c.body);
+        HeapTrace::Counters before = HeapTrace::snapshot();
+        String text;
+        if (c.length > 0) {
+            text.reserve(c.length);
+        }
+        HttpBodyStream raw(copied, c.length, c.chunked);
+        // HTTPClient::writeToStream() appends up to one TCP segment at a time
+        char segment[1460];
+        for (size_t n; (n = raw.readBytes(segment, sizeof(segment))) > 0;) {
+            text.concat(segment, n);
+        }
+        const HeapTrace::Counters after = HeapTrace::snapshot();
+
+        ReplayStream streamed(c.complete ? c.body + next : c.body);
+        HttpBodyStream body(streamed, c.length, c.chunked);
+        const HeapTrace::Counters streamBefore = HeapTrace::snapshot();
+        size_t bytes = 0;
+        while (body.read() >= 0) {
+            bytes++;
+        }
+        const bool reusable = body.finish();
+        const HeapTrace::Counters streamAfter = HeapTrace::snapshot();
+        const bool aligned = streamed.rest() == next;
+        Serial.printf("%-9s: body %4u B; String %4u B held, %2u allocs; stream %u allocs; "
+                      "keep connection %s, next response %s\n",
+                      c.name, static_cast<unsigned>(bytes), text.length(),
+                      static_cast<unsigned>(after.allocs - before.allocs),
+                      static_cast<unsigned>(streamAfter.allocs - streamBefore.allocs),
+                      reusable ? "yes" : "no",
+                      reusable ? (aligned ? "aligned" : "MISALIGNED") : "-");
+        if (c.complete) {
+            ok &= check(bytes == json.size() && reusable && aligned,
+                        "body stream: complete body not read up to the next response");
+        } else {
+            ok &= check(!reusable, "body stream: connection kept after a cut-short body");
+        }
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// QoS 1 in-flight window
+// ---------------------------------------------------------------------------
+
+/**
+ * 200 QoS 1 messages of ~200 B after a reconnect, over a link with a 150 ms
+ * round trip that loses 1% of the packets each way and drops for 3 s after
+ * 5 s -- or flaps six times, shorter than a one-way trip each time.  The
+ * device serves the socket every 10 ms.  Window 1 is the stop-and-wait of
+ * the library's publish(); the broker counts every message it delivers, so a
+ * message counted twice is a duplicate and one never counted is lost.
+ */
+bool runInflightWindow() {
+    const size_t messages = 200;
+    const uint32_t oneWayMs = 75;
+    const uint32_t stepMs = 10;
+    const float loss = 0.01f;
+    const char* topic = "stream/A0B1C2D3E4F5/rpcout";
+
+    struct Link {
+        struct Packet {
+            uint32_t atMs;
+            bool toBroker;
+            std::vector<uint8_t> bytes;
+        };
+        MqttInflight* device;
+        std::vector<Packet> wire;
+        std::vector<uint32_t> delivered;
+        Rng rng{0x5eed};
+        float loss;
+        uint32_t oneWayMs;
+        uint32_t nowMs = 0;
+        bool up = true;
+        uint32_t dupSeen = 0;
+    };
+    auto send = [](const uint8_t* packet, size_t length, void* context) {
+        Link& link = *static_cast<Link*>(context);
+        if (!link.up) {
+            return false;
+        }
+        if (link.rng.unit() >= link.loss) {
+            link.wire.push_back({link.nowMs + link.oneWayMs, true,
+                                 std::vector<uint8_t>(packet, packet + length)});
+        }
+        return true;
+    };
+
+    struct Outage {
+        uint32_t downAtMs;
+        uint32_t upAtMs;
+    };
+    struct Scenario {
+        const char* name;
+        std::vector<Outage> outages;
+    };
+    const Scenario scenarios[] = {
+        {"link down 5-8 s", {{5000, 8000}}},
+        {"link down 50 ms six times from 5 s",
+         {{5000, 5050}, {5100, 5150}, {5200, 5250}, {5300, 5350}, {5400, 5450}, {5500, 5550}}},
+    };
+    bool ok = true;
+    for (const Scenario& scenario : scenarios) {
+        Serial.printf("\nQoS 1 after a reconnect: 200 messages, 150 ms RTT, 1%% loss each way, "
+                      "%s\n", scenario.name);
+        for (size_t window : {static_cast<size_t>(1), static_cast<size_t>(2),
+                              static_cast<size_t>(MQTT_INFLIGHT_WINDOW)}) {
+            Link link;
+            link.loss = loss;
+            link.oneWayMs = oneWayMs;
+            link.delivered.assign(messages, 0);
+            MqttInflight* device = new MqttInflight();
+            link.device = device;
+            device->setWindow(window);
+            device->setTransport(send, &link);
+
+            size_t next = 0;
+            uint32_t doneMs = 0;
+            for (uint32_t now = 0; now < 600000 && doneMs == 0; now++) {
+                link.nowMs = now;
+                for (const Outage& outage : scenario.outages) {
+                    if (now == outage.downAtMs) {
+                        link.up = false;
+                        link.wire.clear();
+                    } else if (now == outage.upAtMs) {
+                        link.up = true;
+                        device->reconnected();
+                    }
+                }
+                // Packets that arrive now, in the order they were sent
+                std::vector<Link::Packet> arrived;
+                for (auto it = link.wire.begin(); it != link.wire.end();) {
+                    if (it->atMs <= now) {
+                        arrived.push_back(std::move(*it));
+                        it = link.wire.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                for (const Link::Packet& packet : arrived) {
+                    if (!packet.toBroker) {
+                        device->receive(packet.bytes.data(), packet.bytes.size(), now);
+                        continue;
+                    }
+                    PublishPacket publish;
+                    if (!decodePublish(packet.bytes.data(), packet.bytes.size(), publish)) {
+                        continue;
+                    }
+                    const std::string payload(reinterpret_cast<const char*>(publish.payload),
+                                              publish.length);
+                    const size_t seq = strtoul(payload.c_str() + payload.find(':') + 1, nullptr, 10);
+                    link.delivered[seq]++;
+                    link.dupSeen += publish.dup;
+                    if (link.rng.unit() >= link.loss) {
+                        link.wire.push_back({now + oneWayMs, false,
+                                             {0x40, 0x02, static_cast<uint8_t>(publish.id >> 8),
+                                              static_cast<uint8_t>(publish.id)}});
+                    }
+                }
+                if (now % stepMs != 0 || !link.up) {
+                    continue;
+                }
+                device->retransmit(now);
+                while (next < messages && !device->full()) {
+                    char payload[200];
+                    const int length = snprintf(payload, sizeof(payload), "{\"seq\":%u,\"pad\":\"%s\"}",
+                                                static_cast<unsigned>(next),
+                                                std::string(170, 'x').c_str());
+                    if (!device->publish(topic, reinterpret_cast<uint8_t*>(payload), length, false,
+                                         now)) {
+                        break;
+                    }
+                    next++;
+                }
+                if (next == messages && device->size() == 0) {
+                    doneMs = now;
+                }
+            }
+            size_t once = 0;
+            size_t duplicates = 0;
+            size_t lost = 0;
+            for (uint32_t count : link.delivered) {
+                once += count > 0;
+                duplicates += count > 1 ? count - 1 : 0;
+                lost += count == 0;
+            }
+            const MqttInflightStats& stats = device->stats();
+            Serial.printf("window %u: all acknowledged after %5.1f s (%5.1f msg/s), %u delivered, "
+                          "%u lost, %u given up, %u duplicates, %2u DUP resends, "
+                          "ack mean %4u ms max %5u ms, %u unknown acks\n",
+                          static_cast<unsigned>(window), doneMs / 1000.0,
+                          doneMs ? messages * 1000.0 / doneMs : 0.0, static_cast<unsigned>(once),
+                          static_cast<unsigned>(lost), static_cast<unsigned>(stats.dropped),
+                          static_cast<unsigned>(duplicates),
+                          static_cast<unsigned>(stats.retransmitted),
+                          static_cast<unsigned>(stats.acknowledged
+                                                    ? stats.ackMsTotal / stats.acknowledged
+                                                    : 0),
+                          static_cast<unsigned>(stats.ackMsMax),
+                          static_cast<unsigned>(stats.unknownAcks));
+            ok &= check(doneMs != 0 && lost == 0 && stats.dropped == 0,
+                        "in-flight window: message lost or given up");
+            ok &= check(stats.unknownAcks == 0, "in-flight window: PUBACK for no message");
+            delete device;
+        }
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main() {
+    Serial.printf("DataQueue host benchmark, MQTT_BUFFER_SIZE=%d, %u params per method\n",
+                  MQTT_BUFFER_SIZE, static_cast<unsigned>(kParamsPerMethod));
+    Serial.printf("%6s  %-14s %12s %12s %10s %10s %10s\n", "params", "phase", "ns/cycle",
+                  "allocs/cycle", "log B", "MQTT B", "msgs");
+
+    mqttInflight.setTransport(loopbackBroker, nullptr);
+    mqttInflight.setDropHandler(storeDroppedMessage, nullptr);
+    const size_t sizes[] = {10, 100, 1000};
+    for (size_t n : sizes) {
+        runScenario(n);
+    }
+    runQueueRoundTrip();
+    bool ok = runUncommittedHead();
+    runSerializerComparison();
+    runProducerContention();
+    runAckLatency();
+    runBacklogDrain();
+    runAggregation();
+    runHistory();
+    runScheduler();
+    runPipeline();
+    runEventLoop();
+    runPowerMonitor();
+    runDelta();
+    ok &= runTelemetryFormats();
+    ok &= runOutbox();
+    ok &= runSleepBurst();
+    runReconnectStorm();
+    runTlsSessions();
+    runHttpsPool();
+    runHttpQueue();
+    ok &= runBodyStream();
+    ok &= runInflightWindow();
+    if (!ok) {
+        Serial.println("\nBenchmark checks FAILED");
+    }
+    return ok ? 0 : 1;
+}
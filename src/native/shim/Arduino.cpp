@@ -0,0 +1,8 @@
+/**
+ * @file Arduino.cpp
+ * @brief Storage for the host Arduino shim globals.
+ */
+
+#include "Arduino.h"
+
+HostSerial Serial;
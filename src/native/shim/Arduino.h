@@ -0,0 +1,190 @@
+/**
+ * @file Arduino.h
+ * @brief Minimal Arduino/FreeRTOS surface for compiling firmware modules on
+ *        the host (`pio run -e native`).
+ *
+ * Only what the queue and telemetry modules touch is provided: timing,
+ * `String`, `Stream`, a `Serial` sink and FreeRTOS mutexes backed by
+ * std::mutex.  The
+ * header is picked up ahead of the real core through `-Isrc/native/shim`.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/time.h>
+#include <thread>
+
+#include "WString.h"
+
+using std::abs;
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+// ---------------------------------------------------------------------------
+// Timing
+// ---------------------------------------------------------------------------
+
+inline unsigned long micros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now() - start)
+                                          .count());
+}
+
+inline unsigned long millis() { return micros() / 1000UL; }
+
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Deep-sleep retention does not exist on the host
+#define RTC_DATA_ATTR
+
+// ---------------------------------------------------------------------------
+// FreeRTOS
+// ---------------------------------------------------------------------------
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct ShimSemaphore {
+    std::mutex mutex;
+};
+typedef ShimSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new ShimSemaphore(); }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t) {
+    if (!sem) {
+        return pdFALSE;
+    }
+    sem->mutex.lock();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    if (!sem) {
+        return pdFALSE;
+    }
+    sem->mutex.unlock();
+    return pdTRUE;
+}
+
+inline void vTaskDelay(TickType_t ticks) { delay(ticks); }
+inline void taskYIELD() { std::this_thread::yield(); }
+
+// ---------------------------------------------------------------------------
+// Stream
+// ---------------------------------------------------------------------------
+
+/** Byte source as in the core: read() returns -1 when nothing is there (yet). */
+class Stream {
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t c) = 0;
+
+    void setTimeout(unsigned long timeoutMs) { timeout_ = timeoutMs; }
+
+    /** Reads until @p length bytes arrived or the timeout passed without data. */
+    virtual size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        while (count < length) {
+            const int c = timedRead();
+            if (c < 0) {
+                break;
+            }
+            buffer[count++] = static_cast<char>(c);
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) {
+        return readBytes(reinterpret_cast<char*>(buffer), length);
+    }
+
+protected:
+    int timedRead() {
+        const unsigned long start = millis();
+        do {
+            const int c = read();
+            if (c >= 0) {
+                return c;
+            }
+        } while (millis() - start < timeout_);
+        return -1;
+    }
+
+    unsigned long timeout_ = 1000;
+};
+
+// ---------------------------------------------------------------------------
+// Serial
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Console sink.  Output is formatted (so its cost stays in the
+ *        measurement) and either printed or dropped when muted.
+ */
+class HostSerial {
+public:
+    void begin(unsigned long) {}
+    void setMuted(bool muted) { muted_ = muted; }
+    size_t bytesWritten() const { return bytes_; }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        return write(buf, n < 0 ? 0 : static_cast<size_t>(n));
+    }
+
+    size_t print(const char* s) { return write(s, strlen(s)); }
+    size_t print(const String& s) { return write(s.c_str(), s.length()); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+    template <typename T>
+    size_t println(const T& v) {
+        return print(v) + print("\n");
+    }
+    size_t println() { return print("\n"); }
+
+private:
+    size_t write(const char* s, size_t n) {
+        bytes_ += n;
+        if (!muted_) {
+            fwrite(s, 1, n, stdout);
+        }
+        return n;
+    }
+
+    bool muted_ = false;
+    size_t bytes_ = 0;
+};
+
+extern HostSerial Serial;
@@ -0,0 +1,154 @@
+/**
+ * @file FS.h
+ * @brief Host replacement for the Arduino-ESP32 `fs::FS` / `fs::File` API,
+ *        backed by a directory of the build machine.
+ *
+ * Covers what the telemetry outbox uses: open/exists/remove/mkdir, sequential
+ * read/write/seek and directory iteration with openNextFile().
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+/** Open file or directory.  Copies share the underlying handle. */
+class File {
+public:
+    File() {}
+    File(const std::string& path, const std::string& name, FILE* file, DIR* dir)
+        : state_(std::make_shared<State>(path, name, file, dir)) {}
+
+    explicit operator bool() const { return state_ && (state_->file || state_->dir); }
+
+    size_t write(const uint8_t* data, size_t size) {
+        return state_ && state_->file ? fwrite(data, 1, size, state_->file) : 0;
+    }
+    size_t read(uint8_t* data, size_t size) {
+        return state_ && state_->file ? fread(data, 1, size, state_->file) : 0;
+    }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+        return state_ && state_->file && fseek(state_->file, pos, mode) == 0;
+    }
+    size_t position() const { return state_ && state_->file ? ftell(state_->file) : 0; }
+    size_t size() const {
+        if (!state_ || !state_->file) {
+            return 0;
+        }
+        struct stat st;
+        fflush(state_->file);
+        return fstat(fileno(state_->file), &st) == 0 ? st.st_size : 0;
+    }
+    void flush() {
+        if (state_ && state_->file) {
+            fflush(state_->file);
+        }
+    }
+    void close() { state_.reset(); }
+
+    const char* name() const { return state_ ? state_->name.c_str() : ""; }
+    const char* path() const { return state_ ? state_->path.c_str() : ""; }
+    bool isDirectory() const { return state_ && state_->dir; }
+
+    File openNextFile() {
+        if (!state_ || !state_->dir) {
+            return File();
+        }
+        while (dirent* entry = readdir(state_->dir)) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            std::string child = state_->path + "/" + entry->d_name;
+            std::string host = state_->hostDir + "/" + entry->d_name;
+            FILE* file = fopen(host.c_str(), "rb");
+            File result(child, entry->d_name, file, nullptr);
+            return result;
+        }
+        return File();
+    }
+
+    // Used by FS to remember where directory entries live on the host.
+    void setHostDir(const std::string& hostDir) {
+        if (state_) {
+            state_->hostDir = hostDir;
+        }
+    }
+
+private:
+    struct State {
+        State(const std::string& p, const std::string& n, FILE* f, DIR* d)
+            : path(p), name(n), file(f), dir(d) {}
+        ~State() {
+            if (file) {
+                fclose(file);
+            }
+            if (dir) {
+                closedir(dir);
+            }
+        }
+        std::string path;
+        std::string name;
+        std::string hostDir;
+        FILE* file;
+        DIR* dir;
+    };
+    std::shared_ptr<State> state_;
+};
+
+/** File system rooted at a host directory (see setRoot()). */
+class FS {
+public:
+    void setRoot(const std::string& root) { root_ = root; }
+
+    File open(const char* path, const char* mode = FILE_READ, bool create = false) {
+        (void)create;
+        const std::string host = root_ + path;
+        struct stat st;
+        if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            File dir(path, baseName(path), nullptr, opendir(host.c_str()));
+            dir.setHostDir(host);
+            return dir;
+        }
+        const char* hostMode = mode[0] == 'w' ? "wb" : (mode[0] == 'a' ? "ab" : "rb");
+        FILE* file = fopen(host.c_str(), hostMode);
+        return file ? File(path, baseName(path), file, nullptr) : File();
+    }
+    bool exists(const char* path) {
+        struct stat st;
+        return stat((root_ + path).c_str(), &st) == 0;
+    }
+    bool remove(const char* path) { return ::remove((root_ + path).c_str()) == 0; }
+    bool mkdir(const char* path) { return ::mkdir((root_ + path).c_str(), 0755) == 0; }
+    bool rmdir(const char* path) { return ::rmdir((root_ + path).c_str()) == 0; }
+    bool rename(const char* from, const char* to) {
+        return ::rename((root_ + from).c_str(), (root_ + to).c_str()) == 0;
+    }
+
+private:
+    static std::string baseName(const char* path) {
+        const char* slash = strrchr(path, '/');
+        return slash ? slash + 1 : path;
+    }
+
+    std::string root_ = ".";
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,50 @@
+/**
+ * @file HeapTrace.cpp
+ * @brief Implementation of the host allocation counters.
+ */
+
+#include "HeapTrace.h"
+
+#include <atomic>
+#include <cstdlib>
+
+namespace {
+std::atomic<uint64_t> allocCount(0);
+std::atomic<uint64_t> freeCount(0);
+std::atomic<uint64_t> byteCount(0);
+}  // namespace
+
+namespace HeapTrace {
+
+void* traceMalloc(size_t size) {
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr) {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        byteCount.fetch_add(size, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+void* traceRealloc(void* ptr, size_t size) {
+    void* out = std::realloc(ptr, size ? size : 1);
+    if (out) {
+        // A realloc costs the same as a fresh allocation on the ESP32 heap,
+        // so it is counted as one.
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        byteCount.fetch_add(size, std::memory_order_relaxed);
+    }
+    return out;
+}
+
+void traceFree(void* ptr) {
+    if (ptr) {
+        freeCount.fetch_add(1, std::memory_order_relaxed);
+        std::free(ptr);
+    }
+}
+
+Counters snapshot() {
+    return {allocCount.load(), freeCount.load(), byteCount.load()};
+}
+
+}  // namespace HeapTrace
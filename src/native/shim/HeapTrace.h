@@ -0,0 +1,31 @@
+/**
+ * @file HeapTrace.h
+ * @brief Allocation counters used by the host benchmark build.
+ *
+ * The native String shim and the global operator new/delete replacement in
+ * the benchmark route every heap request through these helpers so that the
+ * number of allocations per telemetry cycle can be reported next to timing.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace HeapTrace {
+
+/** Snapshot of the allocation counters. */
+struct Counters {
+    uint64_t allocs;  ///< Successful malloc/realloc calls that allocated
+    uint64_t frees;   ///< Released blocks
+    uint64_t bytes;   ///< Total bytes requested
+};
+
+void* traceMalloc(size_t size);
+void* traceRealloc(void* ptr, size_t size);
+void traceFree(void* ptr);
+
+/** Return the counters accumulated since start-up. */
+Counters snapshot();
+
+}  // namespace HeapTrace
@@ -0,0 +1,24 @@
+/**
+ * @file LittleFS.h
+ * @brief Host stand-in for the ESP32 LittleFS instance (see FS.h).
+ */
+
+#pragma once
+
+#include "FS.h"
+
+namespace fs {
+
+class LittleFSFS : public FS {
+public:
+    bool begin(bool formatOnFail = false) {
+        (void)formatOnFail;
+        return true;
+    }
+    bool format() { return true; }
+    size_t totalBytes() { return 0x60000; }
+};
+
+}  // namespace fs
+
+extern fs::LittleFSFS LittleFS;
@@ -0,0 +1,79 @@
+/**
+ * @file MQTTPubSubClient.h
+ * @brief Host stand-in for hideakitai/MQTTPubSubClient.
+ *
+ * Publishing is accepted immediately and only accounted: the benchmark reads
+ * the counters to report messages and bytes leaving the device.  Failures can
+ * be injected to exercise the retry path, and payloads can be captured to
+ * check their content.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+namespace MQTTPubSub {
+
+template <size_t BUFFER_SIZE>
+class PubSubClient {
+public:
+    bool isConnected() const { return connected_; }
+    void setConnected(bool connected) { connected_ = connected; }
+
+    /** Append the payload of every successful publish to @p sink, nullptr stops. */
+    void capture(std::vector<std::string>* sink) { capture_ = sink; }
+
+    /** Make the next @p count publish() calls fail. */
+    void failNext(size_t count) { failNext_ = count; }
+
+    bool publish(const String& topic, const String& payload, const bool retained = false,
+                 const uint8_t qos = 0) {
+        return publish(topic, (uint8_t*)payload.c_str(), payload.length(), retained, qos);
+    }
+
+    bool publish(const String& topic, uint8_t* payload, const size_t length,
+                 const bool retained = false, const uint8_t qos = 0) {
+        (void)retained;
+        (void)qos;
+        if (!connected_) {
+            return false;
+        }
+        if (failNext_ > 0) {
+            failNext_--;
+            return false;
+        }
+        // Fixed header, topic length prefix and topic must fit with the payload.
+        if (5 + 2 + topic.length() + length > BUFFER_SIZE) {
+            oversized_++;
+            return false;
+        }
+        published_++;
+        payloadBytes_ += length;
+        if (capture_) {
+            capture_->emplace_back(reinterpret_cast<const char*>(payload), length);
+        }
+        return true;
+    }
+
+    size_t published() const { return published_; }
+    size_t payloadBytes() const { return payloadBytes_; }
+    size_t oversized() const { return oversized_; }
+    void resetCounters() {
+        published_ = 0;
+        payloadBytes_ = 0;
+        oversized_ = 0;
+    }
+
+private:
+    bool connected_ = true;
+    size_t failNext_ = 0;
+    size_t published_ = 0;
+    size_t payloadBytes_ = 0;
+    size_t oversized_ = 0;
+    std::vector<std::string>* capture_ = nullptr;
+};
+
+}  // namespace MQTTPubSub
@@ -0,0 +1,411 @@
+/**
+ * @file WString.cpp
+ * @brief Implementation of the host `String` shim.
+ */
+
+#include "WString.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "HeapTrace.h"
+
+namespace {
+
+// Arduino cores format integers through itoa/ultoa; snprintf is close enough
+// for the host and keeps the shim short.
+void formatSigned(char* out, size_t size, long long value, unsigned char base) {
+    if (base == 16) {
+        snprintf(out, size, "%llx", static_cast<unsigned long long>(value));
+    } else {
+        snprintf(out, size, "%lld", value);
+    }
+}
+
+void formatUnsigned(char* out, size_t size, unsigned long long value, unsigned char base) {
+    if (base == 16) {
+        snprintf(out, size, "%llx", value);
+    } else {
+        snprintf(out, size, "%llu", value);
+    }
+}
+
+}  // namespace
+
+String::String(const char* cstr) {
+    if (cstr) {
+        assign(cstr, strlen(cstr));
+    }
+}
+
+String::String(const String& str) { assign(str.buffer(), str.len_); }
+
+String::String(String&& rval) noexcept
+    : heap_(rval.heap_), cap_(rval.cap_), len_(rval.len_) {
+    if (!heap_) {
+        memcpy(sso_, rval.sso_, sizeof(sso_));
+    }
+    rval.heap_ = nullptr;
+    rval.cap_ = 0;
+    rval.len_ = 0;
+    rval.sso_[0] = '\0';
+}
+
+String::String(char c) {
+    char buf[2] = {c, '\0'};
+    assign(buf, 1);
+}
+
+String::String(int value, unsigned char base) {
+    char buf[24];
+    formatSigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(unsigned int value, unsigned char base) {
+    char buf[24];
+    formatUnsigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(long value, unsigned char base) {
+    char buf[24];
+    formatSigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(unsigned long value, unsigned char base) {
+    char buf[24];
+    formatUnsigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(long long value, unsigned char base) {
+    char buf[24];
+    formatSigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(unsigned long long value, unsigned char base) {
+    char buf[24];
+    formatUnsigned(buf, sizeof(buf), value, base);
+    assign(buf, strlen(buf));
+}
+
+String::String(float value, unsigned int decimalPlaces)
+    : String(static_cast<double>(value), decimalPlaces) {}
+
+String::String(double value, unsigned int decimalPlaces) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", static_cast<int>(decimalPlaces), value);
+    assign(buf, strlen(buf));
+}
+
+String::~String() { invalidate(); }
+
+String& String::operator=(const String& rhs) {
+    if (this != &rhs) {
+        assign(rhs.buffer(), rhs.len_);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& rval) noexcept {
+    if (this != &rval) {
+        invalidate();
+        heap_ = rval.heap_;
+        cap_ = rval.cap_;
+        len_ = rval.len_;
+        if (!heap_) {
+            memcpy(sso_, rval.sso_, sizeof(sso_));
+        }
+        rval.heap_ = nullptr;
+        rval.cap_ = 0;
+        rval.len_ = 0;
+        rval.sso_[0] = '\0';
+    }
+    return *this;
+}
+
+String& String::operator=(const char* cstr) {
+    if (cstr) {
+        assign(cstr, strlen(cstr));
+    } else {
+        invalidate();
+    }
+    return *this;
+}
+
+void String::invalidate() {
+    HeapTrace::traceFree(heap_);
+    heap_ = nullptr;
+    cap_ = 0;
+    len_ = 0;
+    sso_[0] = '\0';
+}
+
+bool String::reserve(unsigned int size) {
+    if (size <= capacity()) {
+        return true;
+    }
+    // Same policy as the ESP32 core: grow to exactly the requested size.
+    char* grown;
+    if (heap_) {
+        grown = static_cast<char*>(HeapTrace::traceRealloc(heap_, size + 1));
+    } else {
+        grown = static_cast<char*>(HeapTrace::traceMalloc(size + 1));
+        if (grown) {
+            memcpy(grown, sso_, len_ + 1);
+        }
+    }
+    if (!grown) {
+        return false;
+    }
+    heap_ = grown;
+    cap_ = size;
+    return true;
+}
+
+void String::assign(const char* cstr, unsigned int length) {
+    if (length > capacity() && !reserve(length)) {
+        invalidate();
+        return;
+    }
+    char* buf = buffer();
+    memmove(buf, cstr, length);
+    buf[length] = '\0';
+    len_ = length;
+}
+
+bool String::concat(const char* cstr, unsigned int length) {
+    if (!cstr) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+    unsigned int newLen = len_ + length;
+    if (!reserve(newLen)) {
+        return false;
+    }
+    char* buf = buffer();
+    memmove(buf + len_, cstr, length);
+    buf[newLen] = '\0';
+    len_ = newLen;
+    return true;
+}
+
+bool String::concat(const String& str) {
+    if (&str == this) {
+        String copy(str);
+        return concat(copy.buffer(), copy.len_);
+    }
+    return concat(str.buffer(), str.len_);
+}
+
+bool String::concat(const char* cstr) { return cstr && concat(cstr, strlen(cstr)); }
+bool String::concat(char c) { return concat(&c, 1); }
+bool String::concat(int num) { return concat(String(num)); }
+bool String::concat(unsigned int num) { return concat(String(num)); }
+bool String::concat(long num) { return concat(String(num)); }
+bool String::concat(unsigned long num) { return concat(String(num)); }
+bool String::concat(long long num) { return concat(String(num)); }
+bool String::concat(float num) { return concat(String(num)); }
+bool String::concat(double num) { return concat(String(num)); }
+
+StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(rhs);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(cstr);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, char c) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(c);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, int num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, long num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned long num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, float num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, double num) {
+    StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+    a.concat(num);
+    return a;
+}
+
+int String::compareTo(const String& s) const { return strcmp(buffer(), s.buffer()); }
+
+bool String::equals(const String& s) const {
+    return len_ == s.len_ && memcmp(buffer(), s.buffer(), len_) == 0;
+}
+
+bool String::equals(const char* cstr) const {
+    return cstr ? strcmp(buffer(), cstr) == 0 : len_ == 0;
+}
+
+bool String::startsWith(const String& prefix) const {
+    return prefix.len_ <= len_ && memcmp(buffer(), prefix.buffer(), prefix.len_) == 0;
+}
+
+bool String::startsWith(const char* prefix) const {
+    size_t n = strlen(prefix);
+    return n <= len_ && memcmp(buffer(), prefix, n) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+    return suffix.len_ <= len_ &&
+           memcmp(buffer() + len_ - suffix.len_, suffix.buffer(), suffix.len_) == 0;
+}
+
+bool String::endsWith(const char* suffix) const {
+    size_t n = strlen(suffix);
+    return n <= len_ && memcmp(buffer() + len_ - n, suffix, n) == 0;
+}
+
+char String::charAt(unsigned int index) const { return index < len_ ? buffer()[index] : '\0'; }
+
+void String::toCharArray(char* buf, unsigned int bufsize, unsigned int index) const {
+    if (!bufsize || !buf) {
+        return;
+    }
+    if (index >= len_) {
+        buf[0] = '\0';
+        return;
+    }
+    unsigned int n = bufsize - 1;
+    if (n > len_ - index) {
+        n = len_ - index;
+    }
+    memcpy(buf, buffer() + index, n);
+    buf[n] = '\0';
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+    if (fromIndex >= len_) {
+        return -1;
+    }
+    const char* found = static_cast<const char*>(memchr(buffer() + fromIndex, ch, len_ - fromIndex));
+    return found ? static_cast<int>(found - buffer()) : -1;
+}
+
+int String::indexOf(const char* str, unsigned int fromIndex) const {
+    if (fromIndex >= len_) {
+        return -1;
+    }
+    const char* found = strstr(buffer() + fromIndex, str);
+    return found ? static_cast<int>(found - buffer()) : -1;
+}
+
+String String::substring(unsigned int beginIndex) const { return substring(beginIndex, len_); }
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+    if (beginIndex > endIndex) {
+        unsigned int tmp = beginIndex;
+        beginIndex = endIndex;
+        endIndex = tmp;
+    }
+    String out;
+    if (beginIndex >= len_) {
+        return out;
+    }
+    if (endIndex > len_) {
+        endIndex = len_;
+    }
+    out.assign(buffer() + beginIndex, endIndex - beginIndex);
+    return out;
+}
+
+void String::replace(const String& find, const String& replace) {
+    if (len_ == 0 || find.len_ == 0) {
+        return;
+    }
+    String out;
+    const char* src = buffer();
+    const char* hit;
+    while ((hit = strstr(src, find.buffer())) != nullptr) {
+        out.concat(src, static_cast<unsigned int>(hit - src));
+        out.concat(replace);
+        src = hit + find.len_;
+    }
+    out.concat(src);
+    *this = std::move(out);
+}
+
+void String::replace(const char* find, const char* replace) {
+    this->replace(String(find), String(replace));
+}
+
+void String::remove(unsigned int index) { remove(index, static_cast<unsigned int>(-1)); }
+
+void String::remove(unsigned int index, unsigned int count) {
+    if (index >= len_ || count == 0) {
+        return;
+    }
+    if (count > len_ - index) {
+        count = len_ - index;
+    }
+    char* buf = buffer();
+    memmove(buf + index, buf + index + count, len_ - index - count + 1);
+    len_ -= count;
+}
+
+void String::trim() {
+    if (len_ == 0) {
+        return;
+    }
+    char* buf = buffer();
+    unsigned int begin = 0;
+    while (begin < len_ && isspace(static_cast<unsigned char>(buf[begin]))) {
+        begin++;
+    }
+    unsigned int end = len_;
+    while (end > begin && isspace(static_cast<unsigned char>(buf[end - 1]))) {
+        end--;
+    }
+    len_ = end - begin;
+    if (begin > 0) {
+        memmove(buf, buf + begin, len_);
+    }
+    buf[len_] = '\0';
+}
+
+long String::toInt() const { return atol(buffer()); }
+float String::toFloat() const { return static_cast<float>(atof(buffer())); }
+double String::toDouble() const { return atof(buffer()); }
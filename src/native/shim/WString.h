@@ -0,0 +1,137 @@
+/**
+ * @file WString.h
+ * @brief Host replacement for the Arduino `String` class.
+ *
+ * Only the subset used by the firmware modules compiled in the `native`
+ * environment is provided.  Memory behaviour follows the ESP32 core: short
+ * strings live in an 11 byte inline buffer, longer ones are grown with an
+ * exact-size realloc on every concatenation, and `"a" + b + c` chains reuse a
+ * single temporary.  This keeps allocation counts comparable to the target.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class StringSumHelper;
+
+class String {
+public:
+    String(const char* cstr = "");
+    String(const String& str);
+    String(String&& rval) noexcept;
+    explicit String(char c);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(long long value, unsigned char base = 10);
+    explicit String(unsigned long long value, unsigned char base = 10);
+    explicit String(float value, unsigned int decimalPlaces = 2);
+    explicit String(double value, unsigned int decimalPlaces = 2);
+    ~String();
+
+    String& operator=(const String& rhs);
+    String& operator=(String&& rval) noexcept;
+    String& operator=(const char* cstr);
+
+    bool reserve(unsigned int size);
+    unsigned int length() const { return len_; }
+    bool isEmpty() const { return len_ == 0; }
+    const char* c_str() const { return buffer(); }
+
+    bool concat(const String& str);
+    bool concat(const char* cstr);
+    bool concat(const char* cstr, unsigned int length);
+    bool concat(char c);
+    bool concat(int num);
+    bool concat(unsigned int num);
+    bool concat(long num);
+    bool concat(unsigned long num);
+    bool concat(long long num);
+    bool concat(float num);
+    bool concat(double num);
+
+    template <typename T>
+    String& operator+=(const T& rhs) {
+        concat(rhs);
+        return *this;
+    }
+
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, char c);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, int num);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, long num);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned long num);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, float num);
+    friend StringSumHelper& operator+(const StringSumHelper& lhs, double num);
+
+    int compareTo(const String& s) const;
+    bool equals(const String& s) const;
+    bool equals(const char* cstr) const;
+    bool operator==(const String& rhs) const { return equals(rhs); }
+    bool operator==(const char* cstr) const { return equals(cstr); }
+    bool operator!=(const String& rhs) const { return !equals(rhs); }
+    bool operator!=(const char* cstr) const { return !equals(cstr); }
+    bool operator<(const String& rhs) const { return compareTo(rhs) < 0; }
+    bool operator>(const String& rhs) const { return compareTo(rhs) > 0; }
+
+    bool startsWith(const String& prefix) const;
+    bool startsWith(const char* prefix) const;
+    bool endsWith(const String& suffix) const;
+    bool endsWith(const char* suffix) const;
+
+    char charAt(unsigned int index) const;
+    char operator[](unsigned int index) const { return charAt(index); }
+    void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const;
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const char* str, unsigned int fromIndex = 0) const;
+    String substring(unsigned int beginIndex) const;
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void replace(const String& find, const String& replace);
+    void replace(const char* find, const char* replace);
+    void remove(unsigned int index);
+    void remove(unsigned int index, unsigned int count);
+    void trim();
+
+    long toInt() const;
+    float toFloat() const;
+    double toDouble() const;
+
+private:
+    enum { SSO_SIZE = 11 };
+
+    char* buffer() { return heap_ ? heap_ : sso_; }
+    const char* buffer() const { return heap_ ? heap_ : sso_; }
+    unsigned int capacity() const { return heap_ ? cap_ : SSO_SIZE - 1; }
+    void assign(const char* cstr, unsigned int length);
+    void invalidate();
+
+    char* heap_ = nullptr;
+    unsigned int cap_ = 0;
+    unsigned int len_ = 0;
+    char sso_[SSO_SIZE] = {0};
+};
+
+/**
+ * @brief Temporary produced by `operator+`; concatenations append to it in
+ *        place just like the Arduino core does.
+ */
+class StringSumHelper : public String {
+public:
+    StringSumHelper(const String& s) : String(s) {}
+    StringSumHelper(const char* p) : String(p) {}
+    StringSumHelper(char c) : String(c) {}
+    StringSumHelper(int num) : String(num) {}
+    StringSumHelper(unsigned long num) : String(num) {}
+    StringSumHelper(float num) : String(num) {}
+    StringSumHelper(double num) : String(num) {}
+};
+
+inline bool operator==(const char* lhs, const String& rhs) { return rhs.equals(lhs); }
+inline bool operator!=(const char* lhs, const String& rhs) { return !rhs.equals(lhs); }
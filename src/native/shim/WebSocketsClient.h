@@ -0,0 +1,15 @@
+/**
+ * @file WebSocketsClient.h
+ * @brief Host placeholder for the links2004 WebSocket transport.  The native
+ *        build never opens a socket; the type only has to exist.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class WebSocketsClient {
+public:
+    void disconnect() {}
+    bool isConnected() { return true; }
+};
@@ -8,7 +8,7 @@
  */
 
 BLEWiFiConfig bleWiFiConfig;      ///< BLE provisioning helper instance
-WiFiClientSecure secureClient;    ///< Shared TLS client
+TlsClient httpsClients[HTTPS_POOL_SLOTS];  ///< Kept HTTPS connections, see HttpsPool.h
 
 // Runtime configuration and tokens ---------------------------------------
 String authUrl;
@@ -32,6 +32,10 @@ Preferences preferences;
 SemaphoreHandle_t mqttMutex = xSemaphoreCreateMutex();
 SemaphoreHandle_t dataQueueMutex = xSemaphoreCreateMutex();
 SemaphoreHandle_t adsMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t deadBandMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t tlsMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t httpsMutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t httpQueueMutex = xSemaphoreCreateMutex();
 
 bool normalMode = true;            ///< Flag used to indicate normal runtime mode
 
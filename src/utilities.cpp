@@ -1,35 +1,203 @@
     
 #include "utilities.h"
 #include "globalConfig.h"
+#include "Outbox.h"
+#include "SensorScheduler.h"
+#include "Pipeline.h"
+#include "PowerMonitor.h"
+#include "MqttReconnect.h"
+#include "MqttInflight.h"
+#include "TlsSession.h"
+#include "HttpQueue.h"
 
 /**
  * @brief Return the device's unique chip identifier as a hexadecimal string.
  */
 String getChipID() {
-  uint8_t mac[6];      // Buffer for MAC address bytes
-  char chipIdStr[13];  // String buffer for MAC in hex without separators
+  return deviceIdentity.chipId();  // Вычисляется один раз, см. DeviceIdentity
+}
 
-  // Obtain MAC address and store in array
+/**
+ * @brief Factory MAC address used by DeviceIdentity.
+ */
+void readDeviceMac(uint8_t mac[6]) {
   esp_efuse_mac_get_default(mac);
-
-  // Convert MAC address into hexadecimal string
-  snprintf(chipIdStr, sizeof(chipIdStr), "%02X%02X%02X%02X%02X%02X",
-           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-
-  return chipIdStr;
 }
 
 /**
  * @brief FreeRTOS task that listens for commands on the serial port.
  */
 void readSerialCommands(void* pvParameters) {
+    // Sleep until the UART reports received bytes instead of polling
+    static TaskHandle_t reader;
+    reader = xTaskGetCurrentTaskHandle();
+    Serial.onReceive([]() { xTaskNotifyGive(reader); });
     while (true) {
-        if (Serial.available() > 0) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        while (Serial.available() > 0) {
             String command = Serial.readStringUntil('\n');
             command.trim();
             processCommand(command);
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+/**
+ * @brief Print lane, drain, outbox and pipeline counters (serial command "qs").
+ */
+void printQueueStats() {
+    for (size_t i = 0; i < static_cast<size_t>(MqttLane::Count); i++) {
+        const MqttLane id = static_cast<MqttLane>(i);
+        MqttRing& lane = mqttLanes.lane(id);
+        const MqttRingStats stats = lane.stats();
+        Serial.printf("lane %-7s %2u/%-2u (peak %2u) enqueued %u published %u retries %u "
+                      "overflows %u evicted %u dropped %u\n",
+                      MqttLanes::laneName(id), (unsigned)lane.size(), (unsigned)lane.capacity(),
+                      (unsigned)stats.highWater, (unsigned)stats.enqueued,
+                      (unsigned)stats.published, (unsigned)stats.retries,
+                      (unsigned)stats.overflows, (unsigned)stats.evicted,
+                      (unsigned)stats.dropped);
+    }
+    const MqttDrainStats drain = mqttDrainStats();
+    Serial.printf("drain %u msg/s (peak %u), %u published, %u bytes in %u calls, "
+                  "budget stops: time %u bytes %u\n",
+                  (unsigned)drain.ratePerSec, (unsigned)drain.peakRatePerSec,
+                  (unsigned)drain.published, (unsigned)drain.bytes, (unsigned)drain.calls,
+                  (unsigned)drain.timeBudgetStops, (unsigned)drain.byteBudgetStops);
+    const OutboxStats box = outbox.stats();
+    Serial.printf("outbox %s, %u bytes in %u segments, appended %u replayed %u corrupt %u "
+                  "dropped segments %u, flash writes %u\n",
+                  outboxConfig.enabled ? "on" : "off", (unsigned)outbox.backlogBytes(),
+                  (unsigned)outbox.segmentCount(), (unsigned)box.appended,
+                  (unsigned)box.replayed, (unsigned)box.corrupt,
+                  (unsigned)box.droppedSegments, (unsigned)box.flashWrites);
+
+    const PipelineStats& flow = pipeline.stats();
+    Serial.printf("pipeline %s, flushes %u deferred %u forced %u\n",
+                  pipeline.running() ? "tasks" : "loop", (unsigned)flow.flushes,
+                  (unsigned)flow.deferredFlushes, (unsigned)flow.forcedFlushes);
+    for (size_t i = 0; i < static_cast<size_t>(PipelineStage::Count); i++) {
+        const PipelineStage stage = static_cast<PipelineStage>(i);
+        const PipelineStageStats& s = flow.stage[i];
+        Serial.printf("stage %-11s cycles %u (idle %u), busy %u ms, max cycle %u us\n",
+                      Pipeline::stageName(stage), (unsigned)s.cycles, (unsigned)s.idle,
+                      (unsigned)s.busyMs, (unsigned)s.maxCycleUs);
+    }
+}
+
+/**
+ * @brief Print the power mode and the awake/asleep split (serial command "ps").
+ */
+void printPowerStats() {
+    Serial.printf("power %s, listen interval %u, poll %u ms, report %s\n",
+                  PowerMonitor::modeName(powerMonitor.mode()),
+                  (unsigned)powerConfig.listenInterval, (unsigned)powerConfig.pollMs,
+                  powerConfig.report ? "on" : "off");
+    const PowerInterval& last = powerMonitor.last();
+    Serial.printf("last interval %u ms: awake %u ms, asleep %u ms, %u wakeups\n",
+                  (unsigned)last.durationMs, (unsigned)last.awakeMs, (unsigned)last.asleepMs,
+                  (unsigned)last.wakeups);
+    const uint64_t awake = powerMonitor.totalAwakeMs();
+    const uint64_t total = awake + powerMonitor.totalAsleepMs();
+    Serial.printf("total awake %llu ms of %llu ms (%.1f%%)\n", (unsigned long long)awake,
+                  (unsigned long long)total, total ? 100.0 * awake / total : 0.0);
+}
+
+/**
+ * @brief Print the reconnect state, connect latency, failure reasons and the
+ *        QoS 1 in-flight window (serial command "cs").
+ */
+void printConnectionStats() {
+    const ConnStats& stats = mqttReconnect.stats();
+    Serial.printf("mqtt %s, %u failures in a row, next retry in %u ms (last delay %u ms)\n",
+                  MqttReconnect::stateName(mqttReconnect.state()),
+                  (unsigned)mqttReconnect.failuresInRow(),
+                  (unsigned)mqttReconnect.msUntilAttempt(millis()), (unsigned)stats.lastBackoffMs);
+    Serial.printf("attempts %u, connects %u, connect %u ms last / %u ms mean / %u ms max, "
+                  "last outage %u ms, token refreshes %u\n",
+                  (unsigned)stats.attempts, (unsigned)stats.connects, (unsigned)stats.lastConnectMs,
+                  stats.connects ? (unsigned)(stats.totalConnectMs / stats.connects) : 0,
+                  (unsigned)stats.maxConnectMs, (unsigned)stats.lastOutageMs,
+                  (unsigned)stats.tokenRefreshes);
+    for (size_t i = 0; i < static_cast<size_t>(ConnFailure::Count); i++) {
+        Serial.printf("  %-17s %u\n", MqttReconnect::failureName(static_cast<ConnFailure>(i)),
+                      (unsigned)stats.failures[i]);
+    }
+    Serial.printf("  refused by code: none %u, 1 %u, 2 %u, 3 %u, 4 %u, 5 %u\n",
+                  (unsigned)stats.refused[0], (unsigned)stats.refused[1], (unsigned)stats.refused[2],
+                  (unsigned)stats.refused[3], (unsigned)stats.refused[4], (unsigned)stats.refused[5]);
+    const MqttInflightStats& inflight = mqttInflight.stats();
+    Serial.printf("qos1 %u in flight (window %u, peak %u): sent %u, acked %u, resent %u, "
+                  "dropped %u, unknown acks %u; ack %u ms mean / %u ms max\n",
+                  (unsigned)mqttInflight.size(), (unsigned)mqttInflight.window(),
+                  (unsigned)inflight.highWater, (unsigned)inflight.sent,
+                  (unsigned)inflight.acknowledged, (unsigned)inflight.retransmitted,
+                  (unsigned)inflight.dropped, (unsigned)inflight.unknownAcks,
+                  inflight.acknowledged ? (unsigned)(inflight.ackMsTotal / inflight.acknowledged) : 0,
+                  (unsigned)inflight.ackMsMax);
+}
+
+/**
+ * @brief Print the HTTP queue counters, the HTTPS connection reuse, the
+ *        handshake-time histogram per kind and the session cache counters
+ *        (serial command "ts").
+ */
+void printTlsStats() {
+    {
+        MutexLock lock(httpQueueMutex);
+        const HttpQueueStats& queue = httpQueue.stats();
+        Serial.printf("http submitted %u: deduplicated %u, rate-limited %u, rejected %u, "
+                      "expired %u; done %u, failed %u, %u pending, max wait %u ms\n",
+                      (unsigned)queue.submitted, (unsigned)queue.deduplicated,
+                      (unsigned)queue.delayed, (unsigned)queue.rejected, (unsigned)queue.expired,
+                      (unsigned)queue.completed, (unsigned)queue.failed,
+                      (unsigned)httpQueue.pending(), (unsigned)queue.maxWaitMs);
+    }
+    {
+        MutexLock lock(httpsMutex);
+        const HttpsPoolStats& pool = httpsPool.stats();
+        Serial.printf("https requests %u: reused %u, connected %u, retried %u; "
+                      "%u open, %u closed idle, %u evicted\n",
+                      (unsigned)pool.requests, (unsigned)pool.reused, (unsigned)pool.opened,
+                      (unsigned)pool.retried, (unsigned)httpsPool.open(),
+                      (unsigned)pool.idleClosed, (unsigned)pool.evicted);
+    }
+    MutexLock lock(tlsMutex);
+    const TlsStats& stats = tlsSessions.stats();
+    Serial.printf("sessions cached %u/%u, stored %u, too large %u, offered %u, failed %u\n",
+                  (unsigned)tlsSessions.size(), (unsigned)TLS_SESSION_SLOTS,
+                  (unsigned)stats.stored, (unsigned)stats.tooLarge, (unsigned)stats.offered,
+                  (unsigned)stats.failed);
+    for (size_t i = 0; i < static_cast<size_t>(HandshakeKind::Count); i++) {
+        const HandshakeHistogram& histogram = stats.kind[i];
+        Serial.printf("%-8s n %u, mean %u ms, max %u ms:",
+                      TlsSessions::kindName(static_cast<HandshakeKind>(i)),
+                      (unsigned)histogram.total,
+                      histogram.total ? (unsigned)(histogram.totalMs / histogram.total) : 0,
+                      (unsigned)histogram.maxMs);
+        for (size_t b = 0; b < TLS_HISTOGRAM_BUCKETS; b++) {
+            if (b + 1 < TLS_HISTOGRAM_BUCKETS) {
+                Serial.printf(" <%u %u", (unsigned)TlsSessions::bucketLimitMs(b),
+                              (unsigned)histogram.counts[b]);
+            } else {
+                Serial.printf(" more %u", (unsigned)histogram.counts[b]);
+            }
+        }
+        Serial.println();
+    }
+}
+
+/**
+ * @brief Print period and counters of every sensor source (serial command "ss").
+ */
+void printSchedulerStats() {
+    for (SensorSourceId id = 0; id < sensorScheduler.size(); id++) {
+        const SensorSourceStats& stats = sensorScheduler.stats(id);
+        Serial.printf("source %-15s every %6u ms, runs %u late %u skipped %u, "
+                      "max lateness %u ms, max run %u us\n",
+                      sensorScheduler.name(id), (unsigned)sensorScheduler.period(id),
+                      (unsigned)stats.runs, (unsigned)stats.late, (unsigned)stats.skipped,
+                      (unsigned)stats.maxLatenessMs, (unsigned)stats.maxRunUs);
     }
 }
 
@@ -49,12 +217,27 @@ void processCommand(const String& command) {
         Serial.println("ka - Clear access token");
         Serial.println("cln - Clean NVS data and restart for pairing");
         Serial.println("sr - Send response test");
+        Serial.println("qs - Show MQTT queue, outbox and pipeline statistics");
+        Serial.println("ss - Show sensor source statistics");
+        Serial.println("ps - Show power mode and awake/asleep time");
+        Serial.println("cs - Show MQTT connection state, latency and failure reasons");
+        Serial.println("ts - Show HTTPS connection reuse, TLS handshake times and the session cache");
     } else if (command == "km") {
         mqttDisconnectTask();
         Serial.println("MQTT disconnected");
     } else if (command == "sr") {
         sendNvsSuccessResponse(1234567890);
         Serial.println("send Response Test");
+    } else if (command == "qs") {
+        printQueueStats();
+    } else if (command == "ss") {
+        printSchedulerStats();
+    } else if (command == "ps") {
+        printPowerStats();
+    } else if (command == "cs") {
+        printConnectionStats();
+    } else if (command == "ts") {
+        printTlsStats();
     } else if (command == "rm") {
         checkWiFiAndMQTTConnection();
         Serial.println("Checking WiFi and MQTT connection");
@@ -236,21 +419,16 @@ void sendNvsSuccessResponse(int64_t id) {
 
     lastSentId = id;  // Обновляем последний ID
 
-    // Строка-шаблон JSON
-    static String jsonTemplate = "{\"jsonrpc\":\"2.0\",\"id\":ID_PLACEHOLDER,\"result\":\"success\"}";
-
-    // Формируем JSON
-    String response = jsonTemplate;
-    response.replace("ID_PLACEHOLDER", String(id));
-    Serial.printf("Generated JSON: %s\n", response.c_str());
-
-    // Формируем MQTT-топик
-    String topic = "stream/" + String(getChipID()) + "/rpcout";
-    Serial.printf("MQTT Topic: %s\n", topic.c_str());
+    // Формируем JSON в буфере на стеке
+    char response[96];
+    JsonWriter json(response, sizeof(response));
+    json.rpcResult(id, "success");
+    Serial.printf("Generated JSON: %s\n", response);
+    Serial.printf("MQTT Topic: %s\n", deviceIdentity.topic(Topic::RpcOut));
 
     // Добавляем сообщение в очередь MQTT
-    enqueueMQTTMessage(topic, response, false, 0);
-    //Serial.println("NVS Success Response enqueued for MQTT processing.");
+    enqueueMQTTMessage(deviceIdentity.topic(Topic::RpcOut), response, json.length(), false, 0,
+                       MqttLane::Control);
 }
 
 void sendErrorResponse(int64_t id, const char* errorMessage) {
@@ -259,22 +437,20 @@ void sendErrorResponse(int64_t id, const char* errorMessage) {
 
     lastSentId = id;  // Обновляем последний ID
 
-    // Строка-шаблон JSON с двумя плейсхолдерами
-    static String jsonTemplate = "{\"jsonrpc\":\"2.0\",\"id\":ID_PLACEHOLDER,\"error\":{\"code\":\"codeError\",\"message\":\"MESSAGE_PLACEHOLDER\"}}";
-
-    // Формируем JSON, заменяя плейсхолдеры
-    String response = jsonTemplate;
-    response.replace("ID_PLACEHOLDER", String(id));
-    response.replace("MESSAGE_PLACEHOLDER", String(errorMessage));
-    Serial.printf("Generated JSON: %s\n", response.c_str());
-
-    // Формируем MQTT-топик
-    String topic = "stream/" + String(getChipID()) + "/rpcout";
-    Serial.printf("MQTT Topic: %s\n", topic.c_str());
+    // Формируем JSON; сообщение экранируется и при переполнении заменяется
+    char response[256];
+    JsonWriter json(response, sizeof(response));
+    json.rpcError(id, "codeError", errorMessage);
+    if (json.overflow()) {
+        json.reset();
+        json.rpcError(id, "codeError", "Error message too long");
+    }
+    Serial.printf("Generated JSON: %s\n", response);
+    Serial.printf("MQTT Topic: %s\n", deviceIdentity.topic(Topic::RpcOut));
 
     // Добавляем сообщение в очередь MQTT
-    enqueueMQTTMessage(topic, response, false, 0);
-    //Serial.println("Error Response enqueued for MQTT processing.");
+    enqueueMQTTMessage(deviceIdentity.topic(Topic::RpcOut), response, json.length(), false, 0,
+                       MqttLane::Control);
 }
 
 